@@ -0,0 +1,92 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _arena_block_t arena_block_t;
+struct _arena_block_t {
+  char *data;
+  int size;
+  int used;
+
+  arena_block_t *next;
+};
+
+// Blocks are kept in the order they were filled, and cur is the one being
+// filled. The blocks after it are empty.
+struct _arena_t {
+  arena_block_t *blocks;
+  arena_block_t *cur;
+};
+
+arena_block_t *new_arena_block(int size) {
+  arena_block_t *block = calloc(1, sizeof(arena_block_t));
+  if (size < 1048576) {
+    size = 1048576;
+  }
+  block->data = calloc(size, 1);
+  block->size = size;
+  return block;
+}
+
+arena_t *new_arena() {
+  arena_t *arena = calloc(1, sizeof(arena_t));
+  arena->blocks = new_arena_block(0);
+  arena->cur = arena->blocks;
+  return arena;
+}
+
+void *arena_alloc(arena_t *arena, int size) {
+  size = (size + 7) & -8;
+
+  arena_block_t *cur = arena->cur;
+  while (cur->used + size > cur->size) {
+    if (cur->next == NULL || cur->next->size < size) {
+      // a block too small for the allocation is moved after the new one
+      arena_block_t *block = new_arena_block(size);
+      block->next = cur->next;
+      cur->next = block;
+    }
+    cur = cur->next;
+  }
+  arena->cur = cur;
+
+  void *p = cur->data + cur->used;
+  cur->used += size;
+  return p;
+}
+
+void reset_arena(arena_t *arena) {
+  arena_block_t *cur = arena->blocks;
+  while (cur) {
+    memset(cur->data, 0, cur->used);
+    cur->used = 0;
+    cur = cur->next;
+  }
+  arena->cur = arena->blocks;
+}
+
+arena_t *long_lived_arena;
+arena_t *node_arena;
+
+arena_t *program_arena() {
+  if (long_lived_arena == NULL) {
+    long_lived_arena = new_arena();
+  }
+  return long_lived_arena;
+}
+
+void *node_alloc(int size) {
+  if (node_arena == NULL) {
+    node_arena = program_arena();
+  }
+  return arena_alloc(node_arena, size);
+}
+
+arena_t *swap_node_arena(arena_t *arena) {
+  arena_t *prev = node_arena;
+  if (prev == NULL) {
+    prev = program_arena();
+  }
+  node_arena = arena;
+  return prev;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// A region allocator. Allocations are carved from large blocks with a bump
+// pointer, come back zeroed, and are only released all together by
+// reset_arena, which keeps the blocks for reuse.
+typedef struct _arena_t arena_t;
+
+arena_t *new_arena();
+
+void *arena_alloc(arena_t *arena, int size);
+
+void reset_arena(arena_t *arena);
+
+// The arena that holds the program: tokens aside, everything the parser
+// builds and the tables codegen keeps across functions. It lives until exit.
+arena_t *program_arena();
+
+// Allocates a node from the current node arena, which is the program arena
+// except while codegen works on a function body.
+void *node_alloc(int size);
+
+// Makes the arena the current node arena and returns the previous one.
+arena_t *swap_node_arena(arena_t *arena);
@@ -0,0 +1,1208 @@
+#include "assembler.h"
+#include "error.h"
+#include "intern.h"
+#include "writer.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the relocation types used, from the AArch64 ELF ABI
+int reloc_abs64() { return 257; }
+int reloc_adr_page() { return 275; }
+int reloc_add_lo12() { return 277; }
+int reloc_cond_branch() { return 280; }
+int reloc_jump() { return 282; }
+int reloc_call() { return 283; }
+
+// The bytes of a section and the relocations against them. Branches to
+// labels are relocations too until the object is written, when the ones to
+// labels in the same section are patched in. Relocations name symbols of the
+// assembler, not of the symbol table written.
+typedef struct {
+  int index;
+  bytes_t *bytes;
+
+  int *reloc_offsets;
+  int *reloc_types;
+  int *reloc_symbols;
+  int *reloc_addends;
+  int reloc_len;
+  int reloc_cap;
+} section_t;
+
+// A label or a name. Labels starting with .L stay out of the symbol table,
+// and relocations against them are made against their section instead.
+typedef struct {
+  char *name;
+  section_t *section;
+  int value;
+  int is_global;
+  int elf_index;
+} symbol_t;
+
+struct _assembler_t {
+  section_t *text;
+  section_t *data;
+  section_t *section;
+
+  symbol_t **symbols;
+  int symbol_len;
+  int symbol_cap;
+  // indexed by interned symbol, the index of its symbol + 1
+  int *symbol_table;
+  int symbol_table_cap;
+
+  // the names given by .file, indexed by number
+  char **files;
+  int file_len;
+
+  // A .loc applies to the instruction after it, so it waits for one or for
+  // the next .loc. The row last added to the line program is kept to encode
+  // the next one as a difference.
+  int has_loc;
+  int loc_file;
+  int loc_line;
+  int loc_column;
+  int row_address;
+  int row_file;
+  int row_line;
+  int row_column;
+  bytes_t *line_program;
+
+  // the line being assembled and the cursor into it
+  char *line;
+  char *cur;
+  // whether the register last read is a 64-bit one, and whether it is sp
+  int is_wide;
+  int is_sp;
+
+  // the start of a line the text given so far stopped in
+  bytes_t *partial;
+};
+
+void add_uleb(bytes_t *bytes, int value) {
+  while (value & ~127) {
+    add_byte(bytes, (value & 127) | 128);
+    value = (value >> 7) & 33554431;
+  }
+  add_byte(bytes, value);
+}
+
+void add_sleb(bytes_t *bytes, int value) {
+  while (value < -64 || value > 63) {
+    add_byte(bytes, (value & 127) | 128);
+    value = value >> 7;
+  }
+  add_byte(bytes, value & 127);
+}
+
+// sets the bits of the 32-bit word at offset
+void or_word(bytes_t *bytes, int offset, int bits) {
+  int i = 0;
+  while (i < 4) {
+    int byte = (bits >> (i * 8)) & 255;
+    bytes->data[offset + i] = bytes->data[offset + i] | byte;
+    i++;
+  }
+}
+
+section_t *new_section(int index) {
+  section_t *section = calloc(1, sizeof(section_t));
+  section->index = index;
+  section->bytes = new_bytes();
+  return section;
+}
+
+void add_reloc(section_t *section, int offset, int type, int symbol,
+               int addend) {
+  if (section->reloc_len == section->reloc_cap) {
+    section->reloc_cap = section->reloc_cap * 2 + 16;
+    int size = section->reloc_cap * sizeof(int);
+    section->reloc_offsets = realloc(section->reloc_offsets, size);
+    section->reloc_types = realloc(section->reloc_types, size);
+    section->reloc_symbols = realloc(section->reloc_symbols, size);
+    section->reloc_addends = realloc(section->reloc_addends, size);
+  }
+  int i = section->reloc_len;
+  section->reloc_offsets[i] = offset;
+  section->reloc_types[i] = type;
+  section->reloc_symbols[i] = symbol;
+  section->reloc_addends[i] = addend;
+  section->reloc_len++;
+}
+
+// the section header indexes of the object written
+int text_index() { return 1; }
+int data_index() { return 3; }
+int debug_line_index() { return 4; }
+int symtab_index() { return 7; }
+int section_count() { return 10; }
+
+assembler_t *new_assembler() {
+  assembler_t *as = calloc(1, sizeof(assembler_t));
+  as->text = new_section(text_index());
+  as->data = new_section(data_index());
+  as->section = as->text;
+  as->line_program = new_bytes();
+  as->partial = new_bytes();
+
+  // the line program starts at the start of .text, which the object's
+  // relocation fills in
+  add_byte(as->line_program, 0);
+  add_uleb(as->line_program, 9);
+  add_byte(as->line_program, 2);
+  add_le(as->line_program, 0, 8);
+  as->row_file = 1;
+  as->row_line = 1;
+  return as;
+}
+
+void bad_line(assembler_t *as) {
+  panic("assembler: cannot assemble '%s'\n", as->line);
+}
+
+char *copy_name(char *name) {
+  int len = strlen(name);
+  char *copy = malloc(len + 1);
+  memcpy(copy, name, len + 1);
+  return copy;
+}
+
+// returns the symbol of the name, added undefined the first time
+int find_label(assembler_t *as, char *name) {
+  int interned = find_symbol(name);
+  if (interned < 0) {
+    interned = intern_symbol(copy_name(name));
+  }
+
+  if (interned >= as->symbol_table_cap) {
+    int cap = interned * 2 + 16;
+    as->symbol_table = realloc(as->symbol_table, cap * sizeof(int));
+    memset(as->symbol_table + as->symbol_table_cap, 0,
+           (cap - as->symbol_table_cap) * sizeof(int));
+    as->symbol_table_cap = cap;
+  }
+  if (as->symbol_table[interned]) {
+    return as->symbol_table[interned] - 1;
+  }
+
+  if (as->symbol_len == as->symbol_cap) {
+    as->symbol_cap = as->symbol_cap * 2 + 16;
+    as->symbols = realloc(as->symbols, as->symbol_cap * sizeof(symbol_t *));
+  }
+  symbol_t *symbol = calloc(1, sizeof(symbol_t));
+  symbol->name = symbol_name(interned);
+  as->symbols[as->symbol_len] = symbol;
+  as->symbol_len++;
+  as->symbol_table[interned] = as->symbol_len;
+  return as->symbol_len - 1;
+}
+
+void define_label(assembler_t *as, char *name) {
+  int index = find_label(as, name);
+  symbol_t *symbol = as->symbols[index];
+  if (symbol->section) {
+    panic("assembler: symbol '%s' is already defined\n", name);
+  }
+  symbol->section = as->section;
+  symbol->value = as->section->bytes->len;
+}
+
+int is_local_label(symbol_t *symbol) {
+  return !strncmp(symbol->name, ".L", 2);
+}
+
+// adds a row for the pending .loc at the current address of .text. Rows
+// are encoded with special opcodes where the line and address differences
+// fit one.
+void add_line_row(assembler_t *as) {
+  bytes_t *program = as->line_program;
+  int address = as->text->bytes->len;
+  if (as->loc_file != as->row_file) {
+    add_byte(program, 4);
+    add_uleb(program, as->loc_file);
+  }
+  if (as->loc_column != as->row_column) {
+    add_byte(program, 5);
+    add_uleb(program, as->loc_column);
+  }
+
+  int line_delta = as->loc_line - as->row_line;
+  int address_delta = (address - as->row_address) / 4;
+  if (line_delta < -5 || line_delta > 8) {
+    add_byte(program, 3);
+    add_sleb(program, line_delta);
+    line_delta = 0;
+  }
+  int opcode = line_delta + 5 + 14 * address_delta + 13;
+  if (opcode > 255) {
+    add_byte(program, 2);
+    add_uleb(program, address_delta);
+    opcode = line_delta + 5 + 13;
+  }
+  add_byte(program, opcode);
+
+  as->row_address = address;
+  as->row_file = as->loc_file;
+  as->row_line = as->loc_line;
+  as->row_column = as->loc_column;
+  as->has_loc = 0;
+}
+
+// relocates the instruction about to be emitted against the symbol
+void reloc_next_word(assembler_t *as, int type, int symbol) {
+  add_reloc(as->text, as->text->bytes->len, type, symbol, 0);
+}
+
+void emit_word(assembler_t *as, int word) {
+  if (as->section != as->text) {
+    bad_line(as);
+  }
+  if (as->has_loc) {
+    add_line_row(as);
+  }
+  add_le(as->text->bytes, word, 4);
+}
+
+void skip_spaces(assembler_t *as) {
+  while (*as->cur == ' ') {
+    as->cur++;
+  }
+}
+
+int consume_operand_char(assembler_t *as, char c) {
+  skip_spaces(as);
+  if (*as->cur != c) {
+    return 0;
+  }
+  as->cur++;
+  return 1;
+}
+
+void expect_operand_char(assembler_t *as, char c) {
+  if (!consume_operand_char(as, c)) {
+    bad_line(as);
+  }
+}
+
+void expect_line_end(assembler_t *as) {
+  skip_spaces(as);
+  if (*as->cur) {
+    bad_line(as);
+  }
+}
+
+int is_reg_head(assembler_t *as) {
+  skip_spaces(as);
+  char *p = as->cur;
+  return ((*p == 'x' || *p == 'w') && (isdigit(p[1]) || p[1] == 'z')) ||
+         !strncmp(p, "sp", 2);
+}
+
+// reads x0-x30, w0-w30, sp, xzr or wzr and returns its number, 31 for sp
+// and the zero registers
+int read_reg(assembler_t *as) {
+  skip_spaces(as);
+  char *p = as->cur;
+  as->is_sp = 0;
+  if (!strncmp(p, "sp", 2)) {
+    as->cur += 2;
+    as->is_wide = 1;
+    as->is_sp = 1;
+    return 31;
+  }
+  if (*p != 'x' && *p != 'w') {
+    bad_line(as);
+  }
+  as->is_wide = *p == 'x';
+  p++;
+  if (!strncmp(p, "zr", 2)) {
+    as->cur = p + 2;
+    return 31;
+  }
+
+  int reg = 0;
+  if (!isdigit(*p)) {
+    bad_line(as);
+  }
+  while (isdigit(*p)) {
+    reg = reg * 10 + *p - '0';
+    p++;
+  }
+  if (reg > 30) {
+    bad_line(as);
+  }
+  as->cur = p;
+  return reg;
+}
+
+// reads a register after a comma
+int read_next_reg(assembler_t *as) {
+  expect_operand_char(as, ',');
+  return read_reg(as);
+}
+
+int read_imm(assembler_t *as) {
+  skip_spaces(as);
+  consume_operand_char(as, '#');
+  int is_negative = consume_operand_char(as, '-');
+  char *p = as->cur;
+  if (!isdigit(*p)) {
+    bad_line(as);
+  }
+
+  int value = 0;
+  if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+    p += 2;
+    while (isxdigit(*p)) {
+      value = value * 16 + hex_digit_value(*p);
+      p++;
+    }
+  } else {
+    while (isdigit(*p)) {
+      value = value * 10 + *p - '0';
+      p++;
+    }
+  }
+  as->cur = p;
+  if (is_negative) {
+    return -value;
+  }
+  return value;
+}
+
+// reads the rest of the line as a symbol name
+int read_label(assembler_t *as) {
+  skip_spaces(as);
+  if (!*as->cur) {
+    bad_line(as);
+  }
+  return find_label(as, as->cur);
+}
+
+// returns the condition code named at the cursor
+int read_cond(assembler_t *as) {
+  skip_spaces(as);
+  char *conds = "eqnecsccmiplvsvchilsgeltgtle";
+  int i = 0;
+  while (conds[i]) {
+    if (!strncmp(as->cur, conds + i, 2)) {
+      as->cur += 2;
+      return i / 2;
+    }
+    i += 2;
+  }
+  bad_line(as);
+  return 0;
+}
+
+// Returns the length of the run of ones in bits if they are a single run,
+// or 0, and sets *start to its lowest bit. bits must not be negative.
+int ones_run(int bits, int *start) {
+  if (bits == 0) {
+    return 0;
+  }
+  int low = 0;
+  while (!((bits >> low) & 1)) {
+    low++;
+  }
+  int len = 0;
+  while (low + len < 31 && ((bits >> (low + len)) & 1)) {
+    len++;
+  }
+  if (bits >> (low + len)) {
+    return 0;
+  }
+  *start = low;
+  return len;
+}
+
+// Encodes mov of the value, sign extended to 64 bits, into *word. mov is
+// movz or movn of a 16-bit half, or orr of a logical immediate, which for a
+// sign extended int is one rotated run of ones in a 64-bit element. Returns
+// 0 if the value needs more than one instruction.
+int encode_mov_immediate(int rd, int value, int *word) {
+  if (value >= 0 && value < 65536) {
+    *word = 0xD2800000 | value << 5 | rd;
+    return 1;
+  }
+  if (value > 0 && !(value & 65535)) {
+    *word = 0xD2A00000 | (value >> 16) << 5 | rd;
+    return 1;
+  }
+  int inverse = ~value;
+  if (value < 0 && inverse < 65536) {
+    *word = 0x92800000 | inverse << 5 | rd;
+    return 1;
+  }
+  if (value < 0 && !(inverse & 65535)) {
+    *word = 0x92A00000 | (inverse >> 16) << 5 | rd;
+    return 1;
+  }
+
+  // the run of ones starts at the low bit of value, or for a negative value
+  // right above its one run of zeros, from where it wraps around to it
+  int start = 0;
+  int len = 0;
+  if (value > 0) {
+    len = ones_run(value, &start);
+  } else {
+    int zeros = ones_run(inverse, &start);
+    if (zeros) {
+      start = start + zeros;
+      len = 64 - zeros;
+    }
+  }
+  if (!len) {
+    return 0;
+  }
+  int rotate = (64 - start) & 63;
+  *word = 0xB2400000 | rotate << 16 | (len - 1) << 10 | 31 << 5 | rd;
+  return 1;
+}
+
+int is_mov_immediate(int value) {
+  int word;
+  return encode_mov_immediate(0, value, &word);
+}
+
+// add, sub, adds or subs (op 0 to 3) of an immediate, which may be negative
+// or shifted by 12
+void emit_add_imm(assembler_t *as, int op, int rd, int rn, int imm) {
+  if (imm < 0) {
+    imm = -imm;
+    op = op ^ 2;
+  }
+  int shift = 0;
+  if (imm > 4095 && !(imm & 4095)) {
+    imm = imm >> 12;
+    shift = 1;
+  }
+  if (imm < 0 || imm > 4095) {
+    bad_line(as);
+  }
+  emit_word(as, 0x91000000 | op << 29 | shift << 22 | imm << 10 | rn << 5 |
+                    rd);
+}
+
+// add, sub, adds or subs (op 0 to 3) of a register or an immediate
+void assemble_add(assembler_t *as, int op, int rd, int rn) {
+  expect_operand_char(as, ',');
+  skip_spaces(as);
+  if (op == 0 && !strncmp(as->cur, ":lo12:", 6)) {
+    as->cur += 6;
+    reloc_next_word(as, reloc_add_lo12(), read_label(as));
+    emit_word(as, 0x91000000 | rn << 5 | rd);
+    return;
+  }
+  if (is_reg_head(as)) {
+    int rm = read_reg(as);
+    expect_line_end(as);
+    emit_word(as, 0x8B000000 | op << 29 | rm << 16 | rn << 5 | rd);
+    return;
+  }
+  int imm = read_imm(as);
+  expect_line_end(as);
+  emit_add_imm(as, op, rd, rn, imm);
+}
+
+// ldr, str, ldrb or strb, with size the log2 of the access size
+void assemble_load_store(assembler_t *as, int is_load, int size) {
+  int rt = read_reg(as);
+  if (size == 3 && !as->is_wide) {
+    size = 2;
+  }
+  expect_operand_char(as, ',');
+  expect_operand_char(as, '[');
+  int rn = read_reg(as);
+
+  int size_bits = 0;
+  if (size == 3) {
+    size_bits = 0xC0000000;
+  } else if (size == 2) {
+    size_bits = 0x80000000;
+  }
+  int base = size_bits | is_load << 22 | rn << 5 | rt;
+
+  if (consume_operand_char(as, ',')) {
+    int imm = read_imm(as);
+    expect_operand_char(as, ']');
+    if (consume_operand_char(as, '!')) {
+      // pre-index
+      expect_line_end(as);
+      emit_word(as, 0x38000C00 | base | (imm & 511) << 12);
+      return;
+    }
+    expect_line_end(as);
+    int scaled = imm >> size;
+    if (imm < 0 || scaled << size != imm || scaled > 4095) {
+      bad_line(as);
+    }
+    emit_word(as, 0x39000000 | base | scaled << 10);
+    return;
+  }
+
+  expect_operand_char(as, ']');
+  if (consume_operand_char(as, ',')) {
+    // post-index
+    int imm = read_imm(as);
+    expect_line_end(as);
+    emit_word(as, 0x38000400 | base | (imm & 511) << 12);
+    return;
+  }
+  expect_line_end(as);
+  emit_word(as, 0x39000000 | base);
+}
+
+// stp or ldp of 64-bit registers, pre- or post-indexed
+void assemble_pair(assembler_t *as, int is_load) {
+  int rt = read_reg(as);
+  int rt2 = read_next_reg(as);
+  expect_operand_char(as, ',');
+  expect_operand_char(as, '[');
+  int rn = read_reg(as);
+  int base = is_load << 22 | rt2 << 10 | rn << 5 | rt;
+
+  if (consume_operand_char(as, ',')) {
+    int imm = read_imm(as);
+    expect_operand_char(as, ']');
+    expect_operand_char(as, '!');
+    expect_line_end(as);
+    emit_word(as, 0xA9800000 | base | ((imm / 8) & 127) << 15);
+    return;
+  }
+  expect_operand_char(as, ']');
+  expect_operand_char(as, ',');
+  int imm = read_imm(as);
+  expect_line_end(as);
+  emit_word(as, 0xA8800000 | base | ((imm / 8) & 127) << 15);
+}
+
+void assemble_mov(assembler_t *as) {
+  int rd = read_reg(as);
+  int is_sp = as->is_sp;
+  expect_operand_char(as, ',');
+  if (is_reg_head(as)) {
+    int rm = read_reg(as);
+    expect_line_end(as);
+    if (is_sp || as->is_sp) {
+      // moves to and from sp are add of 0
+      emit_word(as, 0x91000000 | rm << 5 | rd);
+    } else {
+      emit_word(as, 0xAA0003E0 | rm << 16 | rd);
+    }
+    return;
+  }
+
+  int value = read_imm(as);
+  expect_line_end(as);
+  int word;
+  if (!encode_mov_immediate(rd, value, &word)) {
+    bad_line(as);
+  }
+  emit_word(as, word);
+}
+
+void assemble_movk(assembler_t *as) {
+  int rd = read_reg(as);
+  expect_operand_char(as, ',');
+  int imm = read_imm(as);
+  int shift = 0;
+  if (consume_operand_char(as, ',')) {
+    skip_spaces(as);
+    if (strncmp(as->cur, "lsl", 3)) {
+      bad_line(as);
+    }
+    as->cur += 3;
+    shift = read_imm(as);
+  }
+  expect_line_end(as);
+  if (imm < 0 || imm > 65535 || shift < 0 || shift > 48 || shift % 16) {
+    bad_line(as);
+  }
+  emit_word(as, 0xF2800000 | (shift / 16) << 21 | imm << 5 | rd);
+}
+
+// an instruction of three registers, or four with msub
+void assemble_reg_op(assembler_t *as, int base, int has_ra) {
+  int rd = read_reg(as);
+  int rn = read_next_reg(as);
+  int rm = read_next_reg(as);
+  int ra = 0;
+  if (has_ra) {
+    ra = read_next_reg(as);
+  }
+  expect_line_end(as);
+  emit_word(as, base | rm << 16 | ra << 10 | rn << 5 | rd);
+}
+
+// an instruction of a destination and a source register
+void assemble_unary(assembler_t *as, int base, int is_rm) {
+  int rd = read_reg(as);
+  int rn = read_next_reg(as);
+  expect_line_end(as);
+  if (is_rm) {
+    emit_word(as, base | rn << 16 | rd);
+  } else {
+    emit_word(as, base | rn << 5 | rd);
+  }
+}
+
+void assemble_branch(assembler_t *as, int cond) {
+  int symbol = read_label(as);
+  if (cond < 0) {
+    reloc_next_word(as, reloc_jump(), symbol);
+    emit_word(as, 0x14000000);
+  } else {
+    reloc_next_word(as, reloc_cond_branch(), symbol);
+    emit_word(as, 0x54000000 | cond);
+  }
+}
+
+void assemble_instruction(assembler_t *as) {
+  char op[8];
+  int len = 0;
+  while (as->cur[len] && as->cur[len] != ' ') {
+    if (len == 7) {
+      bad_line(as);
+    }
+    op[len] = as->cur[len];
+    len++;
+  }
+  op[len] = 0;
+  as->cur += len;
+
+  if (!strcmp(op, "str")) {
+    assemble_load_store(as, 0, 3);
+  } else if (!strcmp(op, "ldr")) {
+    assemble_load_store(as, 1, 3);
+  } else if (!strcmp(op, "mov")) {
+    assemble_mov(as);
+  } else if (!strcmp(op, "add") || !strcmp(op, "sub") ||
+             !strcmp(op, "subs")) {
+    int op_bits = 0;
+    if (op[0] == 's') {
+      op_bits = 2;
+    }
+    if (op[3] == 's') {
+      op_bits = 3;
+    }
+    int rd = read_reg(as);
+    int rn = read_next_reg(as);
+    assemble_add(as, op_bits, rd, rn);
+  } else if (!strcmp(op, "cmp")) {
+    int rn = read_reg(as);
+    assemble_add(as, 3, 31, rn);
+  } else if (!strcmp(op, "cset")) {
+    int rd = read_reg(as);
+    expect_operand_char(as, ',');
+    int cond = read_cond(as);
+    expect_line_end(as);
+    emit_word(as, 0x9A9F07E0 | (cond ^ 1) << 12 | rd);
+  } else if (!strcmp(op, "b")) {
+    assemble_branch(as, -1);
+  } else if (op[0] == 'b' && (len == 3 || (len == 4 && op[1] == '.'))) {
+    as->cur -= 2;
+    assemble_branch(as, read_cond(as));
+  } else if (!strcmp(op, "bl")) {
+    reloc_next_word(as, reloc_call(), read_label(as));
+    emit_word(as, 0x94000000);
+  } else if (!strcmp(op, "adrp")) {
+    int rd = read_reg(as);
+    expect_operand_char(as, ',');
+    reloc_next_word(as, reloc_adr_page(), read_label(as));
+    emit_word(as, 0x90000000 | rd);
+  } else if (!strcmp(op, "ret")) {
+    expect_line_end(as);
+    emit_word(as, 0xD65F03C0);
+  } else if (!strcmp(op, "ldrb")) {
+    assemble_load_store(as, 1, 0);
+  } else if (!strcmp(op, "strb")) {
+    assemble_load_store(as, 0, 0);
+  } else if (!strcmp(op, "stp")) {
+    assemble_pair(as, 0);
+  } else if (!strcmp(op, "ldp")) {
+    assemble_pair(as, 1);
+  } else if (!strcmp(op, "movk")) {
+    assemble_movk(as);
+  } else if (!strcmp(op, "mul")) {
+    assemble_reg_op(as, 0x9B007C00, 0);
+  } else if (!strcmp(op, "msub")) {
+    assemble_reg_op(as, 0x9B008000, 1);
+  } else if (!strcmp(op, "sdiv")) {
+    assemble_reg_op(as, 0x9AC00C00, 0);
+  } else if (!strcmp(op, "udiv")) {
+    assemble_reg_op(as, 0x9AC00800, 0);
+  } else if (!strcmp(op, "lsl")) {
+    assemble_reg_op(as, 0x9AC02000, 0);
+  } else if (!strcmp(op, "asr")) {
+    assemble_reg_op(as, 0x9AC02800, 0);
+  } else if (!strcmp(op, "and")) {
+    assemble_reg_op(as, 0x8A000000, 0);
+  } else if (!strcmp(op, "orr")) {
+    assemble_reg_op(as, 0xAA000000, 0);
+  } else if (!strcmp(op, "eor")) {
+    assemble_reg_op(as, 0xCA000000, 0);
+  } else if (!strcmp(op, "mvn")) {
+    assemble_unary(as, 0xAA2003E0, 1);
+  } else if (!strcmp(op, "sxtw")) {
+    assemble_unary(as, 0x93407C00, 0);
+  } else if (!strcmp(op, "sxtb")) {
+    assemble_unary(as, 0x93401C00, 0);
+  } else {
+    bad_line(as);
+  }
+}
+
+// adds the bytes of a .string operand and its NUL
+void assemble_string(assembler_t *as) {
+  bytes_t *bytes = as->section->bytes;
+  expect_operand_char(as, '"');
+  char *p = as->cur;
+  while (*p != '"') {
+    if (!*p) {
+      bad_line(as);
+    }
+    int c = *p;
+    if (c == '\\') {
+      p++;
+      c = *p;
+      if (c == 'n') {
+        c = '\n';
+      } else if (c == '0') {
+        c = 0;
+      } else if (c != '\\' && c != '\'' && c != '"') {
+        bad_line(as);
+      }
+    }
+    add_byte(bytes, c);
+    p++;
+  }
+  add_byte(bytes, 0);
+  as->cur = p + 1;
+  expect_line_end(as);
+}
+
+// .file number "name"
+void assemble_file(assembler_t *as) {
+  int file = read_imm(as);
+  expect_operand_char(as, '"');
+  char *name = as->cur;
+  char *end = name;
+  while (*end != '"') {
+    if (!*end) {
+      bad_line(as);
+    }
+    end++;
+  }
+  *end = 0;
+  if (file < 1) {
+    bad_line(as);
+  }
+
+  if (file > as->file_len) {
+    as->files = realloc(as->files, (file + 1) * sizeof(char *));
+    while (as->file_len < file) {
+      as->file_len++;
+      as->files[as->file_len] = "";
+    }
+  }
+  as->files[file] = copy_name(name);
+}
+
+void assemble_directive(assembler_t *as) {
+  char *p = as->cur;
+  if (!strncmp(p, ".loc ", 5)) {
+    // a .loc right after another still gets its row
+    if (as->has_loc) {
+      add_line_row(as);
+    }
+    as->cur += 5;
+    as->loc_file = read_imm(as);
+    as->loc_line = read_imm(as);
+    as->loc_column = read_imm(as);
+    expect_line_end(as);
+    as->has_loc = 1;
+  } else if (!strncmp(p, ".string ", 8)) {
+    as->cur += 8;
+    assemble_string(as);
+  } else if (!strncmp(p, ".global ", 8)) {
+    as->cur += 8;
+    int symbol = read_label(as);
+    as->symbols[symbol]->is_global = 1;
+  } else if (!strncmp(p, ".zero ", 6)) {
+    as->cur += 6;
+    int len = read_imm(as);
+    expect_line_end(as);
+    add_zeros(as->section->bytes, len);
+  } else if (!strcmp(p, ".text")) {
+    as->section = as->text;
+  } else if (!strcmp(p, ".data")) {
+    as->section = as->data;
+  } else if (!strncmp(p, ".file ", 6)) {
+    as->cur += 6;
+    assemble_file(as);
+  } else {
+    bad_line(as);
+  }
+}
+
+void assemble_line(assembler_t *as, char *line) {
+  as->line = line;
+  as->cur = line;
+  skip_spaces(as);
+  int len = strlen(as->cur);
+  if (len == 0) {
+    return;
+  }
+
+  if (as->cur[len - 1] == ':') {
+    as->cur[len - 1] = 0;
+    define_label(as, as->cur);
+  } else if (*as->cur == '.') {
+    assemble_directive(as);
+  } else {
+    assemble_instruction(as);
+  }
+}
+
+void assemble(assembler_t *as, char *text, int len) {
+  int i = 0;
+  if (as->partial->len > 0) {
+    while (i < len && text[i] != '\n') {
+      i++;
+    }
+    add_bytes(as->partial, text, i);
+    if (i == len) {
+      return;
+    }
+    add_byte(as->partial, 0);
+    assemble_line(as, as->partial->data);
+    as->partial->len = 0;
+    i++;
+  }
+
+  while (i < len) {
+    int start = i;
+    while (i < len && text[i] != '\n') {
+      i++;
+    }
+    if (i == len) {
+      add_bytes(as->partial, text + start, len - start);
+      return;
+    }
+    text[i] = 0;
+    assemble_line(as, text + start);
+    i++;
+  }
+}
+
+// Patches in the branches to labels of .text and makes the other
+// relocations name symbols of the symbol table, dropping the patched ones.
+void resolve_relocs(assembler_t *as, section_t *section) {
+  int len = 0;
+  int i = 0;
+  while (i < section->reloc_len) {
+    int offset = section->reloc_offsets[i];
+    int type = section->reloc_types[i];
+    symbol_t *symbol = as->symbols[section->reloc_symbols[i]];
+    int addend = section->reloc_addends[i];
+    i++;
+
+    int is_branch = type == reloc_jump() || type == reloc_cond_branch();
+    if (is_branch && symbol->section == section) {
+      int distance = (symbol->value - offset) >> 2;
+      if (type == reloc_jump()) {
+        or_word(section->bytes, offset, distance & 67108863);
+      } else {
+        or_word(section->bytes, offset, (distance & 524287) << 5);
+      }
+      continue;
+    }
+
+    int elf_symbol = symbol->elf_index;
+    if (is_local_label(symbol)) {
+      if (!symbol->section || is_branch) {
+        panic("assembler: undefined label '%s'\n", symbol->name);
+      }
+      elf_symbol = 1;
+      if (symbol->section == as->data) {
+        elf_symbol = 2;
+      }
+      addend += symbol->value;
+    }
+
+    section->reloc_offsets[len] = offset;
+    section->reloc_types[len] = type;
+    section->reloc_symbols[len] = elf_symbol;
+    section->reloc_addends[len] = addend;
+    len++;
+  }
+  section->reloc_len = len;
+}
+
+bytes_t *rela_bytes(section_t *section) {
+  bytes_t *bytes = new_bytes();
+  int i = 0;
+  while (i < section->reloc_len) {
+    add_le(bytes, section->reloc_offsets[i], 8);
+    add_le(bytes, section->reloc_types[i], 4);
+    add_le(bytes, section->reloc_symbols[i], 4);
+    add_le(bytes, section->reloc_addends[i], 8);
+    i++;
+  }
+  return bytes;
+}
+
+void add_elf_symbol(bytes_t *symtab, int name, int info, int section,
+                    int value) {
+  add_le(symtab, name, 4);
+  add_byte(symtab, info);
+  add_byte(symtab, 0);
+  add_le(symtab, section, 2);
+  add_le(symtab, value, 8);
+  add_le(symtab, 0, 8);
+}
+
+// Numbers the symbols of the symbol table and builds it and its strings:
+// the null symbol and the symbols of .text, .data and .debug_line come
+// first, then the other local symbols and then the global ones, undefined
+// names included. Returns the index of the first global symbol.
+int build_symtab(assembler_t *as, bytes_t *symtab, bytes_t *strtab) {
+  add_byte(strtab, 0);
+  add_elf_symbol(symtab, 0, 0, 0, 0);
+  add_elf_symbol(symtab, 0, 3, text_index(), 0);
+  add_elf_symbol(symtab, 0, 3, data_index(), 0);
+  add_elf_symbol(symtab, 0, 3, debug_line_index(), 0);
+  int count = 4;
+
+  int first_global = 0;
+  int pass = 0;
+  while (pass < 2) {
+    if (pass == 1) {
+      first_global = count;
+    }
+    int i = 0;
+    while (i < as->symbol_len) {
+      symbol_t *symbol = as->symbols[i];
+      i++;
+      int is_global = symbol->is_global || !symbol->section;
+      if (is_local_label(symbol) || is_global != pass) {
+        continue;
+      }
+
+      int section = 0;
+      if (symbol->section) {
+        section = symbol->section->index;
+      }
+      int name = add_cstring(strtab, symbol->name);
+      add_elf_symbol(symtab, name, is_global << 4, section, symbol->value);
+      symbol->elf_index = count;
+      count++;
+    }
+    pass++;
+  }
+  return first_global;
+}
+
+// builds .debug_line, a version 4 line program header followed by the rows
+bytes_t *debug_line_bytes(assembler_t *as) {
+  bytes_t *program = as->line_program;
+  add_byte(program, 2);
+  add_uleb(program, (as->text->bytes->len - as->row_address) / 4);
+  add_byte(program, 0);
+  add_uleb(program, 1);
+  add_byte(program, 1);
+
+  bytes_t *header = new_bytes();
+  add_byte(header, 4);
+  add_byte(header, 1);
+  add_byte(header, 1);
+  add_byte(header, -5);
+  add_byte(header, 14);
+  add_byte(header, 13);
+  char *opcode_lengths = "011110001001";
+  int i = 0;
+  while (opcode_lengths[i]) {
+    add_byte(header, opcode_lengths[i] - '0');
+    i++;
+  }
+  add_byte(header, 0);
+  i = 1;
+  while (i <= as->file_len) {
+    add_cstring(header, as->files[i]);
+    add_uleb(header, 0);
+    add_uleb(header, 0);
+    add_uleb(header, 0);
+    i++;
+  }
+  add_byte(header, 0);
+
+  bytes_t *bytes = new_bytes();
+  add_le(bytes, 2 + 4 + header->len + program->len, 4);
+  add_le(bytes, 4, 2);
+  add_le(bytes, header->len, 4);
+  add_bytes(bytes, header->data, header->len);
+  add_bytes(bytes, program->data, program->len);
+  return bytes;
+}
+
+void write_object(assembler_t *as, char *path) {
+  bytes_t *symtab = new_bytes();
+  bytes_t *strtab = new_bytes();
+  int first_global = build_symtab(as, symtab, strtab);
+  resolve_relocs(as, as->text);
+  if (as->data->reloc_len) {
+    panic("assembler: .data cannot have relocations\n");
+  }
+
+  // the address the line program starts at is set by the relocation at
+  // byte 3 of the program, which comes after the header
+  bytes_t *debug_line = debug_line_bytes(as);
+  section_t *debug_rela = new_section(0);
+  add_reloc(debug_rela, debug_line->len - as->line_program->len + 3,
+            reloc_abs64(), 1, 0);
+
+  int count = section_count();
+  bytes_t **contents = calloc(count, sizeof(bytes_t *));
+  char **names = calloc(count, sizeof(char *));
+  int *types = calloc(count, sizeof(int));
+  int *flags = calloc(count, sizeof(int));
+  int *links = calloc(count, sizeof(int));
+  int *infos = calloc(count, sizeof(int));
+  int *aligns = calloc(count, sizeof(int));
+  int *entry_sizes = calloc(count, sizeof(int));
+
+  // types: 1 progbits, 2 symtab, 3 strtab, 4 rela. flags: 1 write, 2 alloc,
+  // 4 exec, 64 info link
+  names[0] = "";
+  contents[0] = new_bytes();
+  names[1] = ".text";
+  contents[1] = as->text->bytes;
+  types[1] = 1;
+  flags[1] = 6;
+  aligns[1] = 4;
+  names[2] = ".rela.text";
+  contents[2] = rela_bytes(as->text);
+  types[2] = 4;
+  flags[2] = 64;
+  links[2] = symtab_index();
+  infos[2] = text_index();
+  aligns[2] = 8;
+  entry_sizes[2] = 24;
+  names[3] = ".data";
+  contents[3] = as->data->bytes;
+  types[3] = 1;
+  flags[3] = 3;
+  aligns[3] = 8;
+  names[4] = ".debug_line";
+  contents[4] = debug_line;
+  types[4] = 1;
+  aligns[4] = 1;
+  names[5] = ".rela.debug_line";
+  contents[5] = rela_bytes(debug_rela);
+  types[5] = 4;
+  flags[5] = 64;
+  links[5] = symtab_index();
+  infos[5] = debug_line_index();
+  aligns[5] = 8;
+  entry_sizes[5] = 24;
+  names[6] = ".note.GNU-stack";
+  contents[6] = new_bytes();
+  types[6] = 1;
+  aligns[6] = 1;
+  names[7] = ".symtab";
+  contents[7] = symtab;
+  types[7] = 2;
+  links[7] = 8;
+  infos[7] = first_global;
+  aligns[7] = 8;
+  entry_sizes[7] = 24;
+  names[8] = ".strtab";
+  contents[8] = strtab;
+  types[8] = 3;
+  aligns[8] = 1;
+  names[9] = ".shstrtab";
+  types[9] = 3;
+  aligns[9] = 1;
+
+  bytes_t *shstrtab = new_bytes();
+  int *name_offsets = calloc(count, sizeof(int));
+  int i = 0;
+  while (i < count) {
+    name_offsets[i] = add_cstring(shstrtab, names[i]);
+    i++;
+  }
+  contents[9] = shstrtab;
+
+  // sections follow the ELF header in order, then the section headers
+  int *offsets = calloc(count, sizeof(int));
+  int offset = 64;
+  i = 1;
+  while (i < count) {
+    while (offset % aligns[i]) {
+      offset++;
+    }
+    offsets[i] = offset;
+    offset += contents[i]->len;
+    i++;
+  }
+  while (offset % 8) {
+    offset++;
+  }
+
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL) {
+    panic("failed to open file '%s'\n", path);
+  }
+  writer_t *out = new_writer(fp);
+  put_char(out, 127);
+  put_str(out, "ELF");
+  put_le(out, 2, 1);
+  put_le(out, 1, 1);
+  put_le(out, 1, 1);
+  put_le(out, 0, 9);
+  put_le(out, 1, 2);
+  put_le(out, 183, 2);
+  put_le(out, 1, 4);
+  put_le(out, 0, 8);
+  put_le(out, 0, 8);
+  put_le(out, offset, 8);
+  put_le(out, 0, 4);
+  put_le(out, 64, 2);
+  put_le(out, 0, 2);
+  put_le(out, 0, 2);
+  put_le(out, 64, 2);
+  put_le(out, count, 2);
+  put_le(out, count - 1, 2);
+
+  i = 1;
+  while (i < count) {
+    while (writer_size(out) < offsets[i]) {
+      put_char(out, 0);
+    }
+    put_bytes(out, contents[i]->data, contents[i]->len);
+    i++;
+  }
+  while (writer_size(out) < offset) {
+    put_char(out, 0);
+  }
+
+  i = 0;
+  while (i < count) {
+    put_le(out, name_offsets[i], 4);
+    put_le(out, types[i], 4);
+    put_le(out, flags[i], 8);
+    put_le(out, 0, 8);
+    put_le(out, offsets[i], 8);
+    put_le(out, contents[i]->len, 8);
+    put_le(out, links[i], 4);
+    put_le(out, infos[i], 4);
+    put_le(out, aligns[i], 8);
+    put_le(out, entry_sizes[i], 8);
+    i++;
+  }
+  flush_writer(out);
+  fclose(fp);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// An AArch64 assembler for the assembly codegen writes. It takes the text as
+// it is written and encodes it into an ELF relocatable object, with symbols,
+// relocations and a .debug_line built from the .file and .loc directives.
+// Only the instructions and directives codegen uses are known.
+typedef struct _assembler_t assembler_t;
+
+assembler_t *new_assembler();
+
+// Assembles the text, which is changed in place. The text may stop in the
+// middle of a line, which is then finished by the next call.
+void assemble(assembler_t *assembler, char *text, int len);
+
+// Writes what was assembled to path as an object file.
+void write_object(assembler_t *assembler, char *path);
+
+// Returns whether mov can load the value into a register in one instruction.
+int is_mov_immediate(int value);
@@ -0,0 +1,45 @@
+#!/bin/bash -eu
+# Generates functions made of single long expressions, deeply nested
+# parentheses, calls, blocks and if and while statements in the subset of C
+# accepted by ccc, to check that deep code neither overflows the stack nor
+# takes more than linear time. Usage: gen_deep.sh <number of terms>
+
+n=${1:-100000}
+
+echo "int sum(int a, int b) {"
+printf "  return a"
+for ((i = 1; i < n; i++)); do
+  printf " + b * $((i % 7)) - a"
+done
+printf ";\n}\n\n"
+
+echo "int any(int a, int b) {"
+printf "  return a < b"
+for ((i = 1; i < n; i++)); do
+  printf " || a == $i && b != $i"
+done
+printf ";\n}\n\n"
+
+open=$(printf "%${n}s" "")
+echo "int paren(int a) {"
+echo "  return ${open// /(}a${open// /)};"
+printf "}\n\n"
+
+echo "int operand(int a) {"
+echo "  return ${open// /1 + (}a${open// /)};"
+printf "}\n\n"
+
+echo "int call(int a) {"
+echo "  return ${open// /paren(}a${open// /)};"
+printf "}\n\n"
+
+echo "int block(int a) {"
+echo "  ${open// /\{}a = a + 1;${open// /\}}"
+echo "  return a;"
+printf "}\n\n"
+
+echo "int branch(int a) {"
+echo "  ${open// /if (a) }a = a + 1;"
+echo "  ${open// /while (a) }a = a - 1;"
+echo "  return a;"
+echo "}"
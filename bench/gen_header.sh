@@ -0,0 +1,24 @@
+#!/bin/bash -eu
+# Generates a large header of declarations in the subset of C accepted by
+# ccc, to compare reading it as text with loading it precompiled.
+# Usage: gen_header.sh <number of declaration groups>
+
+n=${1:-1000}
+
+echo "#pragma once"
+for ((i = 0; i < n; i++)); do
+  cat << EOF2
+// generated declarations $i
+#define RECORD_${i}_SIZE $i
+typedef struct _record_${i}_t record_${i}_t;
+struct _record_${i}_t {
+  int id;
+  char *name;
+  record_${i}_t *next;
+};
+typedef enum { RECORD_${i}_NEW, RECORD_${i}_OLD } record_${i}_state_t;
+record_${i}_t *record_${i}_find(record_${i}_t *records, int id, char *name);
+extern int record_${i}_count;
+
+EOF2
+done
@@ -0,0 +1,38 @@
+#!/bin/bash -eu
+# Generates a large, machine-generated-looking translation unit in the subset
+# of C accepted by ccc. Usage: gen_large.sh <number of functions>
+
+n=${1:-1000}
+
+cat << EOF2
+typedef struct _entry_t entry_t;
+struct _entry_t {
+  int key;
+  int value;
+  entry_t *next;
+};
+
+EOF2
+
+for ((i = 0; i < n; i++)); do
+  cat << EOF2
+// generated function $i
+int table_lookup_$i(entry_t *entries, int key, char *name) {
+  int result = 0;
+  int index = key % 17;
+  while (entries) {
+    if (entries->key == key && entries->value >= $i) {
+      result = result + entries->value * $i - (index << 2);
+    } else {
+      result = result ^ (entries->key | $i);
+    }
+    entries = entries->next;
+  }
+  name = "table_lookup_$i";
+  return result + index;
+}
+
+EOF2
+done
+
+echo "int main() { return 0; }"
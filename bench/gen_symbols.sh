@@ -0,0 +1,20 @@
+#!/bin/bash -eu
+# Generates a translation unit with many file scope names in the subset of C
+# accepted by ccc: enums of 100 constants each, then functions that each call
+# an earlier function and use a constant, to time the symbol tables of
+# codegen. Usage: gen_symbols.sh <number of functions and of enum constants>
+
+n=${1:-50000}
+
+for ((i = 0; i < n; i += 100)); do
+  printf "enum { e$i"
+  for ((j = i + 1; j < i + 100 && j < n; j++)); do
+    printf ", e$j"
+  done
+  printf " };\n"
+done
+
+echo "int f0(int a) { return a; }"
+for ((i = 1; i < n; i++)); do
+  echo "int f$i(int a) { return f$((i * 7919 % 65521 % i))(a) + e$((i * 104729 % n)); }"
+done
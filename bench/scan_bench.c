@@ -0,0 +1,158 @@
+// Lexer microbenchmark: tokenizes a file with the vectorized scanners and
+// with the byte-at-a-time loops and reports bytes per cycle for each, plus
+// the raw scanners on their own. Build with `make bench/scan_bench`.
+#define _POSIX_C_SOURCE 200809L
+#include "../intern.h"
+#include "../os.h"
+#include "../scan.h"
+#include "../tokenizer.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static unsigned long long cycles() { return __rdtsc(); }
+#define UNIT "cycle"
+#else
+static unsigned long long cycles() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#define UNIT "ns"
+#endif
+
+enum { RUNS = 5 };
+
+static char *src;
+static int src_size;
+static char *work;
+
+static unsigned long long lex(int is_scalar, int *tokens) {
+  memcpy(work, src, src_size + 1);
+  unsigned long long start = cycles();
+  tokenizer_ctx_t *ctx = new_tokenizer_ctx(work, src_size);
+  ctx->is_scalar = is_scalar;
+  token_array_t *ring = new_token_array(1);
+  *tokens = 0;
+  do {
+    read_token(ctx, ring, 0);
+    (*tokens)++;
+  } while (ring->kinds[0] != TOKEN_EOF);
+  return cycles() - start;
+}
+
+// Walks the whole input, calling the scanner at the start of every run of
+// its class, so runs are scanned with their real length distribution.
+static void scan(char *name, int (*in_class)(int), int (*scanner)(char *)) {
+  unsigned long long best = ~0ull;
+  long scanned = 0;
+  for (int run = 0; run < RUNS; run++) {
+    unsigned long long start = cycles();
+    scanned = 0;
+    char *p = src;
+    char *end = src + src_size;
+    while (p < end) {
+      if (in_class(*p)) {
+        int len = scanner(p);
+        scanned += len;
+        p += len;
+      } else {
+        p++;
+      }
+    }
+    unsigned long long elapsed = cycles() - start;
+    if (elapsed < best) {
+      best = elapsed;
+    }
+  }
+  printf("  %-20s %8.3f bytes/%s (%ld bytes in runs)\n", name,
+         (double)src_size / best, UNIT, scanned);
+}
+
+static int is_ident(int c) { return isalnum(c) || c == '_'; }
+
+static int is_not_newline(int c) { return c != '\n'; }
+
+static int scan_spaces_only(char *p) {
+  int newlines;
+  int last_newline;
+  return scan_spaces(p, &newlines, &last_newline);
+}
+
+static int ident_loop(char *p) {
+  char *cur = p;
+  while (is_ident(*cur)) {
+    cur++;
+  }
+  return cur - p;
+}
+
+static int digit_loop(char *p) {
+  char *cur = p;
+  while (isdigit(*cur)) {
+    cur++;
+  }
+  return cur - p;
+}
+
+static int space_loop(char *p) {
+  char *cur = p;
+  while (isspace(*cur)) {
+    cur++;
+  }
+  return cur - p;
+}
+
+static int newline_loop(char *p) {
+  char *cur = p;
+  while (*cur && *cur != '\n') {
+    cur++;
+  }
+  return cur - p;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <file>\n", argv[0]);
+    return 1;
+  }
+
+  src = map_file(argv[1], &src_size);
+  if (src == NULL) {
+    fprintf(stderr, "failed to open file '%s'\n", argv[1]);
+    return 1;
+  }
+  work = malloc(src_size + 1);
+
+  printf("input: %d bytes, simd scanners %s\n", src_size,
+         has_simd_scan() ? "available" : "unavailable");
+
+  for (int is_scalar = 0; is_scalar <= 1; is_scalar++) {
+    unsigned long long best = ~0ull;
+    int tokens = 0;
+    for (int run = 0; run < RUNS; run++) {
+      unsigned long long elapsed = lex(is_scalar, &tokens);
+      if (elapsed < best) {
+        best = elapsed;
+      }
+    }
+    printf("tokenize %-7s %8.3f bytes/%s, %d tokens\n",
+           is_scalar ? "scalar" : "simd", (double)src_size / best, UNIT,
+           tokens);
+  }
+
+  printf("scanners over the whole input:\n");
+  scan("scan_ident_chars", is_ident, scan_ident_chars);
+  scan("  scalar", is_ident, ident_loop);
+  scan("scan_digits", isdigit, scan_digits);
+  scan("  scalar", isdigit, digit_loop);
+  scan("scan_spaces", isspace, scan_spaces_only);
+  scan("  scalar", isspace, space_loop);
+  scan("scan_to_newline", is_not_newline, scan_to_newline);
+  scan("  scalar", is_not_newline, newline_loop);
+  return 0;
+}
@@ -1,47 +1,40 @@
 #include "codegen.h"
+#include "arena.h"
+#include "assembler.h"
+#include "codegen_bytecode.h"
+#include "codegen_x86.h"
 #include "error.h"
-#include <stdarg.h>
+#include "intern.h"
 #include <stdlib.h>
 #include <string.h>
 
-char *arg_regs[8];
-
-void init_arg_regs() {
-  arg_regs[0] = "x0";
-  arg_regs[1] = "x1";
-  arg_regs[2] = "x2";
-  arg_regs[3] = "x3";
-  arg_regs[4] = "x4";
-  arg_regs[5] = "x5";
-  arg_regs[6] = "x6";
-  arg_regs[7] = "x7";
-}
-
-void gen_expr(codegen_ctx_t *ctx, expr_t *expr);
-void gen_stmt(codegen_ctx_t *ctx, stmt_t *stmt);
+void gen_stmt(codegen_ctx_t *ctx, int node);
 
 void push_scope(codegen_ctx_t *ctx) {
-  var_scope_t *var_scope = calloc(1, sizeof(var_scope_t));
+  var_scope_t *var_scope = node_alloc(sizeof(var_scope_t));
+  var_scope->undo_mark = ctx->undo_len;
   var_scope->parent = ctx->var_scopes;
   ctx->var_scopes = var_scope;
-
-  type_scope_t *type_scope = calloc(1, sizeof(type_scope_t));
-  type_scope->parent = ctx->type_scopes;
-  ctx->type_scopes = type_scope;
 }
 
 void pop_scope(codegen_ctx_t *ctx) {
+  while (ctx->undo_len > ctx->var_scopes->undo_mark) {
+    ctx->undo_len--;
+    variable_t *variable = ctx->undo_log[ctx->undo_len];
+    ctx->var_table[variable->symbol] = variable->shadowed;
+  }
   ctx->var_scopes = ctx->var_scopes->parent;
-  ctx->type_scopes = ctx->type_scopes->parent;
 }
 
-codegen_ctx_t *new_codegen_ctx(char *in_filepath, FILE *out_fp,
+codegen_ctx_t *new_codegen_ctx(char *in_filepath, writer_t *out,
                                global_var_t *globals) {
   codegen_ctx_t *ctx = calloc(1, sizeof(codegen_ctx_t));
   ctx->in_filepath = in_filepath;
-  ctx->out_fp = out_fp;
+  ctx->out = out;
   ctx->cur_offset = 16;
   ctx->globals = globals;
+  ctx->func_arena = new_arena();
+
   push_scope(ctx);
   return ctx;
 }
@@ -52,79 +45,105 @@ void init_ctx(codegen_ctx_t *ctx, char *func_name) {
   ctx->cur_func_name = func_name;
 }
 
-variable_t *add_variable(codegen_ctx_t *ctx, type_t *type, char *name) {
-  variable_t *variable = calloc(1, sizeof(variable_t));
+variable_t *add_variable(codegen_ctx_t *ctx, type_t *type, int symbol) {
+  variable_t *variable = node_alloc(sizeof(variable_t));
   variable->type = type;
-  variable->name = name;
+  variable->symbol = symbol;
 
   variable->offset = ctx->cur_offset;
   ctx->cur_offset =
       align_to(ctx->cur_offset + type_size(type), type_align(type));
 
-  var_scope_t *cur_scope = ctx->var_scopes;
-  variable->next = cur_scope->variables;
-  cur_scope->variables = variable;
+  if (symbol >= ctx->var_table_cap) {
+    int cap = ctx->var_table_cap * 2 + 256;
+    while (cap <= symbol) {
+      cap *= 2;
+    }
+    ctx->var_table = realloc(ctx->var_table, cap * sizeof(variable_t *));
+    memset(ctx->var_table + ctx->var_table_cap, 0,
+           (cap - ctx->var_table_cap) * sizeof(variable_t *));
+    ctx->var_table_cap = cap;
+  }
+  if (ctx->undo_len == ctx->undo_cap) {
+    ctx->undo_cap = ctx->undo_cap * 2 + 64;
+    ctx->undo_log = realloc(ctx->undo_log, ctx->undo_cap * sizeof(variable_t *));
+  }
+
+  variable->scope = ctx->var_scopes;
+  variable->shadowed = ctx->var_table[symbol];
+  ctx->var_table[symbol] = variable;
+  ctx->undo_log[ctx->undo_len] = variable;
+  ctx->undo_len++;
 
   return variable;
 }
 
-variable_t *find_variable_in(codegen_ctx_t *ctx, char *name,
-                             var_scope_t *scope) {
-  variable_t *cur = scope->variables;
-  while (cur) {
-    if (!strcmp(cur->name, name)) {
-      return cur;
-    }
-    cur = cur->next;
+variable_t *find_variable(codegen_ctx_t *ctx, int symbol) {
+  if (symbol >= ctx->var_table_cap) {
+    return NULL;
   }
-
-  return NULL;
+  return ctx->var_table[symbol];
 }
 
-variable_t *find_variable(codegen_ctx_t *ctx, char *name) {
-  var_scope_t *cur_scope = ctx->var_scopes;
+int is_variable_already_defined(codegen_ctx_t *ctx, int symbol) {
+  variable_t *variable = find_variable(ctx, symbol);
+  return variable != NULL && variable->scope == ctx->var_scopes;
+}
 
-  while (cur_scope) {
-    variable_t *variable = find_variable_in(ctx, name, cur_scope);
-    if (variable) {
-      return variable;
+// Returns the file scope entry of the symbol, growing the table to hold it.
+file_name_t *file_name(codegen_ctx_t *ctx, int symbol) {
+  if (symbol >= ctx->file_name_cap) {
+    int cap = ctx->file_name_cap * 2 + 1024;
+    while (cap <= symbol) {
+      cap *= 2;
     }
-
-    cur_scope = cur_scope->parent;
+    ctx->file_names = realloc(ctx->file_names, cap * sizeof(file_name_t));
+    memset(ctx->file_names + ctx->file_name_cap, 0,
+           (cap - ctx->file_name_cap) * sizeof(file_name_t));
+    ctx->file_name_cap = cap;
   }
-
-  return NULL;
-}
-
-int is_variable_already_defined(codegen_ctx_t *ctx, char *name) {
-  return find_variable_in(ctx, name, ctx->var_scopes) != NULL;
+  return ctx->file_names + symbol;
 }
 
+// a later declaration of the function replaces the earlier one
 function_t *add_function(codegen_ctx_t *ctx, type_t *ret_type, char *name) {
-  function_t *function = calloc(1, sizeof(function_t));
+  function_t *function = arena_alloc(program_arena(), sizeof(function_t));
   function->ret_type = ret_type;
   function->name = name;
 
-  function->next = ctx->functions;
-  ctx->functions = function;
-
+  file_name(ctx, intern_symbol(name))->function = function;
   return function;
 }
 
-function_t *find_function(codegen_ctx_t *ctx, char *name) {
-  function_t *cur = ctx->functions;
+// marks the functions defined, so that calls to them can be told apart from
+// calls to the C library before the definition is reached
+void mark_defined_functions(codegen_ctx_t *ctx, global_stmt_t *gstmt) {
+  global_stmt_t *cur = gstmt;
   while (cur) {
-    if (!strcmp(cur->name, name)) {
-      return cur;
+    if (cur->type == GSTMT_FUNC) {
+      file_name(ctx, intern_symbol(cur->value.func.name))->is_defined = 1;
     }
     cur = cur->next;
   }
+}
+
+int is_defined_function(codegen_ctx_t *ctx, char *name) {
+  int symbol = intern_symbol(name);
+  if (symbol >= ctx->file_name_cap) {
+    return 0;
+  }
+  return ctx->file_names[symbol].is_defined;
+}
 
-  return NULL;
+function_t *find_function(codegen_ctx_t *ctx, int symbol) {
+  if (symbol >= ctx->file_name_cap) {
+    return NULL;
+  }
+  return ctx->file_names[symbol].function;
 }
 
 int add_string(codegen_ctx_t *ctx, char *string) {
-  string_t *str = calloc(1, sizeof(string_t));
+  string_t *str = arena_alloc(program_arena(), sizeof(string_t));
   str->string = string;
 
   str->next = ctx->strings;
@@ -135,7 +154,7 @@ int add_string(codegen_ctx_t *ctx, char *string) {
 }
 
 void push_loop(codegen_ctx_t *ctx, int break_label, int continue_label) {
-  loop_t *loop = calloc(1, sizeof(loop_t));
+  loop_t *loop = node_alloc(sizeof(loop_t));
   loop->break_label = break_label;
   loop->continue_label = continue_label;
 
@@ -147,41 +166,26 @@ loop_t *cur_loop(codegen_ctx_t *ctx) { return ctx->loops; }
 
 void pop_loop(codegen_ctx_t *ctx) { ctx->loops = ctx->loops->next; }
 
+// a later definition of the tag replaces the earlier one
 void add_type(codegen_ctx_t *ctx, type_t *type) {
-  defined_type_t *defined_type = calloc(1, sizeof(defined_type_t));
-  defined_type->type = type;
-
-  type_scope_t *cur_scope = ctx->type_scopes;
-  defined_type->next = cur_scope->types;
-  cur_scope->types = defined_type;
-}
-
-type_t *find_type_in(codegen_ctx_t *ctx, char *tag, type_scope_t *scope) {
-  defined_type_t *cur = scope->types;
-  while (cur) {
-    char *cur_tag = cur->type->value.struct_union.tag;
-    if (cur_tag && !strcmp(cur_tag, tag)) {
-      return cur->type;
-    }
-    cur = cur->next;
+  char *tag = type->value.struct_union.tag;
+  if (type->kind == TYPE_ENUM) {
+    tag = type->value.enum_.tag;
+  }
+  if (tag) {
+    file_name(ctx, intern_symbol(tag))->tag = type;
   }
-
-  return NULL;
 }
 
 type_t *find_type(codegen_ctx_t *ctx, char *tag) {
-  type_scope_t *cur_scope = ctx->type_scopes;
-
-  while (cur_scope) {
-    type_t *type = find_type_in(ctx, tag, cur_scope);
-    if (type) {
-      return type;
-    }
-
-    cur_scope = cur_scope->parent;
+  if (tag == NULL) {
+    return NULL;
   }
-
-  return NULL;
+  int symbol = intern_symbol(tag);
+  if (symbol >= ctx->file_name_cap) {
+    return NULL;
+  }
+  return ctx->file_names[symbol].tag;
 }
 
 type_t *complete_type(codegen_ctx_t *ctx, type_t *type) {
@@ -201,60 +205,63 @@ type_t *complete_type(codegen_ctx_t *ctx, type_t *type) {
     type->value.array.elm = complete_type(ctx, type->value.array.elm);
     return type;
   case TYPE_STRUCT:
-  case TYPE_UNION: {
-    type_t *completed_type = find_type(ctx, type->value.struct_union.tag);
-    if (completed_type) {
-      return completed_type;
+  case TYPE_UNION:
+    if (!type->completion) {
+      type->completion = find_type(ctx, type->value.struct_union.tag);
+    }
+    if (type->completion) {
+      return type->completion;
     }
     return type;
-  }
-  case TYPE_ENUM: {
-    type_t *completed_type = find_type(ctx, type->value.enum_.tag);
-    if (completed_type) {
-      return completed_type;
+  case TYPE_ENUM:
+    if (!type->completion) {
+      type->completion = find_type(ctx, type->value.enum_.tag);
+    }
+    if (type->completion) {
+      return type->completion;
     }
     return type;
   }
-  }
 }
 
-void append_enums(codegen_ctx_t *ctx, enum_t *enums) {
-  if (ctx->enums == NULL) {
-    ctx->enums = enums;
-    return;
-  }
-
-  enum_t *cur = ctx->enums;
-  while (cur->next) {
-    cur = cur->next;
-  }
-
-  cur->next = enums;
-}
-
-int find_enum(codegen_ctx_t *ctx, char *name, int *value) {
-  enum_t *cur = ctx->enums;
+// the first enum constant declared under a name is the one that counts
+void add_enums(codegen_ctx_t *ctx, enum_t *enums) {
+  enum_t *cur = enums;
   while (cur) {
-    if (!strcmp(cur->name, name)) {
-      *value = cur->value;
-      return 1;
+    file_name_t *name = file_name(ctx, intern_symbol(cur->name));
+    if (name->enum_ == NULL) {
+      name->enum_ = cur;
     }
     cur = cur->next;
   }
+}
 
-  return 0;
+int find_enum(codegen_ctx_t *ctx, int symbol, int *value) {
+  if (symbol >= ctx->file_name_cap ||
+      ctx->file_names[symbol].enum_ == NULL) {
+    return 0;
+  }
+  *value = ctx->file_names[symbol].enum_->value;
+  return 1;
 }
 
-global_var_t *find_global(codegen_ctx_t *ctx, char *name) {
-  global_var_t *cur = ctx->globals;
+// the list runs from the latest global back, and the latest one counts
+void add_globals(codegen_ctx_t *ctx, global_var_t *globals) {
+  global_var_t *cur = globals;
   while (cur) {
-    if (!strcmp(cur->name, name)) {
-      return cur;
+    file_name_t *name = file_name(ctx, intern_symbol(cur->name));
+    if (name->global == NULL) {
+      name->global = cur;
     }
     cur = cur->next;
   }
+}
 
-  return NULL;
+global_var_t *find_global(codegen_ctx_t *ctx, int symbol) {
+  if (symbol >= ctx->file_name_cap) {
+    return NULL;
+  }
+  return ctx->file_names[symbol].global;
 }
 
 int next_label(codegen_ctx_t *ctx) {
@@ -262,7 +269,8 @@ int next_label(codegen_ctx_t *ctx) {
   return ctx->cur_label;
 }
 
-int eval_const_expr(codegen_ctx_t *ctx, expr_t *expr) {
+int eval_const_expr(codegen_ctx_t *ctx, int node) {
+  expr_t *expr = expr_at(node);
   switch (expr->type) {
   case EXPR_CHAR:
     return expr->value.char_;
@@ -273,100 +281,358 @@ int eval_const_expr(codegen_ctx_t *ctx, expr_t *expr) {
     if (find_enum(ctx, expr->value.ident, &enum_value)) {
       return enum_value;
     }
-    error(expr->pos, "unknown enum '%s'\n", expr->value.ident);
+    error(expr->pos, "unknown enum '%s'\n", symbol_name(expr->value.ident));
   }
   default:
     error(expr->pos, "unimplemented const expression\n");
   }
 }
 
-#ifdef __GNUC__
-#define GEN_NAME gen
-void GEN_NAME(codegen_ctx_t *ctx, char *format, ...) {
-  va_list args;
-  va_start(args, format);
-  vfprintf(ctx->out_fp, format, args);
-  va_end(args);
+// Output goes through the append buffer of a writer, piece by piece: text,
+// registers and names as strings, numbers and labels by their own emitters.
+void emit(codegen_ctx_t *ctx, char *str) { put_str(ctx->out, str); }
+
+void emit_int(codegen_ctx_t *ctx, int n) { put_int(ctx->out, n); }
+
+// writes the name of a label of the current function
+void emit_label_name(codegen_ctx_t *ctx, int label) {
+  emit(ctx, ".L.");
+  emit(ctx, ctx->cur_func_name);
+  emit(ctx, ".");
+  emit_int(ctx, label);
+}
+
+// writes a line that ends with a number, such as "  mov x8, " followed by 42
+void emit_with_int(codegen_ctx_t *ctx, char *head, int n) {
+  emit(ctx, head);
+  emit_int(ctx, n);
+  emit(ctx, "\n");
+}
+
+// writes a line that ends with a name
+void emit_with_name(codegen_ctx_t *ctx, char *head, char *name) {
+  emit(ctx, head);
+  emit(ctx, name);
+  emit(ctx, "\n");
 }
-#else
-void gen(codegen_ctx_t *ctx, char *format, void *a1, void *a2, void *a3,
-         void *a4) {
-  fprintf(ctx->out_fp, format, a1, a2, a3, a4);
+
+void emit_loc(codegen_ctx_t *ctx, pos_t pos) {
+  // bytecode carries no line table
+  if (ctx->target == TARGET_BYTECODE) {
+    return;
+  }
+  emit(ctx, ".loc ");
+  emit_int(ctx, pos_file(pos));
+  emit(ctx, " ");
+  emit_int(ctx, pos_line(pos));
+  emit(ctx, " ");
+  emit_int(ctx, pos_column(pos));
+  emit(ctx, "\n");
+}
+
+// The code is that of a stack machine: operands are pushed, and popped into
+// register 8, and register 9 for a second one, and results pushed again.
+// Registers are numbered as on AArch64, where 0 to 7 pass arguments and 10
+// is a scratch register; the other targets map them to their own.
+char *aarch64_regs[11];
+
+void init_regs() {
+  aarch64_regs[0] = "x0";
+  aarch64_regs[1] = "x1";
+  aarch64_regs[2] = "x2";
+  aarch64_regs[3] = "x3";
+  aarch64_regs[4] = "x4";
+  aarch64_regs[5] = "x5";
+  aarch64_regs[6] = "x6";
+  aarch64_regs[7] = "x7";
+  aarch64_regs[8] = "x8";
+  aarch64_regs[9] = "x9";
+  aarch64_regs[10] = "x10";
+  init_x86_regs();
+}
+
+int is_x86(codegen_ctx_t *ctx) { return ctx->target == TARGET_X86_64; }
+
+int is_bytecode(codegen_ctx_t *ctx) {
+  return ctx->target == TARGET_BYTECODE;
+}
+
+// Loads the value into reg. A value mov cannot load in one instruction is
+// built from its two 16-bit halves and sign extended.
+void gen_mov(codegen_ctx_t *ctx, int reg, int value) {
+  if (is_bytecode(ctx)) {
+    bc_mov(ctx, reg, value);
+    return;
+  }
+  if (is_x86(ctx)) {
+    x86_mov(ctx, reg, value);
+    return;
+  }
+
+  char *name = aarch64_regs[reg];
+  if (is_mov_immediate(value)) {
+    emit(ctx, "  mov ");
+    emit(ctx, name);
+    emit_with_int(ctx, ", ", value);
+    return;
+  }
+
+  emit(ctx, "  mov ");
+  emit(ctx, name);
+  emit_with_int(ctx, ", ", value & 65535);
+  emit(ctx, "  movk ");
+  emit(ctx, name);
+  emit(ctx, ", ");
+  emit_int(ctx, (value >> 16) & 65535);
+  emit(ctx, ", lsl 16\n");
+  emit(ctx, "  sxtw ");
+  emit(ctx, name);
+  emit(ctx, ", w");
+  emit(ctx, name + 1);
+  emit(ctx, "\n");
 }
-#endif
 
 void gen_label(codegen_ctx_t *ctx, int label) {
-  gen(ctx, ".L.%s.%d:\n", ctx->cur_func_name, label);
+  if (is_bytecode(ctx)) {
+    bc_label(ctx, label);
+    return;
+  }
+  emit_label_name(ctx, label);
+  emit(ctx, ":\n");
 }
 
 void gen_branch(codegen_ctx_t *ctx, char *op, int label) {
-  gen(ctx, "  %s .L.%s.%d\n", op, ctx->cur_func_name, label);
+  emit(ctx, "  ");
+  emit(ctx, op);
+  emit(ctx, " ");
+  emit_label_name(ctx, label);
+  emit(ctx, "\n");
 }
 
-void gen_push(codegen_ctx_t *ctx, char *reg) {
-  gen(ctx, "  str %s, [sp, -16]!\n", reg);
+void gen_jump(codegen_ctx_t *ctx, int label) {
+  if (is_bytecode(ctx)) {
+    bc_jump(ctx, OP_JUMP, label);
+  } else if (is_x86(ctx)) {
+    gen_branch(ctx, "jmp", label);
+  } else {
+    gen_branch(ctx, "b", label);
+  }
 }
 
-void gen_pop(codegen_ctx_t *ctx, char *reg) {
-  gen(ctx, "  ldr %s, [sp], 16\n", reg);
+// branches to the label if register 8 is zero
+void gen_branch_zero(codegen_ctx_t *ctx, int label) {
+  if (is_bytecode(ctx)) {
+    bc_jump(ctx, OP_JUMP_ZERO, label);
+  } else if (is_x86(ctx)) {
+    emit(ctx, "  cmpq $0, %rax\n");
+    gen_branch(ctx, "je", label);
+  } else {
+    emit(ctx, "  subs x8, x8, 0\n");
+    gen_branch(ctx, "beq", label);
+  }
 }
 
-void gen_load(codegen_ctx_t *ctx, type_t *type, pos_t *pos) {
-  gen_pop(ctx, "x8");
-  switch (type_size(type)) {
-  case 1:
-    gen(ctx, "  ldrb w8, [x8]\n");
-    gen(ctx, "  sxtb x8, w8\n");
-    break;
-  case 4:
-    gen(ctx, "  ldr w8, [x8]\n");
-    gen(ctx, "  sxtw x8, w8\n");
-    break;
-  case 8:
-    gen(ctx, "  ldr x8, [x8]\n");
-    break;
-  default:
+// branches to the label if register 8 is not zero
+void gen_branch_nonzero(codegen_ctx_t *ctx, int label) {
+  if (is_bytecode(ctx)) {
+    bc_jump(ctx, OP_JUMP_NONZERO, label);
+  } else if (is_x86(ctx)) {
+    emit(ctx, "  cmpq $0, %rax\n");
+    gen_branch(ctx, "jne", label);
+  } else {
+    emit(ctx, "  subs x8, x8, 0\n");
+    gen_branch(ctx, "bne", label);
+  }
+}
+
+// branches to the label if register 8 holds the value
+void gen_branch_equal(codegen_ctx_t *ctx, int value, int label) {
+  if (is_bytecode(ctx)) {
+    bc_jump_equal(ctx, value, label);
+  } else if (is_x86(ctx)) {
+    x86_compare(ctx, value);
+    gen_branch(ctx, "je", label);
+  } else {
+    emit_with_int(ctx, "  cmp x8, ", value);
+    gen_branch(ctx, "beq", label);
+  }
+}
+
+// branches to the label of the function's return
+void gen_return_jump(codegen_ctx_t *ctx) {
+  if (is_bytecode(ctx)) {
+    bc_jump(ctx, OP_JUMP, 0);
+    return;
+  }
+  if (is_x86(ctx)) {
+    emit(ctx, "  jmp .L.");
+  } else {
+    emit(ctx, "  b .L.");
+  }
+  emit(ctx, ctx->cur_func_name);
+  emit(ctx, ".ret\n");
+}
+
+// places the label gen_return_jump goes to
+void gen_return_label(codegen_ctx_t *ctx) {
+  if (is_bytecode(ctx)) {
+    bc_label(ctx, 0);
+    return;
+  }
+  emit(ctx, ".L.");
+  emit(ctx, ctx->cur_func_name);
+  emit(ctx, ".ret:\n");
+}
+
+// starts the current function
+void gen_func_label(codegen_ctx_t *ctx, pos_t pos) {
+  if (is_bytecode(ctx)) {
+    bc_func(ctx);
+    return;
+  }
+  emit_with_name(ctx, ".global ", ctx->cur_func_name);
+  emit(ctx, ctx->cur_func_name);
+  emit(ctx, ":\n");
+  emit_loc(ctx, pos);
+}
+
+void gen_push(codegen_ctx_t *ctx, int reg) {
+  if (is_bytecode(ctx)) {
+    bc_push(ctx, reg);
+    return;
+  }
+  if (is_x86(ctx)) {
+    x86_push(ctx, reg);
+    return;
+  }
+  emit(ctx, "  str ");
+  emit(ctx, aarch64_regs[reg]);
+  emit(ctx, ", [sp, -16]!\n");
+}
+
+void gen_pop(codegen_ctx_t *ctx, int reg) {
+  if (is_bytecode(ctx)) {
+    bc_pop(ctx, reg);
+    return;
+  }
+  if (is_x86(ctx)) {
+    x86_pop(ctx, reg);
+    return;
+  }
+  emit(ctx, "  ldr ");
+  emit(ctx, aarch64_regs[reg]);
+  emit(ctx, ", [sp], 16\n");
+}
+
+void gen_load(codegen_ctx_t *ctx, type_t *type, pos_t pos) {
+  int size = type_size(type);
+  if (size != 1 && size != 4 && size != 8) {
     error(pos, "cannot load: type=%d\n", type->kind);
   }
-  gen_push(ctx, "x8");
+
+  gen_pop(ctx, 8);
+  if (is_bytecode(ctx)) {
+    bc_load(ctx, size);
+  } else if (is_x86(ctx)) {
+    x86_load(ctx, size);
+  } else if (size == 1) {
+    emit(ctx, "  ldrb w8, [x8]\n");
+    emit(ctx, "  sxtb x8, w8\n");
+  } else if (size == 4) {
+    emit(ctx, "  ldr w8, [x8]\n");
+    emit(ctx, "  sxtw x8, w8\n");
+  } else {
+    emit(ctx, "  ldr x8, [x8]\n");
+  }
+  gen_push(ctx, 8);
 }
 
-void gen_store(codegen_ctx_t *ctx, type_t *type, pos_t *pos) {
-  gen_pop(ctx, "x8"); // dst
-  gen_pop(ctx, "x9"); // src
-  switch (type_size(type)) {
-  case 1:
-    gen(ctx, "  strb w9, [x8]\n");
-    break;
-  case 4:
-    gen(ctx, "  str w9, [x8]\n");
-    break;
-  case 8:
-    gen(ctx, "  str x9, [x8]\n");
-    break;
-  default:
+void gen_store(codegen_ctx_t *ctx, type_t *type, pos_t pos) {
+  int size = type_size(type);
+  if (size != 1 && size != 4 && size != 8) {
     error(pos, "cannot store: type=%d\n", type->kind);
   }
+
+  gen_pop(ctx, 8); // dst
+  gen_pop(ctx, 9); // src
+  if (is_bytecode(ctx)) {
+    bc_store(ctx, size);
+  } else if (is_x86(ctx)) {
+    x86_store(ctx, size);
+  } else if (size == 1) {
+    emit(ctx, "  strb w9, [x8]\n");
+  } else if (size == 4) {
+    emit(ctx, "  str w9, [x8]\n");
+  } else {
+    emit(ctx, "  str x9, [x8]\n");
+  }
+}
+
+// adds the value to register 8
+void gen_add_imm(codegen_ctx_t *ctx, int value) {
+  if (is_bytecode(ctx)) {
+    bc_add_imm(ctx, value);
+  } else if (is_x86(ctx)) {
+    x86_add_imm(ctx, value);
+  } else if (value < 0) {
+    emit_with_int(ctx, "  sub x8, x8, ", -value);
+  } else {
+    emit_with_int(ctx, "  add x8, x8, ", value);
+  }
+}
+
+void gen_frame_addr(codegen_ctx_t *ctx, int offset) {
+  if (is_bytecode(ctx)) {
+    bc_frame_addr(ctx, offset);
+  } else if (is_x86(ctx)) {
+    x86_frame_addr(ctx, offset);
+  } else {
+    emit_with_int(ctx, "  add x8, x29, ", offset);
+  }
+  gen_push(ctx, 8);
 }
 
 void gen_var_addr(codegen_ctx_t *ctx, variable_t *var) {
-  gen(ctx, "  add x8, x29, %d\n", var->offset);
-  gen_push(ctx, "x8");
+  gen_frame_addr(ctx, var->offset);
 }
 
 void gen_str_addr(codegen_ctx_t *ctx, int str_index) {
-  gen(ctx, "  adrp x8, .L.str.%d\n", str_index);
-  gen(ctx, "  add x8, x8, :lo12:.L.str.%d\n", str_index);
-  gen_push(ctx, "x8");
+  if (is_bytecode(ctx)) {
+    bc_str_addr(ctx, str_index);
+  } else if (is_x86(ctx)) {
+    x86_str_addr(ctx, str_index);
+  } else {
+    emit_with_int(ctx, "  adrp x8, .L.str.", str_index);
+    emit_with_int(ctx, "  add x8, x8, :lo12:.L.str.", str_index);
+  }
+  gen_push(ctx, 8);
 }
 
 void gen_global_addr(codegen_ctx_t *ctx, global_var_t *global) {
-  gen(ctx, "  adrp x8, %s\n", global->name);
-  gen(ctx, "  add x8, x8, :lo12:%s\n", global->name);
-  gen_push(ctx, "x8");
+  if (is_bytecode(ctx)) {
+    bc_global_addr(ctx, global);
+  } else if (is_x86(ctx)) {
+    x86_global_addr(ctx, global->name);
+  } else {
+    emit_with_name(ctx, "  adrp x8, ", global->name);
+    emit_with_name(ctx, "  add x8, x8, :lo12:", global->name);
+  }
+  gen_push(ctx, 8);
+}
+
+// Returns the type annotate_expr gave the expression. Calls to undeclared
+// functions are allowed as long as nothing needs their type.
+type_t *expr_type(codegen_ctx_t *ctx, int node) {
+  expr_t *expr = expr_at(node);
+  if (expr->value_type == NULL) {
+    error(expr->pos, "unknown function '%s'\n",
+          symbol_name(expr->value.call.name));
+  }
+  return expr->value_type;
 }
 
-type_t *infer_expr_type(codegen_ctx_t *ctx, expr_t *expr) {
+type_t *resolve_expr_type(codegen_ctx_t *ctx, int node) {
+  expr_t *expr = expr_at(node);
   switch (expr->type) {
   case EXPR_CHAR:
     return new_type(TYPE_CHAR);
@@ -375,26 +641,34 @@ type_t *infer_expr_type(codegen_ctx_t *ctx, expr_t *expr) {
   case EXPR_STRING:
     return ptr_to(new_type(TYPE_CHAR));
   case EXPR_IDENT: {
+    // the identifier is bound here, so that codegen never looks it up
+    char *name = symbol_name(expr->value.ident);
     variable_t *var = find_variable(ctx, expr->value.ident);
     if (var != NULL) {
+      expr->bind = BIND_LOCAL;
+      expr->bind_value = var->offset;
       return var->type;
     }
 
     global_var_t *global = find_global(ctx, expr->value.ident);
     if (global != NULL) {
+      expr->bind = BIND_GLOBAL;
+      expr->bound_global = global;
       return complete_type(ctx, global->type);
     }
 
     int enum_value;
     if (find_enum(ctx, expr->value.ident, &enum_value)) {
+      expr->bind = BIND_ENUM;
+      expr->bind_value = enum_value;
       return new_type(TYPE_INT);
     }
 
-    error(expr->pos, "unknown variable '%s'\n", expr->value.ident);
+    error(expr->pos, "unknown variable '%s'\n", name);
   }
   case EXPR_ADD: {
-    type_t *lhs_type = infer_expr_type(ctx, expr->value.binary.lhs);
-    type_t *rhs_type = infer_expr_type(ctx, expr->value.binary.rhs);
+    type_t *lhs_type = expr_type(ctx, expr->value.binary.lhs);
+    type_t *rhs_type = expr_type(ctx, expr->value.binary.rhs);
     if (is_integer(lhs_type) && is_integer(rhs_type)) {
       return lhs_type;
     } else if (is_ptr(lhs_type) && is_integer(rhs_type)) {
@@ -403,11 +677,11 @@ type_t *infer_expr_type(codegen_ctx_t *ctx, expr_t *expr) {
       return rhs_type;
     }
     error(expr->pos, "invalid add operation: lhs=%d, rhs=%d\n",
-          pos_to_string(expr->pos), lhs_type->kind, rhs_type->kind);
+          lhs_type->kind, rhs_type->kind);
   }
   case EXPR_SUB: {
-    type_t *lhs_type = infer_expr_type(ctx, expr->value.binary.lhs);
-    type_t *rhs_type = infer_expr_type(ctx, expr->value.binary.rhs);
+    type_t *lhs_type = expr_type(ctx, expr->value.binary.lhs);
+    type_t *rhs_type = expr_type(ctx, expr->value.binary.rhs);
     if (is_integer(lhs_type) && is_integer(rhs_type)) {
       return lhs_type;
     } else if (is_ptr(lhs_type) && is_integer(rhs_type)) {
@@ -416,7 +690,7 @@ type_t *infer_expr_type(codegen_ctx_t *ctx, expr_t *expr) {
       return new_type(TYPE_INT);
     }
     error(expr->pos, "invalid sub operation: lhs=%d, rhs=%d\n",
-          pos_to_string(expr->pos), lhs_type->kind, rhs_type->kind);
+          lhs_type->kind, rhs_type->kind);
   }
   case EXPR_MUL:
   case EXPR_DIV:
@@ -438,33 +712,31 @@ type_t *infer_expr_type(codegen_ctx_t *ctx, expr_t *expr) {
   case EXPR_LOGOR:
     return new_type(TYPE_INT); // TODO
   case EXPR_ASSIGN:
-    return infer_expr_type(ctx, expr->value.assign.dst);
+    return expr_type(ctx, expr->value.assign.dst);
   case EXPR_CALL: {
     function_t *func = find_function(ctx, expr->value.call.name);
     if (func != NULL) {
       return func->ret_type;
     }
-
-    error(expr->pos, "unknown function '%s'\n", expr->value.call.name);
+    return NULL;
   }
-
-    return new_type(TYPE_INT); // TODO
   case EXPR_REF:
-    return ptr_to(infer_expr_type(ctx, expr->value.unary));
+    return ptr_to(expr_type(ctx, expr->value.unary));
   case EXPR_DEREF: {
-    type_t *ptr_type = infer_expr_type(ctx, expr->value.unary);
+    type_t *ptr_type = expr_type(ctx, expr->value.unary);
     return type_deref(ptr_type);
   }
   case EXPR_SIZEOF:
     return new_type(TYPE_INT);
   case EXPR_MEMBER: {
-    expr_t *mexpr = expr->value.member.expr;
-    char *name = expr->value.member.name;
+    int mexpr = expr->value.member.expr;
+    int name = expr->value.member.name;
 
-    type_t *mtype = infer_expr_type(ctx, mexpr);
+    type_t *mtype = expr_type(ctx, mexpr);
     struct_member_t *member = find_member(mtype, name);
     if (member == NULL) {
-      error(expr->pos, "unknown member: type=%d, name=%s\n", mtype->kind, name);
+      error(expr->pos, "unknown member: type=%d, name=%s\n", mtype->kind,
+            symbol_name(name));
     }
 
     return complete_type(ctx, member->type);
@@ -473,413 +745,627 @@ type_t *infer_expr_type(codegen_ctx_t *ctx, expr_t *expr) {
   case EXPR_INC_POST:
   case EXPR_DEC_PRE:
   case EXPR_DEC_POST:
-    return infer_expr_type(ctx, expr->value.unary);
+    return expr_type(ctx, expr->value.unary);
   }
   error(expr->pos, "unreachable\n");
 }
 
-void gen_lvalue(codegen_ctx_t *ctx, expr_t *expr) {
-  switch (expr->type) {
-  case EXPR_IDENT: {
-    variable_t *var = find_variable(ctx, expr->value.ident);
-    if (var != NULL) {
-      gen_var_addr(ctx, var);
-      break;
+void push_work(codegen_ctx_t *ctx, int item) {
+  if (ctx->work_len == ctx->work_cap) {
+    ctx->work_cap = ctx->work_cap * 2 + 256;
+    ctx->work = realloc(ctx->work, ctx->work_cap * sizeof(int));
+  }
+  ctx->work[ctx->work_len] = item;
+  ctx->work_len++;
+}
+
+int pop_work(codegen_ctx_t *ctx) {
+  ctx->work_len--;
+  return ctx->work[ctx->work_len];
+}
+
+// Gives every expression of the tree its type, children first, so that each
+// type is resolved once and codegen only reads them. This is where the type
+// errors of expressions are reported. The tree is walked with the work stack
+// rather than recursion, since generated code can nest expressions deeper
+// than the C stack allows: a node is pushed to be visited, and a visit pushes
+// -node to resolve it after its children.
+void annotate_expr(codegen_ctx_t *ctx, int root) {
+  int mark = ctx->work_len;
+  push_work(ctx, root);
+  while (ctx->work_len > mark) {
+    int node = pop_work(ctx);
+    if (node < 0) {
+      expr_at(-node)->value_type = resolve_expr_type(ctx, -node);
+      continue;
     }
 
-    global_var_t *global = find_global(ctx, expr->value.ident);
-    if (global != NULL) {
-      gen_global_addr(ctx, global);
-      break;
+    // children are pushed last first, to be resolved in order
+    expr_t *expr = expr_at(node);
+    push_work(ctx, -node);
+    if (is_binary_expr(expr->type)) {
+      push_work(ctx, expr->value.binary.rhs);
+      push_work(ctx, expr->value.binary.lhs);
+    } else if (expr->type == EXPR_SIZEOF) {
+      if (expr->value.sizeof_.expr) {
+        push_work(ctx, expr->value.sizeof_.expr);
+      }
+    } else if (is_unary_expr(expr->type)) {
+      push_work(ctx, expr->value.unary);
+    } else if (expr->type == EXPR_ASSIGN) {
+      push_work(ctx, expr->value.assign.dst);
+      push_work(ctx, expr->value.assign.src);
+    } else if (expr->type == EXPR_CALL) {
+      int args = expr->value.call.args;
+      int i = list_len(args) - 1;
+      while (i >= 0) {
+        push_work(ctx, list_at(args, i));
+        i--;
+      }
+    } else if (expr->type == EXPR_MEMBER) {
+      push_work(ctx, expr->value.member.expr);
     }
+  }
+}
 
-    error(expr->pos, "unknown variable '%s'\n", expr->value.ident);
-    break;
+// multiplies the register by the size of what a pointer points to
+void gen_scale(codegen_ctx_t *ctx, int reg, int size) {
+  if (is_bytecode(ctx)) {
+    bc_scale(ctx, reg, size);
+    return;
   }
-  case EXPR_DEREF:
-    gen_expr(ctx, expr->value.unary);
-    break;
-  case EXPR_MEMBER: {
-    expr_t *mexpr = expr->value.member.expr;
-    char *name = expr->value.member.name;
+  if (is_x86(ctx)) {
+    x86_scale(ctx, reg, size);
+    return;
+  }
+  gen_mov(ctx, 10, size);
+  emit(ctx, "  mul ");
+  emit(ctx, aarch64_regs[reg]);
+  emit(ctx, ", ");
+  emit(ctx, aarch64_regs[reg]);
+  emit(ctx, ", x10\n");
+}
 
-    type_t *mtype = infer_expr_type(ctx, mexpr);
-    struct_member_t *member = find_member(mtype, name);
-    if (member == NULL) {
-      error(expr->pos, "unknown member: type=%d, name=%s\n", mtype->kind, name);
-    }
+// divides register 8, the distance between two pointers, by the size of
+// what they point to
+void gen_div_size(codegen_ctx_t *ctx, int size) {
+  if (is_bytecode(ctx)) {
+    bc_div_size(ctx, size);
+    return;
+  }
+  if (is_x86(ctx)) {
+    x86_div_size(ctx, size);
+    return;
+  }
+  gen_mov(ctx, 9, size);
+  emit(ctx, "  udiv x8, x8, x9\n");
+}
 
-    gen_lvalue(ctx, mexpr);
-    gen_pop(ctx, "x8");
-    gen(ctx, "  add x8, x8, %d\n", member->offset);
-    gen_push(ctx, "x8");
-    break;
+void gen_cset(codegen_ctx_t *ctx, char *cond) {
+  emit(ctx, "  subs x8, x8, x9\n");
+  emit_with_name(ctx, "  cset x8, ", cond);
+}
+
+// applies the operator to registers 8 and 9, leaving the result in 8
+void gen_binary_op(codegen_ctx_t *ctx, exprtype_t type, pos_t pos) {
+  if (is_bytecode(ctx)) {
+    bc_binary_op(ctx, type);
+    return;
+  }
+  if (is_x86(ctx)) {
+    x86_binary_op(ctx, type, pos);
+    return;
   }
+
+  switch (type) {
+  case EXPR_ADD:
+    emit(ctx, "  add x8, x8, x9\n");
+    break;
+  case EXPR_SUB:
+    emit(ctx, "  sub x8, x8, x9\n");
+    break;
+  case EXPR_MUL:
+    emit(ctx, "  mul x8, x8, x9\n");
+    break;
+  case EXPR_DIV:
+    emit(ctx, "  sdiv x8, x8, x9\n");
+    break;
+  case EXPR_REM:
+    emit(ctx, "  sdiv x2, x8, x9\n");
+    emit(ctx, "  msub x8, x9, x2, x8\n");
+    break;
+  case EXPR_LT:
+    gen_cset(ctx, "lt");
+    break;
+  case EXPR_LE:
+    gen_cset(ctx, "le");
+    break;
+  case EXPR_GT:
+    gen_cset(ctx, "gt");
+    break;
+  case EXPR_GE:
+    gen_cset(ctx, "ge");
+    break;
+  case EXPR_EQ:
+    gen_cset(ctx, "eq");
+    break;
+  case EXPR_NE:
+    gen_cset(ctx, "ne");
+    break;
+  case EXPR_AND:
+    emit(ctx, "  and x8, x8, x9\n");
+    break;
+  case EXPR_OR:
+    emit(ctx, "  orr x8, x8, x9\n");
+    break;
+  case EXPR_XOR:
+    emit(ctx, "  eor x8, x8, x9\n");
+    break;
+  case EXPR_SHL:
+    emit(ctx, "  lsl x8, x8, x9\n");
+    break;
+  case EXPR_SHR:
+    emit(ctx, "  asr x8, x8, x9\n");
+    break;
   default:
+    error(pos, "unreachab le: expr=%d\n", type);
+  }
+}
+
+// applies ~ (EXPR_NOT) or ! (EXPR_NEG) to register 8
+void gen_unary_op(codegen_ctx_t *ctx, exprtype_t type) {
+  if (is_bytecode(ctx)) {
+    bc_unary_op(ctx, type);
+  } else if (is_x86(ctx)) {
+    x86_unary_op(ctx, type);
+  } else if (type == EXPR_NOT) {
+    emit(ctx, "  mvn x8, x8\n");
+  } else {
+    emit(ctx, "  subs x8, x8, 0\n");
+    emit(ctx, "  cset x8, eq\n");
+  }
+}
+
+// calls the function with the arguments on the stack, the last on top, and
+// pushes what it returns, of the type if it is known
+void gen_call(codegen_ctx_t *ctx, char *name, int arg_len, type_t *type) {
+  if (is_bytecode(ctx)) {
+    bc_call(ctx, name, arg_len, type);
+    return;
+  }
+  if (is_x86(ctx)) {
+    x86_call(ctx, name, arg_len, type);
+    return;
+  }
+
+  int i = arg_len - 1;
+  while (i >= 0) {
+    gen_pop(ctx, i);
+    i--;
+  }
+  emit_with_name(ctx, "  bl ", name);
+  gen_push(ctx, 0);
+}
+
+// pushes the value of the parameter
+void gen_param(codegen_ctx_t *ctx, int index) {
+  if (is_x86(ctx)) {
+    x86_param(ctx, index);
+  } else {
+    gen_push(ctx, index);
+  }
+}
+
+void gen_prologue(codegen_ctx_t *ctx) {
+  if (is_bytecode(ctx)) {
+    bc_prologue(ctx);
+    return;
+  }
+  if (is_x86(ctx)) {
+    x86_prologue(ctx);
+    return;
+  }
+  emit(ctx, "  stp x29, x30, [sp, -0x100]!\n"); // TODO
+  emit(ctx, "  mov x29, sp\n");
+}
+
+// returns the value on top of the stack
+void gen_epilogue(codegen_ctx_t *ctx) {
+  if (is_bytecode(ctx)) {
+    bc_epilogue(ctx);
+    return;
+  }
+  if (is_x86(ctx)) {
+    x86_epilogue(ctx);
+    return;
+  }
+  gen_pop(ctx, 0);
+  emit(ctx, "  mov sp, x29\n");
+  emit(ctx, "  ldp x29, x30, [sp], 0x100\n");
+  emit(ctx, "  ret\n");
+}
+
+// pushes the address of a variable
+void gen_lvalue(codegen_ctx_t *ctx, int node) {
+  expr_t *expr = expr_at(node);
+  if (expr->type != EXPR_IDENT) {
     error(expr->pos, "cannot generate lvalue: expr=%d\n", expr->type);
   }
+  if (expr->bind == BIND_LOCAL) {
+    gen_frame_addr(ctx, expr->bind_value);
+  } else if (expr->bind == BIND_GLOBAL) {
+    gen_global_addr(ctx, expr->bound_global);
+  } else {
+    error(expr->pos, "unknown variable '%s'\n", symbol_name(expr->value.ident));
+  }
 }
 
-void gen_special_expr(codegen_ctx_t *ctx, expr_t *expr) {
+// returns the offset of the member the expression names in its struct
+int member_offset(codegen_ctx_t *ctx, int node) {
+  expr_t *expr = expr_at(node);
+  int mexpr = expr->value.member.expr;
+  int name = expr->value.member.name;
+
+  type_t *mtype = expr_type(ctx, mexpr);
+  struct_member_t *member = find_member(mtype, name);
+  if (member == NULL) {
+    error(expr->pos, "unknown member: type=%d, name=%s\n", mtype->kind,
+          symbol_name(name));
+  }
+  return member->offset;
+}
+
+void gen_special_expr(codegen_ctx_t *ctx, int node) {
+  expr_t *expr = expr_at(node);
   switch (expr->type) {
   case EXPR_CHAR:
-    gen(ctx, "  mov x8, %d\n", expr->value.char_);
-    gen_push(ctx, "x8");
+    gen_mov(ctx, 8, expr->value.char_);
+    gen_push(ctx, 8);
     break;
   case EXPR_NUMBER:
-    gen(ctx, "  mov x8, %d\n", expr->value.number);
-    gen_push(ctx, "x8");
+    gen_mov(ctx, 8, expr->value.number);
+    gen_push(ctx, 8);
     break;
   case EXPR_STRING: {
-    int str_index = add_string(ctx, expr->value.string);
+    int str_index = add_string(ctx, symbol_name(expr->value.string));
     gen_str_addr(ctx, str_index);
     break;
   }
-  case EXPR_IDENT: {
-    variable_t *var = find_variable(ctx, expr->value.ident);
-    if (var != NULL) {
-      gen_var_addr(ctx, var);
-      if (var->type->kind != TYPE_ARRAY) {
-        gen_load(ctx, var->type, expr->pos);
+  case EXPR_IDENT:
+    switch (expr->bind) {
+    case BIND_LOCAL:
+      gen_frame_addr(ctx, expr->bind_value);
+      if (expr->value_type->kind != TYPE_ARRAY) {
+        gen_load(ctx, expr->value_type, expr->pos);
       }
       break;
-    }
-
-    global_var_t *global = find_global(ctx, expr->value.ident);
-    if (global != NULL) {
+    case BIND_GLOBAL: {
+      global_var_t *global = expr->bound_global;
       gen_global_addr(ctx, global);
       if (global->type->kind != TYPE_ARRAY) {
         gen_load(ctx, global->type, expr->pos);
       }
       break;
     }
-
-    int enum_value;
-    if (find_enum(ctx, expr->value.ident, &enum_value)) {
-      gen(ctx, "  mov x8, %d\n", enum_value);
-      gen_push(ctx, "x8");
+    case BIND_ENUM:
+      gen_mov(ctx, 8, expr->bind_value);
+      gen_push(ctx, 8);
       break;
+    default:
+      error(expr->pos, "unknown variable '%s'\n",
+            symbol_name(expr->value.ident));
     }
-
-    error(expr->pos, "unknown variable '%s'\n", expr->value.ident);
     break;
+  default:
+    error(expr->pos, "unreachable: expr=%d\n", expr->type);
   }
-  case EXPR_ASSIGN:
-    gen_expr(ctx, expr->value.assign.src);
-    gen_lvalue(ctx, expr->value.assign.dst);
-    gen_store(ctx, infer_expr_type(ctx, expr), expr->pos);
-    gen_push(ctx, "x8"); // FIXME
-    break;
-  case EXPR_CALL: {
-    int i = 0;
-    argument_t *cur_arg = expr->value.call.args;
-    while (cur_arg) {
-      if (i > 7) {
-        error(expr->pos, "cannot use > 7 arguments\n");
-      }
-
-      gen_expr(ctx, cur_arg->value);
-
-      cur_arg = cur_arg->next;
-      i++;
-    }
+}
 
-    int j = 0;
-    while (j < i) {
-      gen_pop(ctx, arg_regs[i - j - 1]);
-      j++;
-    }
+void gen_sizeof(codegen_ctx_t *ctx, int node) {
+  expr_t *expr = expr_at(node);
+  type_t *type = type_at(expr->value.sizeof_.type);
+  if (!type) {
+    type = expr_type(ctx, expr->value.sizeof_.expr);
+  }
+  type = complete_type(ctx, type);
+  gen_mov(ctx, 8, type_size(type));
+  gen_push(ctx, 8);
+}
 
-    gen(ctx, "  bl %s\n", expr->value.ident);
-    gen_push(ctx, "x0");
-    break;
+// Turns the value of the operand of ++ or -- on the stack into the value of
+// the expression, with the value to store above it.
+void gen_inc_dec(codegen_ctx_t *ctx, int node) {
+  exprtype_t type = expr_at(node)->type;
+  int is_post = type == EXPR_INC_POST || type == EXPR_DEC_POST;
+  gen_pop(ctx, 8);
+  if (is_post) {
+    gen_push(ctx, 8); // dup
   }
-  case EXPR_MEMBER:
-    gen_lvalue(ctx, expr);
-    gen_load(ctx, infer_expr_type(ctx, expr), expr->pos);
-    break;
-  default:
-    error(expr->pos, "unreachable: expr=%d\n", expr->type);
+  if (type == EXPR_INC_PRE || type == EXPR_INC_POST) {
+    gen_add_imm(ctx, 1); // TODO
+  } else {
+    gen_add_imm(ctx, -1); // TODO
+  }
+  gen_push(ctx, 8);
+  if (!is_post) {
+    gen_push(ctx, 8);
   }
 }
 
-void gen_unary_expr(codegen_ctx_t *ctx, expr_t *expr) {
-  switch (expr->type) {
-  case EXPR_REF:
-    gen_lvalue(ctx, expr->value.unary);
-    break;
-  case EXPR_DEREF:
-    gen_expr(ctx, expr->value.unary);
-    gen_load(ctx, infer_expr_type(ctx, expr), expr->pos);
-    break;
-  case EXPR_SIZEOF: {
-    type_t *type = expr->value.sizeof_.type;
-    if (!type) {
-      type = infer_expr_type(ctx, expr->value.sizeof_.expr);
-    }
-    type = complete_type(ctx, type);
-    gen(ctx, "  mov x8, %d\n", type_size(type));
-    gen_push(ctx, "x8");
-    break;
-  }
-  case EXPR_NOT:
-    gen_expr(ctx, expr->value.unary);
-    gen_pop(ctx, "x8");
-    gen(ctx, "  mvn x8, x8\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_NEG:
-    gen_expr(ctx, expr->value.unary);
-    gen_pop(ctx, "x8");
-    gen(ctx, "  subs x8, x8, 0\n");
-    gen(ctx, "  cset x8, eq\n");
-    gen_push(ctx, "x8"); // dup
-    break;
-  case EXPR_INC_PRE:
-    gen_expr(ctx, expr->value.unary);
-    gen_pop(ctx, "x8");
-    gen(ctx, "  add x8, x8, 1\n"); // TODO
-    gen_push(ctx, "x8");           // dup
-    gen_push(ctx, "x8");
-
-    gen_lvalue(ctx, expr->value.unary);
-    gen_store(ctx, infer_expr_type(ctx, expr), expr->pos);
-    break;
-  case EXPR_INC_POST:
-    gen_expr(ctx, expr->value.unary);
-    gen_pop(ctx, "x8");
-    gen_push(ctx, "x8");
-    gen(ctx, "  add x8, x8, 1\n"); // TODO
-    gen_push(ctx, "x8");
-
-    gen_lvalue(ctx, expr->value.unary);
-    gen_store(ctx, infer_expr_type(ctx, expr), expr->pos);
-    break;
-  case EXPR_DEC_PRE:
-    gen_expr(ctx, expr->value.unary);
-    gen_pop(ctx, "x8");
-    gen(ctx, "  sub x8, x8, 1\n"); // TODO
-    gen_push(ctx, "x8");
-    gen_push(ctx, "x8");
-
-    gen_lvalue(ctx, expr->value.unary);
-    gen_store(ctx, infer_expr_type(ctx, expr), expr->pos);
-    break;
-  case EXPR_DEC_POST:
-    gen_expr(ctx, expr->value.unary);
-    gen_pop(ctx, "x8");
-    gen_push(ctx, "x8");           // dup
-    gen(ctx, "  sub x8, x8, 1\n"); // TODO
-    gen_push(ctx, "x8");
-
-    gen_lvalue(ctx, expr->value.unary);
-    gen_store(ctx, infer_expr_type(ctx, expr), expr->pos);
-    break;
-  default:
-    error(expr->pos, "unreachable: expr=%d\n", expr->type);
+// stores the value under the address on top of the stack
+void gen_assign_rest(codegen_ctx_t *ctx, int node) {
+  expr_t *expr = expr_at(node);
+  gen_store(ctx, expr_type(ctx, node), expr->pos);
+  if (expr->type == EXPR_ASSIGN) {
+    gen_push(ctx, 8); // FIXME
   }
 }
 
-void gen_binary_expr(codegen_ctx_t *ctx, expr_t *expr) {
-  switch (expr->type) {
-  case EXPR_LOGAND: {
-    int skip_label = next_label(ctx);
-    gen_expr(ctx, expr->value.binary.lhs);
-    gen_pop(ctx, "x8");
-    gen_push(ctx, "x8"); // dup
-    gen(ctx, "  subs x8, x8, 0\n");
-    gen_branch(ctx, "beq", skip_label);
-    gen_expr(ctx, expr->value.binary.rhs);
-    gen_label(ctx, skip_label);
+// generates the operator of a unary expression whose operand is on the
+// stack
+void gen_unary_rest(codegen_ctx_t *ctx, int node) {
+  expr_t *expr = expr_at(node);
+  if (expr->type == EXPR_DEREF) {
+    gen_load(ctx, expr_type(ctx, node), expr->pos);
     return;
   }
-  case EXPR_LOGOR: {
-    int skip_label = next_label(ctx);
-    gen_expr(ctx, expr->value.binary.lhs);
-    gen_pop(ctx, "x8");
-    gen_push(ctx, "x8"); // dup
-    gen(ctx, "  subs x8, x8, 0\n");
-    gen_branch(ctx, "bne", skip_label);
-    gen_expr(ctx, expr->value.binary.rhs);
+  gen_pop(ctx, 8);
+  gen_unary_op(ctx, expr->type);
+  gen_push(ctx, 8);
+}
+
+// branches past the right operand of && and || whose left operand is on the
+// stack
+void gen_logical_skip(codegen_ctx_t *ctx, int node, int skip_label) {
+  gen_pop(ctx, 8);
+  gen_push(ctx, 8); // dup
+  if (expr_at(node)->type == EXPR_LOGAND) {
+    gen_branch_zero(ctx, skip_label);
+  } else {
+    gen_branch_nonzero(ctx, skip_label);
+  }
+}
+
+// generates the operator of a binary expression whose operands are on the
+// stack
+void gen_binary_rest(codegen_ctx_t *ctx, int node, int skip_label) {
+  expr_t *expr = expr_at(node);
+  if (expr->type == EXPR_LOGAND || expr->type == EXPR_LOGOR) {
     gen_label(ctx, skip_label);
     return;
   }
-  default:
-    break;
-  }
 
-  gen_expr(ctx, expr->value.binary.lhs);
-  gen_expr(ctx, expr->value.binary.rhs);
-  gen_pop(ctx, "x9");
-  gen_pop(ctx, "x8");
+  gen_pop(ctx, 9);
+  gen_pop(ctx, 8);
 
   switch (expr->type) {
   case EXPR_ADD: {
-    type_t *lhs_type = infer_expr_type(ctx, expr->value.binary.lhs);
-    type_t *rhs_type = infer_expr_type(ctx, expr->value.binary.rhs);
-    if (is_integer(lhs_type) && is_integer(rhs_type)) {
-      // do nothing
-    } else if (is_ptr(lhs_type) && is_integer(rhs_type)) {
-      gen(ctx, "  mov x10, %d\n", type_size(type_deref(lhs_type)));
-      gen(ctx, "  mul x9, x9, x10\n");
+    type_t *lhs_type = expr_type(ctx, expr->value.binary.lhs);
+    type_t *rhs_type = expr_type(ctx, expr->value.binary.rhs);
+    if (is_ptr(lhs_type) && is_integer(rhs_type)) {
+      gen_scale(ctx, 9, type_size(type_deref(lhs_type)));
     } else if (is_integer(lhs_type) && is_ptr(rhs_type)) {
-      gen(ctx, "  mov x10, %d\n", type_size(type_deref(rhs_type)));
-      gen(ctx, "  mul x8, x8, x10\n");
-    } else {
-      error(expr->pos, "invalid add operation: lhs=%d, rhs=%d\n",
-            lhs_type->kind, rhs_type->kind);
+      gen_scale(ctx, 8, type_size(type_deref(rhs_type)));
     }
-    gen(ctx, "  add x8, x8, x9\n");
-    gen_push(ctx, "x8");
+    gen_binary_op(ctx, EXPR_ADD, expr->pos);
     break;
   }
   case EXPR_SUB: {
-    type_t *lhs_type = infer_expr_type(ctx, expr->value.binary.lhs);
-    type_t *rhs_type = infer_expr_type(ctx, expr->value.binary.rhs);
+    type_t *lhs_type = expr_type(ctx, expr->value.binary.lhs);
+    type_t *rhs_type = expr_type(ctx, expr->value.binary.rhs);
     if (is_integer(lhs_type) && is_integer(rhs_type)) {
-      gen(ctx, "  sub x8, x8, x9\n");
+      gen_binary_op(ctx, EXPR_SUB, expr->pos);
     } else if (is_ptr(lhs_type) && is_integer(rhs_type)) {
-      gen(ctx, "  mov x10, %d\n", type_size(type_deref(lhs_type)));
-      gen(ctx, "  mul x9, x9, x10\n");
-      gen(ctx, "  sub x8, x8, x9\n");
+      gen_scale(ctx, 9, type_size(type_deref(lhs_type)));
+      gen_binary_op(ctx, EXPR_SUB, expr->pos);
     } else if (is_ptr(lhs_type) && is_ptr(rhs_type)) {
-      gen(ctx, "  sub x8, x8, x9\n");
-      gen(ctx, "  mov x9, %d\n", type_size(type_deref(lhs_type)));
-      gen(ctx, "  udiv x8, x8, x9\n");
-    } else {
-      error(expr->pos, "invalid a dd operation: lhs=%d, rhs=%d\n",
-            lhs_type->kind, rhs_type->kind);
+      gen_binary_op(ctx, EXPR_SUB, expr->pos);
+      gen_div_size(ctx, type_size(type_deref(lhs_type)));
     }
-    gen_push(ctx, "x8");
     break;
   }
-  case EXPR_MUL:
-    gen(ctx, "  mul x8, x8, x9\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_DIV:
-    gen(ctx, "  sdiv x8, x8, x9\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_REM:
-    gen(ctx, "  sdiv x2, x8, x9\n");
-    gen(ctx, "  msub x8, x9, x2, x8\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_LT:
-    gen(ctx, "  subs x8, x8, x9\n");
-    gen(ctx, "  cset x8, lt\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_LE:
-    gen(ctx, "  subs x8, x8, x9\n");
-    gen(ctx, "  cset x8, le\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_GT:
-    gen(ctx, "  subs x8, x8, x9\n");
-    gen(ctx, "  cset x8, gt\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_GE:
-    gen(ctx, "  subs x8, x8, x9\n");
-    gen(ctx, "  cset x8, ge\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_EQ:
-    gen(ctx, "  subs x8, x8, x9\n");
-    gen(ctx, "  cset x8, eq\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_NE:
-    gen(ctx, "  subs x8, x8, x9\n");
-    gen(ctx, "  cset x8, ne\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_AND:
-    gen(ctx, "  and x8, x8, x9\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_OR:
-    gen(ctx, "  orr x8, x8, x9\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_XOR:
-    gen(ctx, "  eor x8, x8, x9\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_SHL:
-    gen(ctx, "  lsl x8, x8, x9\n");
-    gen_push(ctx, "x8");
-    break;
-  case EXPR_SHR:
-    gen(ctx, "  asr x8, x8, x9\n");
-    gen_push(ctx, "x8");
-    break;
   default:
-    error(expr->pos, "unreachab le: expr=%d\n", expr->type);
+    gen_binary_op(ctx, expr->type, expr->pos);
   }
+  gen_push(ctx, 8);
+}
+
+int is_chained_unary(exprtype_t type) {
+  return type == EXPR_DEREF || type == EXPR_NOT || type == EXPR_NEG;
 }
 
-void gen_expr(codegen_ctx_t *ctx, expr_t *expr) {
-  if (is_unary_expr(expr->type)) {
-    gen_unary_expr(ctx, expr);
-  } else if (is_binary_expr(expr->type)) {
-    gen_binary_expr(ctx, expr);
+// what is left to do for a node on the work stack of gen_expr
+typedef enum {
+  GEN_OPERANDS,
+  GEN_RHS,
+  GEN_OPERATOR,
+  GEN_ADDRESS,  // pushes the address of the node rather than its value
+  GEN_MEMBER,   // adds the offset of a member to the address on the stack
+  GEN_LOAD,     // loads a member from the address on the stack
+  GEN_ARGUMENT, // goes on with the argument at the index, or makes the call
+  GEN_INC_DEC,
+  GEN_STORE,
+} gen_step_t;
+
+void push_gen(codegen_ctx_t *ctx, int node, int value, gen_step_t step) {
+  push_work(ctx, node);
+  push_work(ctx, value);
+  push_work(ctx, step);
+}
+
+// pushes what it takes to push the value of the node
+void visit_operands(codegen_ctx_t *ctx, int node) {
+  expr_t *expr = expr_at(node);
+  if (is_binary_expr(expr->type)) {
+    // the skip label is taken when the node is first visited, so that labels
+    // are taken outermost first down a chain of && or ||
+    int skip_label = 0;
+    if (expr->type == EXPR_LOGAND || expr->type == EXPR_LOGOR) {
+      skip_label = next_label(ctx);
+    }
+    push_gen(ctx, node, skip_label, GEN_RHS);
+    push_gen(ctx, expr->value.binary.lhs, 0, GEN_OPERANDS);
+  } else if (is_chained_unary(expr->type)) {
+    push_gen(ctx, node, 0, GEN_OPERATOR);
+    push_gen(ctx, expr->value.unary, 0, GEN_OPERANDS);
+  } else if (expr->type == EXPR_REF) {
+    push_gen(ctx, expr->value.unary, 0, GEN_ADDRESS);
+  } else if (expr->type == EXPR_SIZEOF) {
+    gen_sizeof(ctx, node);
+  } else if (is_unary_expr(expr->type)) {
+    push_gen(ctx, node, 0, GEN_INC_DEC);
+    push_gen(ctx, expr->value.unary, 0, GEN_OPERANDS);
+  } else if (expr->type == EXPR_ASSIGN) {
+    push_gen(ctx, node, 0, GEN_STORE);
+    push_gen(ctx, expr->value.assign.dst, 0, GEN_ADDRESS);
+    push_gen(ctx, expr->value.assign.src, 0, GEN_OPERANDS);
+  } else if (expr->type == EXPR_CALL) {
+    push_gen(ctx, node, 0, GEN_ARGUMENT);
+  } else if (expr->type == EXPR_MEMBER) {
+    push_gen(ctx, node, 0, GEN_LOAD);
+    push_gen(ctx, node, 0, GEN_ADDRESS);
   } else {
-    gen_special_expr(ctx, expr);
+    gen_special_expr(ctx, node);
+  }
+}
+
+// pushes what it takes to push the address of the node
+void visit_address(codegen_ctx_t *ctx, int node) {
+  expr_t *expr = expr_at(node);
+  if (expr->type == EXPR_DEREF) {
+    push_gen(ctx, expr->value.unary, 0, GEN_OPERANDS);
+  } else if (expr->type == EXPR_MEMBER) {
+    push_gen(ctx, node, member_offset(ctx, node), GEN_MEMBER);
+    push_gen(ctx, expr->value.member.expr, 0, GEN_ADDRESS);
+  } else {
+    gen_lvalue(ctx, node);
+  }
+}
+
+// generates the argument at the index, or the call once there are no more
+void gen_argument(codegen_ctx_t *ctx, int node, int i) {
+  expr_t *expr = expr_at(node);
+  int args = expr->value.call.args;
+  if (i == list_len(args)) {
+    gen_call(ctx, symbol_name(expr->value.call.name), i, expr->value_type);
+    return;
+  }
+  if (i > 7) {
+    error(expr->pos, "cannot use > 7 arguments\n");
+  }
+  push_gen(ctx, node, i + 1, GEN_ARGUMENT);
+  push_gen(ctx, list_at(args, i), 0, GEN_OPERANDS);
+}
+
+// Expressions nest in operands, arguments and addresses as deep as the source
+// does, so they are walked with the work stack rather than by recursion, as
+// triples of a node, a value and the step left to do. The value is the skip
+// label of && and ||, the offset of a member or the index of an argument.
+void gen_expr(codegen_ctx_t *ctx, int root) {
+  int mark = ctx->work_len;
+  push_gen(ctx, root, 0, GEN_OPERANDS);
+  while (ctx->work_len > mark) {
+    gen_step_t step = pop_work(ctx);
+    int value = pop_work(ctx);
+    int node = pop_work(ctx);
+    expr_t *expr = expr_at(node);
+
+    if (step == GEN_OPERANDS) {
+      visit_operands(ctx, node);
+    } else if (step == GEN_RHS) {
+      if (value) {
+        gen_logical_skip(ctx, node, value);
+      }
+      push_gen(ctx, node, value, GEN_OPERATOR);
+      push_gen(ctx, expr->value.binary.rhs, 0, GEN_OPERANDS);
+    } else if (step == GEN_OPERATOR) {
+      if (is_binary_expr(expr->type)) {
+        gen_binary_rest(ctx, node, value);
+      } else {
+        gen_unary_rest(ctx, node);
+      }
+    } else if (step == GEN_ADDRESS) {
+      visit_address(ctx, node);
+    } else if (step == GEN_MEMBER) {
+      gen_pop(ctx, 8);
+      gen_add_imm(ctx, value);
+      gen_push(ctx, 8);
+    } else if (step == GEN_LOAD) {
+      gen_load(ctx, expr_type(ctx, node), expr->pos);
+    } else if (step == GEN_ARGUMENT) {
+      gen_argument(ctx, node, value);
+    } else if (step == GEN_INC_DEC) {
+      gen_inc_dec(ctx, node);
+      push_gen(ctx, node, 0, GEN_STORE);
+      push_gen(ctx, expr->value.unary, 0, GEN_ADDRESS);
+    } else {
+      gen_assign_rest(ctx, node);
+    }
   }
 }
 
-void gen_stmt_list(codegen_ctx_t *ctx, stmt_list_t *list) {
-  while (list) {
-    gen_stmt(ctx, list->stmt);
-    list = list->next;
+// generates an expression that is not part of another one
+void gen_full_expr(codegen_ctx_t *ctx, int node) {
+  annotate_expr(ctx, node);
+  gen_expr(ctx, node);
+}
+
+void gen_stmt_list(codegen_ctx_t *ctx, int list) {
+  int i = 0;
+  while (i < list_len(list)) {
+    gen_stmt(ctx, list_at(list, i));
+    i++;
   }
 }
 
-void gen_stmt(codegen_ctx_t *ctx, stmt_t *stmt) {
-  gen(ctx, ".loc 1 %d %d\n", stmt->pos->line, stmt->pos->column);
+// what is left to do for a statement on the work stack of gen_stmt
+typedef enum {
+  GEN_STMT,
+  GEN_NEXT,      // goes on with the statement of a block at the index
+  GEN_ELSE,      // ends the then branch of an if with the labels of its else
+  GEN_END_IF,    // places the label at the end of an if
+  GEN_END_WHILE,
+  GEN_END_FOR,   // ends the body of a for with the label of its condition
+} gen_stmt_step_t;
+
+void push_stmt_gen(codegen_ctx_t *ctx, int node, int label, int label2,
+                   gen_stmt_step_t step) {
+  push_work(ctx, node);
+  push_work(ctx, label);
+  push_work(ctx, label2);
+  push_work(ctx, step);
+}
+
+// Generates the statement up to the statements in it, which are pushed to the
+// work stack to be generated after it, followed by what ends it.
+void visit_stmt(codegen_ctx_t *ctx, int node) {
+  stmt_t *stmt = stmt_at(node);
+  emit_loc(ctx, stmt->pos);
   switch (stmt->type) {
   case STMT_EXPR:
-    gen_expr(ctx, stmt->value.expr);
-    gen_pop(ctx, "x8"); // pop expr value
+    gen_full_expr(ctx, stmt->value.expr);
+    gen_pop(ctx, 8); // pop expr value
     break;
   case STMT_RETURN:
     if (stmt->value.ret) {
-      gen_expr(ctx, stmt->value.ret);
+      gen_full_expr(ctx, stmt->value.ret);
     } else {
-      gen_push(ctx, "x8"); // push dummy value
+      gen_push(ctx, 8); // push dummy value
     }
-    gen(ctx, "  b .L.%s.ret\n", ctx->cur_func_name);
+    gen_return_jump(ctx);
     break;
   case STMT_IF: {
     int else_label = next_label(ctx);
     if (stmt->value.if_.else_) {
       int merge_label = next_label(ctx);
-      gen_expr(ctx, stmt->value.if_.cond);
-      gen_pop(ctx, "x8");
-      gen(ctx, "  subs x8, x8, 0\n");
-      gen_branch(ctx, "beq", else_label);
-
-      gen_stmt(ctx, stmt->value.if_.then_);
-      gen_branch(ctx, "b", merge_label);
-
-      gen_label(ctx, else_label);
-      gen_stmt(ctx, stmt->value.if_.else_);
-
-      gen_label(ctx, merge_label);
+      push_stmt_gen(ctx, node, else_label, merge_label, GEN_ELSE);
     } else {
-      gen_expr(ctx, stmt->value.if_.cond);
-      gen_pop(ctx, "x8");
-      gen(ctx, "  subs x8, x8, 0\n");
-      gen_branch(ctx, "beq", else_label);
-
-      gen_stmt(ctx, stmt->value.if_.then_);
-
-      gen_label(ctx, else_label);
+      push_stmt_gen(ctx, node, else_label, 0, GEN_END_IF);
     }
-
+    gen_full_expr(ctx, stmt->value.if_.cond);
+    gen_pop(ctx, 8);
+    gen_branch_zero(ctx, else_label);
+    push_stmt_gen(ctx, stmt->value.if_.then_, 0, 0, GEN_STMT);
     break;
   }
   case STMT_WHILE: {
@@ -888,16 +1374,12 @@ void gen_stmt(codegen_ctx_t *ctx, stmt_t *stmt) {
     push_loop(ctx, end_label, cond_label);
 
     gen_label(ctx, cond_label);
-    gen_expr(ctx, stmt->value.while_.cond);
-    gen_pop(ctx, "x8");
-    gen(ctx, "  subs x8, x8, 0\n");
-    gen_branch(ctx, "beq", end_label);
+    gen_full_expr(ctx, stmt->value.while_.cond);
+    gen_pop(ctx, 8);
+    gen_branch_zero(ctx, end_label);
 
-    gen_stmt(ctx, stmt->value.while_.body);
-    gen_branch(ctx, "b", cond_label);
-
-    gen_label(ctx, end_label);
-    pop_loop(ctx);
+    push_stmt_gen(ctx, node, 0, 0, GEN_END_WHILE);
+    push_stmt_gen(ctx, stmt->value.while_.body, 0, 0, GEN_STMT);
     break;
   }
   case STMT_FOR: {
@@ -912,79 +1394,70 @@ void gen_stmt(codegen_ctx_t *ctx, stmt_t *stmt) {
 
     gen_label(ctx, cond_label);
     if (stmt->value.for_.cond) {
-      gen_expr(ctx, stmt->value.for_.cond);
-      gen_pop(ctx, "x8");
-      gen(ctx, "  subs x8, x8, 0\n");
-      gen_branch(ctx, "beq", end_label);
+      gen_full_expr(ctx, stmt->value.for_.cond);
+      gen_pop(ctx, 8);
+      gen_branch_zero(ctx, end_label);
     }
 
-    gen_stmt(ctx, stmt->value.for_.body);
-
-    gen_label(ctx, loop_label);
-    if (stmt->value.for_.loop) {
-      gen_expr(ctx, stmt->value.for_.loop);
-    }
-    gen_branch(ctx, "b", cond_label);
-
-    gen_label(ctx, end_label);
-    pop_loop(ctx);
+    push_stmt_gen(ctx, node, cond_label, 0, GEN_END_FOR);
+    push_stmt_gen(ctx, stmt->value.for_.body, 0, 0, GEN_STMT);
     break;
   }
   case STMT_BLOCK:
     push_scope(ctx);
-    gen_stmt_list(ctx, stmt->value.block);
-    pop_scope(ctx);
+    push_stmt_gen(ctx, stmt->value.block, 0, 0, GEN_NEXT);
     break;
   case STMT_DEFINE: {
-    char *name = stmt->value.define.name;
+    int name = stmt->value.define.name;
     if (is_variable_already_defined(ctx, name)) {
-      error(stmt->pos, "variable '%s' already defined\n", name);
+      error(stmt->pos, "variable '%s' already defined\n", symbol_name(name));
     }
-    type_t *type = stmt->value.define.type;
+    type_t *type = type_at(stmt->value.define.type);
     type = complete_type(ctx, type);
     variable_t *var = add_variable(ctx, type, name);
     if (stmt->value.define.value) {
-      gen_expr(ctx, stmt->value.define.value);
+      gen_full_expr(ctx, stmt->value.define.value);
       gen_var_addr(ctx, var);
       gen_store(ctx, var->type, stmt->pos);
     }
     break;
   }
   case STMT_BREAK:
-    gen_branch(ctx, "b", cur_loop(ctx)->break_label);
+    gen_jump(ctx, cur_loop(ctx)->break_label);
     break;
   case STMT_CONTINUE:
-    gen_branch(ctx, "b", cur_loop(ctx)->continue_label);
+    gen_jump(ctx, cur_loop(ctx)->continue_label);
     break;
   case STMT_SWITCH: {
     int merge_label = next_label(ctx);
     push_loop(ctx, merge_label, -1);
 
-    gen_expr(ctx, stmt->value.switch_.value);
-    gen_pop(ctx, "x8");
-    stmt_case_t *cur_case = stmt->value.switch_.cases;
-    while (cur_case) {
+    gen_full_expr(ctx, stmt->value.switch_.value);
+    gen_pop(ctx, 8);
+    int cases = stmt->value.switch_.cases;
+    int i = 0;
+    while (i < list_len(cases)) {
+      stmt_case_t *cur_case = case_at(list_at(cases, i));
       cur_case->label = next_label(ctx);
       int value = eval_const_expr(ctx, cur_case->value);
-      gen(ctx, "  cmp x8, %d\n", value);
-      gen_branch(ctx, "beq", cur_case->label);
-
-      cur_case = cur_case->next;
+      gen_branch_equal(ctx, value, cur_case->label);
+      i++;
     }
 
-    stmt_case_t *default_case = stmt->value.switch_.default_case;
-    if (default_case) {
+    stmt_case_t *default_case = NULL;
+    if (stmt->value.switch_.default_case) {
+      default_case = case_at(stmt->value.switch_.default_case);
       default_case->label = next_label(ctx);
-      gen_branch(ctx, "b", default_case->label);
+      gen_jump(ctx, default_case->label);
     }
-    gen_branch(ctx, "b", merge_label);
+    gen_jump(ctx, merge_label);
 
-    cur_case = stmt->value.switch_.cases;
-    while (cur_case) {
+    i = 0;
+    while (i < list_len(cases)) {
+      stmt_case_t *cur_case = case_at(list_at(cases, i));
       gen_label(ctx, cur_case->label);
       gen_stmt_list(ctx, cur_case->body);
-
-      cur_case = cur_case->next;
+      i++;
     }
 
     if (default_case) {
@@ -999,22 +1472,66 @@ void gen_stmt(codegen_ctx_t *ctx, stmt_t *stmt) {
   }
 }
 
-void gen_func_parameter(codegen_ctx_t *ctx, parameter_t *params, pos_t *pos) {
+// Statements nest in blocks and in the bodies of if, while and for as deep as
+// the source does, so they are walked with the work stack rather than by
+// recursion, as quadruples of a node, two labels and the step left to do. The
+// node of GEN_NEXT is the list of a block. The labels of a loop are those of
+// the innermost one again when its body ends.
+void gen_stmt(codegen_ctx_t *ctx, int root) {
+  int mark = ctx->work_len;
+  push_stmt_gen(ctx, root, 0, 0, GEN_STMT);
+  while (ctx->work_len > mark) {
+    gen_stmt_step_t step = pop_work(ctx);
+    int label2 = pop_work(ctx);
+    int label = pop_work(ctx);
+    int node = pop_work(ctx);
+
+    if (step == GEN_STMT) {
+      visit_stmt(ctx, node);
+    } else if (step == GEN_NEXT) {
+      if (label == list_len(node)) {
+        pop_scope(ctx);
+      } else {
+        push_stmt_gen(ctx, node, label + 1, 0, GEN_NEXT);
+        push_stmt_gen(ctx, list_at(node, label), 0, 0, GEN_STMT);
+      }
+    } else if (step == GEN_ELSE) {
+      gen_jump(ctx, label2);
+      gen_label(ctx, label);
+      push_stmt_gen(ctx, node, label2, 0, GEN_END_IF);
+      push_stmt_gen(ctx, stmt_at(node)->value.if_.else_, 0, 0, GEN_STMT);
+    } else if (step == GEN_END_IF) {
+      gen_label(ctx, label);
+    } else if (step == GEN_END_WHILE) {
+      gen_jump(ctx, cur_loop(ctx)->continue_label);
+      gen_label(ctx, cur_loop(ctx)->break_label);
+      pop_loop(ctx);
+    } else {
+      gen_label(ctx, cur_loop(ctx)->continue_label);
+      if (stmt_at(node)->value.for_.loop) {
+        gen_full_expr(ctx, stmt_at(node)->value.for_.loop);
+      }
+      gen_jump(ctx, label);
+      gen_label(ctx, cur_loop(ctx)->break_label);
+      pop_loop(ctx);
+    }
+  }
+}
+
+void gen_func_parameter(codegen_ctx_t *ctx, int params, pos_t pos) {
   int i = 0;
-  while (params) {
+  while (i < list_len(params)) {
     if (i > 7) {
       error(pos, "cannot use > 7 arguments\n");
     }
 
-    type_t *type = params->type;
-    type = complete_type(ctx, type);
+    parameter_t *param = param_at(list_at(params, i));
+    type_t *type = complete_type(ctx, param->type);
 
-    variable_t *var = add_variable(ctx, type, params->name);
-    gen_push(ctx, arg_regs[i]);
+    variable_t *var = add_variable(ctx, type, intern_symbol(param->name));
+    gen_param(ctx, i);
     gen_var_addr(ctx, var);
     gen_store(ctx, var->type, pos);
-
-    params = params->next;
     i++;
   }
 }
@@ -1027,7 +1544,10 @@ void gen_global_stmt(codegen_ctx_t *ctx, global_stmt_t *gstmt) {
     add_function(ctx, ret_type, gstmt->value.func.name);
     break;
   }
-  case GSTMT_FUNC:
+  case GSTMT_FUNC: {
+    // scopes, variables, loops and inferred types die with the function, so
+    // they go to an arena that is reset after it
+    arena_t *prev_arena = swap_node_arena(ctx->func_arena);
     init_ctx(ctx, gstmt->value.func.name);
     push_scope(ctx);
 
@@ -1035,35 +1555,32 @@ void gen_global_stmt(codegen_ctx_t *ctx, global_stmt_t *gstmt) {
     ret_type = complete_type(ctx, ret_type);
     add_function(ctx, ret_type, gstmt->value.func.name);
 
-    gen(ctx, ".global %s\n", ctx->cur_func_name);
-    gen(ctx, "%s:\n", ctx->cur_func_name);
-    gen(ctx, ".loc 1 %d %d\n", gstmt->pos->line, gstmt->pos->column);
-    gen(ctx, "  stp x29, x30, [sp, -0x100]!\n"); // TODO
-    gen(ctx, "  mov x29, sp\n");
+    gen_func_label(ctx, gstmt->pos);
+    gen_prologue(ctx);
 
     gen_func_parameter(ctx, gstmt->value.func.params, gstmt->pos);
     gen_stmt(ctx, gstmt->value.func.body);
 
-    gen(ctx, ".L.%s.ret:\n", ctx->cur_func_name);
-    gen_pop(ctx, "x0");
-    gen(ctx, "  mov sp, x29\n");
-    gen(ctx, "  ldp x29, x30, [sp], 0x100\n");
-    gen(ctx, "  ret\n");
+    gen_return_label(ctx);
+    gen_epilogue(ctx);
 
     pop_scope(ctx);
+    swap_node_arena(prev_arena);
+    reset_arena(ctx->func_arena);
     break;
+  }
   case GSTMT_STRUCT:
   case GSTMT_UNION:
     add_type(ctx, gstmt->value.type);
     break;
   case GSTMT_ENUM:
     add_type(ctx, gstmt->value.type);
-    append_enums(ctx, gstmt->value.type->value.enum_.enums);
+    add_enums(ctx, gstmt->value.type->value.enum_.enums);
     break;
   case GSTMT_TYPEDEF:
     if (gstmt->value.type->kind == TYPE_ENUM) {
       add_type(ctx, gstmt->value.type);
-      append_enums(ctx, gstmt->value.type->value.enum_.enums);
+      add_enums(ctx, gstmt->value.type->value.enum_.enums);
     }
     break;
   case GSTMT_DEFINE:
@@ -1072,10 +1589,7 @@ void gen_global_stmt(codegen_ctx_t *ctx, global_stmt_t *gstmt) {
   }
 }
 
-void gen_text(codegen_ctx_t *ctx, global_stmt_t *gstmt) {
-  gen(ctx, ".text\n");
-  gen(ctx, ".file 1 \"%s\"\n", ctx->in_filepath);
-
+void gen_global_stmts(codegen_ctx_t *ctx, global_stmt_t *gstmt) {
   global_stmt_t *cur = gstmt;
   while (cur) {
     gen_global_stmt(ctx, cur);
@@ -1083,40 +1597,58 @@ void gen_text(codegen_ctx_t *ctx, global_stmt_t *gstmt) {
   }
 }
 
+void gen_text(codegen_ctx_t *ctx, global_stmt_t *gstmt) {
+  if (is_bytecode(ctx)) {
+    gen_global_stmts(ctx, gstmt);
+    return;
+  }
+
+  emit(ctx, ".text\n");
+  emit(ctx, ".file 1 \"");
+  emit(ctx, ctx->in_filepath);
+  emit(ctx, "\"\n");
+
+  // the main file is always file 1, the files it includes follow
+  int file = 2;
+  while (file <= source_file_count()) {
+    emit(ctx, ".file ");
+    emit_int(ctx, file);
+    emit(ctx, " \"");
+    emit(ctx, source_file_name(file));
+    emit(ctx, "\"\n");
+    file++;
+  }
+
+  gen_global_stmts(ctx, gstmt);
+}
+
 void gen_string(codegen_ctx_t *ctx, char *string) {
-  gen(ctx, "  .string \"");
+  emit(ctx, "  .string \"");
 
   char *p = string;
-  char buf[2];
-  buf[1] = 0;
-
   while (*p) {
     switch (*p) {
     case '\n':
-      gen(ctx, "\\n");
+      emit(ctx, "\\n");
       break;
     case '\\':
-      gen(ctx, "\\\\");
+      emit(ctx, "\\\\");
       break;
     case '\'':
-      gen(ctx, "\\'");
+      emit(ctx, "\\'");
       break;
     case '\"':
-      gen(ctx, "\\\"");
-      break;
-    case '%':
-      gen(ctx, "%%");
+      emit(ctx, "\\\"");
       break;
     default:
-      buf[0] = *p;
-      gen(ctx, buf);
+      put_char(ctx->out, *p);
       break;
     }
 
     p++;
   }
 
-  gen(ctx, "\\0\"\n");
+  emit(ctx, "\\0\"\n");
 }
 
 void gen_strings(codegen_ctx_t *ctx) {
@@ -1124,7 +1656,9 @@ void gen_strings(codegen_ctx_t *ctx) {
   int str_index = ctx->cur_string;
 
   while (cur) {
-    gen(ctx, ".L.str.%d:\n", str_index);
+    emit(ctx, ".L.str.");
+    emit_int(ctx, str_index);
+    emit(ctx, ":\n");
     gen_string(ctx, cur->string);
 
     cur = cur->next;
@@ -1135,31 +1669,54 @@ void gen_strings(codegen_ctx_t *ctx) {
 void gen_globals(codegen_ctx_t *ctx) {
   global_var_t *cur = ctx->globals;
   while (cur) {
-    if (cur->type->is_extern) {
+    if (cur->is_extern) {
       cur = cur->next;
       continue;
     }
 
     int size = type_size(cur->type);
-    gen(ctx, ".global %s\n", cur->name);
-    gen(ctx, "%s:\n", cur->name);
-    gen(ctx, "  .zero %d\n", size);
+    emit_with_name(ctx, ".global ", cur->name);
+    emit(ctx, cur->name);
+    emit(ctx, ":\n");
+    emit_with_int(ctx, "  .zero ", size);
 
     cur = cur->next;
   }
 }
 
 void gen_data(codegen_ctx_t *ctx) {
-  gen(ctx, ".data\n");
+  emit(ctx, ".data\n");
 
   gen_strings(ctx);
   gen_globals(ctx);
 }
 
-void gen_code(program_t *program, char *in_filepath, FILE *out_fp) {
-  codegen_ctx_t *ctx = new_codegen_ctx(in_filepath, out_fp, program->globals);
+int gen_code(program_t *program, char *in_filepath, writer_t *out,
+             target_t target) {
+  codegen_ctx_t *ctx = new_codegen_ctx(in_filepath, out, program->globals);
+  ctx->target = target;
+  add_globals(ctx, program->globals);
+  mark_defined_functions(ctx, program->body);
 
-  init_arg_regs();
+  init_regs();
   gen_text(ctx, program->body);
   gen_data(ctx);
+  // the GNU linker makes the stack of x86-64 code without this executable
+  if (is_x86(ctx)) {
+    emit(ctx, ".section .note.GNU-stack,\"\",@progbits\n");
+  }
+  flush_writer(ctx->out);
+  return writer_size(ctx->out);
+}
+
+bytecode_t *gen_bytecode(program_t *program, char *in_filepath) {
+  codegen_ctx_t *ctx = new_codegen_ctx(in_filepath, NULL, program->globals);
+  ctx->target = TARGET_BYTECODE;
+  ctx->bytecode = new_bytecode();
+  add_globals(ctx, program->globals);
+
+  init_regs();
+  gen_text(ctx, program->body);
+  bc_finish(ctx);
+  return ctx->bytecode;
 }
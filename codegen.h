@@ -1,24 +1,49 @@
 #pragma once
+#include "arena.h"
 #include "parser.h"
 #include "type.h"
+#include "writer.h"
 #include <stdio.h>
 
+// the instruction sets code can be generated for, and the bytecode of
+// ccc --run
+typedef enum {
+  TARGET_AARCH64,
+  TARGET_X86_64,
+  TARGET_BYTECODE,
+} target_t;
+
+typedef struct _bytecode_t bytecode_t;
+
+typedef struct _var_scope_t var_scope_t;
+
 typedef struct _variable_t variable_t;
 struct _variable_t {
   type_t *type;
-  char *name;
+  int symbol;
   int offset;
+  var_scope_t *scope;
 
-  variable_t *next;
+  // the variable of the same name in an enclosing scope
+  variable_t *shadowed;
 };
 
-typedef struct _function_t function_t;
-struct _function_t {
+typedef struct {
   type_t *ret_type;
   char *name;
+} function_t;
 
-  function_t *next;
-};
+// What a name means at file scope. A name can be a function, a global and an
+// enum constant at once, and lookups decide which one counts. Struct, union
+// and enum tags are a namespace of their own. is_defined is set for the
+// functions the translation unit defines before any code is generated.
+typedef struct {
+  function_t *function;
+  int is_defined;
+  global_var_t *global;
+  enum_t *enum_;
+  type_t *tag;
+} file_name_t;
 
 typedef struct _string_t string_t;
 struct _string_t {
@@ -34,45 +59,67 @@ struct _loop_t {
   loop_t *next;
 };
 
-typedef struct _defined_type_t defined_type_t;
-struct _defined_type_t {
-  type_t *type;
-
-  defined_type_t *next;
-};
-
-typedef struct _var_scope_t var_scope_t;
+// A scope remembers how long the undo log was when it was entered; leaving
+// it undoes the variables added since.
 struct _var_scope_t {
-  variable_t *variables;
+  int undo_mark;
 
   var_scope_t *parent;
 };
 
-typedef struct _type_scope_t type_scope_t;
-struct _type_scope_t {
-  defined_type_t *types;
-
-  type_scope_t *parent;
-};
-
 typedef struct {
   char *in_filepath;
-  FILE *out_fp;
+  writer_t *out;
+  target_t target;
+  // where the code goes instead of out for TARGET_BYTECODE
+  bytecode_t *bytecode;
 
   var_scope_t *var_scopes;
-  type_scope_t *type_scopes;
 
-  function_t *functions;
+  // Indexed by symbol, the innermost variable of that name in scope. Every
+  // variable added is also pushed to the undo log, so that leaving a scope
+  // puts back the variables it shadowed.
+  variable_t **var_table;
+  int var_table_cap;
+  variable_t **undo_log;
+  int undo_len;
+  int undo_cap;
+
   string_t *strings;
   loop_t *loops;
-  enum_t *enums;
   global_var_t *globals;
 
+  // the file scope names, indexed by symbol
+  file_name_t *file_names;
+  int file_name_cap;
+
   char *cur_func_name;
+  arena_t *func_arena;
+
+  // pending nodes of the walks over expressions that avoid recursion
+  int *work;
+  int work_len;
+  int work_cap;
 
   int cur_offset;
   int cur_label;
   int cur_string;
 } codegen_ctx_t;
 
-void gen_code(program_t *program, char *in_filepath, FILE *out_fp);
+// Writes the assembly for the program to out, in the syntax of the GNU
+// assembler for the target, and returns the number of bytes written.
+int gen_code(program_t *program, char *in_filepath, writer_t *out,
+             target_t target);
+
+// Generates the program as bytecode, for the interpreter.
+bytecode_t *gen_bytecode(program_t *program, char *in_filepath);
+
+// the emitters of codegen.c, for the backends
+void emit(codegen_ctx_t *ctx, char *str);
+void emit_int(codegen_ctx_t *ctx, int n);
+void emit_with_int(codegen_ctx_t *ctx, char *head, int n);
+void emit_with_name(codegen_ctx_t *ctx, char *head, char *name);
+
+// whether the translation unit defines the function, as opposed to the C
+// library
+int is_defined_function(codegen_ctx_t *ctx, char *name);
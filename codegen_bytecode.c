@@ -0,0 +1,287 @@
+#include "codegen_bytecode.h"
+#include "error.h"
+#include "intern.h"
+#include "type.h"
+#include <stdlib.h>
+#include <string.h>
+
+bytecode_t *new_bytecode() {
+  bytecode_t *bc = calloc(1, sizeof(bytecode_t));
+  bc->cap = 4096;
+  bc->code = malloc(bc->cap * sizeof(int));
+  bc->last_op = -1;
+
+  // a return to 0 ends the program
+  bc->code[0] = OP_HALT;
+  bc->len = 1;
+  return bc;
+}
+
+// Returns the table indexed by symbol, grown to hold the symbol, with the new
+// entries 0.
+int *grow_symbol_table(int *table, int *cap, int symbol) {
+  if (symbol < *cap) {
+    return table;
+  }
+  int new_cap = *cap * 2 + 1024;
+  while (new_cap <= symbol) {
+    new_cap *= 2;
+  }
+  table = realloc(table, new_cap * sizeof(int));
+  memset(table + *cap, 0, (new_cap - *cap) * sizeof(int));
+  *cap = new_cap;
+  return table;
+}
+
+void put_code(bytecode_t *bc, int word) {
+  if (bc->len == bc->cap) {
+    bc->cap *= 2;
+    bc->code = realloc(bc->code, bc->cap * sizeof(int));
+  }
+  bc->code[bc->len] = word;
+  bc->len++;
+}
+
+void put_op(codegen_ctx_t *ctx, opcode_t op) {
+  ctx->bytecode->last_op = ctx->bytecode->len;
+  put_code(ctx->bytecode, op);
+}
+
+void put_op_with(codegen_ctx_t *ctx, opcode_t op, int operand) {
+  put_op(ctx, op);
+  put_code(ctx->bytecode, operand);
+}
+
+void bc_label(codegen_ctx_t *ctx, int label) {
+  bytecode_t *bc = ctx->bytecode;
+  if (label >= bc->label_cap) {
+    bc->label_cap = bc->label_cap * 2 + 256;
+    while (bc->label_cap <= label) {
+      bc->label_cap *= 2;
+    }
+    bc->labels = realloc(bc->labels, bc->label_cap * sizeof(int));
+  }
+  bc->labels[label] = bc->len;
+  bc->last_label = bc->len;
+}
+
+// puts an operand that is the label, until the function ends
+void put_label(codegen_ctx_t *ctx, int label) {
+  bytecode_t *bc = ctx->bytecode;
+  if (bc->fixup_len + 2 > bc->fixup_cap) {
+    bc->fixup_cap = bc->fixup_cap * 2 + 256;
+    bc->fixups = realloc(bc->fixups, bc->fixup_cap * sizeof(int));
+  }
+  bc->fixups[bc->fixup_len] = bc->len;
+  bc->fixups[bc->fixup_len + 1] = label;
+  bc->fixup_len += 2;
+  put_code(bc, 0);
+}
+
+void bc_jump(codegen_ctx_t *ctx, opcode_t op, int label) {
+  put_op(ctx, op);
+  put_label(ctx, label);
+}
+
+void bc_jump_equal(codegen_ctx_t *ctx, int value, int label) {
+  put_op_with(ctx, OP_JUMP_EQUAL, value);
+  put_label(ctx, label);
+}
+
+void bc_mov(codegen_ctx_t *ctx, int reg, int value) {
+  put_op_with(ctx, OP_MOV, reg);
+  put_code(ctx->bytecode, value);
+}
+
+void bc_push(codegen_ctx_t *ctx, int reg) { put_op_with(ctx, OP_PUSH, reg); }
+
+// A value pushed and popped right away is moved between the registers
+// instead, which is most of the pushes of the stack machine.
+void bc_pop(codegen_ctx_t *ctx, int reg) {
+  bytecode_t *bc = ctx->bytecode;
+  if (bc->last_op >= 0 && bc->code[bc->last_op] == OP_PUSH &&
+      bc->last_label <= bc->last_op) {
+    int src = bc->code[bc->last_op + 1];
+    bc->len = bc->last_op;
+    bc->last_op = -1;
+    if (src != reg) {
+      put_op_with(ctx, OP_COPY, reg);
+      put_code(bc, src);
+    }
+    return;
+  }
+  put_op_with(ctx, OP_POP, reg);
+}
+
+void bc_load(codegen_ctx_t *ctx, int size) {
+  if (size == 1) {
+    put_op(ctx, OP_LOAD1);
+  } else if (size == 4) {
+    put_op(ctx, OP_LOAD4);
+  } else {
+    put_op(ctx, OP_LOAD8);
+  }
+}
+
+void bc_store(codegen_ctx_t *ctx, int size) {
+  if (size == 1) {
+    put_op(ctx, OP_STORE1);
+  } else if (size == 4) {
+    put_op(ctx, OP_STORE4);
+  } else {
+    put_op(ctx, OP_STORE8);
+  }
+}
+
+void bc_add_imm(codegen_ctx_t *ctx, int value) {
+  put_op_with(ctx, OP_ADD_IMM, value);
+}
+
+void bc_frame_addr(codegen_ctx_t *ctx, int offset) {
+  put_op_with(ctx, OP_FRAME, offset);
+}
+
+void bc_str_addr(codegen_ctx_t *ctx, int str_index) {
+  put_op_with(ctx, OP_STRING, str_index);
+}
+
+// globals get a slot when they are first used
+void bc_global_addr(codegen_ctx_t *ctx, global_var_t *global) {
+  bytecode_t *bc = ctx->bytecode;
+  int symbol = intern_symbol(global->name);
+  bc->global_of = grow_symbol_table(bc->global_of, &bc->global_cap, symbol);
+  if (bc->global_of[symbol] == 0) {
+    int len = bc->global_len + 1;
+    bc->global_names = realloc(bc->global_names, len * sizeof(char *));
+    bc->global_sizes = realloc(bc->global_sizes, len * sizeof(int));
+    bc->global_externs = realloc(bc->global_externs, len * sizeof(int));
+    bc->global_names[bc->global_len] = global->name;
+    bc->global_sizes[bc->global_len] = type_size(global->type);
+    bc->global_externs[bc->global_len] = global->is_extern;
+    bc->global_len = len;
+    bc->global_of[symbol] = len;
+  }
+  put_op_with(ctx, OP_GLOBAL, bc->global_of[symbol] - 1);
+}
+
+void bc_scale(codegen_ctx_t *ctx, int reg, int size) {
+  put_op_with(ctx, OP_SCALE, reg);
+  put_code(ctx->bytecode, size);
+}
+
+void bc_div_size(codegen_ctx_t *ctx, int size) {
+  put_op_with(ctx, OP_DIV_SIZE, size);
+}
+
+void bc_binary_op(codegen_ctx_t *ctx, exprtype_t type) {
+  put_op(ctx, OP_ADD + (type - EXPR_ADD));
+}
+
+void bc_unary_op(codegen_ctx_t *ctx, exprtype_t type) {
+  if (type == EXPR_NOT) {
+    put_op(ctx, OP_NOT);
+  } else {
+    put_op(ctx, OP_LOGNOT);
+  }
+}
+
+// The call is to a native until the function turns out to be defined, and
+// it takes the return kind along.
+void bc_call(codegen_ctx_t *ctx, char *name, int arg_len, type_t *type) {
+  bytecode_t *bc = ctx->bytecode;
+  int ret_kind = RET_WORD;
+  if (type && (type->kind == TYPE_INT || type->kind == TYPE_ENUM)) {
+    ret_kind = RET_INT;
+  } else if (type && type->kind == TYPE_CHAR) {
+    ret_kind = RET_CHAR;
+  }
+
+  if (bc->call_len == bc->call_cap) {
+    bc->call_cap = bc->call_cap * 2 + 256;
+    bc->calls = realloc(bc->calls, bc->call_cap * sizeof(int));
+  }
+  put_op(ctx, OP_CALL_NATIVE);
+  bc->calls[bc->call_len] = bc->len;
+  bc->call_len++;
+  put_code(bc, intern_symbol(name));
+  put_code(bc, arg_len);
+  put_code(bc, ret_kind);
+  bc_push(ctx, 0);
+}
+
+void bc_func(codegen_ctx_t *ctx) {
+  bytecode_t *bc = ctx->bytecode;
+  int symbol = intern_symbol(ctx->cur_func_name);
+  bc->entries = grow_symbol_table(bc->entries, &bc->entry_cap, symbol);
+  bc->entries[symbol] = bc->len;
+  bc->fixup_len = 0;
+}
+
+void bc_prologue(codegen_ctx_t *ctx) {
+  put_op(ctx, OP_ENTER);
+  ctx->bytecode->enter = ctx->bytecode->len;
+  put_code(ctx->bytecode, 0);
+}
+
+// The frame size and the labels of the function are known at its end.
+void bc_epilogue(codegen_ctx_t *ctx) {
+  bytecode_t *bc = ctx->bytecode;
+  int frame_size = align_to(ctx->cur_offset, 16);
+  bc_pop(ctx, 0);
+  put_op_with(ctx, OP_LEAVE, frame_size);
+  bc->code[bc->enter] = frame_size;
+
+  int i = 0;
+  while (i < bc->fixup_len) {
+    bc->code[bc->fixups[i]] = bc->labels[bc->fixups[i + 1]];
+    i += 2;
+  }
+}
+
+// numbers the natives by the symbol of their name
+int native_index(bytecode_t *bc, int symbol) {
+  bc->native_of = grow_symbol_table(bc->native_of, &bc->native_cap, symbol);
+  if (bc->native_of[symbol] == 0) {
+    bc->native_len++;
+    bc->natives = realloc(bc->natives, bc->native_len * sizeof(char *));
+    bc->natives[bc->native_len - 1] = symbol_name(symbol);
+    bc->native_of[symbol] = bc->native_len;
+  }
+  return bc->native_of[symbol] - 1;
+}
+
+int find_entry(bytecode_t *bc, int symbol) {
+  if (symbol >= bc->entry_cap) {
+    return 0;
+  }
+  return bc->entries[symbol];
+}
+
+void bc_finish(codegen_ctx_t *ctx) {
+  bytecode_t *bc = ctx->bytecode;
+  int i = 0;
+  while (i < bc->call_len) {
+    int operand = bc->calls[i];
+    int symbol = bc->code[operand];
+    int entry = find_entry(bc, symbol);
+    if (entry) {
+      bc->code[operand - 1] = OP_CALL;
+      bc->code[operand] = entry;
+    } else {
+      bc->code[operand] = native_index(bc, symbol);
+    }
+    i++;
+  }
+
+  // the list runs from the latest string back
+  bc->strings = calloc(ctx->cur_string + 1, sizeof(char *));
+  string_t *cur = ctx->strings;
+  int str_index = ctx->cur_string;
+  while (cur) {
+    bc->strings[str_index] = cur->string;
+    cur = cur->next;
+    str_index--;
+  }
+
+  bc->main = find_entry(bc, intern_symbol("main"));
+}
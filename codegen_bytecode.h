@@ -0,0 +1,174 @@
+#pragma once
+#include "codegen.h"
+
+// The bytecode ccc --run executes: the code of the stack machine codegen.c
+// generates, with the registers numbered the same way. An instruction is an
+// opcode followed by its operands, all ints, and jumps go to the index of an
+// instruction. Values are 8 bytes, and loads sign extend as on AArch64.
+typedef enum {
+  OP_HALT,
+  OP_MOV,  // reg, value: loads the value, sign extended
+  OP_COPY, // dst reg, src reg
+  OP_PUSH, // reg
+  OP_POP,  // reg
+
+  // register 8 becomes what it points to, or register 9 is stored there
+  OP_LOAD1,
+  OP_LOAD4,
+  OP_LOAD8,
+  OP_STORE1,
+  OP_STORE4,
+  OP_STORE8,
+
+  // register 8 becomes an address, or has a value added
+  OP_ADD_IMM, // value
+  OP_FRAME,   // offset in the frame
+  OP_STRING,  // index of the string
+  OP_GLOBAL,  // slot of the global
+  OP_SCALE,   // reg, size: multiplies the register
+  OP_DIV_SIZE, // size: divides register 8, unsigned
+
+  // register 8 becomes 8 op 9, in the order of exprtype_t
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_REM,
+  OP_LT,
+  OP_LE,
+  OP_GT,
+  OP_GE,
+  OP_EQ,
+  OP_NE,
+  OP_AND,
+  OP_OR,
+  OP_XOR,
+  OP_SHL,
+  OP_SHR,
+  OP_NOT,
+  OP_LOGNOT,
+
+  OP_JUMP,         // target
+  OP_JUMP_ZERO,    // target: if register 8 is zero
+  OP_JUMP_NONZERO, // target
+  OP_JUMP_EQUAL,   // value, target: if register 8 holds the value
+
+  // The arguments are popped into registers 0 up, and what the function
+  // returns is left in register 0. Only the value a native returns needs
+  // the return kind, but both calls take it so that one can be patched into
+  // the other.
+  OP_CALL,        // target, number of arguments, return kind
+  OP_CALL_NATIVE, // native, number of arguments, return kind
+
+  // A frame holds the caller's frame and return address, then the locals.
+  OP_ENTER, // frame size
+  OP_LEAVE, // frame size: returns register 0
+} opcode_t;
+
+// how the value a C library function returns is extended to 8 bytes
+typedef enum {
+  RET_WORD,
+  RET_INT,
+  RET_CHAR,
+} ret_kind_t;
+
+struct _bytecode_t {
+  int *code;
+  int len;
+  int cap;
+
+  // Where the last instruction and the last label are. A push right before
+  // a pop cancels out, unless a jump lands in between.
+  int last_op;
+  int last_label;
+
+  // The labels of the function being generated, by number, where 0 is the
+  // return, and the operands that jump to them as pairs of operand and
+  // label. The operand of OP_ENTER gets the frame size at the end.
+  int *labels;
+  int label_cap;
+  int *fixups;
+  int fixup_len;
+  int fixup_cap;
+  int enter;
+
+  // The entry of every function defined and the natives called, by the
+  // symbol of the name, with 0 for none. The operands of OP_CALL hold the
+  // symbol of the function until bc_finish.
+  int *entries;
+  int entry_cap;
+  int *calls;
+  int call_len;
+  int call_cap;
+  int *native_of;
+  int native_cap;
+
+  // the C library functions called, which the interpreter looks up
+  char **natives;
+  int native_len;
+
+  // The globals used, by slot, which the interpreter allocates. Extern ones
+  // are looked up as well.
+  int *global_of;
+  int global_cap;
+  char **global_names;
+  int *global_sizes;
+  int *global_externs;
+  int global_len;
+
+  // the strings, by the index codegen gives them
+  char **strings;
+
+  int main;
+};
+
+bytecode_t *new_bytecode();
+
+void bc_label(codegen_ctx_t *ctx, int label);
+
+void bc_jump(codegen_ctx_t *ctx, opcode_t op, int label);
+
+void bc_jump_equal(codegen_ctx_t *ctx, int value, int label);
+
+void bc_mov(codegen_ctx_t *ctx, int reg, int value);
+
+void bc_push(codegen_ctx_t *ctx, int reg);
+
+void bc_pop(codegen_ctx_t *ctx, int reg);
+
+void bc_load(codegen_ctx_t *ctx, int size);
+
+void bc_store(codegen_ctx_t *ctx, int size);
+
+void bc_add_imm(codegen_ctx_t *ctx, int value);
+
+void bc_frame_addr(codegen_ctx_t *ctx, int offset);
+
+void bc_str_addr(codegen_ctx_t *ctx, int str_index);
+
+void bc_global_addr(codegen_ctx_t *ctx, global_var_t *global);
+
+void bc_scale(codegen_ctx_t *ctx, int reg, int size);
+
+void bc_div_size(codegen_ctx_t *ctx, int size);
+
+void bc_binary_op(codegen_ctx_t *ctx, exprtype_t type);
+
+void bc_unary_op(codegen_ctx_t *ctx, exprtype_t type);
+
+void bc_call(codegen_ctx_t *ctx, char *name, int arg_len, type_t *type);
+
+// starts the current function
+void bc_func(codegen_ctx_t *ctx);
+
+void bc_prologue(codegen_ctx_t *ctx);
+
+void bc_epilogue(codegen_ctx_t *ctx);
+
+// Points the calls at the functions defined, or at natives, and takes the
+// strings, once the whole program is generated.
+void bc_finish(codegen_ctx_t *ctx);
+
+// Runs main of the program with the arguments and returns what it returns.
+// Implemented in interp.c, or interp_portable.c when ccc compiles itself.
+int run_bytecode(bytecode_t *bc, int argc, char **argv);
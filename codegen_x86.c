@@ -0,0 +1,261 @@
+#include "codegen_x86.h"
+#include "error.h"
+#include "type.h"
+
+char *x86_regs[11];
+
+void init_x86_regs() {
+  x86_regs[0] = "%rdi";
+  x86_regs[1] = "%rsi";
+  x86_regs[2] = "%rdx";
+  x86_regs[3] = "%rcx";
+  x86_regs[4] = "%r8";
+  x86_regs[5] = "%r9";
+  x86_regs[8] = "%rax";
+  x86_regs[9] = "%r11";
+  x86_regs[10] = "%r10";
+}
+
+void x86_mov(codegen_ctx_t *ctx, int reg, int value) {
+  emit(ctx, "  movq $");
+  emit_int(ctx, value);
+  emit_with_name(ctx, ", ", x86_regs[reg]);
+}
+
+// The stack is kept in slots of 16 bytes as on AArch64, so that it is
+// aligned at every call without counting what is pushed.
+void x86_push(codegen_ctx_t *ctx, int reg) {
+  emit(ctx, "  subq $16, %rsp\n");
+  emit(ctx, "  movq ");
+  emit(ctx, x86_regs[reg]);
+  emit(ctx, ", (%rsp)\n");
+}
+
+void x86_pop(codegen_ctx_t *ctx, int reg) {
+  emit_with_name(ctx, "  movq (%rsp), ", x86_regs[reg]);
+  emit(ctx, "  addq $16, %rsp\n");
+}
+
+void x86_load(codegen_ctx_t *ctx, int size) {
+  if (size == 1) {
+    emit(ctx, "  movsbq (%rax), %rax\n");
+  } else if (size == 4) {
+    emit(ctx, "  movslq (%rax), %rax\n");
+  } else {
+    emit(ctx, "  movq (%rax), %rax\n");
+  }
+}
+
+void x86_store(codegen_ctx_t *ctx, int size) {
+  if (size == 1) {
+    emit(ctx, "  movb %r11b, (%rax)\n");
+  } else if (size == 4) {
+    emit(ctx, "  movl %r11d, (%rax)\n");
+  } else {
+    emit(ctx, "  movq %r11, (%rax)\n");
+  }
+}
+
+void x86_add_imm(codegen_ctx_t *ctx, int value) {
+  emit(ctx, "  addq $");
+  emit_int(ctx, value);
+  emit(ctx, ", %rax\n");
+}
+
+void x86_compare(codegen_ctx_t *ctx, int value) {
+  emit(ctx, "  cmpq $");
+  emit_int(ctx, value);
+  emit(ctx, ", %rax\n");
+}
+
+// writes the name of the symbol the size of the frame is set to
+void x86_frame_size(codegen_ctx_t *ctx) {
+  emit(ctx, ".L.");
+  emit(ctx, ctx->cur_func_name);
+  emit(ctx, ".frame");
+}
+
+void x86_frame_addr(codegen_ctx_t *ctx, int offset) {
+  emit(ctx, "  leaq ");
+  emit_int(ctx, offset);
+  emit(ctx, "-");
+  x86_frame_size(ctx);
+  emit(ctx, "(%rbp), %rax\n");
+}
+
+void x86_str_addr(codegen_ctx_t *ctx, int str_index) {
+  emit(ctx, "  leaq .L.str.");
+  emit_int(ctx, str_index);
+  emit(ctx, "(%rip), %rax\n");
+}
+
+void x86_global_addr(codegen_ctx_t *ctx, char *name) {
+  emit(ctx, "  leaq ");
+  emit(ctx, name);
+  emit(ctx, "(%rip), %rax\n");
+}
+
+void x86_scale(codegen_ctx_t *ctx, int reg, int size) {
+  emit(ctx, "  imulq $");
+  emit_int(ctx, size);
+  emit_with_name(ctx, ", ", x86_regs[reg]);
+}
+
+void x86_div_size(codegen_ctx_t *ctx, int size) {
+  x86_mov(ctx, 9, size);
+  emit(ctx, "  xorl %edx, %edx\n");
+  emit(ctx, "  divq %r11\n");
+}
+
+void x86_set(codegen_ctx_t *ctx, char *cond) {
+  emit(ctx, "  cmpq %r11, %rax\n");
+  emit(ctx, "  set");
+  emit(ctx, cond);
+  emit(ctx, " %al\n");
+  emit(ctx, "  movzbq %al, %rax\n");
+}
+
+void x86_binary_op(codegen_ctx_t *ctx, exprtype_t type, pos_t pos) {
+  switch (type) {
+  case EXPR_ADD:
+    emit(ctx, "  addq %r11, %rax\n");
+    break;
+  case EXPR_SUB:
+    emit(ctx, "  subq %r11, %rax\n");
+    break;
+  case EXPR_MUL:
+    emit(ctx, "  imulq %r11, %rax\n");
+    break;
+  case EXPR_DIV:
+    emit(ctx, "  cqto\n");
+    emit(ctx, "  idivq %r11\n");
+    break;
+  case EXPR_REM:
+    emit(ctx, "  cqto\n");
+    emit(ctx, "  idivq %r11\n");
+    emit(ctx, "  movq %rdx, %rax\n");
+    break;
+  case EXPR_LT:
+    x86_set(ctx, "l");
+    break;
+  case EXPR_LE:
+    x86_set(ctx, "le");
+    break;
+  case EXPR_GT:
+    x86_set(ctx, "g");
+    break;
+  case EXPR_GE:
+    x86_set(ctx, "ge");
+    break;
+  case EXPR_EQ:
+    x86_set(ctx, "e");
+    break;
+  case EXPR_NE:
+    x86_set(ctx, "ne");
+    break;
+  case EXPR_AND:
+    emit(ctx, "  andq %r11, %rax\n");
+    break;
+  case EXPR_OR:
+    emit(ctx, "  orq %r11, %rax\n");
+    break;
+  case EXPR_XOR:
+    emit(ctx, "  xorq %r11, %rax\n");
+    break;
+  case EXPR_SHL:
+    emit(ctx, "  movq %r11, %rcx\n");
+    emit(ctx, "  salq %cl, %rax\n");
+    break;
+  case EXPR_SHR:
+    emit(ctx, "  movq %r11, %rcx\n");
+    emit(ctx, "  sarq %cl, %rax\n");
+    break;
+  default:
+    error(pos, "unreachable: expr=%d\n", type);
+  }
+}
+
+void x86_unary_op(codegen_ctx_t *ctx, exprtype_t type) {
+  if (type == EXPR_NOT) {
+    emit(ctx, "  notq %rax\n");
+  } else {
+    emit(ctx, "  cmpq $0, %rax\n");
+    emit(ctx, "  sete %al\n");
+    emit(ctx, "  movzbq %al, %rax\n");
+  }
+}
+
+// Arguments 6 and 7, on top of the stack, are moved to where the callee
+// finds them, right above the return address. al says how many vector
+// registers a variadic callee gets, none. A C library function returning
+// int or char leaves the upper bits of rax undefined, so its value is sign
+// extended. Functions ccc compiles return the whole register untouched, as
+// on AArch64 and in the bytecode, and their values are left alone.
+void x86_call(codegen_ctx_t *ctx, char *name, int arg_len, type_t *type) {
+  if (arg_len > 7) {
+    x86_pop(ctx, 8);
+  }
+  if (arg_len > 6) {
+    x86_pop(ctx, 9);
+  }
+  int i = arg_len - 1;
+  if (i > 5) {
+    i = 5;
+  }
+  while (i >= 0) {
+    x86_pop(ctx, i);
+    i--;
+  }
+
+  if (arg_len > 6) {
+    emit(ctx, "  subq $16, %rsp\n");
+    emit(ctx, "  movq %r11, (%rsp)\n");
+  }
+  if (arg_len > 7) {
+    emit(ctx, "  movq %rax, 8(%rsp)\n");
+  }
+  emit(ctx, "  movl $0, %eax\n");
+  emit_with_name(ctx, "  call ", name);
+  if (arg_len > 6) {
+    emit(ctx, "  addq $16, %rsp\n");
+  }
+
+  int is_library = type && !is_defined_function(ctx, name);
+  if (is_library && (type->kind == TYPE_INT || type->kind == TYPE_ENUM)) {
+    emit(ctx, "  cltq\n");
+  } else if (is_library && type->kind == TYPE_CHAR) {
+    emit(ctx, "  movsbq %al, %rax\n");
+  }
+  x86_push(ctx, 8);
+}
+
+void x86_param(codegen_ctx_t *ctx, int index) {
+  if (index < 6) {
+    x86_push(ctx, index);
+    return;
+  }
+  emit(ctx, "  movq ");
+  emit_int(ctx, 16 + (index - 6) * 8);
+  emit(ctx, "(%rbp), %rax\n");
+  x86_push(ctx, 8);
+}
+
+// The size of the frame is only known once the body is generated, so it is
+// a symbol the epilogue sets.
+void x86_prologue(codegen_ctx_t *ctx) {
+  emit(ctx, "  pushq %rbp\n");
+  emit(ctx, "  movq %rsp, %rbp\n");
+  emit(ctx, "  subq $");
+  x86_frame_size(ctx);
+  emit(ctx, ", %rsp\n");
+}
+
+void x86_epilogue(codegen_ctx_t *ctx) {
+  x86_pop(ctx, 8);
+  emit(ctx, "  movq %rbp, %rsp\n");
+  emit(ctx, "  popq %rbp\n");
+  emit(ctx, "  ret\n");
+  emit(ctx, ".set ");
+  x86_frame_size(ctx);
+  emit_with_int(ctx, ", ", align_to(ctx->cur_offset, 16));
+}
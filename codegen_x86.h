@@ -0,0 +1,48 @@
+#pragma once
+#include "codegen.h"
+
+// The x86-64 side of the primitives of codegen.c, in AT&T syntax for the
+// System V ABI. Registers 8, 9 and 10 are rax, r11 and r10, which no
+// argument is passed in. Arguments 0 to 5 are passed in registers and 6 and 7
+// on the stack. Below the saved rbp, the frame holds the locals at the
+// offsets codegen gives them from its start, and is as large as they need.
+
+void init_x86_regs();
+
+void x86_mov(codegen_ctx_t *ctx, int reg, int value);
+
+void x86_push(codegen_ctx_t *ctx, int reg);
+
+void x86_pop(codegen_ctx_t *ctx, int reg);
+
+// loads the value of the size register 8 points to into it, sign extended
+void x86_load(codegen_ctx_t *ctx, int size);
+
+// stores the size low bytes of register 9 where register 8 points
+void x86_store(codegen_ctx_t *ctx, int size);
+
+void x86_add_imm(codegen_ctx_t *ctx, int value);
+
+void x86_compare(codegen_ctx_t *ctx, int value);
+
+void x86_frame_addr(codegen_ctx_t *ctx, int offset);
+
+void x86_str_addr(codegen_ctx_t *ctx, int str_index);
+
+void x86_global_addr(codegen_ctx_t *ctx, char *name);
+
+void x86_scale(codegen_ctx_t *ctx, int reg, int size);
+
+void x86_div_size(codegen_ctx_t *ctx, int size);
+
+void x86_binary_op(codegen_ctx_t *ctx, exprtype_t type, pos_t pos);
+
+void x86_unary_op(codegen_ctx_t *ctx, exprtype_t type);
+
+void x86_call(codegen_ctx_t *ctx, char *name, int arg_len, type_t *type);
+
+void x86_param(codegen_ctx_t *ctx, int index);
+
+void x86_prologue(codegen_ctx_t *ctx);
+
+void x86_epilogue(codegen_ctx_t *ctx);
@@ -13,8 +13,8 @@ void panic(char *format, ...) {
   exit(1);
 }
 
-void error(pos_t *pos, char *format, ...) {
-  if (pos != NULL) {
+void error(pos_t pos, char *format, ...) {
+  if (pos.line) {
     fprintf(stderr, "%s; ", pos_to_string(pos));
   }
 
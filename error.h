@@ -3,4 +3,4 @@
 
 void panic(char *format, ...);
 
-void error(pos_t *pos, char *format, ...);
+void error(pos_t pos, char *format, ...);
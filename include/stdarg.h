@@ -0,0 +1,8 @@
+#pragma once
+
+// Arguments are only passed in registers, so there is no argument area to
+// walk. va_list is enough for vfprintf and friends to be called.
+typedef int va_list;
+
+#define va_start(ap, last) 0
+#define va_end(ap) 0
@@ -0,0 +1,16 @@
+#pragma once
+
+// The C library as far as ccc needs it to compile itself. Functions can be
+// called without a prototype, so only types, objects and constants are
+// declared in these headers.
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+#define EOF -1
+
+typedef struct FILE FILE;
+
+extern FILE *stdout;
+extern FILE *stderr;
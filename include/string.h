@@ -0,0 +1,5 @@
+#pragma once
+
+#ifndef NULL
+#define NULL 0
+#endif
@@ -0,0 +1,98 @@
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Every distinct spelling gets a dense symbol id. The strings themselves are
+// not copied, they stay where the tokenizer terminated them. The open
+// addressing table maps hashes to symbol id + 1, so 0 marks an empty slot.
+char **symbol_names;
+int *symbol_hashes;
+int symbols_len;
+int symbols_cap;
+
+int *symbol_table;
+int symbol_table_cap;
+
+int hash_name(char *name) {
+  int hash = 0;
+  char *p = name;
+  while (*p) {
+    hash = (hash * 31 + *p) & 16777215;
+    p++;
+  }
+  return hash;
+}
+
+void insert_symbol(int symbol) {
+  int mask = symbol_table_cap - 1;
+  int i = symbol_hashes[symbol] & mask;
+  while (symbol_table[i]) {
+    i = (i + 1) & mask;
+  }
+  symbol_table[i] = symbol + 1;
+}
+
+void grow_symbols() {
+  if (symbols_cap == 0) {
+    symbols_cap = 512;
+  } else {
+    symbols_cap *= 2;
+  }
+  symbol_names = realloc(symbol_names, symbols_cap * sizeof(char *));
+  symbol_hashes = realloc(symbol_hashes, symbols_cap * sizeof(int));
+
+  symbol_table_cap = symbols_cap * 2;
+  symbol_table = realloc(symbol_table, symbol_table_cap * sizeof(int));
+  memset(symbol_table, 0, symbol_table_cap * sizeof(int));
+
+  int i = 0;
+  while (i < symbols_len) {
+    insert_symbol(i);
+    i++;
+  }
+}
+
+int intern_symbol(char *name) {
+  return intern_hashed_symbol(name, hash_name(name));
+}
+
+int find_hashed_symbol(char *name, int hash) {
+  int mask = symbol_table_cap - 1;
+  int i = hash & mask;
+  while (symbol_table_cap && symbol_table[i]) {
+    int symbol = symbol_table[i] - 1;
+    if (symbol_hashes[symbol] == hash && !strcmp(symbol_names[symbol], name)) {
+      return symbol;
+    }
+    i = (i + 1) & mask;
+  }
+  return -1;
+}
+
+int find_symbol(char *name) {
+  return find_hashed_symbol(name, hash_name(name));
+}
+
+int intern_hashed_symbol(char *name, int hash) {
+  int found = find_hashed_symbol(name, hash);
+  if (found >= 0) {
+    return found;
+  }
+
+  if (symbols_len == symbols_cap) {
+    grow_symbols();
+  }
+
+  int symbol = symbols_len;
+  symbols_len++;
+  symbol_names[symbol] = name;
+  symbol_hashes[symbol] = hash;
+  insert_symbol(symbol);
+  return symbol;
+}
+
+char *symbol_name(int symbol) { return symbol_names[symbol]; }
+
+int symbol_count() { return symbols_len; }
+
+char *intern(char *name) { return symbol_name(intern_symbol(name)); }
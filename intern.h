@@ -0,0 +1,23 @@
+#pragma once
+
+// Returns the canonical copy of a NUL-terminated spelling. Every identifier
+// is interned by the tokenizer, so names can be compared by pointer.
+char *intern(char *name);
+
+// Interned spellings are also numbered densely from 0.
+int intern_symbol(char *name);
+
+// The hash intern_symbol uses. It touches no shared state, so spellings can
+// be hashed on other threads and interned later by intern_hashed_symbol.
+int hash_name(char *name);
+
+int intern_hashed_symbol(char *name, int hash);
+
+// Returns the symbol of the spelling, or -1 if it has not been interned. As
+// interning keeps the string, a spelling in a scratch buffer is looked up
+// first and copied only when it is new.
+int find_symbol(char *name);
+
+char *symbol_name(int symbol);
+
+int symbol_count();
@@ -0,0 +1,373 @@
+#include "codegen_bytecode.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// C library functions are called with every argument as a long. The
+// prototype is variadic so that printf and friends are told there are no
+// floating point arguments; on the ABIs ccc targets, the registers that
+// carry the arguments of a function are the same either way.
+typedef long (*native_fn_t)(long, ...);
+
+typedef struct {
+  char *name;
+  native_fn_t fn;
+} native_t;
+
+native_t natives[64];
+int native_count;
+
+void add_native(char *name, native_fn_t fn) {
+  natives[native_count].name = name;
+  natives[native_count].fn = fn;
+  native_count++;
+}
+
+// the functions of the C library ccc's headers cover, and ccc needs itself
+void init_natives() {
+  add_native("printf", (native_fn_t)printf);
+  add_native("fprintf", (native_fn_t)fprintf);
+  add_native("sprintf", (native_fn_t)sprintf);
+  add_native("snprintf", (native_fn_t)snprintf);
+  add_native("vfprintf", (native_fn_t)vfprintf);
+  add_native("puts", (native_fn_t)puts);
+  add_native("putchar", (native_fn_t)putchar);
+  add_native("getchar", (native_fn_t)getchar);
+  add_native("fputs", (native_fn_t)fputs);
+  add_native("fputc", (native_fn_t)fputc);
+  add_native("fgets", (native_fn_t)fgets);
+  add_native("fopen", (native_fn_t)fopen);
+  add_native("fclose", (native_fn_t)fclose);
+  add_native("fread", (native_fn_t)fread);
+  add_native("fwrite", (native_fn_t)fwrite);
+  add_native("fflush", (native_fn_t)fflush);
+  add_native("malloc", (native_fn_t)malloc);
+  add_native("calloc", (native_fn_t)calloc);
+  add_native("realloc", (native_fn_t)realloc);
+  add_native("free", (native_fn_t)free);
+  add_native("exit", (native_fn_t)exit);
+  add_native("abort", (native_fn_t)abort);
+  add_native("atoi", (native_fn_t)atoi);
+  add_native("strtol", (native_fn_t)strtol);
+  add_native("getenv", (native_fn_t)getenv);
+  add_native("system", (native_fn_t)system);
+  add_native("strlen", (native_fn_t)strlen);
+  add_native("strcmp", (native_fn_t)strcmp);
+  add_native("strncmp", (native_fn_t)strncmp);
+  add_native("strcpy", (native_fn_t)strcpy);
+  add_native("strncpy", (native_fn_t)strncpy);
+  add_native("strcat", (native_fn_t)strcat);
+  add_native("strchr", (native_fn_t)strchr);
+  add_native("strrchr", (native_fn_t)strrchr);
+  add_native("strstr", (native_fn_t)strstr);
+  add_native("memcpy", (native_fn_t)memcpy);
+  add_native("memmove", (native_fn_t)memmove);
+  add_native("memset", (native_fn_t)memset);
+  add_native("memcmp", (native_fn_t)memcmp);
+  add_native("isdigit", (native_fn_t)isdigit);
+  add_native("isalpha", (native_fn_t)isalpha);
+  add_native("isalnum", (native_fn_t)isalnum);
+  add_native("isspace", (native_fn_t)isspace);
+  add_native("isxdigit", (native_fn_t)isxdigit);
+  add_native("isupper", (native_fn_t)isupper);
+  add_native("islower", (native_fn_t)islower);
+  add_native("toupper", (native_fn_t)toupper);
+  add_native("tolower", (native_fn_t)tolower);
+  add_native("chmod", (native_fn_t)chmod);
+}
+
+native_fn_t find_native(char *name) {
+  int i = 0;
+  while (i < native_count) {
+    if (!strcmp(natives[i].name, name)) {
+      return natives[i].fn;
+    }
+    i++;
+  }
+  return NULL;
+}
+
+// the objects of the C library ccc's headers declare extern
+void *find_native_data(char *name) {
+  if (!strcmp(name, "stdin")) {
+    return &stdin;
+  } else if (!strcmp(name, "stdout")) {
+    return &stdout;
+  } else if (!strcmp(name, "stderr")) {
+    return &stderr;
+  }
+  return NULL;
+}
+
+int stack_size() { return 64 << 20; }
+
+// room left below a frame for the values its code pushes
+int stack_margin() { return 1 << 20; }
+
+// Values pushed take 8 bytes. A frame starts with the caller's frame and
+// the code index to return to, as a frame of AArch64 code does, and
+// OP_ENTER checks that it and some room for pushes fit.
+int run_bytecode(bytecode_t *bc, int argc, char **argv) {
+  init_natives();
+  native_fn_t *fns = calloc(bc->native_len + 1, sizeof(native_fn_t));
+  int i = 0;
+  while (i < bc->native_len) {
+    fns[i] = find_native(bc->natives[i]);
+    if (fns[i] == NULL) {
+      fprintf(stderr, "ccc: undefined function '%s'\n", bc->natives[i]);
+      return 1;
+    }
+    i++;
+  }
+
+  char **globals = calloc(bc->global_len + 1, sizeof(char *));
+  i = 0;
+  while (i < bc->global_len) {
+    if (bc->global_externs[i]) {
+      globals[i] = find_native_data(bc->global_names[i]);
+      if (globals[i] == NULL) {
+        fprintf(stderr, "ccc: undefined variable '%s'\n",
+                bc->global_names[i]);
+        return 1;
+      }
+    } else {
+      globals[i] = calloc(bc->global_sizes[i] + 1, 1);
+    }
+    i++;
+  }
+
+  if (bc->main == 0) {
+    fprintf(stderr, "ccc: undefined function 'main'\n");
+    return 1;
+  }
+
+  char *stack = malloc(stack_size());
+  char *limit = stack + stack_margin();
+  char *sp = stack + stack_size();
+  char *fp = sp;
+  int *code = bc->code;
+  long r[11];
+  memset(r, 0, sizeof(r));
+  r[0] = argc;
+  r[1] = (long)argv;
+
+  // main returns to the OP_HALT at 0
+  int lr = 0;
+  int pc = bc->main;
+  while (1) {
+    switch (code[pc]) {
+    case OP_HALT:
+      return r[0];
+    case OP_MOV:
+      r[code[pc + 1]] = code[pc + 2];
+      pc += 3;
+      break;
+    case OP_COPY:
+      r[code[pc + 1]] = r[code[pc + 2]];
+      pc += 3;
+      break;
+    case OP_PUSH:
+      sp -= 8;
+      *(long *)sp = r[code[pc + 1]];
+      pc += 2;
+      break;
+    case OP_POP:
+      r[code[pc + 1]] = *(long *)sp;
+      sp += 8;
+      pc += 2;
+      break;
+    case OP_LOAD1:
+      r[8] = *(char *)r[8];
+      pc++;
+      break;
+    case OP_LOAD4:
+      r[8] = *(int *)r[8];
+      pc++;
+      break;
+    case OP_LOAD8:
+      r[8] = *(long *)r[8];
+      pc++;
+      break;
+    case OP_STORE1:
+      *(char *)r[8] = r[9];
+      pc++;
+      break;
+    case OP_STORE4:
+      *(int *)r[8] = r[9];
+      pc++;
+      break;
+    case OP_STORE8:
+      *(long *)r[8] = r[9];
+      pc++;
+      break;
+    case OP_ADD_IMM:
+      r[8] += code[pc + 1];
+      pc += 2;
+      break;
+    case OP_FRAME:
+      r[8] = (long)(fp + code[pc + 1]);
+      pc += 2;
+      break;
+    case OP_STRING:
+      r[8] = (long)bc->strings[code[pc + 1]];
+      pc += 2;
+      break;
+    case OP_GLOBAL:
+      r[8] = (long)globals[code[pc + 1]];
+      pc += 2;
+      break;
+    case OP_SCALE:
+      r[code[pc + 1]] *= code[pc + 2];
+      pc += 3;
+      break;
+    case OP_DIV_SIZE:
+      r[8] = (unsigned long)r[8] / code[pc + 1];
+      pc += 2;
+      break;
+    case OP_ADD:
+      r[8] += r[9];
+      pc++;
+      break;
+    case OP_SUB:
+      r[8] -= r[9];
+      pc++;
+      break;
+    case OP_MUL:
+      r[8] *= r[9];
+      pc++;
+      break;
+    case OP_DIV:
+      r[8] /= r[9];
+      pc++;
+      break;
+    case OP_REM:
+      r[8] %= r[9];
+      pc++;
+      break;
+    case OP_LT:
+      r[8] = r[8] < r[9];
+      pc++;
+      break;
+    case OP_LE:
+      r[8] = r[8] <= r[9];
+      pc++;
+      break;
+    case OP_GT:
+      r[8] = r[8] > r[9];
+      pc++;
+      break;
+    case OP_GE:
+      r[8] = r[8] >= r[9];
+      pc++;
+      break;
+    case OP_EQ:
+      r[8] = r[8] == r[9];
+      pc++;
+      break;
+    case OP_NE:
+      r[8] = r[8] != r[9];
+      pc++;
+      break;
+    case OP_AND:
+      r[8] &= r[9];
+      pc++;
+      break;
+    case OP_OR:
+      r[8] |= r[9];
+      pc++;
+      break;
+    case OP_XOR:
+      r[8] ^= r[9];
+      pc++;
+      break;
+    // the shift is taken modulo 64, as on AArch64
+    case OP_SHL:
+      r[8] = (long)((unsigned long)r[8] << (r[9] & 63));
+      pc++;
+      break;
+    case OP_SHR:
+      r[8] >>= r[9] & 63;
+      pc++;
+      break;
+    case OP_NOT:
+      r[8] = ~r[8];
+      pc++;
+      break;
+    case OP_LOGNOT:
+      r[8] = !r[8];
+      pc++;
+      break;
+    case OP_JUMP:
+      pc = code[pc + 1];
+      break;
+    case OP_JUMP_ZERO:
+      if (r[8] == 0) {
+        pc = code[pc + 1];
+      } else {
+        pc += 2;
+      }
+      break;
+    case OP_JUMP_NONZERO:
+      if (r[8] != 0) {
+        pc = code[pc + 1];
+      } else {
+        pc += 2;
+      }
+      break;
+    case OP_JUMP_EQUAL:
+      if (r[8] == code[pc + 1]) {
+        pc = code[pc + 2];
+      } else {
+        pc += 3;
+      }
+      break;
+    case OP_CALL:
+      i = code[pc + 2] - 1;
+      while (i >= 0) {
+        r[i] = *(long *)sp;
+        sp += 8;
+        i--;
+      }
+      lr = pc + 4;
+      pc = code[pc + 1];
+      break;
+    case OP_CALL_NATIVE:
+      i = code[pc + 2] - 1;
+      while (i >= 0) {
+        r[i] = *(long *)sp;
+        sp += 8;
+        i--;
+      }
+      r[0] = fns[code[pc + 1]](r[0], r[1], r[2], r[3], r[4], r[5], r[6],
+                               r[7]);
+      if (code[pc + 3] == RET_INT) {
+        r[0] = (int)r[0];
+      } else if (code[pc + 3] == RET_CHAR) {
+        r[0] = (char)r[0];
+      }
+      pc += 4;
+      break;
+    case OP_ENTER:
+      sp -= code[pc + 1];
+      if (sp < limit) {
+        fprintf(stderr, "ccc: stack overflow\n");
+        exit(1);
+      }
+      ((long *)sp)[0] = (long)fp;
+      ((long *)sp)[1] = lr;
+      fp = sp;
+      pc += 2;
+      break;
+    case OP_LEAVE:
+      sp = fp + code[pc + 1];
+      pc = ((long *)fp)[1];
+      fp = (char *)((long *)fp)[0];
+      break;
+    default:
+      fprintf(stderr, "ccc: bad opcode %d at %d\n", code[pc], pc);
+      exit(1);
+    }
+  }
+}
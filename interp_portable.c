@@ -0,0 +1,10 @@
+#include "codegen_bytecode.h"
+#include <stdio.h>
+
+// Fallback for interp.c used when ccc compiles itself, since calling into
+// the C library by address takes function pointers, which ccc does not have.
+
+int run_bytecode(bytecode_t *bc, int argc, char **argv) {
+  fprintf(stderr, "ccc: --run needs a ccc built by cc\n");
+  return 1;
+}
@@ -0,0 +1,64 @@
+#include "parallel_lex.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct {
+  lex_chunk_t **chunks;
+  int len;
+  int first;
+  int step;
+} lex_worker_t;
+
+// chunks are dealt out in turn, so that every thread gets a share of each
+// part of the file
+void *run_lex_worker(void *arg) {
+  lex_worker_t *worker = arg;
+  int i = worker->first;
+  while (i < worker->len) {
+    lex_chunk(worker->chunks[i]);
+    i += worker->step;
+  }
+  return NULL;
+}
+
+void run_lex_chunks(lex_chunk_t **chunks, int len, int threads) {
+  if (threads > len) {
+    threads = len;
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  lex_worker_t *workers = calloc(threads, sizeof(lex_worker_t));
+  pthread_t *ids = calloc(threads, sizeof(pthread_t));
+  int i = 0;
+  while (i < threads) {
+    workers[i].chunks = chunks;
+    workers[i].len = len;
+    workers[i].first = i;
+    workers[i].step = threads;
+    i++;
+  }
+
+  // the calling thread takes the first share
+  i = 1;
+  while (i < threads) {
+    if (pthread_create(&ids[i], NULL, run_lex_worker, &workers[i])) {
+      // lex the share on this thread instead
+      run_lex_worker(&workers[i]);
+      ids[i] = 0;
+    }
+    i++;
+  }
+  run_lex_worker(&workers[0]);
+
+  i = 1;
+  while (i < threads) {
+    if (ids[i]) {
+      pthread_join(ids[i], NULL);
+    }
+    i++;
+  }
+  free(ids);
+  free(workers);
+}
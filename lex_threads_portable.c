@@ -0,0 +1,12 @@
+#include "parallel_lex.h"
+
+// Fallback for lex_threads.c used when ccc compiles itself, since there are
+// no threads then. The chunks are lexed in order on the calling thread.
+
+void run_lex_chunks(lex_chunk_t **chunks, int len, int threads) {
+  int i = 0;
+  while (i < len) {
+    lex_chunk(chunks[i]);
+    i++;
+  }
+}
@@ -0,0 +1,1165 @@
+#include "linker.h"
+#include "intern.h"
+#include "os.h"
+#include "writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the output sections, in the order they are laid out. The first four make
+// the read-only segment and the rest the writable one.
+int out_init() { return 0; }
+int out_text() { return 1; }
+int out_fini() { return 2; }
+int out_rodata() { return 3; }
+int out_preinit_array() { return 4; }
+int out_init_array() { return 5; }
+int out_fini_array() { return 6; }
+int out_data() { return 7; }
+int out_got() { return 8; }
+int out_bss() { return 9; }
+int out_count() { return 10; }
+
+int link_base() { return 4194304; }
+// Addresses are ints, so the image is kept well below 2 GB, past which they
+// would overflow. A bigger one is left to ld.
+int max_image_end() { return 1073741824; }
+int segment_align() { return 65536; }
+int headers_size() { return 64 + 56 * 3; }
+
+// An object file, given on its own or as a member of an archive, read in
+// place. Archive members are only loaded once they define a symbol needed.
+typedef struct {
+  char *path;
+  char *buf;
+  int is_loaded;
+
+  char *section_headers;
+  int section_count;
+  char *symbols;
+  int symbol_count;
+  int first_global;
+  char *symbol_names;
+
+  // indexed by section, the output section it goes to or -1, and where in
+  // the output section it starts
+  int *out_sections;
+  int *out_offsets;
+  // indexed by symbol from first_global on, the global symbol it names
+  int *globals;
+} link_input_t;
+
+// A global symbol. One defined by an input is at value in section of the
+// input. One defined by the linker, a common symbol or a name like
+// __bss_start, is at value in out_section instead, or at the end of it.
+typedef struct {
+  char *name;
+  link_input_t *input;
+  int section;
+  int value;
+  int size;
+  int type;
+  int is_defined;
+  int is_weak;
+  int is_absolute;
+  int is_common;
+  int align;
+  int out_section;
+  int is_section_end;
+  // whether a reference that is not weak was seen
+  int is_needed;
+  int got_index;
+} link_symbol_t;
+
+typedef struct {
+  link_input_t **inputs;
+  int input_len;
+  int input_cap;
+  // the inputs loaded, in the order their sections are laid out
+  link_input_t **loaded;
+  int loaded_len;
+  int loaded_cap;
+
+  link_symbol_t **symbols;
+  int symbol_len;
+  int symbol_cap;
+  // indexed by interned symbol, the index of its symbol + 1
+  int *symbol_table;
+  int symbol_table_cap;
+  int got_len;
+
+  char **out_names;
+  bytes_t **out_bytes;
+  int *out_sizes;
+  int *out_aligns;
+  int *out_addresses;
+  int *out_file_offsets;
+
+  char *error;
+} linker_t;
+
+// Records why the link cannot be done. Only the first reason is kept.
+void link_error(linker_t *ctx, char *format, char *name) {
+  if (!ctx->error) {
+    ctx->error = malloc(256);
+    snprintf(ctx->error, 256, format, name);
+  }
+}
+
+int read_le(char *p, int size) {
+  int value = 0;
+  int i = 0;
+  while (i < size && i < 4) {
+    value = value | ((p[i] & 255) << (i * 8));
+    i++;
+  }
+  return value;
+}
+
+void write_le(char *p, int value, int size) {
+  int i = 0;
+  while (i < size) {
+    if (i < 4) {
+      p[i] = (value >> (i * 8)) & 255;
+    } else if (value < 0) {
+      p[i] = 255;
+    } else {
+      p[i] = 0;
+    }
+    i++;
+  }
+}
+
+int align_up(int value, int align) {
+  int rem = value % align;
+  if (rem) {
+    return value + align - rem;
+  }
+  return value;
+}
+
+// reads a field of the ELF section header
+int section_field(link_input_t *input, int section, int offset, int size) {
+  return read_le(input->section_headers + section * 64 + offset, size);
+}
+
+// reads a field of the ELF symbol
+int symbol_field(link_input_t *input, int symbol, int offset, int size) {
+  return read_le(input->symbols + symbol * 24 + offset, size);
+}
+
+// whether the value of the ELF symbol fits in an int, as addresses must
+int is_int_value(link_input_t *input, int symbol) {
+  int high = symbol_field(input, symbol, 12, 4);
+  if (symbol_field(input, symbol, 8, 4) < 0) {
+    return high == -1;
+  }
+  return high == 0;
+}
+
+char *symbol_name_at(link_input_t *input, int symbol) {
+  return input->symbol_names + symbol_field(input, symbol, 0, 4);
+}
+
+// returns the symbol of the name, added undefined the first time
+int find_link_symbol(linker_t *ctx, char *name) {
+  int interned = intern_symbol(name);
+  if (interned >= ctx->symbol_table_cap) {
+    int cap = interned * 2 + 16;
+    ctx->symbol_table = realloc(ctx->symbol_table, cap * sizeof(int));
+    memset(ctx->symbol_table + ctx->symbol_table_cap, 0,
+           (cap - ctx->symbol_table_cap) * sizeof(int));
+    ctx->symbol_table_cap = cap;
+  }
+  if (ctx->symbol_table[interned]) {
+    return ctx->symbol_table[interned] - 1;
+  }
+
+  if (ctx->symbol_len == ctx->symbol_cap) {
+    ctx->symbol_cap = ctx->symbol_cap * 2 + 16;
+    ctx->symbols =
+        realloc(ctx->symbols, ctx->symbol_cap * sizeof(link_symbol_t *));
+  }
+  link_symbol_t *symbol = calloc(1, sizeof(link_symbol_t));
+  symbol->name = symbol_name(interned);
+  symbol->out_section = -1;
+  symbol->got_index = -1;
+  ctx->symbols[ctx->symbol_len] = symbol;
+  ctx->symbol_len++;
+  ctx->symbol_table[interned] = ctx->symbol_len;
+  return ctx->symbol_len - 1;
+}
+
+// returns the symbol of the name, or NULL if no input has named it
+link_symbol_t *lookup_link_symbol(linker_t *ctx, char *name) {
+  int interned = find_symbol(name);
+  if (interned < 0 || interned >= ctx->symbol_table_cap ||
+      !ctx->symbol_table[interned]) {
+    return NULL;
+  }
+  return ctx->symbols[ctx->symbol_table[interned] - 1];
+}
+
+int is_elf(char *p) {
+  return p[0] == 127 && !strncmp(p + 1, "ELF", 3);
+}
+
+// Reads the headers of an object. The sections and symbols stay where they
+// are in the buffer.
+link_input_t *add_object(linker_t *ctx, char *path, char *buf, int size) {
+  if (size < 64 || buf[4] != 2 || buf[5] != 1) {
+    link_error(ctx, "%s is not a 64-bit little-endian object", path);
+    return NULL;
+  }
+  if (read_le(buf + 16, 2) != 1 || read_le(buf + 18, 2) != 183) {
+    link_error(ctx, "%s is not an AArch64 relocatable object", path);
+    return NULL;
+  }
+
+  link_input_t *input = calloc(1, sizeof(link_input_t));
+  input->path = path;
+  input->buf = buf;
+  input->section_headers = buf + read_le(buf + 40, 8);
+  input->section_count = read_le(buf + 60, 2);
+  input->out_sections = calloc(input->section_count, sizeof(int));
+  input->out_offsets = calloc(input->section_count, sizeof(int));
+  int i = 0;
+  while (i < input->section_count) {
+    // symtab
+    if (section_field(input, i, 4, 4) == 2) {
+      input->symbols = buf + section_field(input, i, 24, 8);
+      input->symbol_count = section_field(input, i, 32, 8) / 24;
+      input->first_global = section_field(input, i, 44, 4);
+      int names = section_field(input, i, 40, 4);
+      input->symbol_names = buf + section_field(input, names, 24, 8);
+    }
+    i++;
+  }
+  if (input->first_global > input->symbol_count) {
+    input->first_global = input->symbol_count;
+  }
+  input->globals =
+      calloc(input->symbol_count - input->first_global + 1, sizeof(int));
+
+  if (ctx->input_len == ctx->input_cap) {
+    ctx->input_cap = ctx->input_cap * 2 + 16;
+    ctx->inputs =
+        realloc(ctx->inputs, ctx->input_cap * sizeof(link_input_t *));
+  }
+  ctx->inputs[ctx->input_len] = input;
+  ctx->input_len++;
+  return input;
+}
+
+// Adds the objects of an archive. Its members start after the "!<arch>\n"
+// magic, each with a 60-byte header giving its size in decimal at byte 48,
+// and are padded to an even size. The symbol index and the long names are
+// members too; they are skipped like anything else that is not an object,
+// as the linker finds what to load by looking at the symbols of each one.
+void add_archive(linker_t *ctx, char *path, char *buf, int size) {
+  int offset = 8;
+  while (offset + 60 <= size) {
+    char *header = buf + offset;
+    int member_size = atoi(header + 48);
+    char *member = header + 60;
+    if (member_size < 0 || offset + 60 + member_size > size) {
+      link_error(ctx, "%s is a truncated archive", path);
+      return;
+    }
+    if (member_size >= 4 && is_elf(member)) {
+      add_object(ctx, path, member, member_size);
+    }
+    offset = align_up(offset + 60 + member_size, 2);
+  }
+}
+
+void load_input(linker_t *ctx, link_input_t *input);
+
+// Adds an object or archive. An object given on its own is always loaded.
+void add_input_file(linker_t *ctx, char *path) {
+  int size;
+  char *buf = map_file(path, &size);
+  if (buf == NULL) {
+    link_error(ctx, "cannot open %s", path);
+  } else if (size >= 8 && !strncmp(buf, "!<thin>\n", 8)) {
+    link_error(ctx, "%s is a thin archive", path);
+  } else if (size >= 8 && !strncmp(buf, "!<arch>\n", 8)) {
+    add_archive(ctx, path, buf, size);
+  } else if (size >= 4 && is_elf(buf)) {
+    link_input_t *input = add_object(ctx, path, buf, size);
+    if (input) {
+      load_input(ctx, input);
+    }
+  } else {
+    link_error(ctx, "%s is not an object or archive", path);
+  }
+}
+
+// Adds a global symbol of an input, as a definition or a reference. A
+// definition replaces a weak or common one; two that are neither clash.
+void resolve_symbol(linker_t *ctx, link_input_t *input, int i) {
+  char *name = symbol_name_at(input, i);
+  int info = symbol_field(input, i, 4, 1);
+  int bind = (info >> 4) & 15;
+  int type = info & 15;
+  int section = symbol_field(input, i, 6, 2);
+  int value = symbol_field(input, i, 8, 8);
+  int size = symbol_field(input, i, 16, 8);
+  int index = find_link_symbol(ctx, name);
+  link_symbol_t *symbol = ctx->symbols[index];
+  input->globals[i - input->first_global] = index;
+
+  // 6 is a thread-local symbol, 10 an ifunc
+  if (type == 6 || type == 10) {
+    link_error(ctx, "%s uses thread-local storage or ifuncs", input->path);
+    return;
+  }
+  // 2 is weak
+  if (section == 0) {
+    if (bind != 2) {
+      symbol->is_needed = 1;
+    }
+    return;
+  }
+
+  // 65522 is common, where value is the alignment
+  if (section == 65522) {
+    if (!symbol->is_defined || symbol->is_common) {
+      symbol->is_defined = 1;
+      symbol->is_common = 1;
+      symbol->type = type;
+      if (size > symbol->size) {
+        symbol->size = size;
+      }
+      if (value > symbol->align) {
+        symbol->align = value;
+      }
+    }
+    return;
+  }
+  if (symbol->is_defined && !symbol->is_weak && !symbol->is_common) {
+    if (bind != 2) {
+      link_error(ctx, "duplicate symbol %s", name);
+    }
+    return;
+  }
+  if (symbol->is_defined && symbol->is_weak && bind == 2) {
+    return;
+  }
+  // 65521 is absolute
+  if (section == 65521 && !is_int_value(input, i)) {
+    link_error(ctx, "%s has an absolute symbol out of range", input->path);
+  }
+  symbol->is_defined = 1;
+  symbol->is_common = 0;
+  symbol->is_weak = bind == 2;
+  symbol->is_absolute = section == 65521;
+  symbol->input = input;
+  symbol->section = section;
+  symbol->value = value;
+  symbol->size = size;
+  symbol->type = type;
+}
+
+void load_input(linker_t *ctx, link_input_t *input) {
+  input->is_loaded = 1;
+  if (ctx->loaded_len == ctx->loaded_cap) {
+    ctx->loaded_cap = ctx->loaded_cap * 2 + 16;
+    ctx->loaded =
+        realloc(ctx->loaded, ctx->loaded_cap * sizeof(link_input_t *));
+  }
+  ctx->loaded[ctx->loaded_len] = input;
+  ctx->loaded_len++;
+  int i = input->first_global;
+  while (i < input->symbol_count) {
+    resolve_symbol(ctx, input, i);
+    i++;
+  }
+}
+
+// returns whether the input defines a symbol needed and not yet defined
+int defines_needed(linker_t *ctx, link_input_t *input) {
+  int i = input->first_global;
+  while (i < input->symbol_count) {
+    int section = symbol_field(input, i, 6, 2);
+    if (section != 0 && section != 65522) {
+      link_symbol_t *symbol =
+          lookup_link_symbol(ctx, symbol_name_at(input, i));
+      if (symbol && symbol->is_needed && !symbol->is_defined) {
+        return 1;
+      }
+    }
+    i++;
+  }
+  return 0;
+}
+
+// Loads the objects given on their own, then the archive members needed,
+// until no more are.
+void load_inputs(linker_t *ctx, char **paths, int path_len) {
+  int i = 0;
+  while (i < path_len && !ctx->error) {
+    add_input_file(ctx, paths[i]);
+    i++;
+  }
+
+  int is_changed = 1;
+  while (is_changed && !ctx->error) {
+    is_changed = 0;
+    i = 0;
+    while (i < ctx->input_len && !ctx->error) {
+      link_input_t *input = ctx->inputs[i];
+      if (!input->is_loaded && defines_needed(ctx, input)) {
+        load_input(ctx, input);
+        is_changed = 1;
+      }
+      i++;
+    }
+  }
+}
+
+char *section_name_at(link_input_t *input, int section) {
+  int names = read_le(input->buf + 62, 2);
+  char *strings = input->buf + section_field(input, names, 24, 8);
+  return strings + section_field(input, section, 0, 4);
+}
+
+// Returns the output section an input section goes to, or -1 if it is left
+// out. Sections that are not allocated, such as debug info, are left out.
+int output_section_of(link_input_t *input, int section) {
+  int type = section_field(input, section, 4, 4);
+  int flags = section_field(input, section, 8, 4);
+  char *name = section_name_at(input, section);
+  // flags: 1 write, 2 alloc, 4 exec
+  if (!(flags & 2)) {
+    return -1;
+  }
+  // types: 8 nobits, 14 init_array, 15 fini_array, 16 preinit_array
+  if (type == 8) {
+    return out_bss();
+  }
+  if (type == 14 || !strncmp(name, ".init_array", 11)) {
+    return out_init_array();
+  }
+  if (type == 15 || !strncmp(name, ".fini_array", 11)) {
+    return out_fini_array();
+  }
+  if (type == 16) {
+    return out_preinit_array();
+  }
+  if (flags & 4) {
+    if (!strcmp(name, ".init")) {
+      return out_init();
+    }
+    if (!strcmp(name, ".fini")) {
+      return out_fini();
+    }
+    return out_text();
+  }
+  if (flags & 1) {
+    return out_data();
+  }
+  return out_rodata();
+}
+
+// Checks the sections of the loaded inputs can be linked and assigns them
+// their output sections.
+void check_sections(linker_t *ctx) {
+  int i = 0;
+  while (i < ctx->loaded_len && !ctx->error) {
+    link_input_t *input = ctx->loaded[i];
+    int section = 1;
+    while (section < input->section_count) {
+      int type = section_field(input, section, 4, 4);
+      int flags = section_field(input, section, 8, 4);
+      // 1024 is thread-local, 9 a relocation section without addends
+      if ((flags & 2) && (flags & 1024)) {
+        link_error(ctx, "%s uses thread-local storage", input->path);
+      }
+      if (type == 9) {
+        link_error(ctx, "%s has REL relocations", input->path);
+      }
+      input->out_sections[section] = output_section_of(input, section);
+      section++;
+    }
+    i++;
+  }
+}
+
+// Defines the names the C runtime expects the linker to, where referenced
+// and not defined already.
+void define_section_symbol(linker_t *ctx, char *name, int out_section,
+                           int is_end) {
+  link_symbol_t *symbol = lookup_link_symbol(ctx, name);
+  if (symbol == NULL || symbol->is_defined) {
+    return;
+  }
+  symbol->is_defined = 1;
+  if (out_section < 0) {
+    symbol->is_absolute = 1;
+    symbol->value = link_base();
+  }
+  symbol->out_section = out_section;
+  symbol->is_section_end = is_end;
+}
+
+void define_linker_symbols(linker_t *ctx) {
+  define_section_symbol(ctx, "__ehdr_start", -1, 0);
+  define_section_symbol(ctx, "__executable_start", -1, 0);
+  // there are no ifuncs, so no relocations for them
+  define_section_symbol(ctx, "__rela_iplt_start", out_init(), 0);
+  define_section_symbol(ctx, "__rela_iplt_end", out_init(), 0);
+  define_section_symbol(ctx, "etext", out_fini(), 1);
+  define_section_symbol(ctx, "_etext", out_fini(), 1);
+  define_section_symbol(ctx, "__etext", out_fini(), 1);
+  define_section_symbol(ctx, "__preinit_array_start", out_preinit_array(), 0);
+  define_section_symbol(ctx, "__preinit_array_end", out_preinit_array(), 1);
+  define_section_symbol(ctx, "__init_array_start", out_init_array(), 0);
+  define_section_symbol(ctx, "__init_array_end", out_init_array(), 1);
+  define_section_symbol(ctx, "__fini_array_start", out_fini_array(), 0);
+  define_section_symbol(ctx, "__fini_array_end", out_fini_array(), 1);
+  define_section_symbol(ctx, "_GLOBAL_OFFSET_TABLE_", out_got(), 0);
+  define_section_symbol(ctx, "_edata", out_got(), 1);
+  define_section_symbol(ctx, "__bss_start", out_bss(), 0);
+  define_section_symbol(ctx, "_end", out_bss(), 1);
+  define_section_symbol(ctx, "end", out_bss(), 1);
+
+  int i = 0;
+  while (i < ctx->symbol_len) {
+    link_symbol_t *symbol = ctx->symbols[i];
+    if (symbol->is_needed && !symbol->is_defined) {
+      link_error(ctx, "undefined symbol %s", symbol->name);
+    }
+    i++;
+  }
+  link_symbol_t *start = lookup_link_symbol(ctx, "_start");
+  if (start == NULL || !start->is_defined) {
+    link_error(ctx, "%s is not defined", "_start");
+  }
+}
+
+int is_supported_reloc(int type) {
+  // none, abs64/32/16, prel64/32/16
+  if (type == 0 || (type >= 257 && type <= 262)) {
+    return 1;
+  }
+  // movw_uabs_g0 to g3
+  if (type >= 263 && type <= 269) {
+    return 1;
+  }
+  // ld_prel_lo19, adr_prel_lo21, adr_prel_pg_hi21 and _nc, add_abs_lo12_nc,
+  // ldst8_abs_lo12_nc, tstbr14, condbr19, jump26, call26
+  if (type >= 273 && type <= 283 && type != 281) {
+    return 1;
+  }
+  // ldst16/32/64/128_abs_lo12_nc, adr_got_page, ld64_got_lo12_nc
+  return type == 284 || type == 285 || type == 286 || type == 299 ||
+         type == 311 || type == 312;
+}
+
+// returns the global symbol a relocation refers to, or NULL for a local one
+link_symbol_t *reloc_global(linker_t *ctx, link_input_t *input, int symbol) {
+  if (symbol < input->first_global) {
+    return NULL;
+  }
+  return ctx->symbols[input->globals[symbol - input->first_global]];
+}
+
+// Checks the relocations are ones the linker knows and gives the symbols
+// loaded through the GOT their entries.
+void scan_relocs(linker_t *ctx) {
+  int i = 0;
+  while (i < ctx->loaded_len && !ctx->error) {
+    link_input_t *input = ctx->loaded[i];
+    int section = 1;
+    while (section < input->section_count && !ctx->error) {
+      int target = section_field(input, section, 44, 4);
+      if (section_field(input, section, 4, 4) != 4 ||
+          input->out_sections[target] < 0) {
+        section++;
+        continue;
+      }
+      if (input->out_sections[target] == out_bss()) {
+        link_error(ctx, "%s has relocations in .bss", input->path);
+      }
+      char *rela = input->buf + section_field(input, section, 24, 8);
+      int count = section_field(input, section, 32, 8) / 24;
+      int j = 0;
+      while (j < count) {
+        int type = read_le(rela + j * 24 + 8, 4);
+        int symbol = read_le(rela + j * 24 + 12, 4);
+        if (!is_supported_reloc(type)) {
+          link_error(ctx, "%s has a relocation type not supported",
+                     input->path);
+        } else if (type == 311 || type == 312) {
+          link_symbol_t *global = reloc_global(ctx, input, symbol);
+          if (global == NULL) {
+            link_error(ctx, "%s loads a local symbol through the GOT",
+                       input->path);
+          } else if (global->got_index < 0) {
+            global->got_index = ctx->got_len;
+            ctx->got_len++;
+          }
+        }
+        j++;
+      }
+      section++;
+    }
+    i++;
+  }
+}
+
+// Gathers the sections of the loaded inputs into the output sections, in
+// load order, and adds the common symbols to .bss and the GOT.
+void layout_sections(linker_t *ctx) {
+  int i = 0;
+  while (i < ctx->loaded_len) {
+    link_input_t *input = ctx->loaded[i];
+    int section = 1;
+    while (section < input->section_count) {
+      int out = input->out_sections[section];
+      if (out < 0) {
+        section++;
+        continue;
+      }
+      int size = section_field(input, section, 32, 8);
+      int align = section_field(input, section, 48, 8);
+      if (align < 1) {
+        align = 1;
+      }
+      int offset = align_up(ctx->out_sizes[out], align);
+      input->out_offsets[section] = offset;
+      ctx->out_sizes[out] = offset + size;
+      if (align > ctx->out_aligns[out]) {
+        ctx->out_aligns[out] = align;
+      }
+      if (out != out_bss()) {
+        bytes_t *bytes = ctx->out_bytes[out];
+        add_zeros(bytes, offset - bytes->len);
+        add_bytes(bytes, input->buf + section_field(input, section, 24, 8),
+                  size);
+      }
+      section++;
+    }
+    i++;
+  }
+
+  i = 0;
+  while (i < ctx->symbol_len) {
+    link_symbol_t *symbol = ctx->symbols[i];
+    if (symbol->is_common) {
+      int align = symbol->align;
+      if (align < 1) {
+        align = 1;
+      }
+      symbol->out_section = out_bss();
+      symbol->value = align_up(ctx->out_sizes[out_bss()], align);
+      ctx->out_sizes[out_bss()] = symbol->value + symbol->size;
+      if (align > ctx->out_aligns[out_bss()]) {
+        ctx->out_aligns[out_bss()] = align;
+      }
+    }
+    i++;
+  }
+
+  ctx->out_sizes[out_got()] = ctx->got_len * 8;
+  ctx->out_aligns[out_got()] = 8;
+  add_zeros(ctx->out_bytes[out_got()], ctx->got_len * 8);
+}
+
+// Places the read-only segment right after the headers, and the writable
+// one at the next segment boundary, at the same offset into a segment as it
+// has in the file, so that both can be mapped from it.
+void assign_addresses(linker_t *ctx, int *rw_offset, int *rw_address) {
+  int address = link_base() + headers_size();
+  int out = 0;
+  while (out < out_count()) {
+    if (out == out_preinit_array()) {
+      *rw_offset = address - link_base();
+      address = align_up(address, segment_align()) +
+                *rw_offset % segment_align();
+      *rw_address = address;
+    }
+    address = align_up(address, ctx->out_aligns[out]);
+    ctx->out_addresses[out] = address;
+    if (out < out_preinit_array()) {
+      ctx->out_file_offsets[out] = address - link_base();
+    } else {
+      ctx->out_file_offsets[out] = address - *rw_address + *rw_offset;
+    }
+    if (ctx->out_sizes[out] > max_image_end() - address) {
+      link_error(ctx, "%s is too big to link", "the output");
+      return;
+    }
+    address += ctx->out_sizes[out];
+    out++;
+  }
+}
+
+// returns the output section a symbol is in, or -1 if it is in none
+int symbol_out_section(link_symbol_t *symbol) {
+  if (!symbol->is_defined || symbol->is_absolute) {
+    return -1;
+  }
+  if (symbol->out_section >= 0) {
+    return symbol->out_section;
+  }
+  return symbol->input->out_sections[symbol->section];
+}
+
+// Addresses fit in an int: the image ends below max_image_end(), and the
+// values of absolute symbols are checked as they are read.
+int symbol_address(linker_t *ctx, link_symbol_t *symbol) {
+  if (symbol->is_absolute) {
+    return symbol->value;
+  }
+  int out = symbol_out_section(symbol);
+  if (out < 0) {
+    return 0;
+  }
+  if (symbol->is_section_end) {
+    return ctx->out_addresses[out] + ctx->out_sizes[out];
+  }
+  if (symbol->out_section >= 0) {
+    return ctx->out_addresses[out] + symbol->value;
+  }
+  return ctx->out_addresses[out] +
+         symbol->input->out_offsets[symbol->section] + symbol->value;
+}
+
+int local_address(linker_t *ctx, link_input_t *input, int symbol) {
+  int section = symbol_field(input, symbol, 6, 2);
+  int value = symbol_field(input, symbol, 8, 8);
+  if (section == 65521) {
+    if (!is_int_value(input, symbol)) {
+      link_error(ctx, "%s has an absolute symbol out of range", input->path);
+    }
+    return value;
+  }
+  if (section == 0 || section >= input->section_count) {
+    return 0;
+  }
+  int out = input->out_sections[section];
+  if (out < 0) {
+    return 0;
+  }
+  return ctx->out_addresses[out] + input->out_offsets[section] + value;
+}
+
+// sets width bits of the instruction at p from bit shift up to the value
+void patch_field(char *p, int value, int shift, int width) {
+  int mask = (1 << width) - 1;
+  if (width == 32) {
+    mask = -1;
+  }
+  int word = read_le(p, 4);
+  word = (word & ~(mask << shift)) | ((value & mask) << shift);
+  write_le(p, word, 4);
+}
+
+// sets the 21-bit immediate of an adr or adrp, split in two fields
+void patch_adr(char *p, int value) {
+  patch_field(p, value & 3, 29, 2);
+  patch_field(p, value >> 2, 5, 19);
+}
+
+int page_of(int address) {
+  return address & -4096;
+}
+
+// whether the value fits in a signed field of the width
+int fits_signed(int value, int width) {
+  int limit = 1 << (width - 1);
+  return value >= -limit && value < limit;
+}
+
+// Applies a relocation at p, which ends up at place, to the symbol at
+// address, whose GOT entry, if it has one, is at got. Returns 0 if the value
+// does not fit in its field, which is only checked by the types without _nc.
+int relocate(char *p, int type, int address, int addend, int place,
+             int got) {
+  int value = address + addend;
+  int fits = 1;
+  if (type == 257 || type == 258 || type == 259) {
+    write_le(p, value, 8 >> (type - 257));
+    if (type == 259) {
+      fits = value >= -32768 && value < 65536;
+    }
+  } else if (type == 260 || type == 261 || type == 262) {
+    write_le(p, value - place, 8 >> (type - 260));
+    if (type == 262) {
+      fits = value - place >= -32768 && value - place < 65536;
+    }
+  } else if (type == 263 || type == 264) {
+    patch_field(p, value, 5, 16);
+    if (type == 263) {
+      fits = value >= 0 && value < 65536;
+    }
+  } else if (type == 265 || type == 266) {
+    patch_field(p, value >> 16, 5, 16);
+    if (type == 265) {
+      fits = value >= 0;
+    }
+  } else if (type >= 267 && type <= 269) {
+    // the value is an int, so its bits from 32 up are 0 unless it is
+    // negative, which even g2_nc and g3 cannot take here
+    patch_field(p, 0, 5, 16);
+    fits = value >= 0;
+  } else if (type == 273) {
+    patch_field(p, (value - place) >> 2, 5, 19);
+    fits = fits_signed(value - place, 21);
+  } else if (type == 274) {
+    patch_adr(p, value - place);
+    fits = fits_signed(value - place, 21);
+  } else if (type == 275 || type == 276) {
+    int pages = (page_of(value) - page_of(place)) >> 12;
+    patch_adr(p, pages);
+    if (type == 275) {
+      fits = fits_signed(pages, 21);
+    }
+  } else if (type == 277 || type == 278) {
+    patch_field(p, value, 10, 12);
+  } else if (type == 284) {
+    patch_field(p, (value & 4095) >> 1, 10, 12);
+  } else if (type == 285) {
+    patch_field(p, (value & 4095) >> 2, 10, 12);
+  } else if (type == 286) {
+    patch_field(p, (value & 4095) >> 3, 10, 12);
+  } else if (type == 299) {
+    patch_field(p, (value & 4095) >> 4, 10, 12);
+  } else if (type == 279) {
+    patch_field(p, (value - place) >> 2, 5, 14);
+    fits = fits_signed(value - place, 16);
+  } else if (type == 280) {
+    patch_field(p, (value - place) >> 2, 5, 19);
+    fits = fits_signed(value - place, 21);
+  } else if (type == 282 || type == 283) {
+    patch_field(p, (value - place) >> 2, 0, 26);
+    fits = fits_signed(value - place, 28);
+  } else if (type == 311) {
+    int pages = (page_of(got) - page_of(place)) >> 12;
+    patch_adr(p, pages);
+    fits = fits_signed(pages, 21);
+  } else if (type == 312) {
+    patch_field(p, (got & 4095) >> 3, 10, 12);
+  }
+  return fits;
+}
+
+void apply_relocs(linker_t *ctx, link_input_t *input) {
+  int section = 1;
+  while (section < input->section_count) {
+    int target = section_field(input, section, 44, 4);
+    if (section_field(input, section, 4, 4) != 4 ||
+        input->out_sections[target] < 0) {
+      section++;
+      continue;
+    }
+    int out = input->out_sections[target];
+    char *base = ctx->out_bytes[out]->data + input->out_offsets[target];
+    int place_base = ctx->out_addresses[out] + input->out_offsets[target];
+    char *rela = input->buf + section_field(input, section, 24, 8);
+    int count = section_field(input, section, 32, 8) / 24;
+    int i = 0;
+    while (i < count) {
+      char *entry = rela + i * 24;
+      int offset = read_le(entry, 8);
+      int type = read_le(entry + 8, 4);
+      int symbol = read_le(entry + 12, 4);
+      int addend = read_le(entry + 16, 8);
+      int place = place_base + offset;
+      link_symbol_t *global = reloc_global(ctx, input, symbol);
+      int address = 0;
+      int got = 0;
+      if (global == NULL) {
+        address = local_address(ctx, input, symbol);
+      } else if (global->is_defined) {
+        address = symbol_address(ctx, global);
+      } else if (type == 282 || type == 283) {
+        // a branch to an undefined weak function falls through
+        address = place + 4;
+        addend = 0;
+      }
+      if (global && global->got_index >= 0) {
+        got = ctx->out_addresses[out_got()] + global->got_index * 8;
+      }
+      if (!relocate(base + offset, type, address, addend, place, got)) {
+        link_error(ctx, "%s has a relocation out of range", input->path);
+      }
+      i++;
+    }
+    section++;
+  }
+}
+
+// Writes the executable: the ELF header and the program headers, the output
+// sections, and then a symbol table of the global symbols, which is not
+// needed to run it but helps tools, and the section headers.
+void write_executable(linker_t *ctx, FILE *fp, int rw_offset,
+                      int rw_address) {
+  // the output sections with something in them get section headers
+  int *indexes = calloc(out_count(), sizeof(int));
+  int section_count = 1;
+  int out = 0;
+  while (out < out_count()) {
+    if (ctx->out_sizes[out]) {
+      indexes[out] = section_count;
+      section_count++;
+    }
+    out++;
+  }
+  int symtab_index = section_count;
+  section_count += 3;
+
+  bytes_t *symtab = new_bytes();
+  bytes_t *strtab = new_bytes();
+  add_zeros(symtab, 24);
+  add_byte(strtab, 0);
+  int i = 0;
+  while (i < ctx->symbol_len) {
+    link_symbol_t *symbol = ctx->symbols[i];
+    i++;
+    if (!symbol->is_defined) {
+      continue;
+    }
+    int shndx = 65521;
+    int symbol_out = symbol_out_section(symbol);
+    if (symbol_out >= 0 && indexes[symbol_out]) {
+      shndx = indexes[symbol_out];
+    }
+    int bind = 1;
+    if (symbol->is_weak) {
+      bind = 2;
+    }
+    add_le(symtab, add_cstring(strtab, symbol->name), 4);
+    add_byte(symtab, (bind << 4) | symbol->type);
+    add_byte(symtab, 0);
+    add_le(symtab, shndx, 2);
+    add_le(symtab, symbol_address(ctx, symbol), 8);
+    add_le(symtab, symbol->size, 8);
+  }
+  bytes_t *shstrtab = new_bytes();
+  add_byte(shstrtab, 0);
+
+  int rw_file_size = ctx->out_file_offsets[out_bss()] - rw_offset;
+  int rw_mem_size =
+      ctx->out_addresses[out_bss()] + ctx->out_sizes[out_bss()] - rw_address;
+  int symtab_offset = align_up(rw_offset + rw_file_size, 8);
+  int strtab_offset = symtab_offset + symtab->len;
+  int shstrtab_offset = strtab_offset + strtab->len;
+  // the section names, added below, are at most 16 bytes each
+  int headers_offset = align_up(shstrtab_offset + 16 * section_count, 8);
+
+  writer_t *w = new_writer(fp);
+  put_char(w, 127);
+  put_str(w, "ELF");
+  put_le(w, 2, 1);
+  put_le(w, 1, 1);
+  put_le(w, 1, 1);
+  put_le(w, 0, 9);
+  // an executable for AArch64
+  put_le(w, 2, 2);
+  put_le(w, 183, 2);
+  put_le(w, 1, 4);
+  put_le(w, symbol_address(ctx, lookup_link_symbol(ctx, "_start")), 8);
+  put_le(w, 64, 8);
+  put_le(w, headers_offset, 8);
+  put_le(w, 0, 4);
+  put_le(w, 64, 2);
+  put_le(w, 56, 2);
+  put_le(w, 3, 2);
+  put_le(w, 64, 2);
+  put_le(w, section_count, 2);
+  put_le(w, section_count - 1, 2);
+
+  // a read and execute load, a read and write one, and a non-executable
+  // stack
+  put_le(w, 1, 4);
+  put_le(w, 5, 4);
+  put_le(w, 0, 8);
+  put_le(w, link_base(), 8);
+  put_le(w, link_base(), 8);
+  put_le(w, rw_offset, 8);
+  put_le(w, rw_offset, 8);
+  put_le(w, segment_align(), 8);
+  put_le(w, 1, 4);
+  put_le(w, 6, 4);
+  put_le(w, rw_offset, 8);
+  put_le(w, rw_address, 8);
+  put_le(w, rw_address, 8);
+  put_le(w, rw_file_size, 8);
+  put_le(w, rw_mem_size, 8);
+  put_le(w, segment_align(), 8);
+  put_le(w, 1685382481, 4);
+  put_le(w, 6, 4);
+  put_le(w, 0, 8 * 5);
+  put_le(w, 16, 8);
+
+  out = 0;
+  while (out < out_bss()) {
+    while (writer_size(w) < ctx->out_file_offsets[out]) {
+      put_char(w, 0);
+    }
+    put_bytes(w, ctx->out_bytes[out]->data, ctx->out_sizes[out]);
+    out++;
+  }
+  while (writer_size(w) < symtab_offset) {
+    put_char(w, 0);
+  }
+  put_bytes(w, symtab->data, symtab->len);
+  put_bytes(w, strtab->data, strtab->len);
+
+  // types: 1 progbits, 2 symtab, 3 strtab, 8 nobits, 14 to 16 the arrays.
+  // flags: 1 write, 2 alloc, 4 exec
+  int *types = calloc(out_count(), sizeof(int));
+  int *flags = calloc(out_count(), sizeof(int));
+  out = 0;
+  while (out < out_count()) {
+    types[out] = 1;
+    flags[out] = 3;
+    out++;
+  }
+  flags[out_init()] = 6;
+  flags[out_text()] = 6;
+  flags[out_fini()] = 6;
+  flags[out_rodata()] = 2;
+  types[out_preinit_array()] = 16;
+  types[out_init_array()] = 14;
+  types[out_fini_array()] = 15;
+  types[out_bss()] = 8;
+
+  bytes_t *headers = new_bytes();
+  add_zeros(headers, 64);
+  out = 0;
+  while (out < out_count()) {
+    if (indexes[out]) {
+      add_le(headers, add_cstring(shstrtab, ctx->out_names[out]), 4);
+      add_le(headers, types[out], 4);
+      add_le(headers, flags[out], 8);
+      add_le(headers, ctx->out_addresses[out], 8);
+      add_le(headers, ctx->out_file_offsets[out], 8);
+      add_le(headers, ctx->out_sizes[out], 8);
+      add_le(headers, 0, 8);
+      add_le(headers, ctx->out_aligns[out], 8);
+      add_le(headers, 0, 8);
+    }
+    out++;
+  }
+  add_le(headers, add_cstring(shstrtab, ".symtab"), 4);
+  add_le(headers, 2, 4);
+  add_le(headers, 0, 8);
+  add_le(headers, 0, 8);
+  add_le(headers, symtab_offset, 8);
+  add_le(headers, symtab->len, 8);
+  add_le(headers, symtab_index + 1, 4);
+  add_le(headers, 1, 4);
+  add_le(headers, 8, 8);
+  add_le(headers, 24, 8);
+  add_le(headers, add_cstring(shstrtab, ".strtab"), 4);
+  add_le(headers, 3, 4);
+  add_le(headers, 0, 8 * 2);
+  add_le(headers, strtab_offset, 8);
+  add_le(headers, strtab->len, 8);
+  add_le(headers, 0, 8);
+  add_le(headers, 1, 8);
+  add_le(headers, 0, 8);
+  add_le(headers, add_cstring(shstrtab, ".shstrtab"), 4);
+  add_le(headers, 3, 4);
+  add_le(headers, 0, 8 * 2);
+  add_le(headers, shstrtab_offset, 8);
+  add_le(headers, shstrtab->len, 8);
+  add_le(headers, 0, 8);
+  add_le(headers, 1, 8);
+  add_le(headers, 0, 8);
+
+  put_bytes(w, shstrtab->data, shstrtab->len);
+  while (writer_size(w) < headers_offset) {
+    put_char(w, 0);
+  }
+  put_bytes(w, headers->data, headers->len);
+  flush_writer(w);
+}
+
+linker_t *new_linker() {
+  linker_t *ctx = calloc(1, sizeof(linker_t));
+  int count = out_count();
+  ctx->out_names = calloc(count, sizeof(char *));
+  ctx->out_bytes = calloc(count, sizeof(bytes_t *));
+  ctx->out_sizes = calloc(count, sizeof(int));
+  ctx->out_aligns = calloc(count, sizeof(int));
+  ctx->out_addresses = calloc(count, sizeof(int));
+  ctx->out_file_offsets = calloc(count, sizeof(int));
+  int i = 0;
+  while (i < count) {
+    ctx->out_bytes[i] = new_bytes();
+    ctx->out_aligns[i] = 1;
+    i++;
+  }
+  ctx->out_names[out_init()] = ".init";
+  ctx->out_names[out_text()] = ".text";
+  ctx->out_names[out_fini()] = ".fini";
+  ctx->out_names[out_rodata()] = ".rodata";
+  ctx->out_names[out_preinit_array()] = ".preinit_array";
+  ctx->out_names[out_init_array()] = ".init_array";
+  ctx->out_names[out_fini_array()] = ".fini_array";
+  ctx->out_names[out_data()] = ".data";
+  ctx->out_names[out_got()] = ".got";
+  ctx->out_names[out_bss()] = ".bss";
+  return ctx;
+}
+
+int link_executable(char *out_path, char **inputs, int input_len,
+                    char **reason) {
+  linker_t *ctx = new_linker();
+  load_inputs(ctx, inputs, input_len);
+  if (!ctx->error) {
+    define_linker_symbols(ctx);
+  }
+  if (!ctx->error) {
+    check_sections(ctx);
+  }
+  if (!ctx->error) {
+    scan_relocs(ctx);
+  }
+  if (ctx->error) {
+    *reason = ctx->error;
+    return 0;
+  }
+
+  layout_sections(ctx);
+  int rw_offset = 0;
+  int rw_address = 0;
+  assign_addresses(ctx, &rw_offset, &rw_address);
+  if (ctx->error) {
+    *reason = ctx->error;
+    return 0;
+  }
+  int i = 0;
+  while (i < ctx->symbol_len) {
+    link_symbol_t *symbol = ctx->symbols[i];
+    if (symbol->got_index >= 0) {
+      write_le(ctx->out_bytes[out_got()]->data + symbol->got_index * 8,
+               symbol_address(ctx, symbol), 8);
+    }
+    i++;
+  }
+  i = 0;
+  while (i < ctx->loaded_len) {
+    apply_relocs(ctx, ctx->loaded[i]);
+    i++;
+  }
+  if (ctx->error) {
+    *reason = ctx->error;
+    return 0;
+  }
+
+  FILE *fp = fopen(out_path, "wb");
+  if (fp == NULL) {
+    *reason = "cannot open the output";
+    return 0;
+  }
+  write_executable(ctx, fp, rw_offset, rw_address);
+  fclose(fp);
+  make_executable(out_path);
+  return 1;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// A static linker for AArch64 ELF objects, such as the ones ccc -c writes,
+// and archives of them, such as a static libc. Objects are all linked, and
+// the members of the archives are linked, as one group, for as long as they
+// define symbols still needed. The result is a static executable entered at
+// _start, with the code and read-only data in one segment and the writable
+// data in another.
+//
+// Only what plain C code needs is supported: thread-local storage, ifuncs,
+// and relocation types other than the usual data, branch, page, low 12 bits
+// and GOT ones are not.
+
+// Links the inputs into an executable at out_path and returns 1. Returns 0
+// without writing anything, and sets *reason, if the inputs need something
+// the linker does not support or do not link.
+int link_executable(char *out_path, char **inputs, int input_len,
+                    char **reason);
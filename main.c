@@ -1,24 +1,411 @@
+#include "assembler.h"
 #include "codegen.h"
+#include "codegen_bytecode.h"
 #include "error.h"
+#include "linker.h"
+#include "os.h"
+#include "parallel_lex.h"
 #include "parser.h"
+#include "pch.h"
+#include "preprocessor.h"
 #include "tokenizer.h"
 #include <stdlib.h>
+#include <string.h>
+
+// reads every token of the file into one token array and returns the number
+// read, including the TOKEN_EOF
+int read_all_tokens(tokenizer_ctx_t *ctx, token_array_t *tokens) {
+  int len = 0;
+  while (1) {
+    if (len == tokens->cap) {
+      grow_token_array(tokens, tokens->cap * 2);
+    }
+    read_token(ctx, tokens, len);
+    len++;
+    if (tokens->kinds[len - 1] == TOKEN_EOF) {
+      return len;
+    }
+  }
+}
+
+int elapsed_since(int start) {
+  int elapsed = now_usec() - start;
+  if (elapsed <= 0) {
+    return 1;
+  }
+  return elapsed;
+}
+
+// prints tokenizer throughput for the given source to stderr. The tokens are
+// kept in one token array to report how compact the storage is.
+token_array_t *bench_lex(tokenizer_ctx_t *ctx, int size) {
+  int start = now_usec();
+  token_array_t *tokens = new_token_array(1024);
+  int len = read_all_tokens(ctx, tokens);
+  int elapsed = elapsed_since(start);
+
+  int bytes = token_array_bytes(len);
+  fprintf(stderr, "lex: %d bytes, %d tokens, %d us, %d.%02d MB/s\n", size,
+          len, elapsed, size / elapsed, (size % elapsed) * 100 / elapsed);
+  fprintf(stderr, "lex: %d bytes of token storage, %d.%02d bytes/token\n",
+          bytes, bytes / len, (bytes % len) * 100 / len);
+  fprintf(stderr, "lex: %d bytes allocated for tokens\n",
+          token_array_bytes(tokens->cap));
+  return tokens;
+}
+
+// prints the throughput of lexing the file in parallel on 1 up to threads
+// threads, and checks that the tokens match the serial ones. Lexing NULs
+// identifiers in place, so every run maps the file afresh. Returns 0 if the
+// tokens of every run matched.
+int bench_parallel_lex(char *path, int is_scalar, int threads,
+                       token_array_t *expected) {
+  int differ = 0;
+  int t = 1;
+  while (t <= threads) {
+    int size;
+    char *buf = map_file(path, &size);
+    tokenizer_ctx_t *ctx = new_tokenizer_ctx(buf, size);
+    ctx->is_scalar = is_scalar;
+    ctx->records_errors = 1;
+
+    int start = now_usec();
+    lex_in_parallel(ctx, t);
+    token_array_t *tokens = new_token_array(1024);
+    int len = read_all_tokens(ctx, tokens);
+    int elapsed = elapsed_since(start);
+
+    // both end in EOF, so the first difference comes before either end
+    int is_same = ctx->error_message == NULL;
+    int i = 0;
+    while (i < len && is_same) {
+      if (tokens->kinds[i] != expected->kinds[i] ||
+          tokens->positions[i].line != expected->positions[i].line ||
+          tokens->positions[i].column != expected->positions[i].column ||
+          tokens->values[i] != expected->values[i]) {
+        is_same = 0;
+      }
+      i++;
+    }
+
+    char *result = "same tokens";
+    if (!is_same) {
+      result = "tokens differ";
+      differ = 1;
+    }
+    fprintf(stderr, "lex: %d threads, %d us, %d.%02d MB/s, %s\n", t, elapsed,
+            size / elapsed, (size % elapsed) * 100 / elapsed, result);
+    t++;
+  }
+  return differ;
+}
+
+// prints the rate at which nodes are built by the parser and walked by
+// codegen to stderr, in thousands of nodes per second
+void report_node_rate(char *phase, int nodes, int elapsed) {
+  int ms = elapsed / 1000;
+  if (ms == 0) {
+    ms = 1;
+  }
+  fprintf(stderr, "%s: %d nodes, %d us, %d k nodes/s\n", phase, nodes,
+          elapsed, nodes / ms);
+}
+
+// Parses the file again on threads threads, and reports the rate and whether
+// the nodes match the ones parsed before, which are set aside.
+program_t *bench_parallel_parse(char *path, int is_scalar, char **include_dirs,
+                                int include_dir_len, char *builtin_dir,
+                                int threads) {
+  ast_t *expected = detach_ast();
+
+  int size;
+  char *buf = map_file(path, &size);
+  tokenizer_ctx_t *tokenizer = new_tokenizer_ctx(buf, size);
+  tokenizer->is_scalar = is_scalar;
+  preprocessor_ctx_t *preprocessor = new_preprocessor_ctx(path, tokenizer);
+  int i = 0;
+  while (i < include_dir_len) {
+    add_include_dir(preprocessor, include_dirs[i]);
+    i++;
+  }
+  add_include_dir(preprocessor, builtin_dir);
+
+  int start = now_usec();
+  program_t *program = parse(preprocessor, NULL, threads);
+  int elapsed = elapsed_since(start);
+
+  char *result = "same nodes";
+  if (!is_same_ast(expected, main_ast())) {
+    result = "NODES DIFFER";
+  }
+  int ms = elapsed / 1000;
+  if (ms == 0) {
+    ms = 1;
+  }
+  fprintf(stderr, "parse: %d threads, %d us, %d k nodes/s, %s\n", threads,
+          elapsed, ast_node_count() / ms, result);
+  return program;
+}
+
+// returns the include directory installed next to the compiler
+char *builtin_include_dir(char *argv0) {
+  int len = strlen(argv0);
+  while (len > 0 && argv0[len - 1] != '/') {
+    len--;
+  }
+
+  char *dir = calloc(len + 8, 1);
+  memcpy(dir, argv0, len);
+  memcpy(dir + len, "include", 7);
+  return dir;
+}
+
+// returns the object file cc -c would write for the source, which is in the
+// current directory
+char *object_path(char *source) {
+  char *name = source;
+  char *p = source;
+  while (*p) {
+    if (*p == '/') {
+      name = p + 1;
+    }
+    p++;
+  }
+
+  int len = strlen(name);
+  if (len > 2 && name[len - 2] == '.' && name[len - 1] == 'c') {
+    len -= 2;
+  }
+  char *path = calloc(len + 3, 1);
+  memcpy(path, name, len);
+  memcpy(path + len, ".o", 2);
+  return path;
+}
+
+// Links the objects and archives with the built-in linker, or with the
+// system's ld when the inputs need something it does not support.
+int link_files(char *out_path, char **inputs, int input_len) {
+  char *reason;
+  if (link_executable(out_path, inputs, input_len, &reason)) {
+    return 0;
+  }
+  fprintf(stderr, "ccc: %s, linking with ld\n", reason);
+
+  int out_size = strlen(out_path);
+  int len = out_size + 64;
+  int i = 0;
+  while (i < input_len) {
+    int input_size = strlen(inputs[i]);
+    len += input_size + 3;
+    i++;
+  }
+  char *command = calloc(len, 1);
+  strcat(command, "ld -static -o '");
+  strcat(command, out_path);
+  strcat(command, "' --start-group");
+  i = 0;
+  while (i < input_len) {
+    strcat(command, " '");
+    strcat(command, inputs[i]);
+    strcat(command, "'");
+    i++;
+  }
+  strcat(command, " --end-group");
+  int status = system(command);
+  return status != 0;
+}
 
 int main(int argc, char **argv) {
-  if (argc != 2) {
-    printf("usage: %s <file>\n", argv[0]);
+  int is_bench_lex = 0;
+  int is_scalar_lex = 0;
+  int is_bench_parse = 0;
+  int is_object = 0;
+  int is_link = 0;
+  int is_run = 0;
+  target_t target = TARGET_AARCH64;
+  int lex_threads = cpu_count();
+  int parse_threads = cpu_count();
+  char *filepath = NULL;
+  char *out_path = NULL;
+  char *emit_pch = NULL;
+  char *include_pch = NULL;
+  char **include_dirs = calloc(argc, sizeof(char *));
+  int include_dir_len = 0;
+  // with --link, every file given is an input
+  char **inputs = calloc(argc, sizeof(char *));
+  int input_len = 0;
+  // with --run, the file and the arguments after it are the program's
+  int run_argc = 0;
+  char **run_argv = NULL;
+
+  int i = 1;
+  while (i < argc) {
+    if (!strcmp(argv[i], "--bench-lex")) {
+      is_bench_lex = 1;
+    } else if (!strcmp(argv[i], "--bench-parse")) {
+      is_bench_parse = 1;
+    } else if (!strcmp(argv[i], "--scalar-lex")) {
+      is_scalar_lex = 1;
+    } else if (!strcmp(argv[i], "--lex-threads") && i + 1 < argc) {
+      i++;
+      lex_threads = atoi(argv[i]);
+    } else if (!strcmp(argv[i], "--parse-threads") && i + 1 < argc) {
+      i++;
+      parse_threads = atoi(argv[i]);
+    } else if (!strcmp(argv[i], "-c")) {
+      is_object = 1;
+    } else if (!strcmp(argv[i], "--target=x86_64")) {
+      target = TARGET_X86_64;
+    } else if (!strcmp(argv[i], "--target=aarch64")) {
+      target = TARGET_AARCH64;
+    } else if (!strcmp(argv[i], "--link")) {
+      is_link = 1;
+    } else if (!strcmp(argv[i], "--run")) {
+      is_run = 1;
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      i++;
+      out_path = argv[i];
+    } else if (!strcmp(argv[i], "--emit-pch") && i + 1 < argc) {
+      i++;
+      emit_pch = argv[i];
+    } else if (!strcmp(argv[i], "--include-pch") && i + 1 < argc) {
+      i++;
+      include_pch = argv[i];
+    } else if (!strcmp(argv[i], "-I") && i + 1 < argc) {
+      i++;
+      include_dirs[include_dir_len] = argv[i];
+      include_dir_len++;
+    } else if (!strncmp(argv[i], "-I", 2)) {
+      include_dirs[include_dir_len] = argv[i] + 2;
+      include_dir_len++;
+    } else {
+      filepath = argv[i];
+      inputs[input_len] = argv[i];
+      input_len++;
+      if (is_run) {
+        run_argc = argc - i;
+        run_argv = argv + i;
+        break;
+      }
+    }
+    i++;
+  }
+
+  if (is_link && input_len) {
+    if (out_path == NULL) {
+      out_path = "a.out";
+    }
+    return link_files(out_path, inputs, input_len);
+  }
+
+  if (filepath == NULL) {
+    printf("usage: %s [--bench-lex] [--bench-parse] [--scalar-lex]\n",
+           argv[0]);
+    printf("       [--lex-threads n] [--parse-threads n]\n");
+    printf("       [-I dir] [--emit-pch out] [--include-pch pch]\n");
+    printf("       [--target=aarch64|x86_64] [-c] [-o out] <file>\n");
+    printf("       %s --link [-o out] <objects and archives>\n", argv[0]);
+    printf("       %s --run <file> [args]\n", argv[0]);
     return 1;
   }
 
-  char *filepath = argv[1];
-  FILE *fp = fopen(filepath, "r");
-  if (fp == NULL) {
-    panic("failed to open file '%s'\n", argv[1]);
+  int size;
+  char *buf = map_file(filepath, &size);
+  if (buf == NULL) {
+    panic("failed to open file '%s'\n", filepath);
+  }
+
+  tokenizer_ctx_t *tokenizer = new_tokenizer_ctx(buf, size);
+  if (is_scalar_lex) {
+    tokenizer->is_scalar = 1;
+  }
+
+  if (is_bench_lex) {
+    token_array_t *tokens = bench_lex(tokenizer, size);
+    return bench_parallel_lex(filepath, tokenizer->is_scalar, lex_threads,
+                              tokens);
   }
 
-  token_t *token = tokenize(fp);
-  program_t *program = parse(token);
-  gen_code(program, filepath, stdout);
+  // files below a megabyte lex faster than threads start
+  if (lex_threads > 1 && size >= 1048576) {
+    lex_in_parallel(tokenizer, lex_threads);
+  }
+
+  preprocessor_ctx_t *preprocessor = new_preprocessor_ctx(filepath, tokenizer);
+  i = 0;
+  while (i < include_dir_len) {
+    add_include_dir(preprocessor, include_dirs[i]);
+    i++;
+  }
+  char *builtin_dir = builtin_include_dir(argv[0]);
+  add_include_dir(preprocessor, builtin_dir);
+
+  program_t *prelude = NULL;
+  if (include_pch) {
+    prelude = read_pch(include_pch, preprocessor);
+  }
+
+  // as with lexing, small files are parsed in order, and --bench-parse times
+  // the threads separately
+  int threads = parse_threads;
+  if (is_bench_parse || size < 1048576) {
+    threads = 1;
+  }
+
+  int start = now_usec();
+  program_t *program = parse(preprocessor, prelude, threads);
+  if (emit_pch) {
+    write_pch(emit_pch, preprocessor, program);
+    return 0;
+  }
+  if (is_bench_parse) {
+    int nodes = ast_node_count();
+    report_node_rate("parse", nodes, elapsed_since(start));
+    if (parse_threads > 1 && !include_pch) {
+      program = bench_parallel_parse(filepath, tokenizer->is_scalar,
+                                     include_dirs, include_dir_len,
+                                     builtin_dir, parse_threads);
+    }
+
+    start = now_usec();
+    writer_t *null_out = new_writer(fopen("/dev/null", "w"));
+    int bytes = gen_code(program, filepath, null_out, target);
+    int elapsed = elapsed_since(start);
+    report_node_rate("codegen", nodes, elapsed);
+    fprintf(stderr, "codegen: %d bytes of assembly, %d.%02d MB/s\n", bytes,
+            bytes / elapsed, (bytes % elapsed) * 100 / elapsed);
+    return 0;
+  }
+
+  if (is_run) {
+    bytecode_t *bc = gen_bytecode(program, filepath);
+    return run_bytecode(bc, run_argc, run_argv);
+  }
+
+  // with -c the assembly goes straight to the assembler
+  if (is_object) {
+    if (target != TARGET_AARCH64) {
+      panic("ccc: -c only assembles AArch64, use cc -c on the assembly\n");
+    }
+    if (out_path == NULL) {
+      out_path = object_path(filepath);
+    }
+    writer_t *out = new_writer(NULL);
+    out->assembler = new_assembler();
+    gen_code(program, filepath, out, target);
+    write_object(out->assembler, out_path);
+    return 0;
+  }
+
+  FILE *out_fp = stdout;
+  if (out_path) {
+    out_fp = fopen(out_path, "w");
+    if (out_fp == NULL) {
+      panic("failed to open file '%s'\n", out_path);
+    }
+  }
+  gen_code(program, filepath, new_writer(out_fp), target);
+  fclose(out_fp);
 
   return 0;
 }
@@ -0,0 +1,76 @@
+#define _POSIX_C_SOURCE 200809L
+#include "os.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+char *read_fd(int fd, int *size) {
+  int cap = 65536;
+  int len = 0;
+  char *buf = malloc(cap + 1);
+
+  while (1) {
+    int n = read(fd, buf + len, cap - len);
+    if (n <= 0) {
+      break;
+    }
+    len += n;
+    if (len == cap) {
+      cap *= 2;
+      buf = realloc(buf, cap + 1);
+    }
+  }
+
+  buf[len] = 0;
+  *size = len;
+  return buf;
+}
+
+char *map_file(char *path, int *size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+      st.st_size % page_size == 0) {
+    // pipes have no size, and a page-aligned file leaves no room in the
+    // mapping for the terminating NUL
+    char *buf = read_fd(fd, size);
+    close(fd);
+    return buf;
+  }
+
+  // the tail of the last page is zero-filled, so buf[size] is a NUL
+  char *buf = mmap(NULL, st.st_size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                   fd, 0);
+  close(fd);
+  if (buf == MAP_FAILED) {
+    return NULL;
+  }
+
+  *size = st.st_size;
+  return buf;
+}
+
+int now_usec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec % 1000) * 1000000 + ts.tv_nsec / 1000;
+}
+
+int cpu_count() {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  if (count < 1) {
+    return 1;
+  }
+  return count;
+}
+
+int make_executable(char *path) { return chmod(path, 0755); }
@@ -0,0 +1,13 @@
+#pragma once
+
+// Returns a writable, NUL-terminated copy-on-write view of the whole file, or
+// NULL if the file cannot be opened. The buffer lives until exit.
+char *map_file(char *path, int *size);
+
+int now_usec();
+
+// Returns the number of processors online, at least 1.
+int cpu_count();
+
+// Marks the file as executable by everyone. Returns 0 on success.
+int make_executable(char *path);
@@ -0,0 +1,41 @@
+#include "os.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Fallback for os.c used when ccc compiles itself, since the POSIX headers
+// are not available then.
+
+char *map_file(char *path, int *size) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    return NULL;
+  }
+
+  int cap = 65536;
+  int len = 0;
+  char *buf = malloc(cap + 1);
+
+  while (1) {
+    int n = fread(buf + len, 1, cap - len, fp);
+    if (n <= 0) {
+      break;
+    }
+    len += n;
+    if (len == cap) {
+      cap *= 2;
+      buf = realloc(buf, cap + 1);
+    }
+  }
+  fclose(fp);
+
+  buf[len] = 0;
+  *size = len;
+  return buf;
+}
+
+int now_usec() { return 0; }
+
+int cpu_count() { return 1; }
+
+// 493 is 0755, ccc has no octal literals
+int make_executable(char *path) { return chmod(path, 493); }
@@ -0,0 +1,222 @@
+#include "parallel_lex.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+void lex_chunk(lex_chunk_t *chunk) {
+  tokenizer_ctx_t *ctx = chunk->tokenizer;
+
+  // about one token per four bytes of source
+  int cap = (chunk->end - chunk->start) / 4 + 16;
+  chunk->tokens = new_token_array(cap);
+  chunk->hashes = malloc(cap * sizeof(int));
+
+  int len = 0;
+  while (1) {
+    if (len == chunk->tokens->cap) {
+      grow_token_array(chunk->tokens, chunk->tokens->cap * 2);
+      chunk->hashes =
+          realloc(chunk->hashes, chunk->tokens->cap * sizeof(int));
+    }
+    ctx->hashes = chunk->hashes;
+    read_token(ctx, chunk->tokens, len);
+    if (ctx->error_message || chunk->tokens->kinds[len] == TOKEN_EOF) {
+      break;
+    }
+    len++;
+  }
+  chunk->len = len;
+}
+
+// Returns the index after the newline that ends the line starting at i, and
+// counts the lines passed. Newlines inside string and char literals do not
+// end the line, and neither do quotes inside a comment.
+int skip_source_line(char *buf, int i, int size, int *line) {
+  int quote = 0;
+  while (i < size) {
+    char c = buf[i];
+    i++;
+    if (c == '\n') {
+      *line = *line + 1;
+      if (!quote) {
+        return i;
+      }
+    } else if (quote) {
+      if (c == '\\' && i < size) {
+        if (buf[i] == '\n') {
+          *line = *line + 1;
+        }
+        i++;
+      } else if (c == quote) {
+        quote = 0;
+      }
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+    } else if (c == '/' && i < size && buf[i] == '/') {
+      while (i < size && buf[i] != '\n') {
+        i++;
+      }
+    }
+  }
+  return i;
+}
+
+// returns how the directive starting at the '#' at i changes the depth of
+// conditionals
+int conditional_depth_change(char *buf, int i) {
+  i++;
+  while (buf[i] != '\n' && isspace(buf[i])) {
+    i++;
+  }
+  if (!strncmp(buf + i, "if", 2)) {
+    return 1;
+  }
+  if (!strncmp(buf + i, "endif", 5)) {
+    return -1;
+  }
+  return 0;
+}
+
+lex_chunk_t *new_lex_chunk(tokenizer_ctx_t *ctx, int start, int end, int line,
+                           int end_line) {
+  lex_chunk_t *chunk = calloc(1, sizeof(lex_chunk_t));
+  chunk->start = start;
+  chunk->end = end;
+  chunk->line = line;
+  chunk->end_line = end_line;
+
+  // made here rather than on the lexing thread, since it sets up the shared
+  // keyword table
+  chunk->tokenizer = new_tokenizer_ctx(ctx->buf, end);
+  chunk->tokenizer->index = start;
+  chunk->tokenizer->line = line;
+  chunk->tokenizer->is_scalar = ctx->is_scalar;
+  return chunk;
+}
+
+// joins the tokens of the chunks in order, merging chunks that follow each
+// other into one stretch
+lexed_t *join_lex_chunks(lex_chunk_t **chunks, int len) {
+  int total = 0;
+  int i = 0;
+  while (i < len) {
+    total += chunks[i]->len;
+    i++;
+  }
+
+  lexed_t *lexed = calloc(1, sizeof(lexed_t));
+  lexed->tokens = new_token_array(total + 1);
+  lexed->hashes = malloc((total + 1) * sizeof(int));
+  lexed->starts = calloc(len, sizeof(int));
+  lexed->ends = calloc(len, sizeof(int));
+  lexed->end_lines = calloc(len, sizeof(int));
+  lexed->token_starts = calloc(len, sizeof(int));
+  lexed->token_ends = calloc(len, sizeof(int));
+  lexed->cur = -1;
+  lexed->error_token = -1;
+
+  int n = 0;
+  i = 0;
+  while (i < len) {
+    lex_chunk_t *chunk = chunks[i];
+    if (lexed->len == 0 || lexed->ends[lexed->len - 1] != chunk->start) {
+      lexed->starts[lexed->len] = chunk->start;
+      lexed->token_starts[lexed->len] = n;
+      lexed->len++;
+    }
+
+    token_array_t *tokens = lexed->tokens;
+    memcpy(tokens->kinds + n, chunk->tokens->kinds,
+           chunk->len * sizeof(tokentype_t));
+    memcpy(tokens->positions + n, chunk->tokens->positions,
+           chunk->len * sizeof(pos_t));
+    memcpy(tokens->values + n, chunk->tokens->values, chunk->len * sizeof(int));
+    memcpy(lexed->hashes + n, chunk->hashes, chunk->len * sizeof(int));
+    n += chunk->len;
+
+    int stretch = lexed->len - 1;
+    lexed->ends[stretch] = chunk->end;
+    lexed->end_lines[stretch] = chunk->end_line;
+    lexed->token_ends[stretch] = n;
+
+    tokenizer_ctx_t *tokenizer = chunk->tokenizer;
+    if (tokenizer->error_message) {
+      // nothing after the error can be reached
+      lexed->error_token = n;
+      lexed->error_pos = tokenizer->error_pos;
+      lexed->error_message = tokenizer->error_message;
+      break;
+    }
+    i++;
+  }
+  return lexed;
+}
+
+// A line can start a chunk if it starts outside of any literal, is no
+// directive, ends on the line it starts and is outside of any conditional,
+// since a group skipped by a conditional is never lexed and its text may not
+// even be valid. Directives and the other lines are lexed as they are
+// reached.
+void lex_in_parallel(tokenizer_ctx_t *ctx, int threads) {
+  char *buf = ctx->buf;
+  int size = ctx->size;
+  int chunk_size = 262144;
+
+  lex_chunk_t **chunks = NULL;
+  int len = 0;
+  int cap = 0;
+
+  int depth = 0;
+  int start = -1;
+  int start_line = 0;
+  int i = ctx->index;
+  int line = ctx->line;
+  while (i < size) {
+    int head = i;
+    while (head < size && buf[head] != '\n' && isspace(buf[head])) {
+      head++;
+    }
+    int is_directive = head < size && buf[head] == '#';
+
+    int next_line = line;
+    int next = skip_source_line(buf, i, size, &next_line);
+    int is_plain = !is_directive && depth == 0 && next_line - line <= 1;
+
+    if (start >= 0 && (!is_plain || i - start >= chunk_size)) {
+      if (len == cap) {
+        cap = cap * 2 + 16;
+        chunks = realloc(chunks, cap * sizeof(lex_chunk_t *));
+      }
+      chunks[len] = new_lex_chunk(ctx, start, i, start_line, line);
+      len++;
+      start = -1;
+    }
+    if (is_plain && start < 0) {
+      start = i;
+      start_line = line;
+    }
+    if (is_directive) {
+      depth += conditional_depth_change(buf, head);
+      if (depth < 0) {
+        depth = 0;
+      }
+    }
+
+    i = next;
+    line = next_line;
+  }
+  if (start >= 0) {
+    if (len == cap) {
+      cap = cap * 2 + 16;
+      chunks = realloc(chunks, cap * sizeof(lex_chunk_t *));
+    }
+    chunks[len] = new_lex_chunk(ctx, start, size, start_line, line);
+    len++;
+  }
+
+  if (len == 0) {
+    return;
+  }
+  run_lex_chunks(chunks, len, threads);
+  ctx->lexed = join_lex_chunks(chunks, len);
+}
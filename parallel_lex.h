@@ -0,0 +1,31 @@
+#pragma once
+#include "tokenizer.h"
+
+// A piece of the file lexed on its own: the bytes from start up to end, which
+// begin at line and finish at end_line. Pieces end right after a newline, so
+// no token and no byte written in place crosses into the next one.
+typedef struct {
+  tokenizer_ctx_t *tokenizer;
+  int start;
+  int end;
+  int line;
+  int end_line;
+
+  token_array_t *tokens;
+  int *hashes;
+  int len;
+} lex_chunk_t;
+
+// Lexes the chunk with its own tokenizer, without touching shared state.
+void lex_chunk(lex_chunk_t *chunk);
+
+// Lexes every chunk, spread over up to threads threads. Implemented in
+// lex_threads.c, or lex_threads_portable.c when ccc compiles itself.
+void run_lex_chunks(lex_chunk_t **chunks, int len, int threads);
+
+// Lexes the file read by ctx ahead of time on up to threads threads, and has
+// ctx serve those tokens. The stretches between directives that are outside
+// of any conditional are split into chunks at lines that start outside of
+// string and char literals; the rest of the file is lexed as it is reached.
+// The tokens served are exactly the ones ctx would have read.
+void lex_in_parallel(tokenizer_ctx_t *ctx, int threads);
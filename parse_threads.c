@@ -0,0 +1,83 @@
+#include "parser.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+pthread_mutex_t type_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+  skimmed_body_t **bodies;
+  int len;
+  int first;
+  int step;
+} parse_worker_t;
+
+// bodies are dealt out in turn, so that every thread gets a share of each
+// part of the file
+void *run_parse_worker(void *arg) {
+  parse_worker_t *worker = arg;
+  int i = worker->first;
+  while (i < worker->len) {
+    parse_skimmed_body(worker->bodies[i], 1);
+    i += worker->step;
+  }
+  return NULL;
+}
+
+// A worker that hits an error ends its thread, so every share runs on a thread
+// of its own and the calling thread only waits. A share whose thread cannot
+// be started is left to the calling thread.
+void run_body_parses(skimmed_body_t **bodies, int len, int threads) {
+  if (threads > len) {
+    threads = len;
+  }
+  if (threads < 1) {
+    return;
+  }
+
+  parse_worker_t *workers = calloc(threads, sizeof(parse_worker_t));
+  pthread_t *ids = calloc(threads, sizeof(pthread_t));
+  int *is_started = calloc(threads, sizeof(int));
+  int i = 0;
+  while (i < threads) {
+    workers[i].bodies = bodies;
+    workers[i].len = len;
+    workers[i].first = i;
+    workers[i].step = threads;
+    is_started[i] = !pthread_create(&ids[i], NULL, run_parse_worker,
+                                    &workers[i]);
+    i++;
+  }
+
+  i = 0;
+  while (i < threads) {
+    if (is_started[i]) {
+      pthread_join(ids[i], NULL);
+    }
+    i++;
+  }
+  free(is_started);
+  free(ids);
+  free(workers);
+}
+
+void stop_body_parse(parser_ctx_t *ctx) {
+  if (!ctx->is_worker) {
+    return;
+  }
+  unlock_types(ctx);
+  pthread_exit(NULL);
+}
+
+void lock_types(parser_ctx_t *ctx) {
+  if (ctx->is_worker) {
+    pthread_mutex_lock(&type_lock);
+    ctx->holds_type_lock = 1;
+  }
+}
+
+void unlock_types(parser_ctx_t *ctx) {
+  if (ctx->holds_type_lock) {
+    ctx->holds_type_lock = 0;
+    pthread_mutex_unlock(&type_lock);
+  }
+}
@@ -0,0 +1,18 @@
+#include "parser.h"
+
+// Fallback for parse_threads.c used when ccc compiles itself, since there are
+// no threads then. The bodies are parsed in order on the calling thread.
+
+void run_body_parses(skimmed_body_t **bodies, int len, int threads) {
+  int i = 0;
+  while (i < len) {
+    parse_skimmed_body(bodies[i], 0);
+    i++;
+  }
+}
+
+void stop_body_parse(parser_ctx_t *ctx) {}
+
+void lock_types(parser_ctx_t *ctx) {}
+
+void unlock_types(parser_ctx_t *ctx) {}
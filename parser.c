@@ -1,12 +1,17 @@
 #include "parser.h"
+#include "arena.h"
 #include "error.h"
+#include "intern.h"
 #include "type.h"
 #include <stdlib.h>
 #include <string.h>
 
 type_t *parse_type(parser_ctx_t *ctx);
-expr_t *parse_expr(parser_ctx_t *ctx);
-stmt_t *parse_stmt(parser_ctx_t *ctx);
+int parse_expr(parser_ctx_t *ctx);
+int parse_stmt(parser_ctx_t *ctx);
+tokentype_t peek(parser_ctx_t *ctx);
+int peek_slot(parser_ctx_t *ctx);
+char *token_ident(parser_ctx_t *ctx, int slot);
 
 int is_unary_expr(exprtype_t type) {
   switch (type) {
@@ -51,640 +56,867 @@ int is_binary_expr(exprtype_t type) {
   }
 }
 
-parser_ctx_t *new_parser_ctx(token_t *token) {
+void add_binary_op(parser_ctx_t *ctx, tokentype_t token, exprtype_t type,
+                   int prec) {
+  ctx->binary_precs[token] = prec;
+  ctx->binary_ops[token] = type;
+}
+
+void init_operator_tables(parser_ctx_t *ctx) {
+  ctx->binary_precs = calloc(TOKEN_NEWLINE + 1, sizeof(int));
+  ctx->binary_ops = calloc(TOKEN_NEWLINE + 1, sizeof(exprtype_t));
+  ctx->compound_ops = calloc(TOKEN_NEWLINE + 1, sizeof(int));
+
+  add_binary_op(ctx, TOKEN_LOGOR, EXPR_LOGOR, 1);
+  add_binary_op(ctx, TOKEN_LOGAND, EXPR_LOGAND, 2);
+  add_binary_op(ctx, TOKEN_OR, EXPR_OR, 3);
+  add_binary_op(ctx, TOKEN_XOR, EXPR_XOR, 4);
+  add_binary_op(ctx, TOKEN_AND, EXPR_AND, 5);
+  add_binary_op(ctx, TOKEN_EQ, EXPR_EQ, 6);
+  add_binary_op(ctx, TOKEN_NE, EXPR_NE, 6);
+  add_binary_op(ctx, TOKEN_LT, EXPR_LT, 7);
+  add_binary_op(ctx, TOKEN_LE, EXPR_LE, 7);
+  add_binary_op(ctx, TOKEN_GT, EXPR_GT, 7);
+  add_binary_op(ctx, TOKEN_GE, EXPR_GE, 7);
+  add_binary_op(ctx, TOKEN_SHL, EXPR_SHL, 8);
+  add_binary_op(ctx, TOKEN_SHR, EXPR_SHR, 8);
+  add_binary_op(ctx, TOKEN_ADD, EXPR_ADD, 9);
+  add_binary_op(ctx, TOKEN_SUB, EXPR_SUB, 9);
+  add_binary_op(ctx, TOKEN_MUL, EXPR_MUL, 10);
+  add_binary_op(ctx, TOKEN_DIV, EXPR_DIV, 10);
+  add_binary_op(ctx, TOKEN_REM, EXPR_REM, 10);
+
+  ctx->compound_ops[TOKEN_ADDEQ] = EXPR_ADD + 1;
+  ctx->compound_ops[TOKEN_SUBEQ] = EXPR_SUB + 1;
+  ctx->compound_ops[TOKEN_MULEQ] = EXPR_MUL + 1;
+  ctx->compound_ops[TOKEN_DIVEQ] = EXPR_DIV + 1;
+  ctx->compound_ops[TOKEN_REMEQ] = EXPR_REM + 1;
+  ctx->compound_ops[TOKEN_ANDEQ] = EXPR_AND + 1;
+  ctx->compound_ops[TOKEN_OREQ] = EXPR_OR + 1;
+  ctx->compound_ops[TOKEN_XOREQ] = EXPR_XOR + 1;
+  ctx->compound_ops[TOKEN_SHLEQ] = EXPR_SHL + 1;
+  ctx->compound_ops[TOKEN_SHREQ] = EXPR_SHR + 1;
+}
+
+parser_ctx_t *new_parser_ctx(preprocessor_ctx_t *preprocessor) {
   parser_ctx_t *ctx = calloc(1, sizeof(parser_ctx_t));
-  ctx->cur_token = token;
+  ctx->preprocessor = preprocessor;
+  ctx->ring = new_token_array(4);
+  ctx->ring_mask = 3;
+  ctx->typedef_seq = 1;
+  ctx->typedef_limit = 2147483647;
+  init_operator_tables(ctx);
   return ctx;
 }
 
+// a later typedef of the same name replaces the earlier one
+void index_typedef(parser_ctx_t *ctx, typedef_t *typedef_) {
+  int symbol = intern_symbol(typedef_->name);
+  if (symbol >= ctx->typedef_cap) {
+    int cap = ctx->typedef_cap * 2 + 256;
+    while (cap <= symbol) {
+      cap *= 2;
+    }
+    ctx->typedef_table = realloc(ctx->typedef_table, cap * sizeof(typedef_t *));
+
+    int i = ctx->typedef_cap;
+    while (i < cap) {
+      ctx->typedef_table[i] = NULL;
+      i++;
+    }
+    ctx->typedef_cap = cap;
+  }
+
+  typedef_->hidden = ctx->typedef_table[symbol];
+  ctx->typedef_table[symbol] = typedef_;
+}
+
 void add_typedef(parser_ctx_t *ctx, type_t *type, char *name) {
-  typedef_t *typedef_ = calloc(1, sizeof(typedef_t));
+  typedef_t *typedef_ = node_alloc(sizeof(typedef_t));
   typedef_->type = type;
   typedef_->name = name;
+  typedef_->seq = ctx->typedef_seq;
+  ctx->typedef_seq++;
 
   typedef_->next = ctx->typedefs;
   ctx->typedefs = typedef_;
+  index_typedef(ctx, typedef_);
 }
 
-typedef_t *find_typedef(parser_ctx_t *ctx, char *name) {
-  typedef_t *cur = ctx->typedefs;
-  while (cur) {
-    if (!strcmp(cur->name, name)) {
-      return cur;
-    }
-    cur = cur->next;
+typedef_t *find_typedef(parser_ctx_t *ctx, int symbol) {
+  if (symbol >= ctx->typedef_cap) {
+    return NULL;
   }
-
-  return NULL;
+  typedef_t *typedef_ = ctx->typedef_table[symbol];
+  while (typedef_ && typedef_->seq >= ctx->typedef_limit) {
+    typedef_ = typedef_->hidden;
+  }
+  return typedef_;
 }
 
-int is_type(parser_ctx_t *ctx, token_t *token) {
-  return token->type == TOKEN_CHAR || token->type == TOKEN_INT ||
-         token->type == TOKEN_STRUCT || token->type == TOKEN_UNION ||
-         token->type == TOKEN_ENUM || token->type == TOKEN_VOID ||
-         (token->type == TOKEN_IDENT && find_typedef(ctx, token->value.ident));
+int is_type(parser_ctx_t *ctx) {
+  tokentype_t type = peek(ctx);
+  return type == TOKEN_CHAR || type == TOKEN_INT || type == TOKEN_STRUCT ||
+         type == TOKEN_UNION || type == TOKEN_ENUM || type == TOKEN_VOID ||
+         (type == TOKEN_IDENT &&
+          find_typedef(ctx, ctx->ring->values[peek_slot(ctx)]));
 }
 
-void add_global_var(parser_ctx_t *ctx, type_t *type, char *name) {
-  global_var_t *global = calloc(1, sizeof(global_var_t));
+void add_global_var(parser_ctx_t *ctx, type_t *type, char *name,
+                    int is_extern) {
+  global_var_t *global = node_alloc(sizeof(global_var_t));
   global->type = type;
   global->name = name;
+  global->is_extern = is_extern;
 
   global->next = ctx->globals;
   ctx->globals = global;
 }
 
-token_t *peek(parser_ctx_t *ctx) { return ctx->cur_token; }
+// Tokens are pulled from the preprocessor on demand into a ring of 4 slots. A
+// consumed token stays valid until the next consume, so lookahead is limited
+// to 2 tokens past the current one. A skimmed function body is read from a
+// ring that holds all of its tokens, followed by enough TOKEN_EOFs that
+// nothing more is pulled.
+int peek_ahead(parser_ctx_t *ctx, int n) {
+  while (ctx->ring_len <= n) {
+    read_preprocessed_token(ctx->preprocessor, ctx->ring,
+                            (ctx->ring_head + ctx->ring_len) & ctx->ring_mask);
+    ctx->ring_len++;
+  }
+  return (ctx->ring_head + n) & ctx->ring_mask;
+}
+
+int peek_slot(parser_ctx_t *ctx) { return peek_ahead(ctx, 0); }
+
+tokentype_t peek(parser_ctx_t *ctx) {
+  return ctx->ring->kinds[peek_ahead(ctx, 0)];
+}
+
+pos_t peek_pos(parser_ctx_t *ctx) {
+  return ctx->ring->positions[peek_ahead(ctx, 0)];
+}
+
+int token_value(parser_ctx_t *ctx, int slot) { return ctx->ring->values[slot]; }
 
-token_t *consume(parser_ctx_t *ctx) {
-  token_t *cur_token = ctx->cur_token;
-  if (cur_token->type != TOKEN_EOF) {
-    ctx->cur_token = cur_token->next;
+char *token_ident(parser_ctx_t *ctx, int slot) {
+  return symbol_name(ctx->ring->values[slot]);
+}
+
+int consume(parser_ctx_t *ctx) {
+  int slot = peek_slot(ctx);
+  if (ctx->ring->kinds[slot] != TOKEN_EOF) {
+    ctx->ring_head = (ctx->ring_head + 1) & ctx->ring_mask;
+    ctx->ring_len--;
+  }
+  return slot;
+}
+
+int consume_if(parser_ctx_t *ctx, tokentype_t type) {
+  if (peek(ctx) == type) {
+    consume(ctx);
+    return 1;
   }
-  return cur_token;
+
+  return 0;
+}
+
+void parse_skimmed_bodies(parser_ctx_t *ctx);
+
+// Called before an error is reported. A worker stops instead, and an error at
+// file scope waits for the errors in the bodies skimmed before it.
+void before_error(parser_ctx_t *ctx) {
+  stop_body_parse(ctx);
+  parse_skimmed_bodies(ctx);
 }
 
-token_t *consume_if(parser_ctx_t *ctx, tokentype_t type) {
-  if (peek(ctx)->type == type) {
-    return consume(ctx);
+int expect(parser_ctx_t *ctx, tokentype_t type) {
+  pos_t pos = peek_pos(ctx);
+  int slot = consume(ctx);
+  if (ctx->ring->kinds[slot] != type) {
+    before_error(ctx);
+    error(pos, "unexpected token: expected=%d, actual=%d\n", type,
+          ctx->ring->kinds[slot]);
   }
+  return slot;
+}
+
+char *expect_ident(parser_ctx_t *ctx) {
+  return token_ident(ctx, expect(ctx, TOKEN_IDENT));
+}
+
+// The nodes of a parse, in typed arrays. Entry 0 of each is never used, so
+// that index 0 means no node. When the nodes are appended to another set, the
+// bases are what their indices move by.
+struct _ast_t {
+  expr_t *exprs;
+  int expr_len;
+  int expr_cap;
+  int expr_base;
+
+  stmt_t *stmts;
+  int stmt_len;
+  int stmt_cap;
+  int stmt_base;
+
+  stmt_case_t *cases;
+  int case_len;
+  int case_cap;
+  int case_base;
+
+  parameter_t *params;
+  int param_len;
+  int param_cap;
+  int param_base;
+
+  type_t **types;
+  int type_len;
+  int type_cap;
+  int type_base;
+
+  int *lists;
+  int list_len;
+  int list_cap;
+  int list_base;
+};
+
+// the nodes codegen reads
+ast_t *program_ast;
+
+// Makes room for about the given number of expressions, and for fewer of the
+// other nodes, which are rarer.
+ast_t *new_ast(int cap) {
+  ast_t *ast = calloc(1, sizeof(ast_t));
+  ast->expr_cap = cap + 1;
+  ast->exprs = calloc(ast->expr_cap, sizeof(expr_t));
+  ast->expr_len = 1;
+  ast->stmt_cap = cap / 2 + 1;
+  ast->stmts = calloc(ast->stmt_cap, sizeof(stmt_t));
+  ast->stmt_len = 1;
+  ast->case_cap = cap / 16 + 1;
+  ast->cases = calloc(ast->case_cap, sizeof(stmt_case_t));
+  ast->case_len = 1;
+  ast->param_cap = cap / 16 + 1;
+  ast->params = calloc(ast->param_cap, sizeof(parameter_t));
+  ast->param_len = 1;
+  ast->type_cap = cap / 16 + 1;
+  ast->types = calloc(ast->type_cap, sizeof(type_t *));
+  ast->type_len = 1;
+  ast->list_cap = cap / 2 + 1;
+  ast->lists = calloc(ast->list_cap, sizeof(int));
+  ast->list_len = 1;
+  return ast;
+}
+
+// frees the nodes, but keeps the bases
+void free_nodes(ast_t *ast) {
+  free(ast->exprs);
+  free(ast->stmts);
+  free(ast->cases);
+  free(ast->params);
+  free(ast->types);
+  free(ast->lists);
+}
+
+ast_t *main_ast() {
+  if (program_ast == NULL) {
+    program_ast = new_ast(1024);
+  }
+  return program_ast;
+}
+
+ast_t *detach_ast() {
+  ast_t *ast = main_ast();
+  program_ast = NULL;
+  return ast;
+}
 
-  return NULL;
+// returns the array grown to hold len entries of the given size
+void *grow_array(void *array, int *cap, int len, int size) {
+  if (len <= *cap) {
+    return array;
+  }
+  while (*cap < len) {
+    *cap = *cap * 2 + 16;
+  }
+  return realloc(array, *cap * size);
 }
 
-token_t *expect(parser_ctx_t *ctx, tokentype_t type) {
-  token_t *cur_token = consume(ctx);
-  if (cur_token->type != type) {
-    error(cur_token->pos, "unexpected token: expected=%d, actual=%d\n", type,
-          cur_token->type);
+expr_t *expr_at(int expr) { return program_ast->exprs + expr; }
+
+stmt_t *stmt_at(int stmt) { return program_ast->stmts + stmt; }
+
+stmt_case_t *case_at(int case_) { return program_ast->cases + case_; }
+
+parameter_t *param_at(int param) { return program_ast->params + param; }
+
+type_t *type_at(int type) { return program_ast->types[type]; }
+
+int list_len(int list) {
+  if (list == 0) {
+    return 0;
   }
-  return cur_token;
+  return program_ast->lists[list];
+}
+
+int list_at(int list, int i) { return program_ast->lists[list + 1 + i]; }
+
+int ast_node_count() {
+  return main_ast()->expr_len + main_ast()->stmt_len;
 }
 
-expr_t *new_expr(exprtype_t type, pos_t *pos) {
-  expr_t *expr = calloc(1, sizeof(expr_t));
+// the nodes being parsed, looked up in the set they go to
+expr_t *expr_of(parser_ctx_t *ctx, int expr) { return ctx->ast->exprs + expr; }
+
+stmt_t *stmt_of(parser_ctx_t *ctx, int stmt) { return ctx->ast->stmts + stmt; }
+
+int new_expr(parser_ctx_t *ctx, exprtype_t type, pos_t pos) {
+  ast_t *ast = ctx->ast;
+  ast->exprs = grow_array(ast->exprs, &ast->expr_cap, ast->expr_len + 1,
+                          sizeof(expr_t));
+
+  int index = ast->expr_len;
+  ast->expr_len++;
+  expr_t *expr = ast->exprs + index;
+  memset(expr, 0, sizeof(expr_t));
   expr->type = type;
   expr->pos = pos;
-  return expr;
+  return index;
 }
 
-expr_t *new_char_expr(char value, pos_t *pos) {
-  expr_t *expr = new_expr(EXPR_CHAR, pos);
-  expr->value.char_ = value;
+int new_char_expr(parser_ctx_t *ctx, char value, pos_t pos) {
+  int expr = new_expr(ctx, EXPR_CHAR, pos);
+  expr_of(ctx, expr)->value.char_ = value;
   return expr;
 }
 
-expr_t *new_number_expr(int value, pos_t *pos) {
-  expr_t *expr = new_expr(EXPR_NUMBER, pos);
-  expr->value.number = value;
+int new_number_expr(parser_ctx_t *ctx, int value, pos_t pos) {
+  int expr = new_expr(ctx, EXPR_NUMBER, pos);
+  expr_of(ctx, expr)->value.number = value;
   return expr;
 }
 
-expr_t *new_string_expr(char *string, pos_t *pos) {
-  expr_t *expr = new_expr(EXPR_STRING, pos);
-  expr->value.string = string;
+int new_string_expr(parser_ctx_t *ctx, int string, pos_t pos) {
+  int expr = new_expr(ctx, EXPR_STRING, pos);
+  expr_of(ctx, expr)->value.string = string;
   return expr;
 }
 
-expr_t *new_ident_expr(char *name, pos_t *pos) {
-  expr_t *expr = new_expr(EXPR_IDENT, pos);
-  expr->value.ident = name;
+int new_ident_expr(parser_ctx_t *ctx, int name, pos_t pos) {
+  int expr = new_expr(ctx, EXPR_IDENT, pos);
+  expr_of(ctx, expr)->value.ident = name;
   return expr;
 }
 
-expr_t *new_unary_expr(exprtype_t type, expr_t *expr2, pos_t *pos) {
-  expr_t *expr = new_expr(type, pos);
-  expr->value.unary = expr2;
+int new_unary_expr(parser_ctx_t *ctx, exprtype_t type, int expr2, pos_t pos) {
+  int expr = new_expr(ctx, type, pos);
+  expr_of(ctx, expr)->value.unary = expr2;
   return expr;
 }
 
-expr_t *new_binary_expr(exprtype_t type, expr_t *lhs, expr_t *rhs, pos_t *pos) {
-  expr_t *expr = new_expr(type, pos);
-  expr->value.binary.lhs = lhs;
-  expr->value.binary.rhs = rhs;
+int new_binary_expr(parser_ctx_t *ctx, exprtype_t type, int lhs, int rhs,
+                    pos_t pos) {
+  int expr = new_expr(ctx, type, pos);
+  expr_of(ctx, expr)->value.binary.lhs = lhs;
+  expr_of(ctx, expr)->value.binary.rhs = rhs;
   return expr;
 }
 
-expr_t *new_assign_expr(exprtype_t type, expr_t *dst, expr_t *src, pos_t *pos) {
-  expr_t *expr = new_expr(type, pos);
-  expr->value.assign.dst = dst;
-  expr->value.assign.src = src;
+int new_assign_expr(parser_ctx_t *ctx, exprtype_t type, int dst, int src,
+                    pos_t pos) {
+  int expr = new_expr(ctx, type, pos);
+  expr_of(ctx, expr)->value.assign.dst = dst;
+  expr_of(ctx, expr)->value.assign.src = src;
   return expr;
 }
 
-argument_t *new_argument(expr_t *value) {
-  argument_t *argument = calloc(1, sizeof(argument_t));
-  argument->value = value;
-  return argument;
-}
+int new_stmt(parser_ctx_t *ctx, stmttype_t type, pos_t pos) {
+  ast_t *ast = ctx->ast;
+  ast->stmts = grow_array(ast->stmts, &ast->stmt_cap, ast->stmt_len + 1,
+                          sizeof(stmt_t));
 
-stmt_t *new_stmt(stmttype_t type, pos_t *pos) {
-  stmt_t *stmt = calloc(1, sizeof(stmt_t));
+  int index = ast->stmt_len;
+  ast->stmt_len++;
+  stmt_t *stmt = ast->stmts + index;
+  memset(stmt, 0, sizeof(stmt_t));
   stmt->type = type;
   stmt->pos = pos;
-  return stmt;
+  return index;
 }
 
-stmt_list_t *new_stmt_list(stmt_t *stmt) {
-  stmt_list_t *stmt_list = calloc(1, sizeof(stmt_list_t));
-  stmt_list->stmt = stmt;
-  return stmt_list;
-}
+int new_stmt_case(parser_ctx_t *ctx, int value, int body) {
+  ast_t *ast = ctx->ast;
+  ast->cases = grow_array(ast->cases, &ast->case_cap, ast->case_len + 1,
+                          sizeof(stmt_case_t));
 
-stmt_case_t *new_stmt_case(expr_t *value, stmt_list_t *body) {
-  stmt_case_t *stmt_case = calloc(1, sizeof(stmt_case_t));
+  int index = ast->case_len;
+  ast->case_len++;
+  stmt_case_t *stmt_case = ast->cases + index;
   stmt_case->value = value;
   stmt_case->body = body;
-  return stmt_case;
+  stmt_case->label = 0;
+  return index;
 }
 
-parameter_t *new_parameter(type_t *type, char *name) {
-  parameter_t *parameter = calloc(1, sizeof(parameter_t));
-  parameter->type = type;
-  parameter->name = name;
-  return parameter;
+int add_param(ast_t *ast, type_t *type, char *name) {
+  ast->params = grow_array(ast->params, &ast->param_cap, ast->param_len + 1,
+                           sizeof(parameter_t));
+
+  int index = ast->param_len;
+  ast->param_len++;
+  parameter_t *param = ast->params + index;
+  param->type = type;
+  param->name = name;
+  return index;
+}
+
+int new_param(type_t *type, char *name) {
+  return add_param(main_ast(), type, name);
+}
+
+int new_type_ref(parser_ctx_t *ctx, type_t *type) {
+  ast_t *ast = ctx->ast;
+  ast->types = grow_array(ast->types, &ast->type_cap, ast->type_len + 1,
+                          sizeof(type_t *));
+
+  ast->types[ast->type_len] = type;
+  ast->type_len++;
+  return ast->type_len - 1;
 }
 
-global_stmt_t *new_global_stmt(global_stmttype_t type, pos_t *pos) {
-  global_stmt_t *gstmt = calloc(1, sizeof(global_stmt_t));
+int add_list(ast_t *ast, int *nodes, int len) {
+  if (len == 0) {
+    return 0;
+  }
+
+  ast->lists = grow_array(ast->lists, &ast->list_cap, ast->list_len + len + 1,
+                          sizeof(int));
+
+  int list = ast->list_len;
+  ast->lists[list] = len;
+  memcpy(ast->lists + list + 1, nodes, len * sizeof(int));
+  ast->list_len += len + 1;
+  return list;
+}
+
+int new_list(int *nodes, int len) { return add_list(main_ast(), nodes, len); }
+
+// Nodes of the lists being parsed are pushed to the scratch stack, and each
+// list takes its nodes off the top when it ends, so nested lists still come
+// out contiguous.
+void push_list_node(parser_ctx_t *ctx, int node) {
+  if (ctx->scratch_len == ctx->scratch_cap) {
+    ctx->scratch_cap = ctx->scratch_cap * 2 + 64;
+    ctx->scratch = realloc(ctx->scratch, ctx->scratch_cap * sizeof(int));
+  }
+  ctx->scratch[ctx->scratch_len] = node;
+  ctx->scratch_len++;
+}
+
+int end_list(parser_ctx_t *ctx, int mark) {
+  int list = add_list(ctx->ast, ctx->scratch + mark, ctx->scratch_len - mark);
+  ctx->scratch_len = mark;
+  return list;
+}
+
+global_stmt_t *new_global_stmt(global_stmttype_t type, pos_t pos) {
+  global_stmt_t *gstmt = node_alloc(sizeof(global_stmt_t));
   gstmt->type = type;
   gstmt->pos = pos;
   return gstmt;
 }
 
-program_t *new_program(global_stmt_t *body, global_var_t *globals) {
-  program_t *program = calloc(1, sizeof(program_t));
+program_t *new_program(global_stmt_t *body, typedef_t *typedefs,
+                       global_var_t *globals) {
+  program_t *program = node_alloc(sizeof(program_t));
   program->body = body;
+  program->typedefs = typedefs;
   program->globals = globals;
   return program;
 }
 
-argument_t *parse_arguments(parser_ctx_t *ctx) {
-  if (peek(ctx)->type == TOKEN_PAREN_CLOSE) {
-    return NULL;
-  }
-
-  argument_t *head = new_argument(parse_expr(ctx));
-  argument_t *cur = head;
+// What waits on the scratch stack while expressions and statements are
+// parsed. They nest as deep as the source does, so each is parsed in one loop
+// rather than by recursion, with a frame for every operator or statement
+// still open: a node, a value and the kind on top.
+typedef enum {
+  FRAME_NONE,
+  FRAME_PAREN,  // (
+  FRAME_PREFIX, // a prefix operator, or 0 for +
+  FRAME_SIZEOF, // sizeof with an expression, whose ) is still to come
+  FRAME_BINARY, // a binary operator and its precedence
+  FRAME_ASSIGN, // an assignment and the binary expression of a compound one
+  FRAME_INDEX,  // the addition and the dereference of a[i]
+  FRAME_CALL,   // a call and the mark of its arguments, which are below
+  FRAME_BLOCK,  // a block and the mark of its statements, which are below
+  FRAME_THEN,   // an if
+  FRAME_ELSE,   // an if whose else follows
+  FRAME_BODY,   // a while or a for
+} parse_frame_t;
+
+// how deep statements may nest in what is still parsed by recursion
+int max_nesting_depth() { return 1000; }
+
+void push_frame(parser_ctx_t *ctx, int node, int value, parse_frame_t kind) {
+  push_list_node(ctx, node);
+  push_list_node(ctx, value);
+  push_list_node(ctx, kind);
+}
 
-  while (peek(ctx)->type == TOKEN_COMMA) {
-    expect(ctx, TOKEN_COMMA);
-    cur->next = new_argument(parse_expr(ctx));
-    cur = cur->next;
+parse_frame_t top_frame(parser_ctx_t *ctx, int base) {
+  if (ctx->scratch_len == base) {
+    return FRAME_NONE;
   }
+  return ctx->scratch[ctx->scratch_len - 1];
+}
 
-  return head;
+int frame_node(parser_ctx_t *ctx) {
+  return ctx->scratch[ctx->scratch_len - 3];
 }
 
-expr_t *parse_primary(parser_ctx_t *ctx) {
-  pos_t *pos = peek(ctx)->pos;
-  switch (peek(ctx)->type) {
-  case TOKEN_PAREN_OPEN:
-    consume(ctx);
-    expr_t *expr = parse_expr(ctx);
-    expect(ctx, TOKEN_PAREN_CLOSE);
-    return expr;
-  case TOKEN_IDENT: {
-    char *name = consume(ctx)->value.ident;
-    return new_ident_expr(name, pos);
-  }
+int frame_value(parser_ctx_t *ctx) {
+  return ctx->scratch[ctx->scratch_len - 2];
+}
+
+void pop_frame(parser_ctx_t *ctx) { ctx->scratch_len -= 3; }
+
+int parse_primary(parser_ctx_t *ctx) {
+  pos_t pos = peek_pos(ctx);
+  switch (peek(ctx)) {
+  case TOKEN_IDENT:
+    return new_ident_expr(ctx, token_value(ctx, consume(ctx)), pos);
   case TOKEN_CHAR_LIT:
-    return new_char_expr(consume(ctx)->value.char_, pos);
+    return new_char_expr(ctx, token_value(ctx, consume(ctx)), pos);
   case TOKEN_NUMBER:
-    return new_number_expr(consume(ctx)->value.number, pos);
+    return new_number_expr(ctx, token_value(ctx, consume(ctx)), pos);
   case TOKEN_STRING:
-    return new_string_expr(consume(ctx)->value.string, pos);
+    return new_string_expr(ctx, token_value(ctx, consume(ctx)), pos);
   default:
-    error(pos, "unexpected token: token=%d\n", peek(ctx)->type);
+    before_error(ctx);
+    error(pos, "unexpected token: token=%d\n", peek(ctx));
   }
 }
 
-expr_t *parse_postfix(parser_ctx_t *ctx) {
-  expr_t *expr = parse_primary(ctx);
+// The prefix operators whose operand is a unary expression again, so that
+// they chain, and the expressions they make.
+int is_chained_prefix(tokentype_t token) {
+  return token == TOKEN_MUL || token == TOKEN_NOT || token == TOKEN_NEG;
+}
+
+exprtype_t chained_prefix_op(tokentype_t token) {
+  if (token == TOKEN_MUL) {
+    return EXPR_DEREF;
+  } else if (token == TOKEN_NOT) {
+    return EXPR_NOT;
+  }
+  return EXPR_NEG;
+}
 
+// Parses up to the first operand of an expression, pushing a frame for each
+// prefix operator and opening parenthesis before it. The operand of + - & ++
+// and -- is a postfix expression, so no other prefix operator may follow them.
+int parse_operand(parser_ctx_t *ctx) {
+  int is_primary = 0;
   while (1) {
-    pos_t *pos = peek(ctx)->pos;
-    switch (peek(ctx)->type) {
-    case TOKEN_PAREN_OPEN:
+    pos_t pos = peek_pos(ctx);
+    tokentype_t token = peek(ctx);
+    if (token == TOKEN_PAREN_OPEN) {
       consume(ctx);
-      if (expr->type != EXPR_IDENT) {
-        error(pos, "not supported calling: expr=%d\n", expr->type);
-      }
-      expr_t *expr2 = new_expr(EXPR_CALL, pos);
-      expr2->value.call.name = expr->value.ident;
-      expr2->value.call.args = parse_arguments(ctx);
-      expect(ctx, TOKEN_PAREN_CLOSE);
-      expr = expr2;
-      break;
-    case TOKEN_BRACK_OPEN:
+      push_frame(ctx, 0, 0, FRAME_PAREN);
+      is_primary = 0;
+    } else if (is_primary) {
+      return parse_primary(ctx);
+    } else if (is_chained_prefix(token)) {
       consume(ctx);
-      expr_t *index = parse_expr(ctx);
-      expect(ctx, TOKEN_BRACK_CLOSE);
-      expr = new_unary_expr(EXPR_DEREF,
-                            new_binary_expr(EXPR_ADD, expr, index, pos), pos);
-      break;
-    case TOKEN_MEMBER:
+      int unary = new_unary_expr(ctx, chained_prefix_op(token), 0, pos);
+      push_frame(ctx, unary, 0, FRAME_PREFIX);
+    } else if (token == TOKEN_ADD) {
       consume(ctx);
-      char *name = expect(ctx, TOKEN_IDENT)->value.ident;
-      expr_t *expr3 = new_expr(EXPR_MEMBER, pos);
-      expr3->value.member.expr = expr;
-      expr3->value.member.name = name;
-      expr = expr3;
-      break;
-    case TOKEN_INC:
+      push_frame(ctx, 0, 0, FRAME_PREFIX);
+      is_primary = 1;
+    } else if (token == TOKEN_SUB) {
       consume(ctx);
-      return new_unary_expr(EXPR_INC_POST, expr, pos);
-    case TOKEN_DEC:
+      int zero = new_number_expr(ctx, 0, pos);
+      int sub = new_binary_expr(ctx, EXPR_SUB, zero, 0, pos);
+      push_frame(ctx, sub, 0, FRAME_PREFIX);
+      is_primary = 1;
+    } else if (token == TOKEN_AND || token == TOKEN_INC ||
+               token == TOKEN_DEC) {
       consume(ctx);
-      return new_unary_expr(EXPR_DEC_POST, expr, pos);
-    case TOKEN_ARROW:
+      exprtype_t type = EXPR_REF;
+      if (token == TOKEN_INC) {
+        type = EXPR_INC_PRE;
+      } else if (token == TOKEN_DEC) {
+        type = EXPR_DEC_PRE;
+      }
+      push_frame(ctx, new_unary_expr(ctx, type, 0, pos), 0, FRAME_PREFIX);
+      is_primary = 1;
+    } else if (token == TOKEN_SIZEOF) {
       consume(ctx);
-      char *name2 = expect(ctx, TOKEN_IDENT)->value.ident;
-      expr_t *expr4 = new_expr(EXPR_MEMBER, pos);
-      expr4->value.member.expr = new_unary_expr(EXPR_DEREF, expr, pos);
-      expr4->value.member.name = name2;
-      expr = expr4;
-      break;
-    default:
+      expect(ctx, TOKEN_PAREN_OPEN);
+      int expr = new_expr(ctx, EXPR_SIZEOF, pos);
+      if (!is_type(ctx)) {
+        push_frame(ctx, expr, 0, FRAME_SIZEOF);
+        continue;
+      }
+      lock_types(ctx);
+      int type = new_type_ref(ctx, parse_type(ctx));
+      unlock_types(ctx);
+      expect(ctx, TOKEN_PAREN_CLOSE);
+      expr_of(ctx, expr)->value.sizeof_.type = type;
       return expr;
+    } else {
+      return parse_primary(ctx);
     }
   }
 }
 
-expr_t *parse_unary(parser_ctx_t *ctx) {
-  pos_t *pos = peek(ctx)->pos;
-
-  switch (peek(ctx)->type) {
-  case TOKEN_ADD:
-    consume(ctx);
-    return parse_postfix(ctx);
-  case TOKEN_SUB:
-    consume(ctx);
-    return new_binary_expr(EXPR_SUB, new_number_expr(0, pos),
-                           parse_postfix(ctx), pos);
-  case TOKEN_AND:
+// Applies the postfix operator that follows the expression, returning what
+// it makes, or 0 if none follows. A call with arguments or an index pushes
+// its frame instead and returns -1.
+int parse_postfix_op(parser_ctx_t *ctx, int expr) {
+  pos_t pos = peek_pos(ctx);
+  tokentype_t token = peek(ctx);
+  if (token == TOKEN_PAREN_OPEN) {
     consume(ctx);
-    return new_unary_expr(EXPR_REF, parse_postfix(ctx), pos);
-  case TOKEN_MUL:
-    consume(ctx);
-    return new_unary_expr(EXPR_DEREF, parse_unary(ctx), pos);
-  case TOKEN_NOT:
-    consume(ctx);
-    return new_unary_expr(EXPR_NOT, parse_unary(ctx), pos);
-  case TOKEN_NEG:
+    if (expr_of(ctx, expr)->type != EXPR_IDENT) {
+      before_error(ctx);
+      error(pos, "not supported calling: expr=%d\n",
+            expr_of(ctx, expr)->type);
+    }
+    int call = new_expr(ctx, EXPR_CALL, pos);
+    expr_of(ctx, call)->value.call.name = expr_of(ctx, expr)->value.ident;
+    if (consume_if(ctx, TOKEN_PAREN_CLOSE)) {
+      return call;
+    }
+    push_frame(ctx, call, ctx->scratch_len, FRAME_CALL);
+    return -1;
+  } else if (token == TOKEN_BRACK_OPEN) {
     consume(ctx);
-    return new_unary_expr(EXPR_NEG, parse_unary(ctx), pos);
-  case TOKEN_SIZEOF:
+    int add = new_binary_expr(ctx, EXPR_ADD, expr, 0, pos);
+    int deref = new_unary_expr(ctx, EXPR_DEREF, add, pos);
+    push_frame(ctx, add, deref, FRAME_INDEX);
+    return -1;
+  } else if (token == TOKEN_MEMBER || token == TOKEN_ARROW) {
     consume(ctx);
-    expect(ctx, TOKEN_PAREN_OPEN);
-    expr_t *expr = new_expr(EXPR_SIZEOF, pos);
-    if (is_type(ctx, peek(ctx))) {
-      expr->value.sizeof_.type = parse_type(ctx);
-    } else {
-      expr->value.sizeof_.expr = parse_unary(ctx);
+    int member = token_value(ctx, expect(ctx, TOKEN_IDENT));
+    if (token == TOKEN_ARROW) {
+      expr = new_unary_expr(ctx, EXPR_DEREF, expr, pos);
     }
-    expect(ctx, TOKEN_PAREN_CLOSE);
-    return expr;
-  case TOKEN_INC:
+    int expr2 = new_expr(ctx, EXPR_MEMBER, pos);
+    expr_of(ctx, expr2)->value.member.expr = expr;
+    expr_of(ctx, expr2)->value.member.name = member;
+    return expr2;
+  } else if (token == TOKEN_INC) {
     consume(ctx);
-    return new_unary_expr(EXPR_INC_PRE, parse_postfix(ctx), pos);
-  case TOKEN_DEC:
+    return new_unary_expr(ctx, EXPR_INC_POST, expr, pos);
+  } else if (token == TOKEN_DEC) {
     consume(ctx);
-    return new_unary_expr(EXPR_DEC_PRE, parse_postfix(ctx), pos);
-  default:
-    return parse_postfix(ctx);
+    return new_unary_expr(ctx, EXPR_DEC_POST, expr, pos);
   }
+  return 0;
 }
 
-expr_t *parse_mul_div(parser_ctx_t *ctx) {
-  expr_t *expr = parse_unary(ctx);
-
-  while (1) {
-    pos_t *pos = peek(ctx)->pos;
-    switch (peek(ctx)->type) {
-    case TOKEN_MUL:
-      consume(ctx);
-      expr = new_binary_expr(EXPR_MUL, expr, parse_unary(ctx), pos);
-      break;
-    case TOKEN_DIV:
-      consume(ctx);
-      expr = new_binary_expr(EXPR_DIV, expr, parse_unary(ctx), pos);
-      break;
-    case TOKEN_REM:
-      consume(ctx);
-      expr = new_binary_expr(EXPR_REM, expr, parse_unary(ctx), pos);
-      break;
-    default:
-      return expr;
-    }
+// sets the operand of the prefix operator of the frame on top
+void end_prefix(parser_ctx_t *ctx, int operand) {
+  int node = frame_node(ctx);
+  if (node == 0) {
+    return;
+  }
+  if (expr_of(ctx, node)->type == EXPR_SUB) {
+    expr_of(ctx, node)->value.binary.rhs = operand;
+  } else if (expr_of(ctx, node)->type == EXPR_SIZEOF) {
+    expect(ctx, TOKEN_PAREN_CLOSE);
+    expr_of(ctx, node)->value.sizeof_.expr = operand;
+  } else {
+    expr_of(ctx, node)->value.unary = operand;
   }
 }
 
-expr_t *parse_add_sub(parser_ctx_t *ctx) {
-  expr_t *expr = parse_mul_div(ctx);
-
+// Binary operators are parsed by precedence climbing: once an operand is
+// parsed, an operator binding tighter than the one waiting for it as its
+// right operand takes it as its left, and one binding no tighter ends the
+// waiting one. Assignments do not chain, and their right side is a binary
+// expression; a compound assignment a op= b is parsed as a = a op b.
+int parse_expr(parser_ctx_t *ctx) {
+  int base = ctx->scratch_len;
+  int expr = 0;
+  int is_postfix = 0;
   while (1) {
-    pos_t *pos = peek(ctx)->pos;
-    switch (peek(ctx)->type) {
-    case TOKEN_ADD:
-      consume(ctx);
-      expr = new_binary_expr(EXPR_ADD, expr, parse_mul_div(ctx), pos);
-      break;
-    case TOKEN_SUB:
-      consume(ctx);
-      expr = new_binary_expr(EXPR_SUB, expr, parse_mul_div(ctx), pos);
-      break;
-    default:
-      return expr;
+    if (expr == 0) {
+      expr = parse_operand(ctx);
+      is_postfix = expr_of(ctx, expr)->type != EXPR_SIZEOF;
     }
-  }
-}
-
-expr_t *parse_shift(parser_ctx_t *ctx) {
-  expr_t *expr = parse_add_sub(ctx);
 
-  while (1) {
-    pos_t *pos = peek(ctx)->pos;
-    switch (peek(ctx)->type) {
-    case TOKEN_SHL:
-      consume(ctx);
-      expr = new_binary_expr(EXPR_SHL, expr, parse_add_sub(ctx), pos);
-      break;
-    case TOKEN_SHR:
-      consume(ctx);
-      expr = new_binary_expr(EXPR_SHR, expr, parse_add_sub(ctx), pos);
-      break;
-    default:
-      return expr;
+    // postfix operators bind tightest, and none follows ++ or --
+    while (is_postfix) {
+      int expr2 = parse_postfix_op(ctx, expr);
+      if (expr2 <= 0) {
+        is_postfix = 0;
+        if (expr2 < 0) {
+          expr = 0;
+        }
+      } else {
+        expr = expr2;
+        exprtype_t type = expr_of(ctx, expr)->type;
+        is_postfix = type != EXPR_INC_POST && type != EXPR_DEC_POST;
+      }
+    }
+    if (expr == 0) {
+      continue;
     }
-  }
-}
 
-expr_t *parse_relational(parser_ctx_t *ctx) {
-  expr_t *expr = parse_shift(ctx);
+    // then the prefix operators waiting for the operand
+    parse_frame_t kind = top_frame(ctx, base);
+    while (kind == FRAME_PREFIX || kind == FRAME_SIZEOF) {
+      end_prefix(ctx, expr);
+      if (frame_node(ctx)) {
+        expr = frame_node(ctx);
+      }
+      pop_frame(ctx);
+      kind = top_frame(ctx, base);
+    }
 
-  while (1) {
-    pos_t *pos = peek(ctx)->pos;
-    switch (peek(ctx)->type) {
-    case TOKEN_LT:
-      consume(ctx);
-      expr = new_binary_expr(EXPR_LT, expr, parse_shift(ctx), pos);
-      break;
-    case TOKEN_LE:
-      consume(ctx);
-      expr = new_binary_expr(EXPR_LE, expr, parse_shift(ctx), pos);
-      break;
-    case TOKEN_GT:
-      consume(ctx);
-      expr = new_binary_expr(EXPR_GT, expr, parse_shift(ctx), pos);
-      break;
-    case TOKEN_GE:
+    tokentype_t token = peek(ctx);
+    pos_t pos = peek_pos(ctx);
+    int prec = ctx->binary_precs[token];
+    if (kind == FRAME_BINARY && prec <= frame_value(ctx)) {
+      expr_of(ctx, frame_node(ctx))->value.binary.rhs = expr;
+      expr = frame_node(ctx);
+      pop_frame(ctx);
+      continue;
+    }
+    if (prec > 0) {
       consume(ctx);
-      expr = new_binary_expr(EXPR_GE, expr, parse_shift(ctx), pos);
-      break;
-    default:
-      return expr;
+      int binary = new_binary_expr(ctx, ctx->binary_ops[token], expr, 0, pos);
+      push_frame(ctx, binary, prec, FRAME_BINARY);
+      expr = 0;
+      continue;
     }
-  }
-}
-
-expr_t *parse_equality(parser_ctx_t *ctx) {
-  expr_t *expr = parse_relational(ctx);
 
-  while (1) {
-    pos_t *pos = peek(ctx)->pos;
-    switch (peek(ctx)->type) {
-    case TOKEN_EQ:
-      consume(ctx);
-      expr = new_binary_expr(EXPR_EQ, expr, parse_relational(ctx), pos);
-      break;
-    case TOKEN_NE:
+    if (kind == FRAME_ASSIGN) {
+      if (frame_value(ctx)) {
+        expr_of(ctx, frame_value(ctx))->value.binary.rhs = expr;
+      } else {
+        expr_of(ctx, frame_node(ctx))->value.assign.src = expr;
+      }
+      expr = frame_node(ctx);
+      pop_frame(ctx);
+      kind = top_frame(ctx, base);
+    } else if (token == TOKEN_ASSIGN || ctx->compound_ops[token]) {
       consume(ctx);
-      expr = new_binary_expr(EXPR_NE, expr, parse_relational(ctx), pos);
-      break;
-    default:
-      return expr;
+      int binary = 0;
+      if (token != TOKEN_ASSIGN) {
+        binary = new_binary_expr(ctx, ctx->compound_ops[token] - 1, expr, 0,
+                                 pos);
+      }
+      int assign = new_assign_expr(ctx, EXPR_ASSIGN, expr, binary, pos);
+      push_frame(ctx, assign, binary, FRAME_ASSIGN);
+      expr = 0;
+      continue;
     }
-  }
-}
-
-expr_t *parse_and(parser_ctx_t *ctx) {
-  expr_t *expr = parse_equality(ctx);
-
-  pos_t *pos = peek(ctx)->pos;
-  while (consume_if(ctx, TOKEN_AND)) {
-    expr = new_binary_expr(EXPR_AND, expr, parse_equality(ctx), pos);
-    pos = peek(ctx)->pos;
-  }
-
-  return expr;
-}
-
-expr_t *parse_xor(parser_ctx_t *ctx) {
-  expr_t *expr = parse_and(ctx);
-
-  pos_t *pos = peek(ctx)->pos;
-  while (consume_if(ctx, TOKEN_XOR)) {
-    expr = new_binary_expr(EXPR_XOR, expr, parse_and(ctx), pos);
-    pos = peek(ctx)->pos;
-  }
-
-  return expr;
-}
-
-expr_t *parse_or(parser_ctx_t *ctx) {
-  expr_t *expr = parse_xor(ctx);
-
-  pos_t *pos = peek(ctx)->pos;
-  while (consume_if(ctx, TOKEN_OR)) {
-    expr = new_binary_expr(EXPR_OR, expr, parse_xor(ctx), pos);
-    pos = peek(ctx)->pos;
-  }
-
-  return expr;
-}
-
-expr_t *parse_logand(parser_ctx_t *ctx) {
-  expr_t *expr = parse_or(ctx);
-
-  pos_t *pos = peek(ctx)->pos;
-  while (consume_if(ctx, TOKEN_LOGAND)) {
-    expr = new_binary_expr(EXPR_LOGAND, expr, parse_or(ctx), pos);
-    pos = peek(ctx)->pos;
-  }
-
-  return expr;
-}
-
-expr_t *parse_logor(parser_ctx_t *ctx) {
-  expr_t *expr = parse_logand(ctx);
-
-  pos_t *pos = peek(ctx)->pos;
-  while (consume_if(ctx, TOKEN_LOGOR)) {
-    expr = new_binary_expr(EXPR_LOGOR, expr, parse_logand(ctx), pos);
-    pos = peek(ctx)->pos;
-  }
 
-  return expr;
-}
-
-expr_t *parse_assign(parser_ctx_t *ctx) {
-  expr_t *expr = parse_logor(ctx);
-
-  pos_t *pos = peek(ctx)->pos;
-  switch (peek(ctx)->type) {
-  case TOKEN_ASSIGN:
-    consume(ctx);
-    return new_assign_expr(EXPR_ASSIGN, expr, parse_logor(ctx), pos);
-  case TOKEN_ADDEQ:
-    consume(ctx);
-    return new_assign_expr(
-        EXPR_ASSIGN, expr,
-        new_binary_expr(EXPR_ADD, expr, parse_logor(ctx), pos), pos);
-  case TOKEN_SUBEQ:
-    consume(ctx);
-    return new_assign_expr(
-        EXPR_ASSIGN, expr,
-        new_binary_expr(EXPR_SUB, expr, parse_logor(ctx), pos), pos);
-  case TOKEN_MULEQ:
-    consume(ctx);
-    return new_assign_expr(
-        EXPR_ASSIGN, expr,
-        new_binary_expr(EXPR_MUL, expr, parse_logor(ctx), pos), pos);
-  case TOKEN_DIVEQ:
-    consume(ctx);
-    return new_assign_expr(
-        EXPR_ASSIGN, expr,
-        new_binary_expr(EXPR_DIV, expr, parse_logor(ctx), pos), pos);
-  case TOKEN_REMEQ:
-    consume(ctx);
-    return new_assign_expr(
-        EXPR_ASSIGN, expr,
-        new_binary_expr(EXPR_REM, expr, parse_logor(ctx), pos), pos);
-  case TOKEN_ANDEQ:
-    consume(ctx);
-    return new_assign_expr(
-        EXPR_ASSIGN, expr,
-        new_binary_expr(EXPR_AND, expr, parse_logor(ctx), pos), pos);
-  case TOKEN_OREQ:
-    consume(ctx);
-    return new_assign_expr(
-        EXPR_ASSIGN, expr,
-        new_binary_expr(EXPR_OR, expr, parse_logor(ctx), pos), pos);
-  case TOKEN_XOREQ:
-    consume(ctx);
-    return new_assign_expr(
-        EXPR_ASSIGN, expr,
-        new_binary_expr(EXPR_XOR, expr, parse_logor(ctx), pos), pos);
-  case TOKEN_SHLEQ:
-    consume(ctx);
-    return new_assign_expr(
-        EXPR_ASSIGN, expr,
-        new_binary_expr(EXPR_SHL, expr, parse_logor(ctx), pos), pos);
-  case TOKEN_SHREQ:
-    consume(ctx);
-    return new_assign_expr(
-        EXPR_ASSIGN, expr,
-        new_binary_expr(EXPR_SHR, expr, parse_logor(ctx), pos), pos);
-  default:
-    return expr;
+    // the expression of a parenthesis, an index or an argument ends here
+    if (kind == FRAME_PAREN) {
+      expect(ctx, TOKEN_PAREN_CLOSE);
+      pop_frame(ctx);
+      is_postfix = 1;
+    } else if (kind == FRAME_INDEX) {
+      expect(ctx, TOKEN_BRACK_CLOSE);
+      expr_of(ctx, frame_node(ctx))->value.binary.rhs = expr;
+      expr = frame_value(ctx);
+      pop_frame(ctx);
+      is_postfix = 1;
+    } else if (kind == FRAME_CALL) {
+      int call = frame_node(ctx);
+      int mark = frame_value(ctx);
+      pop_frame(ctx);
+      push_list_node(ctx, expr);
+      if (consume_if(ctx, TOKEN_COMMA)) {
+        push_frame(ctx, call, mark, FRAME_CALL);
+        expr = 0;
+        continue;
+      }
+      expect(ctx, TOKEN_PAREN_CLOSE);
+      expr_of(ctx, call)->value.call.args = end_list(ctx, mark);
+      expr = call;
+      is_postfix = 1;
+    } else {
+      return expr;
+    }
   }
 }
 
-expr_t *parse_expr(parser_ctx_t *ctx) { return parse_assign(ctx); }
-
-stmt_t *parse_return(parser_ctx_t *ctx) {
-  pos_t *pos = expect(ctx, TOKEN_RETURN)->pos;
-  stmt_t *stmt = new_stmt(STMT_RETURN, pos);
-  if (consume_if(ctx, TOKEN_SEMICOLON)) {
-    return stmt;
+int parse_return(parser_ctx_t *ctx) {
+  pos_t pos = peek_pos(ctx);
+  expect(ctx, TOKEN_RETURN);
+  int value = 0;
+  if (!consume_if(ctx, TOKEN_SEMICOLON)) {
+    value = parse_expr(ctx);
+    expect(ctx, TOKEN_SEMICOLON);
   }
 
-  stmt->value.ret = parse_expr(ctx);
-  expect(ctx, TOKEN_SEMICOLON);
+  int stmt = new_stmt(ctx, STMT_RETURN, pos);
+  stmt_of(ctx, stmt)->value.ret = value;
   return stmt;
 }
 
-stmt_t *parse_if(parser_ctx_t *ctx) {
-  pos_t *pos = expect(ctx, TOKEN_IF)->pos;
-  stmt_t *stmt = new_stmt(STMT_IF, pos);
+// parses an if up to its statements, which parse_stmt goes on with
+void parse_if(parser_ctx_t *ctx) {
+  pos_t pos = peek_pos(ctx);
+  expect(ctx, TOKEN_IF);
 
   expect(ctx, TOKEN_PAREN_OPEN);
-  stmt->value.if_.cond = parse_expr(ctx);
+  int cond = parse_expr(ctx);
   expect(ctx, TOKEN_PAREN_CLOSE);
-  stmt->value.if_.then_ = parse_stmt(ctx);
-  if (consume_if(ctx, TOKEN_ELSE)) {
-    stmt->value.if_.else_ = parse_stmt(ctx);
-  } else {
-    stmt->value.if_.else_ = NULL;
-  }
-  return stmt;
+
+  int stmt = new_stmt(ctx, STMT_IF, pos);
+  stmt_of(ctx, stmt)->value.if_.cond = cond;
+  push_frame(ctx, stmt, 0, FRAME_THEN);
 }
 
-stmt_t *parse_while(parser_ctx_t *ctx) {
-  pos_t *pos = expect(ctx, TOKEN_WHILE)->pos;
-  stmt_t *stmt = new_stmt(STMT_WHILE, pos);
+void parse_while(parser_ctx_t *ctx) {
+  pos_t pos = peek_pos(ctx);
+  expect(ctx, TOKEN_WHILE);
 
   expect(ctx, TOKEN_PAREN_OPEN);
-  stmt->value.while_.cond = parse_expr(ctx);
+  int cond = parse_expr(ctx);
   expect(ctx, TOKEN_PAREN_CLOSE);
-  stmt->value.while_.body = parse_stmt(ctx);
-  return stmt;
+
+  int stmt = new_stmt(ctx, STMT_WHILE, pos);
+  stmt_of(ctx, stmt)->value.while_.cond = cond;
+  push_frame(ctx, stmt, 0, FRAME_BODY);
 }
 
-stmt_t *parse_for(parser_ctx_t *ctx) {
-  pos_t *pos = expect(ctx, TOKEN_FOR)->pos;
-  stmt_t *stmt = new_stmt(STMT_FOR, pos);
+void parse_for(parser_ctx_t *ctx) {
+  pos_t pos = peek_pos(ctx);
+  expect(ctx, TOKEN_FOR);
 
   expect(ctx, TOKEN_PAREN_OPEN);
 
   // TODO
-  if (peek(ctx)->type != TOKEN_SEMICOLON) {
-    stmt->value.for_.init = parse_stmt(ctx);
-  } else {
-    stmt->value.for_.init = NULL;
+  int init = 0;
+  if (peek(ctx) != TOKEN_SEMICOLON) {
+    init = parse_stmt(ctx);
   }
 
-  if (peek(ctx)->type != TOKEN_SEMICOLON) {
-    stmt->value.for_.cond = parse_expr(ctx);
-  } else {
-    stmt->value.for_.cond = NULL;
+  int cond = 0;
+  if (peek(ctx) != TOKEN_SEMICOLON) {
+    cond = parse_expr(ctx);
   }
   expect(ctx, TOKEN_SEMICOLON);
 
-  if (peek(ctx)->type != TOKEN_PAREN_CLOSE) {
-    stmt->value.for_.loop = parse_expr(ctx);
-  } else {
-    stmt->value.for_.loop = NULL;
+  int loop = 0;
+  if (peek(ctx) != TOKEN_PAREN_CLOSE) {
+    loop = parse_expr(ctx);
   }
   expect(ctx, TOKEN_PAREN_CLOSE);
 
-  stmt->value.for_.body = parse_stmt(ctx);
-
-  return stmt;
-}
-
-stmt_t *parse_block(parser_ctx_t *ctx) {
-  pos_t *pos = expect(ctx, TOKEN_BRACE_OPEN)->pos;
-
-  stmt_t *stmt;
-  if (consume_if(ctx, TOKEN_BRACE_CLOSE)) {
-    stmt = new_stmt(STMT_BLOCK, pos);
-    stmt->value.block = NULL;
-    return stmt;
-  }
-
-  stmt_list_t *head = new_stmt_list(parse_stmt(ctx));
-  stmt_list_t *cur = head;
-  while (peek(ctx)->type != TOKEN_BRACE_CLOSE) {
-    cur->next = new_stmt_list(parse_stmt(ctx));
-    cur = cur->next;
-  }
-  expect(ctx, TOKEN_BRACE_CLOSE);
-
-  stmt = new_stmt(STMT_BLOCK, pos);
-  stmt->value.block = head;
-  return stmt;
+  int stmt = new_stmt(ctx, STMT_FOR, pos);
+  stmt_of(ctx, stmt)->value.for_.init = init;
+  stmt_of(ctx, stmt)->value.for_.cond = cond;
+  stmt_of(ctx, stmt)->value.for_.loop = loop;
+  push_frame(ctx, stmt, 0, FRAME_BODY);
 }
 
 type_t *parse_struct_union(parser_ctx_t *ctx) {
@@ -696,8 +928,8 @@ type_t *parse_struct_union(parser_ctx_t *ctx) {
   }
 
   char *tag = NULL;
-  if (peek(ctx)->type == TOKEN_IDENT) {
-    tag = consume(ctx)->value.ident;
+  if (peek(ctx) == TOKEN_IDENT) {
+    tag = token_ident(ctx, consume(ctx));
   }
 
   if (!consume_if(ctx, TOKEN_BRACE_OPEN)) {
@@ -709,15 +941,15 @@ type_t *parse_struct_union(parser_ctx_t *ctx) {
   }
 
   type_t *type = parse_type(ctx);
-  char *name = expect(ctx, TOKEN_IDENT)->value.ident;
+  char *name = expect_ident(ctx);
   expect(ctx, TOKEN_SEMICOLON);
 
   struct_member_t *head = new_struct_member(type, name);
   struct_member_t *cur = head;
 
-  while (peek(ctx)->type != TOKEN_BRACE_CLOSE) {
+  while (peek(ctx) != TOKEN_BRACE_CLOSE) {
     type = parse_type(ctx);
-    name = expect(ctx, TOKEN_IDENT)->value.ident;
+    name = expect_ident(ctx);
     expect(ctx, TOKEN_SEMICOLON);
     cur->next = new_struct_member(type, name);
     cur = cur->next;
@@ -736,25 +968,25 @@ type_t *parse_enum(parser_ctx_t *ctx) {
   expect(ctx, TOKEN_ENUM);
 
   char *tag = NULL;
-  if (peek(ctx)->type == TOKEN_IDENT) {
-    tag = consume(ctx)->value.ident;
+  if (peek(ctx) == TOKEN_IDENT) {
+    tag = token_ident(ctx, consume(ctx));
   }
 
   if (!consume_if(ctx, TOKEN_BRACE_OPEN)) {
     return enum_of(tag, NULL);
   }
 
-  char *name = expect(ctx, TOKEN_IDENT)->value.ident;
+  char *name = expect_ident(ctx);
   enum_t *head = new_enum(name, 0);
   enum_t *cur = head;
 
   int value = 1;
   while (consume_if(ctx, TOKEN_COMMA)) {
-    if (peek(ctx)->type == TOKEN_BRACE_CLOSE) {
+    if (peek(ctx) == TOKEN_BRACE_CLOSE) {
       break;
     }
 
-    name = expect(ctx, TOKEN_IDENT)->value.ident;
+    name = expect_ident(ctx);
     cur->next = new_enum(name, value);
     value++;
     cur = cur->next;
@@ -766,13 +998,11 @@ type_t *parse_enum(parser_ctx_t *ctx) {
 }
 
 type_t *parse_type(parser_ctx_t *ctx) {
-  int is_extern = 0;
-  if (consume_if(ctx, TOKEN_EXTERN)) {
-    is_extern = 1;
-  }
+  // extern is only kept for globals, see parse_global_stmt
+  consume_if(ctx, TOKEN_EXTERN);
 
   type_t *type;
-  switch (peek(ctx)->type) {
+  switch (peek(ctx)) {
   case TOKEN_VOID:
     consume(ctx);
     type = new_type(TYPE_VOID);
@@ -793,23 +1023,26 @@ type_t *parse_type(parser_ctx_t *ctx) {
     type = parse_enum(ctx);
     break;
   case TOKEN_IDENT: {
-    token_t *token = consume(ctx);
-    typedef_t *typdef = find_typedef(ctx, token->value.ident);
+    pos_t pos = peek_pos(ctx);
+    int slot = consume(ctx);
+    char *name = token_ident(ctx, slot);
+    typedef_t *typdef = find_typedef(ctx, ctx->ring->values[slot]);
     if (!typdef) {
-      error(token->pos, "unknown type: %s\n", token->value.ident);
+      before_error(ctx);
+      error(pos, "unknown type: %s\n", name);
     }
     type = typdef->type;
     break;
   }
   default:
-    error(peek(ctx)->pos, "unknown type: token=%d\n", peek(ctx)->type);
+    before_error(ctx);
+    error(peek_pos(ctx), "unknown type: token=%d\n", peek(ctx));
   }
 
   while (consume_if(ctx, TOKEN_MUL)) {
     type = ptr_to(type);
   }
 
-  type->is_extern = is_extern;
   return type;
 }
 
@@ -818,152 +1051,223 @@ type_t *parse_type_post(parser_ctx_t *ctx, type_t *base_type) {
     return base_type;
   }
 
-  int len = expect(ctx, TOKEN_NUMBER)->value.number;
+  int len = token_value(ctx, expect(ctx, TOKEN_NUMBER));
   expect(ctx, TOKEN_BRACK_CLOSE);
 
   return array_of(base_type, len);
 }
 
-stmt_t *parse_define(parser_ctx_t *ctx) {
-  pos_t *pos = peek(ctx)->pos;
+int parse_define(parser_ctx_t *ctx) {
+  pos_t pos = peek_pos(ctx);
+  lock_types(ctx);
   type_t *type = parse_type(ctx);
-  char *name = expect(ctx, TOKEN_IDENT)->value.ident;
+  int name = token_value(ctx, expect(ctx, TOKEN_IDENT));
   type = parse_type_post(ctx, type);
+  unlock_types(ctx);
 
-  expr_t *value = NULL;
+  int value = 0;
   if (consume_if(ctx, TOKEN_ASSIGN)) {
     value = parse_expr(ctx);
   }
   expect(ctx, TOKEN_SEMICOLON);
 
-  stmt_t *stmt = new_stmt(STMT_DEFINE, pos);
-  stmt->value.define.type = type;
-  stmt->value.define.name = name;
-  stmt->value.define.value = value;
+  int stmt = new_stmt(ctx, STMT_DEFINE, pos);
+  stmt_of(ctx, stmt)->value.define.type = new_type_ref(ctx, type);
+  stmt_of(ctx, stmt)->value.define.name = name;
+  stmt_of(ctx, stmt)->value.define.value = value;
   return stmt;
 }
 
-stmt_case_t *parse_case(parser_ctx_t *ctx) {
-  expr_t *value = NULL;
+int parse_case(parser_ctx_t *ctx) {
+  int value = 0;
   if (!consume_if(ctx, TOKEN_DEFAULT)) {
     expect(ctx, TOKEN_CASE);
     value = parse_expr(ctx);
   }
   expect(ctx, TOKEN_COLON);
 
-  stmt_list_t *head = NULL;
-  stmt_list_t *cur = head;
-  while (peek(ctx)->type != TOKEN_CASE && peek(ctx)->type != TOKEN_DEFAULT &&
-         peek(ctx)->type != TOKEN_BRACE_CLOSE) {
-
-    if (!head) {
-      head = new_stmt_list(parse_stmt(ctx));
-      cur = head;
-    } else {
-      cur->next = new_stmt_list(parse_stmt(ctx));
-      cur = cur->next;
-    }
+  int mark = ctx->scratch_len;
+  while (peek(ctx) != TOKEN_CASE && peek(ctx) != TOKEN_DEFAULT &&
+         peek(ctx) != TOKEN_BRACE_CLOSE) {
+    push_list_node(ctx, parse_stmt(ctx));
   }
 
-  return new_stmt_case(value, head);
+  return new_stmt_case(ctx, value, end_list(ctx, mark));
 }
 
-stmt_t *parse_switch(parser_ctx_t *ctx) {
-  pos_t *pos = expect(ctx, TOKEN_SWITCH)->pos;
+int parse_switch(parser_ctx_t *ctx) {
+  pos_t pos = peek_pos(ctx);
+  expect(ctx, TOKEN_SWITCH);
   expect(ctx, TOKEN_PAREN_OPEN);
 
-  expr_t *value = parse_expr(ctx);
+  int value = parse_expr(ctx);
 
   expect(ctx, TOKEN_PAREN_CLOSE);
   expect(ctx, TOKEN_BRACE_OPEN);
 
-  stmt_case_t *head = parse_case(ctx);
-  stmt_case_t *cur = head;
-  stmt_case_t *default_case = NULL;
+  // the first case is taken as a case even if it is the default
+  int mark = ctx->scratch_len;
+  push_list_node(ctx, parse_case(ctx));
+  int default_case = 0;
 
-  while (peek(ctx)->type == TOKEN_CASE || peek(ctx)->type == TOKEN_DEFAULT) {
-    if (peek(ctx)->type == TOKEN_DEFAULT) {
+  while (peek(ctx) == TOKEN_CASE || peek(ctx) == TOKEN_DEFAULT) {
+    if (peek(ctx) == TOKEN_DEFAULT) {
       default_case = parse_case(ctx);
       continue;
     }
 
-    cur->next = parse_case(ctx);
-    cur = cur->next;
+    push_list_node(ctx, parse_case(ctx));
   }
 
   expect(ctx, TOKEN_BRACE_CLOSE);
 
-  stmt_t *stmt = new_stmt(STMT_SWITCH, pos);
-  stmt->value.switch_.value = value;
-  stmt->value.switch_.cases = head;
-  stmt->value.switch_.default_case = default_case;
+  int stmt = new_stmt(ctx, STMT_SWITCH, pos);
+  stmt_of(ctx, stmt)->value.switch_.value = value;
+  stmt_of(ctx, stmt)->value.switch_.cases = end_list(ctx, mark);
+  stmt_of(ctx, stmt)->value.switch_.default_case = default_case;
   return stmt;
 }
 
-stmt_t *parse_stmt(parser_ctx_t *ctx) {
-  pos_t *pos = peek(ctx)->pos;
-  switch (peek(ctx)->type) {
+// Parses a statement, or pushes the frame of one that contains statements
+// and returns 0.
+int parse_stmt_head(parser_ctx_t *ctx) {
+  pos_t pos = peek_pos(ctx);
+  switch (peek(ctx)) {
   case TOKEN_RETURN:
     return parse_return(ctx);
   case TOKEN_IF:
-    return parse_if(ctx);
+    parse_if(ctx);
+    return 0;
   case TOKEN_WHILE:
-    return parse_while(ctx);
+    parse_while(ctx);
+    return 0;
   case TOKEN_FOR:
-    return parse_for(ctx);
-  case TOKEN_BRACE_OPEN:
-    return parse_block(ctx);
+    parse_for(ctx);
+    return 0;
+  case TOKEN_BRACE_OPEN: {
+    int block = new_stmt(ctx, STMT_BLOCK, pos);
+    consume(ctx);
+    push_frame(ctx, block, ctx->scratch_len, FRAME_BLOCK);
+    return 0;
+  }
   case TOKEN_BREAK:
     consume(ctx);
     expect(ctx, TOKEN_SEMICOLON);
-    return new_stmt(STMT_BREAK, pos);
+    return new_stmt(ctx, STMT_BREAK, pos);
   case TOKEN_CONTINUE:
     consume(ctx);
     expect(ctx, TOKEN_SEMICOLON);
-    return new_stmt(STMT_CONTINUE, pos);
+    return new_stmt(ctx, STMT_CONTINUE, pos);
   case TOKEN_SWITCH:
     return parse_switch(ctx);
   default:
-    if (is_type(ctx, peek(ctx))) {
+    if (is_type(ctx)) {
       return parse_define(ctx);
     } else {
-      stmt_t *stmt = new_stmt(STMT_EXPR, pos);
-      stmt->value.expr = parse_expr(ctx);
+      int expr = parse_expr(ctx);
       expect(ctx, TOKEN_SEMICOLON);
+      int stmt = new_stmt(ctx, STMT_EXPR, pos);
+      stmt_of(ctx, stmt)->value.expr = expr;
       return stmt;
     }
   }
 }
 
-parameter_t *parse_parameter(parser_ctx_t *ctx) {
-  if (peek(ctx)->type == TOKEN_PAREN_CLOSE) {
-    return NULL;
+// Statements nest in blocks and in the bodies of if, while and for as deep
+// as the source does, so they are parsed in one loop too, with a frame for
+// each one still open. The statements of a block go below its frame, which is
+// pushed again above each one as it ends. Only the cases of a switch and the
+// first clause of a for are parsed by recursion, which is limited.
+int parse_stmt(parser_ctx_t *ctx) {
+  ctx->stmt_depth++;
+  if (ctx->stmt_depth > max_nesting_depth()) {
+    before_error(ctx);
+    error(peek_pos(ctx), "statement nested too deeply\n");
   }
 
+  int base = ctx->scratch_len;
+  int stmt = 0;
+  while (1) {
+    parse_frame_t kind = top_frame(ctx, base);
+    if (stmt == 0 && kind == FRAME_BLOCK &&
+        consume_if(ctx, TOKEN_BRACE_CLOSE)) {
+      stmt = frame_node(ctx);
+      int mark = frame_value(ctx);
+      pop_frame(ctx);
+      stmt_of(ctx, stmt)->value.block = end_list(ctx, mark);
+      kind = top_frame(ctx, base);
+    }
+    if (stmt == 0) {
+      stmt = parse_stmt_head(ctx);
+      continue;
+    }
+
+    if (kind == FRAME_NONE) {
+      ctx->stmt_depth--;
+      return stmt;
+    }
+
+    int node = frame_node(ctx);
+    if (kind == FRAME_BLOCK) {
+      int mark = frame_value(ctx);
+      pop_frame(ctx);
+      push_list_node(ctx, stmt);
+      push_frame(ctx, node, mark, FRAME_BLOCK);
+      stmt = 0;
+    } else if (kind == FRAME_THEN) {
+      stmt_of(ctx, node)->value.if_.then_ = stmt;
+      stmt = 0;
+      if (consume_if(ctx, TOKEN_ELSE)) {
+        ctx->scratch[ctx->scratch_len - 1] = FRAME_ELSE;
+      } else {
+        pop_frame(ctx);
+        stmt = node;
+      }
+    } else if (kind == FRAME_ELSE) {
+      stmt_of(ctx, node)->value.if_.else_ = stmt;
+      pop_frame(ctx);
+      stmt = node;
+    } else if (stmt_of(ctx, node)->type == STMT_WHILE) {
+      stmt_of(ctx, node)->value.while_.body = stmt;
+      pop_frame(ctx);
+      stmt = node;
+    } else {
+      stmt_of(ctx, node)->value.for_.body = stmt;
+      pop_frame(ctx);
+      stmt = node;
+    }
+  }
+}
+
+int parse_parameter(parser_ctx_t *ctx) {
+  if (peek(ctx) == TOKEN_PAREN_CLOSE) {
+    return 0;
+  }
+
+  int mark = ctx->scratch_len;
   type_t *type = parse_type(ctx);
-  char *name = expect(ctx, TOKEN_IDENT)->value.ident;
-  parameter_t *head = new_parameter(type, name);
-  parameter_t *cur = head;
+  char *name = expect_ident(ctx);
+  push_list_node(ctx, add_param(ctx->ast, type, name));
 
-  while (peek(ctx)->type == TOKEN_COMMA) {
+  while (peek(ctx) == TOKEN_COMMA) {
     expect(ctx, TOKEN_COMMA);
     if (consume_if(ctx, TOKEN_VARARG)) {
       break;
     }
     type = parse_type(ctx);
-    name = expect(ctx, TOKEN_IDENT)->value.ident;
-    cur->next = new_parameter(type, name);
-    cur = cur->next;
+    name = expect_ident(ctx);
+    push_list_node(ctx, add_param(ctx->ast, type, name));
   }
 
-  return head;
+  return end_list(ctx, mark);
 }
 
 global_stmt_t *parse_typedef(parser_ctx_t *ctx) {
-  pos_t *pos = expect(ctx, TOKEN_TYPEDEF)->pos;
+  pos_t pos = peek_pos(ctx);
+  expect(ctx, TOKEN_TYPEDEF);
 
   type_t *type = parse_type(ctx);
-  char *name = expect(ctx, TOKEN_IDENT)->value.ident;
+  char *name = expect_ident(ctx);
   expect(ctx, TOKEN_SEMICOLON);
 
   add_typedef(ctx, type, name);
@@ -973,7 +1277,7 @@ global_stmt_t *parse_typedef(parser_ctx_t *ctx) {
   return gstmt;
 }
 
-global_stmt_t *parse_global_type(parser_ctx_t *ctx, type_t *type, pos_t *pos) {
+global_stmt_t *parse_global_type(parser_ctx_t *ctx, type_t *type, pos_t pos) {
   expect(ctx, TOKEN_SEMICOLON);
   global_stmt_t *gstmt;
   switch (type->kind) {
@@ -987,6 +1291,7 @@ global_stmt_t *parse_global_type(parser_ctx_t *ctx, type_t *type, pos_t *pos) {
     gstmt = new_global_stmt(GSTMT_ENUM, pos);
     break;
   default:
+    before_error(ctx);
     error(pos, "unexpected type: kind=%d\n", type->kind);
   }
   gstmt->value.type = type;
@@ -994,11 +1299,11 @@ global_stmt_t *parse_global_type(parser_ctx_t *ctx, type_t *type, pos_t *pos) {
 }
 
 global_stmt_t *parse_global_var(parser_ctx_t *ctx, type_t *type, char *name,
-                                pos_t *pos) {
+                                int is_extern, pos_t pos) {
   type = parse_type_post(ctx, type);
   expect(ctx, TOKEN_SEMICOLON);
 
-  add_global_var(ctx, type, name);
+  add_global_var(ctx, type, name, is_extern);
 
   global_stmt_t *gstmt = new_global_stmt(GSTMT_DEFINE, pos);
   gstmt->value.define.type = type;
@@ -1006,8 +1311,70 @@ global_stmt_t *parse_global_var(parser_ctx_t *ctx, type_t *type, char *name,
   return gstmt;
 }
 
+// Reads the tokens of a function body up to the matching '}' without parsing
+// them, and starts a new set of nodes for what follows at file scope.
+void skim_body(parser_ctx_t *ctx, global_stmt_t *gstmt) {
+  token_array_t *tokens = new_token_array(64);
+  int len = 0;
+  int depth = 0;
+  while (1) {
+    // room for the token and the TOKEN_EOFs after it
+    if (len + 3 >= tokens->cap) {
+      grow_token_array(tokens, tokens->cap * 2);
+    }
+    int slot = consume(ctx);
+    tokentype_t kind = ctx->ring->kinds[slot];
+    tokens->kinds[len] = kind;
+    tokens->positions[len] = ctx->ring->positions[slot];
+    tokens->values[len] = ctx->ring->values[slot];
+    len++;
+
+    if (kind == TOKEN_BRACE_OPEN) {
+      depth++;
+    } else if (kind == TOKEN_BRACE_CLOSE) {
+      depth--;
+    }
+    if (depth == 0 || kind == TOKEN_EOF) {
+      break;
+    }
+  }
+
+  int i = 0;
+  while (i < 3) {
+    tokens->kinds[len + i] = TOKEN_EOF;
+    tokens->positions[len + i] = tokens->positions[len - 1];
+    tokens->values[len + i] = 0;
+    i++;
+  }
+
+  // the capacity of a token array doubles from 64, so it makes a ring
+  parser_ctx_t *parser = calloc(1, sizeof(parser_ctx_t));
+  parser->ring = tokens;
+  parser->ring_mask = tokens->cap - 1;
+  parser->typedef_limit = ctx->typedef_seq;
+  parser->binary_precs = ctx->binary_precs;
+  parser->binary_ops = ctx->binary_ops;
+  parser->compound_ops = ctx->compound_ops;
+
+  skimmed_body_t *body = calloc(1, sizeof(skimmed_body_t));
+  body->parser = parser;
+  body->token_len = len;
+  body->gstmt = gstmt;
+  body->segment = ctx->ast;
+
+  if (ctx->body_len == ctx->body_cap) {
+    ctx->body_cap = ctx->body_cap * 2 + 256;
+    ctx->bodies =
+        realloc(ctx->bodies, ctx->body_cap * sizeof(skimmed_body_t *));
+  }
+  ctx->bodies[ctx->body_len] = body;
+  ctx->body_len++;
+
+  ctx->ast = new_ast(8);
+}
+
 global_stmt_t *parse_global_func(parser_ctx_t *ctx, type_t *type, char *name,
-                                 pos_t *pos) {
+                                 pos_t pos) {
   global_stmt_t *gstmt = new_global_stmt(GSTMT_FUNC, pos);
   gstmt->value.func.ret_type = type;
   gstmt->value.func.name = name;
@@ -1020,41 +1387,349 @@ global_stmt_t *parse_global_func(parser_ctx_t *ctx, type_t *type, char *name,
     return gstmt;
   }
 
+  if (ctx->threads > 1 && peek(ctx) == TOKEN_BRACE_OPEN) {
+    skim_body(ctx, gstmt);
+    return gstmt;
+  }
   gstmt->value.func.body = parse_stmt(ctx);
   return gstmt;
 }
 
 global_stmt_t *parse_global_stmt(parser_ctx_t *ctx) {
-  pos_t *pos = peek(ctx)->pos;
+  pos_t pos = peek_pos(ctx);
 
-  if (peek(ctx)->type == TOKEN_TYPEDEF) {
+  if (peek(ctx) == TOKEN_TYPEDEF) {
     return parse_typedef(ctx);
   }
 
+  // types are shared, so whether a global is extern is kept with the global
+  int is_extern = consume_if(ctx, TOKEN_EXTERN);
   type_t *type = parse_type(ctx);
-  if (peek(ctx)->type == TOKEN_SEMICOLON) {
+  if (peek(ctx) == TOKEN_SEMICOLON) {
     return parse_global_type(ctx, type, pos);
   }
 
-  char *name = expect(ctx, TOKEN_IDENT)->value.ident;
-  if (peek(ctx)->type == TOKEN_PAREN_OPEN) {
+  char *name = expect_ident(ctx);
+  if (peek(ctx) == TOKEN_PAREN_OPEN) {
     return parse_global_func(ctx, type, name, pos);
   }
 
-  return parse_global_var(ctx, type, name, pos);
+  return parse_global_var(ctx, type, name, is_extern, pos);
 }
 
-program_t *parse(token_t *token) {
-  parser_ctx_t *ctx = new_parser_ctx(token);
+void parse_skimmed_body(skimmed_body_t *body, int is_worker) {
+  parser_ctx_t *ctx = body->parser;
+  ctx->is_worker = is_worker;
+  ctx->ast = new_ast(body->token_len / 2 + 16);
+  ctx->ring_head = 0;
+  ctx->ring_len = body->token_len + 3;
+  ctx->scratch_len = 0;
 
-  global_stmt_t *head = parse_global_stmt(ctx);
-  global_stmt_t *cur = head;
-  while (peek(ctx)->type != TOKEN_EOF) {
-    cur->next = parse_global_stmt(ctx);
-    if (cur->next) {
+  body->body = parse_stmt(ctx);
+  body->is_parsed = 1;
+}
+
+// the typedef table may have moved since a body was skimmed
+void share_typedefs(parser_ctx_t *ctx) {
+  int i = 0;
+  while (i < ctx->body_len) {
+    ctx->bodies[i]->parser->typedef_table = ctx->typedef_table;
+    ctx->bodies[i]->parser->typedef_cap = ctx->typedef_cap;
+    i++;
+  }
+}
+
+// parses the skimmed bodies not parsed yet in order on this thread
+void parse_skimmed_bodies(parser_ctx_t *ctx) {
+  share_typedefs(ctx);
+  int i = 0;
+  while (i < ctx->body_len) {
+    if (!ctx->bodies[i]->is_parsed) {
+      parse_skimmed_body(ctx->bodies[i], 0);
+    }
+    i++;
+  }
+}
+
+int rebase(int index, int base) {
+  if (index == 0) {
+    return 0;
+  }
+  return index + base;
+}
+
+// Returns where the list of src was appended to dst, after moving the nodes
+// it holds by base.
+int rebase_list(ast_t *dst, ast_t *src, int list, int base) {
+  if (list == 0) {
+    return 0;
+  }
+  list += src->list_base;
+  int len = dst->lists[list];
+  int i = 0;
+  while (i < len) {
+    dst->lists[list + 1 + i] = rebase(dst->lists[list + 1 + i], base);
+    i++;
+  }
+  return list;
+}
+
+void rebase_expr(ast_t *dst, ast_t *src, expr_t *expr) {
+  int base = src->expr_base;
+  if (expr->type == EXPR_SIZEOF) {
+    expr->value.sizeof_.type = rebase(expr->value.sizeof_.type, src->type_base);
+    expr->value.sizeof_.expr = rebase(expr->value.sizeof_.expr, base);
+  } else if (is_unary_expr(expr->type)) {
+    expr->value.unary = rebase(expr->value.unary, base);
+  } else if (is_binary_expr(expr->type)) {
+    expr->value.binary.lhs = rebase(expr->value.binary.lhs, base);
+    expr->value.binary.rhs = rebase(expr->value.binary.rhs, base);
+  } else if (expr->type == EXPR_ASSIGN) {
+    expr->value.assign.dst = rebase(expr->value.assign.dst, base);
+    expr->value.assign.src = rebase(expr->value.assign.src, base);
+  } else if (expr->type == EXPR_CALL) {
+    expr->value.call.args = rebase_list(dst, src, expr->value.call.args, base);
+  } else if (expr->type == EXPR_MEMBER) {
+    expr->value.member.expr = rebase(expr->value.member.expr, base);
+  }
+}
+
+void rebase_stmt(ast_t *dst, ast_t *src, stmt_t *stmt) {
+  int expr_base = src->expr_base;
+  int base = src->stmt_base;
+  switch (stmt->type) {
+  case STMT_EXPR:
+    stmt->value.expr = rebase(stmt->value.expr, expr_base);
+    break;
+  case STMT_RETURN:
+    stmt->value.ret = rebase(stmt->value.ret, expr_base);
+    break;
+  case STMT_IF:
+    stmt->value.if_.cond = rebase(stmt->value.if_.cond, expr_base);
+    stmt->value.if_.then_ = rebase(stmt->value.if_.then_, base);
+    stmt->value.if_.else_ = rebase(stmt->value.if_.else_, base);
+    break;
+  case STMT_WHILE:
+    stmt->value.while_.cond = rebase(stmt->value.while_.cond, expr_base);
+    stmt->value.while_.body = rebase(stmt->value.while_.body, base);
+    break;
+  case STMT_FOR:
+    stmt->value.for_.init = rebase(stmt->value.for_.init, base);
+    stmt->value.for_.cond = rebase(stmt->value.for_.cond, expr_base);
+    stmt->value.for_.loop = rebase(stmt->value.for_.loop, expr_base);
+    stmt->value.for_.body = rebase(stmt->value.for_.body, base);
+    break;
+  case STMT_BLOCK:
+    stmt->value.block = rebase_list(dst, src, stmt->value.block, base);
+    break;
+  case STMT_DEFINE:
+    stmt->value.define.type =
+        rebase(stmt->value.define.type, src->type_base);
+    stmt->value.define.value = rebase(stmt->value.define.value, expr_base);
+    break;
+  case STMT_SWITCH:
+    stmt->value.switch_.value = rebase(stmt->value.switch_.value, expr_base);
+    stmt->value.switch_.cases =
+        rebase_list(dst, src, stmt->value.switch_.cases, src->case_base);
+    stmt->value.switch_.default_case =
+        rebase(stmt->value.switch_.default_case, src->case_base);
+    break;
+  default:
+    break;
+  }
+}
+
+// Appends the nodes of src to dst, moving the indices they hold by the
+// bases, which are kept in src.
+void append_ast(ast_t *dst, ast_t *src) {
+  src->expr_base = dst->expr_len - 1;
+  src->stmt_base = dst->stmt_len - 1;
+  src->case_base = dst->case_len - 1;
+  src->param_base = dst->param_len - 1;
+  src->type_base = dst->type_len - 1;
+  src->list_base = dst->list_len - 1;
+
+  // the lists go first, since the nodes that own them move what they hold
+  int n = src->list_len - 1;
+  dst->lists =
+      grow_array(dst->lists, &dst->list_cap, dst->list_len + n, sizeof(int));
+  memcpy(dst->lists + dst->list_len, src->lists + 1, n * sizeof(int));
+  dst->list_len += n;
+
+  n = src->param_len - 1;
+  dst->params = grow_array(dst->params, &dst->param_cap, dst->param_len + n,
+                           sizeof(parameter_t));
+  memcpy(dst->params + dst->param_len, src->params + 1,
+         n * sizeof(parameter_t));
+  dst->param_len += n;
+
+  n = src->type_len - 1;
+  dst->types = grow_array(dst->types, &dst->type_cap, dst->type_len + n,
+                          sizeof(type_t *));
+  memcpy(dst->types + dst->type_len, src->types + 1, n * sizeof(type_t *));
+  dst->type_len += n;
+
+  n = src->expr_len - 1;
+  dst->exprs = grow_array(dst->exprs, &dst->expr_cap, dst->expr_len + n,
+                          sizeof(expr_t));
+  memcpy(dst->exprs + dst->expr_len, src->exprs + 1, n * sizeof(expr_t));
+  while (n > 0) {
+    rebase_expr(dst, src, dst->exprs + dst->expr_len);
+    dst->expr_len++;
+    n--;
+  }
+
+  n = src->stmt_len - 1;
+  dst->stmts = grow_array(dst->stmts, &dst->stmt_cap, dst->stmt_len + n,
+                          sizeof(stmt_t));
+  memcpy(dst->stmts + dst->stmt_len, src->stmts + 1, n * sizeof(stmt_t));
+  while (n > 0) {
+    rebase_stmt(dst, src, dst->stmts + dst->stmt_len);
+    dst->stmt_len++;
+    n--;
+  }
+
+  n = src->case_len - 1;
+  dst->cases = grow_array(dst->cases, &dst->case_cap, dst->case_len + n,
+                          sizeof(stmt_case_t));
+  memcpy(dst->cases + dst->case_len, src->cases + 1,
+         n * sizeof(stmt_case_t));
+  while (n > 0) {
+    stmt_case_t *stmt_case = dst->cases + dst->case_len;
+    stmt_case->value = rebase(stmt_case->value, src->expr_base);
+    stmt_case->body =
+        rebase_list(dst, src, stmt_case->body, src->stmt_base);
+    dst->case_len++;
+    n--;
+  }
+}
+
+// Parses the skimmed bodies and appends every set of nodes to the program in
+// the order it was read, so that the nodes end up where parsing in order
+// would have put them. first is the first declaration parsed since the last
+// join.
+void join_skimmed_bodies(parser_ctx_t *ctx, global_stmt_t *first) {
+  share_typedefs(ctx);
+  run_body_parses(ctx->bodies, ctx->body_len, ctx->threads);
+  parse_skimmed_bodies(ctx);
+
+  ast_t *ast = main_ast();
+  int i = 0;
+  while (i < ctx->body_len) {
+    skimmed_body_t *body = ctx->bodies[i];
+    append_ast(ast, body->segment);
+    free_nodes(body->segment);
+    append_ast(ast, body->parser->ast);
+    free_nodes(body->parser->ast);
+
+    token_array_t *tokens = body->parser->ring;
+    free(tokens->kinds);
+    free(tokens->positions);
+    free(tokens->values);
+    i++;
+  }
+  append_ast(ast, ctx->ast);
+  free_nodes(ctx->ast);
+
+  // a function that was skimmed starts the next segment
+  i = 0;
+  global_stmt_t *gstmt = first;
+  while (gstmt) {
+    ast_t *segment = ctx->ast;
+    if (i < ctx->body_len) {
+      segment = ctx->bodies[i]->segment;
+    }
+
+    if (gstmt->type == GSTMT_FUNC || gstmt->type == GSTMT_FUNC_DECL) {
+      gstmt->value.func.params = rebase_list(
+          ast, segment, gstmt->value.func.params, segment->param_base);
+    }
+    if (i < ctx->body_len && gstmt == ctx->bodies[i]->gstmt) {
+      skimmed_body_t *body = ctx->bodies[i];
+      gstmt->value.func.body = rebase(body->body, body->parser->ast->stmt_base);
+      i++;
+    } else if (gstmt->type == GSTMT_FUNC) {
+      gstmt->value.func.body =
+          rebase(gstmt->value.func.body, segment->stmt_base);
+    }
+    gstmt = gstmt->next;
+  }
+  ctx->body_len = 0;
+  ctx->ast = ast;
+}
+
+int is_same_ast(ast_t *a, ast_t *b) {
+  if (a->expr_len != b->expr_len || a->stmt_len != b->stmt_len ||
+      a->case_len != b->case_len || a->param_len != b->param_len ||
+      a->type_len != b->type_len || a->list_len != b->list_len) {
+    return 0;
+  }
+  if (memcmp(a->exprs, b->exprs, a->expr_len * sizeof(expr_t)) ||
+      memcmp(a->stmts, b->stmts, a->stmt_len * sizeof(stmt_t)) ||
+      memcmp(a->cases, b->cases, a->case_len * sizeof(stmt_case_t)) ||
+      memcmp(a->lists, b->lists, a->list_len * sizeof(int))) {
+    return 0;
+  }
+  return 1;
+}
+
+program_t *parse(preprocessor_ctx_t *preprocessor, program_t *prelude,
+                 int threads) {
+  parser_ctx_t *ctx = new_parser_ctx(preprocessor);
+  ctx->threads = threads;
+  if (threads > 1) {
+    ctx->ast = new_ast(8);
+  } else {
+    ctx->ast = main_ast();
+  }
+
+  global_stmt_t *head = NULL;
+  global_stmt_t *cur = NULL;
+  if (prelude) {
+    ctx->typedefs = prelude->typedefs;
+    ctx->globals = prelude->globals;
+
+    // the list runs from the latest typedef back, so the first one indexed
+    // under a name is the one that counts
+    typedef_t *typedef_ = ctx->typedefs;
+    while (typedef_) {
+      if (!find_typedef(ctx, intern_symbol(typedef_->name))) {
+        index_typedef(ctx, typedef_);
+      }
+      typedef_ = typedef_->next;
+    }
+
+    head = prelude->body;
+    cur = head;
+    while (cur && cur->next) {
       cur = cur->next;
     }
   }
 
-  return new_program(head, ctx->globals);
+  global_stmt_t *unjoined = NULL;
+  while (peek(ctx) != TOKEN_EOF) {
+    global_stmt_t *gstmt = parse_global_stmt(ctx);
+    if (cur) {
+      cur->next = gstmt;
+    } else {
+      head = gstmt;
+    }
+    cur = gstmt;
+    if (unjoined == NULL) {
+      unjoined = gstmt;
+    }
+
+    // bodies are joined in batches, which bounds the nodes kept apart
+    if (ctx->body_len == 1024) {
+      join_skimmed_bodies(ctx, unjoined);
+      unjoined = NULL;
+      ctx->ast = new_ast(8);
+    }
+  }
+
+  if (threads > 1) {
+    join_skimmed_bodies(ctx, unjoined);
+  }
+
+  return new_program(head, ctx->typedefs, ctx->globals);
 }
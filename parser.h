@@ -1,4 +1,5 @@
 #pragma once
+#include "preprocessor.h"
 #include "tokenizer.h"
 #include "type.h"
 
@@ -7,6 +8,12 @@ struct _typedef_t {
   type_t *type;
   char *name;
 
+  // Typedefs are numbered from 1 in the order they are declared, and those
+  // read from a precompiled header take 0. hidden is the typedef of the same
+  // name that this one replaced.
+  int seq;
+  typedef_t *hidden;
+
   typedef_t *next;
 };
 
@@ -14,16 +21,11 @@ typedef struct _global_var_t global_var_t;
 struct _global_var_t {
   type_t *type;
   char *name;
+  int is_extern;
 
   global_var_t *next;
 };
 
-typedef struct {
-  token_t *cur_token;
-  typedef_t *typedefs;
-  global_var_t *globals;
-} parser_ctx_t;
-
 typedef enum {
   // special
   EXPR_CHAR,
@@ -66,45 +68,115 @@ typedef enum {
   EXPR_LOGOR,
 } exprtype_t;
 
+typedef struct _ast_t ast_t;
+typedef struct _skimmed_body_t skimmed_body_t;
+
+typedef struct {
+  preprocessor_ctx_t *preprocessor;
+  token_array_t *ring;
+  int ring_head;
+  int ring_len;
+  int ring_mask;
+
+  // where the nodes being parsed go
+  ast_t *ast;
+
+  typedef_t *typedefs;
+  global_var_t *globals;
+
+  // the typedefs again, indexed by the symbol of their name, so that telling
+  // whether an identifier names a type takes no search
+  typedef_t **typedef_table;
+  int typedef_cap;
+  int typedef_seq;
+
+  // only typedefs numbered below the limit are seen, so that a function body
+  // parsed ahead of time sees the typedefs declared before it
+  int typedef_limit;
+
+  // the nodes of the lists being parsed, kept on a stack until the list ends
+  int *scratch;
+  int scratch_len;
+  int scratch_cap;
+
+  // how many calls of parse_stmt are running
+  int stmt_depth;
+
+  // Indexed by token. The precedence of a binary operator, from 1 for || up
+  // to 10 for * / %, or 0 for other tokens, with the expression it makes. A
+  // compound assignment operator maps to its binary expression + 1.
+  int *binary_precs;
+  exprtype_t *binary_ops;
+  int *compound_ops;
+
+  // With more than one thread, function bodies are skimmed and parsed
+  // afterwards, each into nodes of its own. The nodes parsed at file scope
+  // go to a new set after every body skimmed.
+  int threads;
+  skimmed_body_t **bodies;
+  int body_len;
+  int body_cap;
+
+  // set while a body is parsed off the main thread
+  int is_worker;
+  int holds_type_lock;
+} parser_ctx_t;
+
 int is_unary_expr(exprtype_t type);
 int is_binary_expr(exprtype_t type);
 
-typedef struct _argument_t argument_t;
-typedef struct _expr_t expr_t;
+typedef enum {
+  BIND_NONE,
+  BIND_LOCAL,
+  BIND_GLOBAL,
+  BIND_ENUM,
+} bindkind_t;
 
-struct _argument_t {
-  expr_t *value;
-  argument_t *next;
-};
+typedef struct _expr_t expr_t;
 
+// The AST is stored in typed arrays. Expressions, statements, cases and
+// parameters are indices into the array of their kind, with 0 for no node.
+// Names are symbols and types are indices into the type array. A list is an
+// index into the list array, where the number of nodes is followed by the
+// nodes themselves; list 0 is empty.
 struct _expr_t {
   exprtype_t type;
-  pos_t *pos;
+  pos_t pos;
+
+  // the type of the value, resolved by codegen before the expression is
+  // generated
+  type_t *value_type;
+
+  // What an identifier names, bound along with the type: the frame offset of
+  // a local, a global, or the value of an enum constant.
+  bindkind_t bind;
+  int bind_value;
+  global_var_t *bound_global;
   union {
     char char_;
     int number;
-    char *string;
-    char *ident;
-    expr_t *unary;
+    int string;
+    int ident;
+    int unary;
     struct {
-      expr_t *lhs;
-      expr_t *rhs;
+      int lhs;
+      int rhs;
     } binary;
     struct {
-      expr_t *dst;
-      expr_t *src;
+      int dst;
+      int src;
     } assign;
     struct {
-      char *name;
-      argument_t *args;
+      int name;
+      int args;
     } call;
     struct {
-      expr_t *expr;
-      char *name;
+      int expr;
+      int name;
     } member;
     struct {
-      type_t *type;
-      expr_t *expr;
+      int type;
+      int expr;
     } sizeof_;
   } value;
 };
@@ -122,58 +194,79 @@ typedef enum {
   STMT_SWITCH,
 } stmttype_t;
 
-typedef struct _stmt_list_t stmt_list_t;
 typedef struct _stmt_case_t stmt_case_t;
 typedef struct _stmt_t stmt_t;
 
-struct _stmt_list_t {
-  stmt_t *stmt;
-  stmt_list_t *next;
-};
-
 struct _stmt_case_t {
-  expr_t *value;
-  stmt_list_t *body;
+  int value;
+  int body;
   int label;
-
-  stmt_case_t *next;
 };
 
 struct _stmt_t {
   stmttype_t type;
-  pos_t *pos;
+  pos_t pos;
   union {
-    expr_t *expr;
-    expr_t *ret;
+    int expr;
+    int ret;
     struct {
-      expr_t *cond;
-      stmt_t *then_;
-      stmt_t *else_;
+      int cond;
+      int then_;
+      int else_;
     } if_;
     struct {
-      expr_t *cond;
-      stmt_t *body;
+      int cond;
+      int body;
     } while_;
     struct {
-      stmt_t *init;
-      expr_t *cond;
-      expr_t *loop;
-      stmt_t *body;
+      int init;
+      int cond;
+      int loop;
+      int body;
     } for_;
-    stmt_list_t *block;
+    int block;
     struct {
-      type_t *type;
-      char *name;
-      expr_t *value;
+      int type;
+      int name;
+      int value;
     } define;
     struct {
-      expr_t *value;
-      stmt_case_t *cases;
-      stmt_case_t *default_case;
+      int value;
+      int cases;
+      int default_case;
     } switch_;
   } value;
 };
 
+typedef struct _parameter_t parameter_t;
+
+struct _parameter_t {
+  type_t *type;
+  char *name;
+};
+
+expr_t *expr_at(int expr);
+
+stmt_t *stmt_at(int stmt);
+
+stmt_case_t *case_at(int case_);
+
+parameter_t *param_at(int param);
+
+type_t *type_at(int type);
+
+int list_len(int list);
+
+// Returns node i of the list.
+int list_at(int list, int i);
+
+int new_param(type_t *type, char *name);
+
+int new_list(int *nodes, int len);
+
+// Returns the number of expressions and statements parsed so far.
+int ast_node_count();
+
 typedef enum {
   GSTMT_FUNC,
   GSTMT_FUNC_DECL,
@@ -184,25 +277,17 @@ typedef enum {
   GSTMT_DEFINE,
 } global_stmttype_t;
 
-typedef struct _parameter_t parameter_t;
 typedef struct _global_stmt_t global_stmt_t;
 
-struct _parameter_t {
-  type_t *type;
-  char *name;
-
-  parameter_t *next;
-};
-
 struct _global_stmt_t {
   global_stmttype_t type;
-  pos_t *pos;
+  pos_t pos;
   union {
     struct {
       type_t *ret_type;
       char *name;
-      parameter_t *params;
-      stmt_t *body;
+      int params;
+      int body;
     } func;
     type_t *type;
     struct {
@@ -216,7 +301,55 @@ struct _global_stmt_t {
 
 typedef struct {
   global_stmt_t *body;
+  typedef_t *typedefs;
   global_var_t *globals;
 } program_t;
 
-program_t *parse(token_t *token);
+// Parses the translation unit. If prelude is given, parsing continues after
+// its declarations, as if they had been read first. With more than one
+// thread, function bodies are parsed on up to threads threads, and the nodes
+// come out the same as when they are parsed in order.
+program_t *parse(preprocessor_ctx_t *preprocessor, program_t *prelude,
+                 int threads);
+
+// Returns the nodes parsed so far, which expr_at and the like read.
+ast_t *main_ast();
+
+// Takes the nodes parsed so far away from expr_at and the like, so that the
+// next parse starts afresh, and returns them.
+ast_t *detach_ast();
+
+// Returns whether two sets of nodes hold the same expressions, statements,
+// cases and lists.
+int is_same_ast(ast_t *a, ast_t *b);
+
+// The tokens of a function body from its '{' to the matching '}', read ahead
+// by parse, and the file scope nodes parsed before it.
+struct _skimmed_body_t {
+  parser_ctx_t *parser;
+  int token_len;
+  global_stmt_t *gstmt;
+  ast_t *segment;
+
+  int body;
+  int is_parsed;
+};
+
+// Parses the body into nodes of its own. A worker does not report errors but
+// stops, and leaves the body unparsed.
+void parse_skimmed_body(skimmed_body_t *body, int is_worker);
+
+// Parses the bodies on up to threads threads. The bodies left unparsed are
+// parsed in order on the calling thread afterwards, so that the first error
+// in the file is the one reported. Implemented in parse_threads.c, or
+// parse_threads_portable.c when ccc compiles itself.
+void run_body_parses(skimmed_body_t **bodies, int len, int threads);
+
+// Ends the thread of a worker that hit an error. Does nothing otherwise.
+void stop_body_parse(parser_ctx_t *ctx);
+
+// Types are built from shared tables and arenas, so workers build them one at
+// a time.
+void lock_types(parser_ctx_t *ctx);
+
+void unlock_types(parser_ctx_t *ctx);
@@ -0,0 +1,706 @@
+#include "pch.h"
+#include "arena.h"
+#include "error.h"
+#include "intern.h"
+#include "os.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The file is a sequence of variable-length integers and NUL-terminated
+// strings, read front to back:
+//
+//   magic, version
+//   symbols: count, then the spellings, in symbol order
+//   files: count, then (path, is_once, guard + 1) per file
+//   macros: count, then (name, is_function, params, body) per macro
+//   types: count, then one record per type
+//   typedefs: count, then (name, type) each
+//   globals: count, then (name, type, is_extern) each
+//   declarations: count, then one record per global statement
+//
+// Symbols are stored by their number in the writing process and mapped to
+// the reader's numbers on load. Types are stored by index + 1, with 0 for
+// NULL, so that shared types stay shared. Names are symbol + 1, with 0 for
+// NULL.
+int pch_magic() { return 1212370499; }
+
+int pch_version() { return 2; }
+
+// Pointers are hashed by their low bits, read through a union since ccc has
+// no casts.
+typedef union _type_key_t type_key_t;
+union _type_key_t {
+  type_t *type;
+  int bits;
+};
+
+typedef struct {
+  FILE *fp;
+
+  // types in index order, and an open addressing table of index + 1
+  type_t **types;
+  int type_len;
+  int type_cap;
+  int *type_table;
+  int type_table_cap;
+} pch_writer_t;
+
+// zigzag encodes the value, so that small negative numbers stay short too,
+// then writes it 7 bits at a time, low bits first
+void write_int(pch_writer_t *w, int value) {
+  int bits = (value << 1) ^ (value >> 31);
+  while (bits & ~127) {
+    fputc((bits & 127) | 128, w->fp);
+    bits = (bits >> 7) & 33554431;
+  }
+  fputc(bits, w->fp);
+}
+
+void write_string(pch_writer_t *w, char *string) {
+  fputs(string, w->fp);
+  fputc(0, w->fp);
+}
+
+void write_name(pch_writer_t *w, char *name) {
+  if (name == NULL) {
+    write_int(w, 0);
+    return;
+  }
+  write_int(w, intern_symbol(name) + 1);
+}
+
+int hash_type(type_t *type, int mask) {
+  type_key_t key;
+  key.type = type;
+  return ((key.bits >> 4) * 31) & mask;
+}
+
+void grow_type_table(pch_writer_t *w) {
+  if (w->type_cap == 0) {
+    w->type_cap = 256;
+  } else {
+    w->type_cap *= 2;
+  }
+  w->types = realloc(w->types, w->type_cap * sizeof(type_t *));
+
+  w->type_table_cap = w->type_cap * 2;
+  w->type_table = calloc(w->type_table_cap, sizeof(int));
+  int mask = w->type_table_cap - 1;
+  int i = 0;
+  while (i < w->type_len) {
+    int slot = hash_type(w->types[i], mask);
+    while (w->type_table[slot]) {
+      slot = (slot + 1) & mask;
+    }
+    w->type_table[slot] = i + 1;
+    i++;
+  }
+}
+
+// returns the index + 1 of the type, numbering it when it is first seen
+int type_index(pch_writer_t *w, type_t *type) {
+  if (type == NULL) {
+    return 0;
+  }
+  if (w->type_len == w->type_cap) {
+    grow_type_table(w);
+  }
+
+  int mask = w->type_table_cap - 1;
+  int slot = hash_type(type, mask);
+  while (w->type_table[slot]) {
+    int index = w->type_table[slot];
+    if (w->types[index - 1] == type) {
+      return index;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  w->types[w->type_len] = type;
+  w->type_len++;
+  w->type_table[slot] = w->type_len;
+  return w->type_len;
+}
+
+void write_type_ref(pch_writer_t *w, type_t *type) {
+  write_int(w, type_index(w, type));
+}
+
+// numbers every type reachable from the declarations before any is written,
+// so that the reader can allocate them all up front
+void number_types(pch_writer_t *w, program_t *program) {
+  typedef_t *typedef_ = program->typedefs;
+  while (typedef_) {
+    type_index(w, typedef_->type);
+    typedef_ = typedef_->next;
+  }
+  global_var_t *global = program->globals;
+  while (global) {
+    type_index(w, global->type);
+    global = global->next;
+  }
+
+  global_stmt_t *gstmt = program->body;
+  while (gstmt) {
+    switch (gstmt->type) {
+    case GSTMT_FUNC:
+      error(gstmt->pos, "function definitions cannot be precompiled\n");
+    case GSTMT_FUNC_DECL: {
+      type_index(w, gstmt->value.func.ret_type);
+      int params = gstmt->value.func.params;
+      int i = 0;
+      while (i < list_len(params)) {
+        type_index(w, param_at(list_at(params, i))->type);
+        i++;
+      }
+      break;
+    }
+    case GSTMT_DEFINE:
+      type_index(w, gstmt->value.define.type);
+      break;
+    default:
+      type_index(w, gstmt->value.type);
+      break;
+    }
+    gstmt = gstmt->next;
+  }
+
+  int i = 0;
+  while (i < w->type_len) {
+    type_t *type = w->types[i];
+    switch (type->kind) {
+    case TYPE_PTR:
+      type_index(w, type->value.ptr);
+      break;
+    case TYPE_ARRAY:
+      type_index(w, type->value.array.elm);
+      break;
+    case TYPE_STRUCT:
+    case TYPE_UNION: {
+      struct_member_t *member = type->value.struct_union.members;
+      while (member) {
+        type_index(w, member->type);
+        member = member->next;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+    i++;
+  }
+}
+
+void write_type(pch_writer_t *w, type_t *type) {
+  write_int(w, type->kind);
+  switch (type->kind) {
+  case TYPE_PTR:
+    write_type_ref(w, type->value.ptr);
+    break;
+  case TYPE_ARRAY:
+    write_type_ref(w, type->value.array.elm);
+    write_int(w, type->value.array.len);
+    break;
+  case TYPE_STRUCT:
+  case TYPE_UNION: {
+    write_name(w, type->value.struct_union.tag);
+    write_int(w, type->value.struct_union.size);
+    write_int(w, type->value.struct_union.align);
+
+    int len = 0;
+    struct_member_t *member = type->value.struct_union.members;
+    while (member) {
+      len++;
+      member = member->next;
+    }
+    write_int(w, len);
+
+    member = type->value.struct_union.members;
+    while (member) {
+      write_type_ref(w, member->type);
+      write_name(w, member->name);
+      write_int(w, member->offset);
+      member = member->next;
+    }
+    break;
+  }
+  case TYPE_ENUM: {
+    write_name(w, type->value.enum_.tag);
+
+    int len = 0;
+    enum_t *enum_ = type->value.enum_.enums;
+    while (enum_) {
+      len++;
+      enum_ = enum_->next;
+    }
+    write_int(w, len);
+
+    enum_ = type->value.enum_.enums;
+    while (enum_) {
+      write_name(w, enum_->name);
+      write_int(w, enum_->value);
+      enum_ = enum_->next;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void write_macro(pch_writer_t *w, int name, macro_t *macro) {
+  write_int(w, name);
+  write_int(w, macro->is_function);
+  write_int(w, macro->param_len);
+  int i = 0;
+  while (i < macro->param_len) {
+    write_int(w, macro->params[i]);
+    i++;
+  }
+
+  write_int(w, macro->body_len);
+  i = 0;
+  while (i < macro->body_len) {
+    write_int(w, macro->body->kinds[i]);
+    write_int(w, macro->body->values[i]);
+    i++;
+  }
+}
+
+void write_declaration(pch_writer_t *w, global_stmt_t *gstmt) {
+  write_int(w, gstmt->type);
+  switch (gstmt->type) {
+  case GSTMT_FUNC_DECL: {
+    write_type_ref(w, gstmt->value.func.ret_type);
+    write_name(w, gstmt->value.func.name);
+
+    int params = gstmt->value.func.params;
+    write_int(w, list_len(params));
+
+    int i = 0;
+    while (i < list_len(params)) {
+      parameter_t *param = param_at(list_at(params, i));
+      write_type_ref(w, param->type);
+      write_name(w, param->name);
+      i++;
+    }
+    break;
+  }
+  case GSTMT_DEFINE:
+    write_type_ref(w, gstmt->value.define.type);
+    write_name(w, gstmt->value.define.name);
+    break;
+  default:
+    write_type_ref(w, gstmt->value.type);
+    break;
+  }
+}
+
+void write_pch(char *path, preprocessor_ctx_t *preprocessor,
+               program_t *program) {
+  pch_writer_t *w = calloc(1, sizeof(pch_writer_t));
+  w->fp = fopen(path, "wb");
+  if (w->fp == NULL) {
+    panic("failed to open file '%s'\n", path);
+  }
+  number_types(w, program);
+
+  // the header itself is in the file, so it is never read again
+  reserve_symbol(preprocessor, preprocessor->source->path);
+  preprocessor->once_files[preprocessor->source->path] = 1;
+
+  write_int(w, pch_magic());
+  write_int(w, pch_version());
+
+  int symbols = symbol_count();
+  write_int(w, symbols);
+  int i = 0;
+  while (i < symbols) {
+    write_string(w, symbol_name(i));
+    i++;
+  }
+
+  int len = 0;
+  i = 0;
+  while (i < preprocessor->symbol_cap) {
+    if (preprocessor->once_files[i] || preprocessor->guard_macros[i]) {
+      len++;
+    }
+    i++;
+  }
+  write_int(w, len);
+  i = 0;
+  while (i < preprocessor->symbol_cap) {
+    if (preprocessor->once_files[i] || preprocessor->guard_macros[i]) {
+      write_int(w, i);
+      write_int(w, preprocessor->once_files[i]);
+      write_int(w, preprocessor->guard_macros[i]);
+    }
+    i++;
+  }
+
+  len = 0;
+  i = 0;
+  while (i < preprocessor->symbol_cap) {
+    if (preprocessor->macros[i]) {
+      len++;
+    }
+    i++;
+  }
+  write_int(w, len);
+  i = 0;
+  while (i < preprocessor->symbol_cap) {
+    if (preprocessor->macros[i]) {
+      write_macro(w, i, preprocessor->macros[i]);
+    }
+    i++;
+  }
+
+  write_int(w, w->type_len);
+  i = 0;
+  while (i < w->type_len) {
+    write_type(w, w->types[i]);
+    i++;
+  }
+
+  len = 0;
+  typedef_t *typedef_ = program->typedefs;
+  while (typedef_) {
+    len++;
+    typedef_ = typedef_->next;
+  }
+  write_int(w, len);
+  typedef_ = program->typedefs;
+  while (typedef_) {
+    write_name(w, typedef_->name);
+    write_type_ref(w, typedef_->type);
+    typedef_ = typedef_->next;
+  }
+
+  len = 0;
+  global_var_t *global = program->globals;
+  while (global) {
+    len++;
+    global = global->next;
+  }
+  write_int(w, len);
+  global = program->globals;
+  while (global) {
+    write_name(w, global->name);
+    write_type_ref(w, global->type);
+    write_int(w, global->is_extern);
+    global = global->next;
+  }
+
+  len = 0;
+  global_stmt_t *gstmt = program->body;
+  while (gstmt) {
+    len++;
+    gstmt = gstmt->next;
+  }
+  write_int(w, len);
+  gstmt = program->body;
+  while (gstmt) {
+    write_declaration(w, gstmt);
+    gstmt = gstmt->next;
+  }
+
+  fclose(w->fp);
+}
+
+typedef struct {
+  char *path;
+  char *buf;
+  int size;
+  int index;
+
+  // the reader's symbol for each symbol of the writer
+  int *symbols;
+  int symbol_len;
+
+  type_t **types;
+  int type_len;
+} pch_reader_t;
+
+void check_pch_size(pch_reader_t *r, int len) {
+  if (r->index + len > r->size) {
+    panic("precompiled header '%s' is truncated\n", r->path);
+  }
+}
+
+int read_int(pch_reader_t *r) {
+  int bits = 0;
+  int shift = 0;
+  while (1) {
+    check_pch_size(r, 1);
+    int byte = r->buf[r->index] & 255;
+    r->index++;
+    bits = bits | (byte & 127) << shift;
+    shift += 7;
+    if (!(byte & 128)) {
+      break;
+    }
+  }
+  return ((bits >> 1) & 2147483647) ^ -(bits & 1);
+}
+
+// returns the string in place, the mapping lives until exit
+char *read_string(pch_reader_t *r) {
+  char *string = r->buf + r->index;
+  int len = strlen(string);
+  check_pch_size(r, len + 1);
+  r->index += len + 1;
+  return string;
+}
+
+int read_symbol(pch_reader_t *r) {
+  int symbol = read_int(r);
+  if (symbol < 0 || symbol >= r->symbol_len) {
+    panic("precompiled header '%s' is corrupt\n", r->path);
+  }
+  return r->symbols[symbol];
+}
+
+char *read_name(pch_reader_t *r) {
+  int symbol = read_int(r);
+  if (symbol == 0) {
+    return NULL;
+  }
+  if (symbol > r->symbol_len) {
+    panic("precompiled header '%s' is corrupt\n", r->path);
+  }
+  return symbol_name(r->symbols[symbol - 1]);
+}
+
+type_t *read_type_ref(pch_reader_t *r) {
+  int index = read_int(r);
+  if (index == 0) {
+    return NULL;
+  }
+  if (index < 0 || index > r->type_len) {
+    panic("precompiled header '%s' is corrupt\n", r->path);
+  }
+  return r->types[index - 1];
+}
+
+void read_type(pch_reader_t *r, type_t *type) {
+  type->kind = read_int(r);
+  switch (type->kind) {
+  case TYPE_PTR:
+    type->value.ptr = read_type_ref(r);
+    break;
+  case TYPE_ARRAY:
+    type->value.array.elm = read_type_ref(r);
+    type->value.array.len = read_int(r);
+    break;
+  case TYPE_STRUCT:
+  case TYPE_UNION: {
+    type->value.struct_union.tag = read_name(r);
+    type->value.struct_union.size = read_int(r);
+    type->value.struct_union.align = read_int(r);
+
+    int len = read_int(r);
+    struct_member_t *cur = NULL;
+    while (len > 0) {
+      type_t *member_type = read_type_ref(r);
+      struct_member_t *member = new_struct_member(member_type, read_name(r));
+      member->offset = read_int(r);
+      if (cur) {
+        cur->next = member;
+      } else {
+        type->value.struct_union.members = member;
+      }
+      cur = member;
+      len--;
+    }
+    break;
+  }
+  case TYPE_ENUM: {
+    type->value.enum_.tag = read_name(r);
+
+    int len = read_int(r);
+    enum_t *cur = NULL;
+    while (len > 0) {
+      char *name = read_name(r);
+      enum_t *enum_ = new_enum(name, read_int(r));
+      if (cur) {
+        cur->next = enum_;
+      } else {
+        type->value.enum_.enums = enum_;
+      }
+      cur = enum_;
+      len--;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void read_macro(pch_reader_t *r, preprocessor_ctx_t *preprocessor) {
+  int name = read_symbol(r);
+  macro_t *macro = calloc(1, sizeof(macro_t));
+  macro->is_function = read_int(r);
+  macro->param_len = read_int(r);
+  macro->params = calloc(macro->param_len + 1, sizeof(int));
+  int i = 0;
+  while (i < macro->param_len) {
+    macro->params[i] = read_symbol(r);
+    i++;
+  }
+
+  macro->body_len = read_int(r);
+  macro->body = new_token_array(macro->body_len + 1);
+  i = 0;
+  while (i < macro->body_len) {
+    tokentype_t kind = read_int(r);
+    macro->body->kinds[i] = kind;
+    macro->body->positions[i] = new_pos(0, 0);
+    if (kind == TOKEN_IDENT || kind == TOKEN_STRING) {
+      macro->body->values[i] = read_symbol(r);
+    } else {
+      macro->body->values[i] = read_int(r);
+    }
+    i++;
+  }
+
+  reserve_symbol(preprocessor, name);
+  preprocessor->macros[name] = macro;
+}
+
+global_stmt_t *read_declaration(pch_reader_t *r) {
+  global_stmt_t *gstmt = node_alloc(sizeof(global_stmt_t));
+  gstmt->type = read_int(r);
+  switch (gstmt->type) {
+  case GSTMT_FUNC_DECL: {
+    gstmt->value.func.ret_type = read_type_ref(r);
+    gstmt->value.func.name = read_name(r);
+
+    int len = read_int(r);
+    int *params = calloc(len + 1, sizeof(int));
+    int i = 0;
+    while (i < len) {
+      type_t *type = read_type_ref(r);
+      char *name = read_name(r);
+      params[i] = new_param(type, name);
+      i++;
+    }
+    gstmt->value.func.params = new_list(params, len);
+    free(params);
+    break;
+  }
+  case GSTMT_DEFINE:
+    gstmt->value.define.type = read_type_ref(r);
+    gstmt->value.define.name = read_name(r);
+    break;
+  default:
+    gstmt->value.type = read_type_ref(r);
+    break;
+  }
+  return gstmt;
+}
+
+program_t *read_pch(char *path, preprocessor_ctx_t *preprocessor) {
+  pch_reader_t *r = calloc(1, sizeof(pch_reader_t));
+  r->path = path;
+  r->buf = map_file(path, &r->size);
+  if (r->buf == NULL) {
+    panic("failed to open file '%s'\n", path);
+  }
+  if (read_int(r) != pch_magic() || read_int(r) != pch_version()) {
+    panic("'%s' is not a precompiled header of this version\n", path);
+  }
+
+  r->symbol_len = read_int(r);
+  r->symbols = calloc(r->symbol_len + 1, sizeof(int));
+  int i = 0;
+  while (i < r->symbol_len) {
+    r->symbols[i] = intern_symbol(read_string(r));
+    i++;
+  }
+
+  int len = read_int(r);
+  while (len > 0) {
+    int file = read_symbol(r);
+    reserve_symbol(preprocessor, file);
+    preprocessor->once_files[file] = read_int(r);
+    int guard = read_int(r);
+    if (guard) {
+      if (guard > r->symbol_len) {
+        panic("precompiled header '%s' is corrupt\n", path);
+      }
+      preprocessor->guard_macros[file] = r->symbols[guard - 1] + 1;
+    }
+    len--;
+  }
+
+  len = read_int(r);
+  while (len > 0) {
+    read_macro(r, preprocessor);
+    len--;
+  }
+
+  // all types are allocated first, since records refer to later ones
+  r->type_len = read_int(r);
+  r->types = calloc(r->type_len + 1, sizeof(type_t *));
+  i = 0;
+  while (i < r->type_len) {
+    r->types[i] = node_alloc(sizeof(type_t));
+    i++;
+  }
+  i = 0;
+  while (i < r->type_len) {
+    read_type(r, r->types[i]);
+    i++;
+  }
+
+  program_t *program = node_alloc(sizeof(program_t));
+
+  len = read_int(r);
+  typedef_t *cur_typedef = NULL;
+  while (len > 0) {
+    typedef_t *typedef_ = node_alloc(sizeof(typedef_t));
+    typedef_->name = read_name(r);
+    typedef_->type = read_type_ref(r);
+    if (cur_typedef) {
+      cur_typedef->next = typedef_;
+    } else {
+      program->typedefs = typedef_;
+    }
+    cur_typedef = typedef_;
+    len--;
+  }
+
+  len = read_int(r);
+  global_var_t *cur_global = NULL;
+  while (len > 0) {
+    global_var_t *global = node_alloc(sizeof(global_var_t));
+    global->name = read_name(r);
+    global->type = read_type_ref(r);
+    global->is_extern = read_int(r);
+    if (cur_global) {
+      cur_global->next = global;
+    } else {
+      program->globals = global;
+    }
+    cur_global = global;
+    len--;
+  }
+
+  len = read_int(r);
+  global_stmt_t *cur = NULL;
+  while (len > 0) {
+    global_stmt_t *gstmt = read_declaration(r);
+    if (cur) {
+      cur->next = gstmt;
+    } else {
+      program->body = gstmt;
+    }
+    cur = gstmt;
+    len--;
+  }
+
+  return program;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "parser.h"
+#include "preprocessor.h"
+
+// A precompiled header holds the state left after reading a header: the
+// macros with their tokens, the files that need not be read again, and the
+// typedefs, globals and declarations the parser saw, including the struct,
+// union and enum types codegen builds its tables from. Function definitions
+// cannot be precompiled.
+void write_pch(char *path, preprocessor_ctx_t *preprocessor,
+               program_t *program);
+
+// Restores the state saved by write_pch into the preprocessor and returns the
+// declarations to continue parsing from.
+program_t *read_pch(char *path, preprocessor_ctx_t *preprocessor);
@@ -0,0 +1,926 @@
+#include "preprocessor.h"
+#include "error.h"
+#include "intern.h"
+#include "os.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+  DIRECTIVE_NULL,
+  DIRECTIVE_IF,
+  DIRECTIVE_IFDEF,
+  DIRECTIVE_IFNDEF,
+  DIRECTIVE_ELIF,
+  DIRECTIVE_ELSE,
+  DIRECTIVE_ENDIF,
+  DIRECTIVE_DEFINE,
+  DIRECTIVE_UNDEF,
+  DIRECTIVE_INCLUDE,
+  DIRECTIVE_PRAGMA,
+  DIRECTIVE_ERROR,
+  DIRECTIVE_UNKNOWN,
+} directive_t;
+
+// interned names of the directives spelled as identifiers
+char *directive_names[16];
+
+char *defined_name;
+char *once_name;
+
+void read_directive(preprocessor_ctx_t *ctx, pos_t pos);
+
+void read_unexpanded(preprocessor_ctx_t *ctx, token_array_t *tokens,
+                     int slot);
+
+void read_expanded(preprocessor_ctx_t *ctx, token_array_t *tokens, int slot);
+
+void reserve_symbol(preprocessor_ctx_t *ctx, int symbol) {
+  if (symbol < ctx->symbol_cap) {
+    return;
+  }
+
+  int cap = ctx->symbol_cap * 2 + 256;
+  while (cap <= symbol) {
+    cap *= 2;
+  }
+  ctx->macros = realloc(ctx->macros, cap * sizeof(macro_t *));
+  ctx->once_files = realloc(ctx->once_files, cap * sizeof(int));
+  ctx->guard_macros = realloc(ctx->guard_macros, cap * sizeof(int));
+
+  int i = ctx->symbol_cap;
+  while (i < cap) {
+    ctx->macros[i] = NULL;
+    ctx->once_files[i] = 0;
+    ctx->guard_macros[i] = 0;
+    i++;
+  }
+  ctx->symbol_cap = cap;
+}
+
+macro_t *find_macro(preprocessor_ctx_t *ctx, int symbol) {
+  if (symbol >= ctx->symbol_cap) {
+    return NULL;
+  }
+  return ctx->macros[symbol];
+}
+
+void copy_token(token_array_t *dst, int dst_slot, token_array_t *src,
+                int src_slot) {
+  dst->kinds[dst_slot] = src->kinds[src_slot];
+  dst->positions[dst_slot] = src->positions[src_slot];
+  dst->values[dst_slot] = src->values[src_slot];
+}
+
+// appends a token at len and returns the new length
+int append_token(token_array_t *dst, int len, token_array_t *src, int slot) {
+  if (len == dst->cap) {
+    grow_token_array(dst, dst->cap * 2);
+  }
+  copy_token(dst, len, src, slot);
+  return len + 1;
+}
+
+// returns the directory part of the path, or NULL if it has none
+char *dir_of(char *path) {
+  int len = 0;
+  int i = 0;
+  while (path[i]) {
+    if (path[i] == '/') {
+      len = i + 1;
+    }
+    i++;
+  }
+  if (len == 0) {
+    return NULL;
+  }
+
+  char *dir = calloc(len + 1, 1);
+  memcpy(dir, path, len);
+  return dir;
+}
+
+char *join_path(char *dir, char *name) {
+  if (dir == NULL || name[0] == '/') {
+    return name;
+  }
+
+  int dir_len = strlen(dir);
+  int name_len = strlen(name);
+  char *path = calloc(dir_len + name_len + 2, 1);
+  memcpy(path, dir, dir_len);
+  if (dir[dir_len - 1] != '/') {
+    path[dir_len] = '/';
+    dir_len++;
+  }
+  memcpy(path + dir_len, name, name_len);
+  return path;
+}
+
+void push_source(preprocessor_ctx_t *ctx, char *path,
+                 tokenizer_ctx_t *tokenizer) {
+  source_t *source = calloc(1, sizeof(source_t));
+  source->tokenizer = tokenizer;
+  source->path = intern_symbol(path);
+  source->dir = dir_of(path);
+  source->file = add_source_file(path);
+  source->cond_depth = ctx->cond_len;
+
+  tokenizer->line_base = ctx->next_line - 1;
+  map_source_lines(ctx->next_line, source->file, 1);
+
+  source->next = ctx->source;
+  ctx->source = source;
+}
+
+// Leaves the current file at its end. Returns 0 at the end of the main file.
+int pop_source(preprocessor_ctx_t *ctx, pos_t pos) {
+  source_t *source = ctx->source;
+  if (ctx->cond_len > source->cond_depth) {
+    error(pos, "unterminated conditional directive\n");
+  }
+  if (source->guard_state == GUARD_CLOSED) {
+    reserve_symbol(ctx, source->path);
+    ctx->guard_macros[source->path] = source->guard + 1;
+  }
+  if (source->next == NULL) {
+    return 0;
+  }
+
+  tokenizer_ctx_t *tokenizer = source->tokenizer;
+  ctx->next_line = tokenizer->line_base + tokenizer->line + 1;
+
+  ctx->source = source->next;
+  tokenizer = ctx->source->tokenizer;
+  tokenizer->line_base = ctx->next_line - tokenizer->line;
+  map_source_lines(ctx->next_line, ctx->source->file, tokenizer->line);
+  return 1;
+}
+
+void add_directive(directive_t directive, char *name) {
+  directive_names[directive] = intern(name);
+}
+
+preprocessor_ctx_t *new_preprocessor_ctx(char *path,
+                                         tokenizer_ctx_t *tokenizer) {
+  add_directive(DIRECTIVE_IFDEF, "ifdef");
+  add_directive(DIRECTIVE_IFNDEF, "ifndef");
+  add_directive(DIRECTIVE_ELIF, "elif");
+  add_directive(DIRECTIVE_ENDIF, "endif");
+  add_directive(DIRECTIVE_DEFINE, "define");
+  add_directive(DIRECTIVE_UNDEF, "undef");
+  add_directive(DIRECTIVE_INCLUDE, "include");
+  add_directive(DIRECTIVE_PRAGMA, "pragma");
+  add_directive(DIRECTIVE_ERROR, "error");
+  defined_name = intern("defined");
+  once_name = intern("once");
+
+  preprocessor_ctx_t *ctx = calloc(1, sizeof(preprocessor_ctx_t));
+  ctx->next_line = 1;
+  ctx->is_scalar = tokenizer->is_scalar;
+  ctx->tmp = new_token_array(1);
+  ctx->cur = new_token_array(1);
+  ctx->pushback = new_token_array(1);
+  push_source(ctx, path, tokenizer);
+  return ctx;
+}
+
+void add_include_dir(preprocessor_ctx_t *ctx, char *dir) {
+  ctx->include_dirs = realloc(ctx->include_dirs,
+                              (ctx->include_dir_len + 1) * sizeof(char *));
+  ctx->include_dirs[ctx->include_dir_len] = dir;
+  ctx->include_dir_len++;
+}
+
+void push_cond(preprocessor_ctx_t *ctx, cond_t cond) {
+  if (ctx->cond_len == ctx->cond_cap) {
+    ctx->cond_cap = ctx->cond_cap * 2 + 16;
+    ctx->conds = realloc(ctx->conds, ctx->cond_cap * sizeof(cond_t));
+  }
+  ctx->conds[ctx->cond_len] = cond;
+  ctx->cond_len++;
+}
+
+cond_t taken_if(int is_taken) {
+  if (is_taken) {
+    return COND_ACTIVE;
+  }
+  return COND_PENDING;
+}
+
+directive_t read_directive_name(preprocessor_ctx_t *ctx,
+                                tokenizer_ctx_t *tokenizer) {
+  read_token(tokenizer, ctx->tmp, 0);
+  switch (ctx->tmp->kinds[0]) {
+  case TOKEN_NEWLINE:
+  case TOKEN_EOF:
+    return DIRECTIVE_NULL;
+  case TOKEN_IF:
+    return DIRECTIVE_IF;
+  case TOKEN_ELSE:
+    return DIRECTIVE_ELSE;
+  case TOKEN_IDENT:
+    break;
+  default:
+    return DIRECTIVE_UNKNOWN;
+  }
+
+  char *name = symbol_name(ctx->tmp->values[0]);
+  int directive = 0;
+  while (directive < DIRECTIVE_UNKNOWN) {
+    if (directive_names[directive] == name) {
+      return directive;
+    }
+    directive++;
+  }
+  return DIRECTIVE_UNKNOWN;
+}
+
+void expect_newline(preprocessor_ctx_t *ctx, tokenizer_ctx_t *tokenizer,
+                    pos_t pos) {
+  read_token(tokenizer, ctx->tmp, 0);
+  tokentype_t kind = ctx->tmp->kinds[0];
+  if (kind != TOKEN_NEWLINE && kind != TOKEN_EOF) {
+    error(pos, "extra tokens at end of directive\n");
+  }
+}
+
+int read_macro_name(preprocessor_ctx_t *ctx, tokenizer_ctx_t *tokenizer,
+                    pos_t pos) {
+  read_token(tokenizer, ctx->tmp, 0);
+  if (ctx->tmp->kinds[0] != TOKEN_IDENT) {
+    error(pos, "macro name must be an identifier\n");
+  }
+  return ctx->tmp->values[0];
+}
+
+// The expression of an #if is read through macro expansion, one token ahead
+// in ctx->cur, and evaluated by precedence climbing.
+void next_cond_token(preprocessor_ctx_t *ctx) {
+  read_expanded(ctx, ctx->cur, 0);
+}
+
+tokentype_t cond_token(preprocessor_ctx_t *ctx) { return ctx->cur->kinds[0]; }
+
+int binary_prec(tokentype_t kind) {
+  switch (kind) {
+  case TOKEN_LOGOR:
+    return 1;
+  case TOKEN_LOGAND:
+    return 2;
+  case TOKEN_OR:
+    return 3;
+  case TOKEN_XOR:
+    return 4;
+  case TOKEN_AND:
+    return 5;
+  case TOKEN_EQ:
+  case TOKEN_NE:
+    return 6;
+  case TOKEN_LT:
+  case TOKEN_LE:
+  case TOKEN_GT:
+  case TOKEN_GE:
+    return 7;
+  case TOKEN_SHL:
+  case TOKEN_SHR:
+    return 8;
+  case TOKEN_ADD:
+  case TOKEN_SUB:
+    return 9;
+  case TOKEN_MUL:
+  case TOKEN_DIV:
+  case TOKEN_REM:
+    return 10;
+  default:
+    return 0;
+  }
+}
+
+int eval_binary(preprocessor_ctx_t *ctx, int min_prec, pos_t pos);
+
+int eval_defined(preprocessor_ctx_t *ctx, pos_t pos) {
+  read_unexpanded(ctx, ctx->cur, 0);
+  int has_paren = cond_token(ctx) == TOKEN_PAREN_OPEN;
+  if (has_paren) {
+    read_unexpanded(ctx, ctx->cur, 0);
+  }
+  if (cond_token(ctx) != TOKEN_IDENT) {
+    error(pos, "expected a macro name after 'defined'\n");
+  }
+
+  int is_defined = find_macro(ctx, ctx->cur->values[0]) != NULL;
+  if (has_paren) {
+    read_unexpanded(ctx, ctx->cur, 0);
+    if (cond_token(ctx) != TOKEN_PAREN_CLOSE) {
+      error(pos, "missing ')' after 'defined'\n");
+    }
+  }
+  next_cond_token(ctx);
+  return is_defined;
+}
+
+int eval_unary(preprocessor_ctx_t *ctx, pos_t pos) {
+  tokentype_t kind = cond_token(ctx);
+  int value = ctx->cur->values[0];
+  switch (kind) {
+  case TOKEN_NUMBER:
+  case TOKEN_CHAR_LIT:
+    next_cond_token(ctx);
+    return value;
+  case TOKEN_IDENT:
+    if (symbol_name(value) == defined_name) {
+      return eval_defined(ctx, pos);
+    }
+    // identifiers left after expansion are 0
+    next_cond_token(ctx);
+    return 0;
+  case TOKEN_PAREN_OPEN:
+    next_cond_token(ctx);
+    value = eval_binary(ctx, 1, pos);
+    if (cond_token(ctx) != TOKEN_PAREN_CLOSE) {
+      error(pos, "missing ')' in #if\n");
+    }
+    next_cond_token(ctx);
+    return value;
+  case TOKEN_ADD:
+    next_cond_token(ctx);
+    return eval_unary(ctx, pos);
+  case TOKEN_SUB:
+    next_cond_token(ctx);
+    return -eval_unary(ctx, pos);
+  case TOKEN_NEG:
+    next_cond_token(ctx);
+    return !eval_unary(ctx, pos);
+  case TOKEN_NOT:
+    next_cond_token(ctx);
+    return ~eval_unary(ctx, pos);
+  default:
+    error(pos, "invalid expression in #if\n");
+  }
+}
+
+int eval_op(tokentype_t op, int lhs, int rhs, pos_t pos) {
+  switch (op) {
+  case TOKEN_LOGOR:
+    return lhs || rhs;
+  case TOKEN_LOGAND:
+    return lhs && rhs;
+  case TOKEN_OR:
+    return lhs | rhs;
+  case TOKEN_XOR:
+    return lhs ^ rhs;
+  case TOKEN_AND:
+    return lhs & rhs;
+  case TOKEN_EQ:
+    return lhs == rhs;
+  case TOKEN_NE:
+    return lhs != rhs;
+  case TOKEN_LT:
+    return lhs < rhs;
+  case TOKEN_LE:
+    return lhs <= rhs;
+  case TOKEN_GT:
+    return lhs > rhs;
+  case TOKEN_GE:
+    return lhs >= rhs;
+  case TOKEN_SHL:
+    return lhs << rhs;
+  case TOKEN_SHR:
+    return lhs >> rhs;
+  case TOKEN_ADD:
+    return lhs + rhs;
+  case TOKEN_SUB:
+    return lhs - rhs;
+  case TOKEN_MUL:
+    return lhs * rhs;
+  default:
+    if (rhs == 0) {
+      error(pos, "division by zero in #if\n");
+    }
+    if (op == TOKEN_DIV) {
+      return lhs / rhs;
+    }
+    return lhs % rhs;
+  }
+}
+
+int eval_binary(preprocessor_ctx_t *ctx, int min_prec, pos_t pos) {
+  int lhs = eval_unary(ctx, pos);
+  while (1) {
+    tokentype_t op = cond_token(ctx);
+    int prec = binary_prec(op);
+    if (prec == 0 || prec < min_prec) {
+      return lhs;
+    }
+
+    next_cond_token(ctx);
+    int rhs = eval_binary(ctx, prec + 1, pos);
+    lhs = eval_op(op, lhs, rhs, pos);
+  }
+}
+
+int eval_condition(preprocessor_ctx_t *ctx, pos_t pos) {
+  next_cond_token(ctx);
+  int value = eval_binary(ctx, 1, pos);
+  if (cond_token(ctx) != TOKEN_NEWLINE && cond_token(ctx) != TOKEN_EOF) {
+    error(pos, "extra tokens at end of #if\n");
+  }
+  return value != 0;
+}
+
+// handles #elif, #else and #endif, both in read and in skipped groups
+void read_conditional(preprocessor_ctx_t *ctx, directive_t directive,
+                      pos_t pos) {
+  source_t *source = ctx->source;
+  if (ctx->cond_len == source->cond_depth) {
+    error(pos, "conditional directive without #if\n");
+  }
+
+  int top = ctx->cond_len - 1;
+  int is_guard = source->guard_state == GUARD_OPEN &&
+                 ctx->cond_len == source->guard_depth;
+  if (directive == DIRECTIVE_ENDIF) {
+    expect_newline(ctx, source->tokenizer, pos);
+    if (is_guard) {
+      source->guard_state = GUARD_CLOSED;
+    }
+    ctx->cond_len--;
+    return;
+  }
+
+  if (is_guard) {
+    source->guard_state = GUARD_INVALID;
+  }
+  if (ctx->conds[top] != COND_PENDING) {
+    ctx->conds[top] = COND_DONE;
+    skip_line(source->tokenizer);
+    return;
+  }
+
+  if (directive == DIRECTIVE_ELSE) {
+    expect_newline(ctx, source->tokenizer, pos);
+    ctx->conds[top] = COND_ACTIVE;
+    return;
+  }
+  ctx->conds[top] = taken_if(eval_condition(ctx, pos));
+}
+
+// Skips lines up to the next group that is taken, or to the end of the
+// outermost one. Only directives are tokenized on the way.
+void skip_group(preprocessor_ctx_t *ctx) {
+  tokenizer_ctx_t *tokenizer = ctx->source->tokenizer;
+  while (ctx->cond_len && ctx->conds[ctx->cond_len - 1] != COND_ACTIVE) {
+    if (!skip_to_directive(tokenizer)) {
+      error(new_pos(tokenizer->line_base + tokenizer->line, tokenizer->column),
+            "unterminated conditional directive\n");
+    }
+
+    read_token(tokenizer, ctx->tmp, 0);
+    pos_t pos = ctx->tmp->positions[0];
+    tokenizer->is_directive = 1;
+    directive_t directive = read_directive_name(ctx, tokenizer);
+    switch (directive) {
+    case DIRECTIVE_NULL:
+      break;
+    case DIRECTIVE_IF:
+    case DIRECTIVE_IFDEF:
+    case DIRECTIVE_IFNDEF:
+      push_cond(ctx, COND_DONE);
+      skip_line(tokenizer);
+      break;
+    case DIRECTIVE_ELIF:
+    case DIRECTIVE_ELSE:
+    case DIRECTIVE_ENDIF:
+      read_conditional(ctx, directive, pos);
+      break;
+    default:
+      skip_line(tokenizer);
+      break;
+    }
+    tokenizer->is_directive = 0;
+  }
+}
+
+int find_param(macro_t *macro, token_array_t *tokens, int slot) {
+  if (tokens->kinds[slot] != TOKEN_IDENT) {
+    return -1;
+  }
+
+  int i = 0;
+  while (i < macro->param_len) {
+    if (macro->params[i] == tokens->values[slot]) {
+      return i;
+    }
+    i++;
+  }
+  return -1;
+}
+
+void read_define(preprocessor_ctx_t *ctx, tokenizer_ctx_t *tokenizer,
+                 pos_t pos) {
+  int name = read_macro_name(ctx, tokenizer, pos);
+  int name_end = strlen(symbol_name(name));
+  name_end += pos_column(ctx->tmp->positions[0]);
+
+  macro_t *macro = calloc(1, sizeof(macro_t));
+  macro->body = new_token_array(8);
+  read_token(tokenizer, macro->body, 0);
+
+  // a '(' right after the name starts a parameter list
+  if (macro->body->kinds[0] == TOKEN_PAREN_OPEN &&
+      pos_column(macro->body->positions[0]) == name_end) {
+    macro->is_function = 1;
+    int cap = 4;
+    macro->params = calloc(cap, sizeof(int));
+    read_token(tokenizer, ctx->tmp, 0);
+    while (ctx->tmp->kinds[0] != TOKEN_PAREN_CLOSE) {
+      if (ctx->tmp->kinds[0] != TOKEN_IDENT) {
+        error(pos, "expected a parameter name\n");
+      }
+      if (macro->param_len == cap) {
+        cap *= 2;
+        macro->params = realloc(macro->params, cap * sizeof(int));
+      }
+      macro->params[macro->param_len] = ctx->tmp->values[0];
+      macro->param_len++;
+
+      read_token(tokenizer, ctx->tmp, 0);
+      if (ctx->tmp->kinds[0] == TOKEN_COMMA) {
+        read_token(tokenizer, ctx->tmp, 0);
+      } else if (ctx->tmp->kinds[0] != TOKEN_PAREN_CLOSE) {
+        error(pos, "expected ',' or ')' in parameter list\n");
+      }
+    }
+    read_token(tokenizer, macro->body, 0);
+  }
+
+  int len = 0;
+  while (macro->body->kinds[len] != TOKEN_NEWLINE &&
+         macro->body->kinds[len] != TOKEN_EOF) {
+    if (macro->body->kinds[len] == TOKEN_HASH) {
+      error(pos, "'#' and '##' are not supported in macros\n");
+    }
+    len++;
+    if (len == macro->body->cap) {
+      grow_token_array(macro->body, len * 2);
+    }
+    read_token(tokenizer, macro->body, len);
+  }
+  macro->body_len = len;
+
+  reserve_symbol(ctx, name);
+  ctx->macros[name] = macro;
+}
+
+// enters the file unless its guard says it would read as nothing. Returns 0
+// if the file does not exist.
+int try_include(preprocessor_ctx_t *ctx, char *path) {
+  int symbol = intern_symbol(path);
+  reserve_symbol(ctx, symbol);
+  if (ctx->once_files[symbol]) {
+    return 1;
+  }
+  int guard = ctx->guard_macros[symbol];
+  if (guard && find_macro(ctx, guard - 1)) {
+    return 1;
+  }
+
+  int size;
+  char *buf = map_file(path, &size);
+  if (buf == NULL) {
+    return 0;
+  }
+
+  tokenizer_ctx_t *tokenizer = new_tokenizer_ctx(buf, size);
+  if (ctx->is_scalar) {
+    tokenizer->is_scalar = 1;
+  }
+  push_source(ctx, path, tokenizer);
+  return 1;
+}
+
+void read_include(preprocessor_ctx_t *ctx, pos_t pos) {
+  source_t *source = ctx->source;
+  int is_system;
+  char *name = read_header_name(source->tokenizer, &is_system);
+  expect_newline(ctx, source->tokenizer, pos);
+  source->tokenizer->is_directive = 0;
+
+  if (!is_system && try_include(ctx, join_path(source->dir, name))) {
+    return;
+  }
+  int i = 0;
+  while (i < ctx->include_dir_len) {
+    if (try_include(ctx, join_path(ctx->include_dirs[i], name))) {
+      return;
+    }
+    i++;
+  }
+  error(pos, "cannot find include file '%s'\n", name);
+}
+
+void read_pragma(preprocessor_ctx_t *ctx, pos_t pos) {
+  source_t *source = ctx->source;
+  read_token(source->tokenizer, ctx->tmp, 0);
+  tokentype_t kind = ctx->tmp->kinds[0];
+  if (kind == TOKEN_NEWLINE || kind == TOKEN_EOF) {
+    return;
+  }
+
+  if (kind == TOKEN_IDENT && symbol_name(ctx->tmp->values[0]) == once_name) {
+    expect_newline(ctx, source->tokenizer, pos);
+    reserve_symbol(ctx, source->path);
+    ctx->once_files[source->path] = 1;
+    return;
+  }
+
+  // other pragmas are ignored
+  skip_line(source->tokenizer);
+}
+
+void read_directive(preprocessor_ctx_t *ctx, pos_t pos) {
+  source_t *source = ctx->source;
+  tokenizer_ctx_t *tokenizer = source->tokenizer;
+  tokenizer->is_directive = 1;
+
+  int is_first = source->guard_state == GUARD_NONE;
+  if (source->guard_state != GUARD_OPEN) {
+    source->guard_state = GUARD_INVALID;
+  }
+
+  directive_t directive = read_directive_name(ctx, tokenizer);
+  switch (directive) {
+  case DIRECTIVE_NULL:
+    break;
+  case DIRECTIVE_IF:
+    push_cond(ctx, taken_if(eval_condition(ctx, pos)));
+    break;
+  case DIRECTIVE_IFDEF:
+  case DIRECTIVE_IFNDEF: {
+    int symbol = read_macro_name(ctx, tokenizer, pos);
+    expect_newline(ctx, tokenizer, pos);
+    int is_defined = find_macro(ctx, symbol) != NULL;
+    push_cond(ctx, taken_if(is_defined == (directive == DIRECTIVE_IFDEF)));
+    if (directive == DIRECTIVE_IFNDEF && is_first) {
+      source->guard_state = GUARD_OPEN;
+      source->guard = symbol;
+      source->guard_depth = ctx->cond_len;
+    }
+    break;
+  }
+  case DIRECTIVE_ELIF:
+  case DIRECTIVE_ELSE:
+  case DIRECTIVE_ENDIF:
+    read_conditional(ctx, directive, pos);
+    break;
+  case DIRECTIVE_DEFINE:
+    read_define(ctx, tokenizer, pos);
+    break;
+  case DIRECTIVE_UNDEF: {
+    int symbol = read_macro_name(ctx, tokenizer, pos);
+    expect_newline(ctx, tokenizer, pos);
+    if (find_macro(ctx, symbol)) {
+      ctx->macros[symbol] = NULL;
+    }
+    break;
+  }
+  case DIRECTIVE_INCLUDE:
+    read_include(ctx, pos);
+    return;
+  case DIRECTIVE_PRAGMA:
+    read_pragma(ctx, pos);
+    break;
+  case DIRECTIVE_ERROR:
+    error(pos, "#error directive\n");
+  default:
+    error(pos, "unknown directive\n");
+  }
+  tokenizer->is_directive = 0;
+
+  if (ctx->cond_len && ctx->conds[ctx->cond_len - 1] != COND_ACTIVE) {
+    skip_group(ctx);
+  }
+}
+
+// reads the next token of the current file after directives, moving on to
+// the includer at the end of an included file
+void read_source_token(preprocessor_ctx_t *ctx, token_array_t *tokens,
+                       int slot) {
+  while (1) {
+    source_t *source = ctx->source;
+    read_token(source->tokenizer, tokens, slot);
+    if (source->tokenizer->is_directive) {
+      return;
+    }
+
+    tokentype_t kind = tokens->kinds[slot];
+    int is_line_start = source->tokenizer->line != source->last_line;
+    source->last_line = source->tokenizer->line;
+    if (kind == TOKEN_HASH && is_line_start) {
+      read_directive(ctx, tokens->positions[slot]);
+      continue;
+    }
+    if (kind == TOKEN_EOF) {
+      if (pop_source(ctx, tokens->positions[slot])) {
+        continue;
+      }
+      return;
+    }
+
+    if (source->guard_state != GUARD_OPEN) {
+      source->guard_state = GUARD_INVALID;
+    }
+    return;
+  }
+}
+
+void read_unexpanded(preprocessor_ctx_t *ctx, token_array_t *tokens,
+                     int slot) {
+  if (ctx->has_pushback) {
+    copy_token(tokens, slot, ctx->pushback, 0);
+    ctx->has_pushback = 0;
+    return;
+  }
+
+  // an expansion is dropped only once a token past its end is read, so the
+  // macro stays disabled while its last token is looked at
+  while (ctx->expansions) {
+    expansion_t *expansion = ctx->expansions;
+    if (expansion->index < expansion->len) {
+      copy_token(tokens, slot, expansion->tokens, expansion->index);
+      tokens->positions[slot] = expansion->pos;
+      expansion->index++;
+      return;
+    }
+
+    if (expansion->macro) {
+      expansion->macro->is_disabled = 0;
+    }
+    ctx->expansions = expansion->next;
+  }
+
+  read_source_token(ctx, tokens, slot);
+}
+
+void push_expansion(preprocessor_ctx_t *ctx, macro_t *macro,
+                    token_array_t *tokens, int len, pos_t pos) {
+  expansion_t *expansion = calloc(1, sizeof(expansion_t));
+  expansion->tokens = tokens;
+  expansion->len = len;
+  expansion->macro = macro;
+  expansion->pos = pos;
+
+  if (macro) {
+    macro->is_disabled = 1;
+  }
+  expansion->next = ctx->expansions;
+  ctx->expansions = expansion;
+}
+
+// Expands the argument args[start] up to args[end] on its own and appends
+// the result to dst at len, returning the new length. The argument is read
+// as an expansion of no macro that ends in an EOF, so that a macro name at
+// its end does not take the tokens after the call as its arguments.
+int expand_argument(preprocessor_ctx_t *ctx, token_array_t *args, int start,
+                    int end, token_array_t *dst, int len, pos_t pos) {
+  token_array_t *arg = new_token_array(end - start + 1);
+  int arg_len = 0;
+  int i = start;
+  while (i < end) {
+    arg_len = append_token(arg, arg_len, args, i);
+    i++;
+  }
+  arg->kinds[arg_len] = TOKEN_EOF;
+  push_expansion(ctx, NULL, arg, arg_len + 1, pos);
+
+  while (1) {
+    if (len == dst->cap) {
+      grow_token_array(dst, len * 2);
+    }
+    read_expanded(ctx, dst, len);
+    if (dst->kinds[len] == TOKEN_EOF) {
+      break;
+    }
+    len++;
+  }
+
+  // the EOF was the last token of the argument, whose expansion is on top
+  ctx->expansions = ctx->expansions->next;
+  return len;
+}
+
+// Expands a call to a function-like macro. Each argument is fully expanded
+// first, while the macro is still enabled, so that ADD(ADD(1, 2), 3) expands
+// both calls, and the result is read again with the macro disabled. Returns
+// 0 if the name is not followed by '('.
+int expand_call(preprocessor_ctx_t *ctx, macro_t *macro, pos_t pos) {
+  read_unexpanded(ctx, ctx->pushback, 0);
+  if (ctx->pushback->kinds[0] != TOKEN_PAREN_OPEN) {
+    ctx->has_pushback = 1;
+    return 0;
+  }
+
+  // argument i is args[starts[i]] up to args[starts[i + 1]]
+  token_array_t *args = new_token_array(16);
+  int *starts = calloc(macro->param_len + 2, sizeof(int));
+  int len = 0;
+  int arg_count = 0;
+  int depth = 0;
+  while (1) {
+    if (len == args->cap) {
+      grow_token_array(args, len * 2);
+    }
+    read_unexpanded(ctx, args, len);
+    tokentype_t kind = args->kinds[len];
+    if (kind == TOKEN_EOF || kind == TOKEN_NEWLINE) {
+      error(pos, "unterminated call to macro\n");
+    }
+
+    if (depth == 0 && (kind == TOKEN_COMMA || kind == TOKEN_PAREN_CLOSE)) {
+      if (arg_count == macro->param_len + 1) {
+        error(pos, "too many arguments to macro\n");
+      }
+      arg_count++;
+      starts[arg_count] = len;
+      if (kind == TOKEN_PAREN_CLOSE) {
+        break;
+      }
+      continue;
+    }
+
+    if (kind == TOKEN_PAREN_OPEN) {
+      depth++;
+    } else if (kind == TOKEN_PAREN_CLOSE) {
+      depth--;
+    }
+    len++;
+  }
+
+  // f() passes one empty argument
+  if (macro->param_len == 0 && arg_count == 1 && len == 0) {
+    arg_count = 0;
+  }
+  if (arg_count != macro->param_len) {
+    error(pos, "wrong number of arguments to macro\n");
+  }
+
+  // expanded argument i is expanded[expanded_starts[i]] up to the next
+  token_array_t *expanded = new_token_array(len + 1);
+  int *expanded_starts = calloc(arg_count + 1, sizeof(int));
+  int expanded_len = 0;
+  int i = 0;
+  while (i < arg_count) {
+    expanded_starts[i] = expanded_len;
+    expanded_len = expand_argument(ctx, args, starts[i], starts[i + 1],
+                                   expanded, expanded_len, pos);
+    i++;
+  }
+  expanded_starts[arg_count] = expanded_len;
+
+  token_array_t *body = macro->body;
+  token_array_t *tokens = new_token_array(body->cap + expanded_len);
+  int tokens_len = 0;
+  i = 0;
+  while (i < macro->body_len) {
+    int param = find_param(macro, body, i);
+    if (param < 0) {
+      tokens_len = append_token(tokens, tokens_len, body, i);
+    } else {
+      int j = expanded_starts[param];
+      while (j < expanded_starts[param + 1]) {
+        tokens_len = append_token(tokens, tokens_len, expanded, j);
+        j++;
+      }
+    }
+    i++;
+  }
+
+  push_expansion(ctx, macro, tokens, tokens_len, pos);
+  return 1;
+}
+
+void read_expanded(preprocessor_ctx_t *ctx, token_array_t *tokens, int slot) {
+  while (1) {
+    read_unexpanded(ctx, tokens, slot);
+    if (tokens->kinds[slot] != TOKEN_IDENT) {
+      return;
+    }
+
+    macro_t *macro = find_macro(ctx, tokens->values[slot]);
+    if (macro == NULL || macro->is_disabled) {
+      return;
+    }
+
+    pos_t pos = tokens->positions[slot];
+    if (!macro->is_function) {
+      push_expansion(ctx, macro, macro->body, macro->body_len, pos);
+    } else if (!expand_call(ctx, macro, pos)) {
+      return;
+    }
+  }
+}
+
+void read_preprocessed_token(preprocessor_ctx_t *ctx, token_array_t *tokens,
+                             int slot) {
+  read_expanded(ctx, tokens, slot);
+}
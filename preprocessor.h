@@ -0,0 +1,110 @@
+#pragma once
+#include "tokenizer.h"
+
+typedef struct _macro_t macro_t;
+struct _macro_t {
+  int is_function;
+  int *params;
+  int param_len;
+  token_array_t *body;
+  int body_len;
+
+  // set while an expansion of the macro is being read, so that the macro
+  // does not expand inside itself
+  int is_disabled;
+};
+
+typedef enum {
+  GUARD_NONE,    // nothing was read from the file yet
+  GUARD_OPEN,    // inside the #ifndef that opened the file
+  GUARD_CLOSED,  // after the #endif of that #ifndef
+  GUARD_INVALID, // the file is not wrapped in a single #ifndef
+} guard_state_t;
+
+// A file being read. next is the file that included it.
+typedef struct _source_t source_t;
+struct _source_t {
+  tokenizer_ctx_t *tokenizer;
+  int path;
+  char *dir;
+  int file;
+
+  // the line of the last token, to tell a '#' that starts a line
+  int last_line;
+
+  // the depth of the conditional stack when the file was entered
+  int cond_depth;
+
+  guard_state_t guard_state;
+  int guard;
+  int guard_depth;
+
+  source_t *next;
+};
+
+// An expansion of a macro being read. Every token takes the position of the
+// macro invocation.
+typedef struct _expansion_t expansion_t;
+struct _expansion_t {
+  token_array_t *tokens;
+  int len;
+  int index;
+  macro_t *macro;
+  pos_t pos;
+
+  expansion_t *next;
+};
+
+typedef enum {
+  COND_ACTIVE,  // the current group is being read
+  COND_PENDING, // no group was taken yet
+  COND_DONE,    // a group was taken, the rest are skipped
+} cond_t;
+
+typedef struct {
+  source_t *source;
+  expansion_t *expansions;
+
+  // Indexed by interned symbol. A path in once_files was marked with
+  // #pragma once, and a path in guard_macros holds the symbol of its include
+  // guard + 1, so that an #include of either is dropped without reading the
+  // file again.
+  macro_t **macros;
+  int *once_files;
+  int *guard_macros;
+  int symbol_cap;
+
+  cond_t *conds;
+  int cond_len;
+  int cond_cap;
+
+  char **include_dirs;
+  int include_dir_len;
+
+  // the first line of the next file entered
+  int next_line;
+
+  // passed on to the tokenizers of included files
+  int is_scalar;
+
+  token_array_t *tmp;
+  token_array_t *cur;
+  token_array_t *pushback;
+  int has_pushback;
+} preprocessor_ctx_t;
+
+// Starts preprocessing the main file, which is read with the given tokenizer.
+preprocessor_ctx_t *new_preprocessor_ctx(char *path,
+                                         tokenizer_ctx_t *tokenizer);
+
+// Grows the tables indexed by symbol so that they hold the symbol.
+void reserve_symbol(preprocessor_ctx_t *ctx, int symbol);
+
+macro_t *find_macro(preprocessor_ctx_t *ctx, int symbol);
+
+// Adds a directory searched for #include files, after the ones added before.
+void add_include_dir(preprocessor_ctx_t *ctx, char *dir);
+
+// Reads the next token after directives and macro expansion into the slot.
+void read_preprocessed_token(preprocessor_ctx_t *ctx, token_array_t *tokens,
+                             int slot);
@@ -0,0 +1,113 @@
+#include "scan.h"
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+// Blocks are loaded unaligned while they stay inside the current page. Near
+// the end of a page the scan switches to 16-byte aligned loads, which never
+// cross into the page after the one holding the terminating NUL.
+
+int has_simd_scan() { return 1; }
+
+static __m128i in_range(__m128i v, char lo, char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                       _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+enum { CLASS_IDENT, CLASS_DIGIT, CLASS_SPACE, CLASS_NOT_NEWLINE };
+
+// returns a bit per byte of v that belongs to the class
+static unsigned class_mask(__m128i v, int cls) {
+  __m128i m;
+  switch (cls) {
+  case CLASS_IDENT:
+    m = in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+    m = _mm_or_si128(m, in_range(v, '0', '9'));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    break;
+  case CLASS_DIGIT:
+    m = in_range(v, '0', '9');
+    break;
+  case CLASS_SPACE:
+    m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                     in_range(v, '\t', '\r'));
+    break;
+  default:
+    m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                     _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    return ~_mm_movemask_epi8(m) & 0xffff;
+  }
+  return _mm_movemask_epi8(m);
+}
+
+static unsigned newline_mask(__m128i v) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+}
+
+static int near_page_end(const char *p) {
+  return ((uintptr_t)p & 4095) > 4096 - 16;
+}
+
+// Scans the run of bytes in the class starting at p. If newlines is not
+// NULL, the newlines inside the run are counted as well.
+static int scan_run(const char *p, int cls, int *newlines, int *last_newline) {
+  const char *block = p;
+  unsigned skip = 0;
+  int is_aligned = 0;
+  int count = 0;
+  int last = -1;
+
+  while (1) {
+    if (!is_aligned && near_page_end(block)) {
+      const char *aligned = (const char *)((uintptr_t)block & ~(uintptr_t)15);
+      skip = (1u << (block - aligned)) - 1;
+      block = aligned;
+      is_aligned = 1;
+    }
+
+    __m128i v;
+    if (is_aligned) {
+      v = _mm_load_si128((const __m128i *)block);
+    } else {
+      v = _mm_loadu_si128((const __m128i *)block);
+    }
+
+    // bytes before p count as part of the run
+    unsigned stop = ~(class_mask(v, cls) | skip) & 0xffff;
+    if (newlines) {
+      unsigned run = stop ? (1u << __builtin_ctz(stop)) - 1 : 0xffff;
+      unsigned lines = newline_mask(v) & run & ~skip;
+      if (lines) {
+        count += __builtin_popcount(lines);
+        last = block + (31 - __builtin_clz(lines)) - p;
+      }
+    }
+    if (stop) {
+      if (newlines) {
+        *newlines = count;
+        *last_newline = last;
+      }
+      return block + __builtin_ctz(stop) - p;
+    }
+
+    block += 16;
+    skip = 0;
+  }
+}
+
+int scan_ident_chars(char *p) { return scan_run(p, CLASS_IDENT, NULL, NULL); }
+
+int scan_digits(char *p) { return scan_run(p, CLASS_DIGIT, NULL, NULL); }
+
+int scan_spaces(char *p, int *newlines, int *last_newline) {
+  return scan_run(p, CLASS_SPACE, newlines, last_newline);
+}
+
+int scan_to_newline(char *p) {
+  return scan_run(p, CLASS_NOT_NEWLINE, NULL, NULL);
+}
+
+#else
+#include "scan_portable.c"
+#endif
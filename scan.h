@@ -0,0 +1,20 @@
+#pragma once
+
+// Vectorized character-class scanners used by the tokenizer. Each returns the
+// length of the run starting at p. The buffer must be NUL-terminated, since
+// the terminator is what stops every scan.
+
+int has_simd_scan();
+
+// [A-Za-z0-9_]
+int scan_ident_chars(char *p);
+
+// [0-9]
+int scan_digits(char *p);
+
+// isspace(); also counts the newlines in the run and returns the offset of
+// the last one in *last_newline, or -1 if there is none
+int scan_spaces(char *p, int *newlines, int *last_newline);
+
+// everything up to a newline
+int scan_to_newline(char *p);
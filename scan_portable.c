@@ -0,0 +1,45 @@
+#include "scan.h"
+#include <ctype.h>
+
+// Byte-at-a-time scanners, used on hosts without SSE2 and when ccc compiles
+// itself.
+
+int has_simd_scan() { return 0; }
+
+int scan_ident_chars(char *p) {
+  char *cur = p;
+  while (isalnum(*cur) || *cur == '_') {
+    cur++;
+  }
+  return cur - p;
+}
+
+int scan_digits(char *p) {
+  char *cur = p;
+  while (isdigit(*cur)) {
+    cur++;
+  }
+  return cur - p;
+}
+
+int scan_spaces(char *p, int *newlines, int *last_newline) {
+  char *cur = p;
+  *newlines = 0;
+  *last_newline = -1;
+  while (isspace(*cur)) {
+    if (*cur == '\n') {
+      *newlines += 1;
+      *last_newline = cur - p;
+    }
+    cur++;
+  }
+  return cur - p;
+}
+
+int scan_to_newline(char *p) {
+  char *cur = p;
+  while (*cur && *cur != '\n') {
+    cur++;
+  }
+  return cur - p;
+}
@@ -0,0 +1,25 @@
+// ccc compiles a single translation unit, so it builds itself from this
+// file. os.c, scan.c, lex_threads.c, parse_threads.c and interp.c need
+// system headers, intrinsics and function pointers, so their portable
+// versions are used instead.
+#include "arena.c"
+#include "type.c"
+#include "intern.c"
+#include "tokenizer.c"
+#include "parallel_lex.c"
+#include "error.c"
+#include "preprocessor.c"
+#include "parser.c"
+#include "pch.c"
+#include "writer.c"
+#include "assembler.c"
+#include "linker.c"
+#include "codegen.c"
+#include "codegen_bytecode.c"
+#include "codegen_x86.c"
+#include "os_portable.c"
+#include "scan_portable.c"
+#include "lex_threads_portable.c"
+#include "parse_threads_portable.c"
+#include "interp_portable.c"
+#include "main.c"
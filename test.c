@@ -56,9 +56,58 @@ int global1;
 extern int global2;
 int global3[2];
 
+#define TEST_ANSWER 42
+#define TEST_ADD(a, b) ((a) + (b))
+#define TEST_TWICE(x) TEST_ADD(x, x)
+
+#if TEST_ANSWER == 42 && defined(TEST_ADD)
+int test_pp() { return TEST_TWICE(TEST_ANSWER); }
+#elif 1
+int test_pp() { return 1; }
+#else
+int test_pp() { return 2; }
+#endif
+
+#ifdef TEST_UNDEFINED
+int test_pp_ifdef() { return 1; }
+#else
+int test_pp_ifdef() { return 0; }
+#endif
+
+int test_pp_nested() { return TEST_ADD(TEST_ADD(1, 2), TEST_TWICE(3)); }
+
+// A header is read again unless #pragma once or its include guard says it
+// would read as nothing.
+int test_pp_include_once() {
+  int hits = 0;
+#include "test_include/once.h"
+#include "test_include/once.h"
+  return hits;
+}
+
+int test_pp_include_guard() {
+  int hits = 0;
+#include "test_include/guard.h"
+#include "test_include/guard.h"
+#undef TEST_GUARD_H
+#include "test_include/guard.h"
+  return hits;
+}
+
+int test_pp_include_unguarded() {
+  int hits = 0;
+#include "test_include/unguarded.h"
+#include "test_include/unguarded.h"
+  return hits;
+}
+
 int main() {
   assert(0, 0);
   assert(42, 42);
+  assert(255, 0xff);
+  assert(4096, 0X1000);
+  assert(305419896, 0x12345678);
+  assert(-65536, -65536);
   assert(3, 1 + 2);
   assert(13, 1 + 10 + 2);
   assert(1, 2 - 1);
@@ -577,6 +626,13 @@ int main() {
     assert(2, global3[1]);
   }
 
+  assert(84, test_pp());
+  assert(0, test_pp_ifdef());
+  assert(9, test_pp_nested());
+  assert(1, test_pp_include_once());
+  assert(20, test_pp_include_guard());
+  assert(2100, test_pp_include_unguarded());
+
   printf("[OK]\n");
 
   return 0;
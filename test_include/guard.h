@@ -0,0 +1,4 @@
+#ifndef TEST_GUARD_H
+#define TEST_GUARD_H
+hits = hits + 10;
+#endif
@@ -0,0 +1,2 @@
+#pragma once
+hits = hits + 1;
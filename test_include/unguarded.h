@@ -0,0 +1,5 @@
+#ifndef TEST_UNGUARDED_H
+#define TEST_UNGUARDED_H
+hits = hits + 100;
+#endif
+hits = hits + 1000;
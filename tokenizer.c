@@ -1,162 +1,366 @@
 #include "tokenizer.h"
 #include "error.h"
+#include "intern.h"
+#include "scan.h"
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
-pos_t *new_pos(int line, int column) {
-  pos_t *pos = calloc(1, sizeof(pos_t));
-  pos->line = line;
-  pos->column = column;
+pos_t new_pos(int line, int column) {
+  pos_t pos;
+  pos.line = line;
+  pos.column = column;
   return pos;
 }
 
-pos_t *copy_pos(pos_t *pos) { return new_pos(pos->line, pos->column); }
+// Files are numbered in the order they are entered. Entry i of the line map
+// says that the lines from line_map_starts[i] on belong to line_map_files[i],
+// starting at its line line_map_lines[i].
+char **source_files;
+int source_file_len;
+
+int *line_map_starts;
+int *line_map_files;
+int *line_map_lines;
+int line_map_len;
+int line_map_cap;
+
+int add_source_file(char *path) {
+  source_files = realloc(source_files, (source_file_len + 1) * sizeof(char *));
+  source_files[source_file_len] = path;
+  source_file_len++;
+  return source_file_len;
+}
+
+int source_file_count() { return source_file_len; }
+
+char *source_file_name(int file) { return source_files[file - 1]; }
+
+void map_source_lines(int line, int file, int file_line) {
+  if (line_map_len && line_map_starts[line_map_len - 1] == line) {
+    line_map_len--;
+  }
+  if (line_map_len == line_map_cap) {
+    line_map_cap = line_map_cap * 2 + 16;
+    line_map_starts = realloc(line_map_starts, line_map_cap * sizeof(int));
+    line_map_files = realloc(line_map_files, line_map_cap * sizeof(int));
+    line_map_lines = realloc(line_map_lines, line_map_cap * sizeof(int));
+  }
+
+  line_map_starts[line_map_len] = line;
+  line_map_files[line_map_len] = file;
+  line_map_lines[line_map_len] = file_line;
+  line_map_len++;
+}
+
+// returns the last entry of the line map starting at or before the line
+int find_line_map(int line) {
+  int lo = 0;
+  int hi = line_map_len;
+  while (hi - lo > 1) {
+    int mid = (lo + hi) / 2;
+    if (line_map_starts[mid] <= line) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+int pos_line(pos_t pos) {
+  int line = pos.line;
+  if (line_map_len == 0) {
+    return line;
+  }
+
+  int i = find_line_map(line);
+  return line - line_map_starts[i] + line_map_lines[i];
+}
 
-char *pos_to_string(pos_t *pos) {
-  char *buf = malloc(8);
-  snprintf(buf, 8, "%d:%d", pos->line, pos->column);
+int pos_column(pos_t pos) { return pos.column; }
+
+int pos_file(pos_t pos) {
+  if (line_map_len == 0) {
+    return 1;
+  }
+  return line_map_files[find_line_map(pos.line)];
+}
+
+char *pos_to_string(pos_t pos) {
+  if (source_file_len == 0) {
+    char *buf = malloc(32);
+    snprintf(buf, 32, "%d:%d", pos_line(pos), pos_column(pos));
+    return buf;
+  }
+
+  char *path = source_file_name(pos_file(pos));
+  int len = strlen(path);
+  len += 32;
+  char *buf = malloc(len);
+  snprintf(buf, len, "%s:%d:%d", path, pos_line(pos), pos_column(pos));
   return buf;
 }
 
-tokenizer_ctx_t *new_tokenizer_ctx(FILE *fp) {
+token_array_t *new_token_array(int cap) {
+  token_array_t *tokens = calloc(1, sizeof(token_array_t));
+  grow_token_array(tokens, cap);
+  return tokens;
+}
+
+void grow_token_array(token_array_t *tokens, int cap) {
+  tokens->kinds = realloc(tokens->kinds, cap * sizeof(tokentype_t));
+  tokens->positions = realloc(tokens->positions, cap * sizeof(pos_t));
+  tokens->values = realloc(tokens->values, cap * sizeof(int));
+  tokens->cap = cap;
+}
+
+// the bytes that len tokens take in the arrays
+int token_array_bytes(int len) {
+  return len * (sizeof(tokentype_t) + sizeof(pos_t) + sizeof(int));
+}
+
+void init_keywords();
+
+tokenizer_ctx_t *new_tokenizer_ctx(char *buf, int size) {
+  init_keywords();
+
   tokenizer_ctx_t *ctx = calloc(1, sizeof(tokenizer_ctx_t));
-  ctx->fp = fp;
-  ctx->cur_pos = new_pos(1, 1);
+  ctx->buf = buf;
+  ctx->size = size;
+  ctx->line = 1;
+  ctx->column = 1;
+  ctx->pending_index = -1;
+  ctx->is_scalar = !has_simd_scan();
   return ctx;
 }
 
-token_t *new_token(tokentype_t type, pos_t *pos) {
-  token_t *token = calloc(1, sizeof(token_t));
-  token->type = type;
-  token->pos = pos;
-  return token;
+int new_token(tokenizer_ctx_t *ctx, tokentype_t type) {
+  ctx->tokens->kinds[ctx->slot] = type;
+  ctx->tokens->values[ctx->slot] = 0;
+  return ctx->slot;
 }
 
+// Reports a lexing error. A tokenizer lexing ahead only records the first
+// one and stops, since an earlier error may end compilation before the text
+// is reached.
+void lex_error(tokenizer_ctx_t *ctx, pos_t pos, char *format, int c) {
+  if (!ctx->hashes && !ctx->records_errors) {
+    error(pos, format, c);
+  }
+
+  if (!ctx->error_message) {
+    ctx->error_pos = pos;
+    ctx->error_message = malloc(64);
+    snprintf(ctx->error_message, 64, format, c);
+  }
+  ctx->index = ctx->size;
+}
+
+int char_at(tokenizer_ctx_t *ctx, int index) {
+  if (index >= ctx->size) {
+    return EOF;
+  }
+  if (index == ctx->pending_index) {
+    return ctx->pending_char;
+  }
+  return ctx->buf[index];
+}
+
+int peek_char(tokenizer_ctx_t *ctx) { return char_at(ctx, ctx->index); }
+
 int read_char(tokenizer_ctx_t *ctx) {
-  int c = fgetc(ctx->fp);
+  int c = peek_char(ctx);
+  if (c == EOF) {
+    return c;
+  }
+
+  ctx->index++;
   if (c != '\n') {
-    ctx->cur_pos->column++;
+    ctx->column++;
   } else {
-    ctx->cur_pos->line++;
-    ctx->cur_pos->column = 1;
+    ctx->line++;
+    ctx->column = 1;
   }
   return c;
 }
 
-void unread_char(tokenizer_ctx_t *ctx, int c) {
-  ungetc(c, ctx->fp);
-  ctx->cur_pos->column--; // TODO
+int consume_char(tokenizer_ctx_t *ctx, int c) {
+  if (peek_char(ctx) != c) {
+    return 0;
+  }
+
+  read_char(ctx);
+  return 1;
+}
+
+// terminates the span ending at the current position without losing the byte
+// stored there
+void terminate_span(tokenizer_ctx_t *ctx) {
+  ctx->pending_index = ctx->index;
+  ctx->pending_char = ctx->buf[ctx->index];
+  ctx->buf[ctx->index] = 0;
 }
 
+// moves past len bytes already known not to contain the pending byte
+void advance(tokenizer_ctx_t *ctx, int len, int newlines, int last_newline) {
+  ctx->index += len;
+  if (newlines) {
+    ctx->line += newlines;
+    ctx->column = len - last_newline;
+  } else {
+    ctx->column += len;
+  }
+}
+
+// The vectorized scanners stop at NUL, which is also what the pending byte
+// is replaced with, so that byte is always stepped over by read_char. Most
+// runs are a single space, so the vector scan only starts from the second
+// byte.
 void skip_whitespaces(tokenizer_ctx_t *ctx) {
-  int c = read_char(ctx);
-  while (c != EOF && isspace(c)) {
-    c = read_char(ctx);
+  while (isspace(peek_char(ctx))) {
+    if (ctx->is_directive && peek_char(ctx) == '\n') {
+      return;
+    }
+
+    read_char(ctx);
+    if (!ctx->is_scalar && !ctx->is_directive &&
+        isspace(ctx->buf[ctx->index])) {
+      int newlines;
+      int last_newline;
+      int len = scan_spaces(ctx->buf + ctx->index, &newlines, &last_newline);
+      advance(ctx, len, newlines, last_newline);
+    }
   }
-  unread_char(ctx, c);
 }
 
 int is_ident_head_char(char c) { return isalpha(c) || c == '_'; }
 
 int is_ident_char(char c) { return isalnum(c) || c == '_'; }
 
-void replace_reserved_tokens(token_t *token) {
-  if (token->type != TOKEN_IDENT) {
-    return;
-  }
-
-  char *ident = token->value.ident;
-  if (!strcmp(ident, "return")) {
-    token->type = TOKEN_RETURN;
-  } else if (!strcmp(ident, "if")) {
-    token->type = TOKEN_IF;
-  } else if (!strcmp(ident, "else")) {
-    token->type = TOKEN_ELSE;
-  } else if (!strcmp(ident, "while")) {
-    token->type = TOKEN_WHILE;
-  } else if (!strcmp(ident, "for")) {
-    token->type = TOKEN_FOR;
-  } else if (!strcmp(ident, "int")) {
-    token->type = TOKEN_INT;
-  } else if (!strcmp(ident, "sizeof")) {
-    token->type = TOKEN_SIZEOF;
-  } else if (!strcmp(ident, "char")) {
-    token->type = TOKEN_CHAR;
-  } else if (!strcmp(ident, "break")) {
-    token->type = TOKEN_BREAK;
-  } else if (!strcmp(ident, "continue")) {
-    token->type = TOKEN_CONTINUE;
-  } else if (!strcmp(ident, "switch")) {
-    token->type = TOKEN_SWITCH;
-  } else if (!strcmp(ident, "case")) {
-    token->type = TOKEN_CASE;
-  } else if (!strcmp(ident, "default")) {
-    token->type = TOKEN_DEFAULT;
-  } else if (!strcmp(ident, "struct")) {
-    token->type = TOKEN_STRUCT;
-  } else if (!strcmp(ident, "typedef")) {
-    token->type = TOKEN_TYPEDEF;
-  } else if (!strcmp(ident, "union")) {
-    token->type = TOKEN_UNION;
-  } else if (!strcmp(ident, "enum")) {
-    token->type = TOKEN_ENUM;
-  } else if (!strcmp(ident, "void")) {
-    token->type = TOKEN_VOID;
-  } else if (!strcmp(ident, "extern")) {
-    token->type = TOKEN_EXTERN;
-  }
-}
-
-token_t *read_ident_token(tokenizer_ctx_t *ctx) {
-  pos_t *pos = copy_pos(ctx->cur_pos);
-  char buf[32];
-  int buf_index = 0;
-
-  char c;
-  while (1) {
-    c = read_char(ctx);
-    if (!is_ident_char(c)) {
-      break;
-    }
+// Keywords are classified with a perfect hash over the first char, the last
+// char and the length. The multipliers were searched offline so that all 32
+// C89 keywords land in distinct slots, so supporting another keyword only
+// takes one more add_keyword call and never adds work per identifier.
+char *keyword_names[64];
+int keyword_lens[64];
+tokentype_t keyword_types[64];
+
+int keyword_hash(char *ident, int len) {
+  return (ident[0] * 14 + ident[len - 1] * 5 + len * 5) & 63;
+}
 
-    buf[buf_index] = c;
-    buf_index++;
+void add_keyword(char *name, tokentype_t type) {
+  int len = strlen(name);
+  int hash = keyword_hash(name, len);
+  if (keyword_names[hash] && strcmp(keyword_names[hash], name)) {
+    panic("keyword hash collision: %s, %s\n", keyword_names[hash], name);
   }
-  unread_char(ctx, c);
-  buf[buf_index] = 0;
-  buf_index++;
 
-  token_t *token = new_token(TOKEN_IDENT, pos);
-  token->value.ident = calloc(1, buf_index);
-  strncpy(token->value.ident, buf, buf_index);
+  keyword_names[hash] = name;
+  keyword_lens[hash] = len;
+  keyword_types[hash] = type;
+}
 
-  replace_reserved_tokens(token);
+void init_keywords() {
+  add_keyword("return", TOKEN_RETURN);
+  add_keyword("if", TOKEN_IF);
+  add_keyword("else", TOKEN_ELSE);
+  add_keyword("while", TOKEN_WHILE);
+  add_keyword("for", TOKEN_FOR);
+  add_keyword("int", TOKEN_INT);
+  add_keyword("sizeof", TOKEN_SIZEOF);
+  add_keyword("char", TOKEN_CHAR);
+  add_keyword("break", TOKEN_BREAK);
+  add_keyword("continue", TOKEN_CONTINUE);
+  add_keyword("switch", TOKEN_SWITCH);
+  add_keyword("case", TOKEN_CASE);
+  add_keyword("default", TOKEN_DEFAULT);
+  add_keyword("struct", TOKEN_STRUCT);
+  add_keyword("typedef", TOKEN_TYPEDEF);
+  add_keyword("union", TOKEN_UNION);
+  add_keyword("enum", TOKEN_ENUM);
+  add_keyword("void", TOKEN_VOID);
+  add_keyword("extern", TOKEN_EXTERN);
+}
 
-  return token;
+tokentype_t find_keyword(char *ident, int len) {
+  int hash = keyword_hash(ident, len);
+  if (keyword_lens[hash] == len && !strcmp(keyword_names[hash], ident)) {
+    return keyword_types[hash];
+  }
+  return TOKEN_IDENT;
 }
 
-token_t *read_number_token(tokenizer_ctx_t *ctx) {
-  pos_t *pos = copy_pos(ctx->cur_pos);
-  char buf[32];
-  int buf_index = 0;
+int read_ident_token(tokenizer_ctx_t *ctx) {
+  char *ident = ctx->buf + ctx->index;
 
-  char c;
-  while (1) {
-    c = read_char(ctx);
-    if (!isdigit(c)) {
-      break;
+  // the head char was already peeked past any pending byte, and the buffer
+  // is NUL-terminated, so the rest of the span can be scanned directly
+  char *cur = ident;
+  if (ctx->is_scalar) {
+    while (is_ident_char(*cur)) {
+      cur++;
     }
+  } else {
+    cur += scan_ident_chars(ident);
+  }
+  advance(ctx, cur - ident, 0, 0);
+  terminate_span(ctx);
+
+  tokentype_t keyword = find_keyword(ident, cur - ident);
+  if (keyword != TOKEN_IDENT) {
+    return new_token(ctx, keyword);
+  }
+
+  int slot = new_token(ctx, TOKEN_IDENT);
+  if (ctx->hashes) {
+    ctx->tokens->values[slot] = ident - ctx->buf;
+    ctx->hashes[slot] = hash_name(ident);
+  } else {
+    ctx->tokens->values[slot] = intern_symbol(ident);
+  }
+  return slot;
+}
+
+int hex_digit_value(int c) {
+  if (isdigit(c)) {
+    return c - '0';
+  }
+  if (c >= 'a') {
+    return c - 'a' + 10;
+  }
+  return c - 'A' + 10;
+}
+
+int read_number_token(tokenizer_ctx_t *ctx) {
+  int number = 0;
 
-    buf[buf_index] = c;
-    buf_index++;
+  int next = char_at(ctx, ctx->index + 1);
+  if (peek_char(ctx) == '0' && (next == 'x' || next == 'X')) {
+    read_char(ctx);
+    read_char(ctx);
+    while (isxdigit(peek_char(ctx))) {
+      number = number * 16 + hex_digit_value(read_char(ctx));
+    }
+  } else if (ctx->is_scalar) {
+    while (isdigit(peek_char(ctx))) {
+      number = number * 10 + read_char(ctx) - '0';
+    }
+  } else {
+    char *cur = ctx->buf + ctx->index;
+    int len = scan_digits(cur);
+    advance(ctx, len, 0, 0);
+    while (len) {
+      number = number * 10 + *cur - '0';
+      cur++;
+      len--;
+    }
   }
-  unread_char(ctx, c);
-  buf[buf_index] = 0;
 
-  token_t *token = new_token(TOKEN_NUMBER, pos);
-  token->value.number = atoi(buf);
-  return token;
+  int slot = new_token(ctx, TOKEN_NUMBER);
+  ctx->tokens->values[slot] = number;
+  return slot;
 }
 
 char read_char_literal(tokenizer_ctx_t *ctx, int *is_escaped) {
@@ -183,77 +387,153 @@ char read_char_literal(tokenizer_ctx_t *ctx, int *is_escaped) {
   case '\"':
     return '\"';
   default:
-    error(ctx->cur_pos, "unknown escape literal");
+    lex_error(ctx, new_pos(ctx->line_base + ctx->line, ctx->column),
+              "unknown escape literal", 0);
+    return 0;
   }
 }
 
-token_t *read_string_token(tokenizer_ctx_t *ctx) {
-  pos_t *pos = copy_pos(ctx->cur_pos);
-  char buf[128];
-  int buf_index = 0;
+// decodes the literal in place; every decoded byte consumes at least one
+// source byte, so the write position never overtakes the read position
+int read_string_token(tokenizer_ctx_t *ctx) {
+  char *string = ctx->buf + ctx->index;
+  char *cur = string;
 
   int c;
   int is_escaped;
   while (1) {
-    c = read_char_literal(ctx, &is_escaped);
-    if (c == EOF) {
-      error(pos, "missing terminating '\"'\n");
+    if (peek_char(ctx) == EOF) {
+      lex_error(ctx, ctx->tokens->positions[ctx->slot],
+                "missing terminating '\"'\n", 0);
+      return new_token(ctx, TOKEN_EOF);
     }
+    c = read_char_literal(ctx, &is_escaped);
     if (!is_escaped && c == '"') {
       break;
     }
 
-    buf[buf_index] = c;
-    buf_index++;
+    *cur = c;
+    cur++;
   }
-  buf[buf_index] = 0;
-  buf_index++;
-
-  token_t *token = new_token(TOKEN_STRING, pos);
-  token->value.ident = calloc(1, buf_index);
-  strncpy(token->value.string, buf, buf_index);
+  *cur = 0;
 
-  return token;
+  int slot = new_token(ctx, TOKEN_STRING);
+  if (ctx->hashes) {
+    ctx->tokens->values[slot] = string - ctx->buf;
+    ctx->hashes[slot] = hash_name(string);
+  } else {
+    ctx->tokens->values[slot] = intern_symbol(string);
+  }
+  return slot;
 }
 
-token_t *read_char_token(tokenizer_ctx_t *ctx) {
-  pos_t *pos = copy_pos(ctx->cur_pos);
-  token_t *token = new_token(TOKEN_CHAR_LIT, pos);
-  token->value.char_ = read_char_literal(ctx, NULL);
+int read_char_token(tokenizer_ctx_t *ctx) {
+  int slot = new_token(ctx, TOKEN_CHAR_LIT);
+  ctx->tokens->values[slot] = read_char_literal(ctx, NULL);
   if (read_char(ctx) != '\'') {
-    error(pos, "missing terminating '\''\n");
+    lex_error(ctx, ctx->tokens->positions[slot],
+              "missing terminating '\''\n", 0);
   }
-  return token;
+  return slot;
 }
 
 void read_line_comment(tokenizer_ctx_t *ctx) {
-  while (read_char(ctx) != '\n') {
-    // do nothing
+  while (peek_char(ctx) != '\n' && peek_char(ctx) != EOF) {
+    if (!ctx->is_scalar) {
+      advance(ctx, scan_to_newline(ctx->buf + ctx->index), 0, 0);
+      if (peek_char(ctx) == '\n' || peek_char(ctx) == EOF) {
+        break;
+      }
+    }
+    read_char(ctx);
   }
 }
 
-token_t *read_next_token(tokenizer_ctx_t *ctx) {
-  skip_whitespaces(ctx);
+// Serves the next token lexed ahead of time if the tokenizer is inside a
+// stretch of them. Skipping whitespace can carry the tokenizer past the start
+// of a stretch, over the blanks before its first token, so the stretch is
+// served from anywhere inside it. Past the end of the stretch, lexing
+// continues from the first byte after it.
+int serve_lexed_token(tokenizer_ctx_t *ctx) {
+  lexed_t *lexed = ctx->lexed;
+  if (lexed->cur < 0) {
+    // stretches skipped by a conditional are passed over
+    while (lexed->next < lexed->len &&
+           lexed->ends[lexed->next] <= ctx->index) {
+      lexed->next++;
+    }
+    if (lexed->next == lexed->len ||
+        lexed->starts[lexed->next] > ctx->index || ctx->is_directive) {
+      return 0;
+    }
+    lexed->cur = lexed->token_starts[lexed->next];
+  }
 
-  pos_t *pos = copy_pos(ctx->cur_pos);
-  int c = read_char(ctx);
-  char c2;
-  char c3;
+  int cur = lexed->cur;
+  if (cur == lexed->error_token) {
+    pos_t error_pos = lexed->error_pos;
+    pos_t pos = new_pos(ctx->line_base + error_pos.line, error_pos.column);
+    if (!ctx->records_errors) {
+      error(pos, "%s", lexed->error_message);
+    }
+    ctx->error_pos = pos;
+    ctx->error_message = lexed->error_message;
+    ctx->index = ctx->size;
+    lexed->next = lexed->len;
+    lexed->cur = -1;
+    return 0;
+  }
+  if (cur == lexed->token_ends[lexed->next]) {
+    ctx->index = lexed->ends[lexed->next];
+    ctx->line = lexed->end_lines[lexed->next];
+    ctx->column = 1;
+    lexed->next++;
+    lexed->cur = -1;
+    return 0;
+  }
+
+  pos_t pos = lexed->tokens->positions[cur];
+  ctx->line = pos.line;
+  tokentype_t kind = lexed->tokens->kinds[cur];
+  int value = lexed->tokens->values[cur];
+  if (kind == TOKEN_IDENT || kind == TOKEN_STRING) {
+    value = intern_hashed_symbol(ctx->buf + value, lexed->hashes[cur]);
+  }
+  ctx->tokens->kinds[ctx->slot] = kind;
+  ctx->tokens->values[ctx->slot] = value;
+  ctx->tokens->positions[ctx->slot] =
+      new_pos(ctx->line_base + ctx->line, pos.column);
+  lexed->cur++;
+  return 1;
+}
 
-  if (c == EOF) {
-    return new_token(TOKEN_EOF, pos);
+int read_next_token(tokenizer_ctx_t *ctx) {
+  if (ctx->lexed && serve_lexed_token(ctx)) {
+    return ctx->slot;
+  }
+
+  skip_whitespaces(ctx);
+  if (ctx->lexed && serve_lexed_token(ctx)) {
+    return ctx->slot;
   }
+  ctx->tokens->positions[ctx->slot] =
+      new_pos(ctx->line_base + ctx->line, ctx->column);
 
+  int c = peek_char(ctx);
   if (isdigit(c)) {
-    unread_char(ctx, c);
     return read_number_token(ctx);
   }
 
   if (is_ident_head_char(c)) {
-    unread_char(ctx, c);
     return read_ident_token(ctx);
   }
 
+  read_char(ctx);
+
+  if (c == EOF) {
+    return new_token(ctx, TOKEN_EOF);
+  }
+
   if (c == '"') {
     return read_string_token(ctx);
   }
@@ -263,174 +543,181 @@ token_t *read_next_token(tokenizer_ctx_t *ctx) {
 
   switch (c) {
   case '(':
-    return new_token(TOKEN_PAREN_OPEN, pos);
+    return new_token(ctx, TOKEN_PAREN_OPEN);
   case ')':
-    return new_token(TOKEN_PAREN_CLOSE, pos);
+    return new_token(ctx, TOKEN_PAREN_CLOSE);
   case ';':
-    return new_token(TOKEN_SEMICOLON, pos);
+    return new_token(ctx, TOKEN_SEMICOLON);
   case '{':
-    return new_token(TOKEN_BRACE_OPEN, pos);
+    return new_token(ctx, TOKEN_BRACE_OPEN);
   case '}':
-    return new_token(TOKEN_BRACE_CLOSE, pos);
+    return new_token(ctx, TOKEN_BRACE_CLOSE);
   case ',':
-    return new_token(TOKEN_COMMA, pos);
+    return new_token(ctx, TOKEN_COMMA);
   case '[':
-    return new_token(TOKEN_BRACK_OPEN, pos);
+    return new_token(ctx, TOKEN_BRACK_OPEN);
   case ']':
-    return new_token(TOKEN_BRACK_CLOSE, pos);
+    return new_token(ctx, TOKEN_BRACK_CLOSE);
   case '~':
-    return new_token(TOKEN_NOT, pos);
+    return new_token(ctx, TOKEN_NOT);
   case ':':
-    return new_token(TOKEN_COLON, pos);
-  case '.': {
-    c2 = read_char(ctx);
-    if (c2 == '.') {
-      c3 = read_char(ctx);
-      if (c3 == '.') {
-        return new_token(TOKEN_VARARG, pos);
-      }
-      unread_char(ctx, c3);
+    return new_token(ctx, TOKEN_COLON);
+  case '#':
+    return new_token(ctx, TOKEN_HASH);
+  case '\n':
+    // only reached inside directives
+    return new_token(ctx, TOKEN_NEWLINE);
+  case '.':
+    if (peek_char(ctx) == '.' && char_at(ctx, ctx->index + 1) == '.') {
+      read_char(ctx);
+      read_char(ctx);
+      return new_token(ctx, TOKEN_VARARG);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_MEMBER, pos);
-  }
-  case '+': {
-    c2 = read_char(ctx);
-    if (c2 == '=') {
-      return new_token(TOKEN_ADDEQ, pos);
-    } else if (c2 == '+') {
-      return new_token(TOKEN_INC, pos);
+    return new_token(ctx, TOKEN_MEMBER);
+  case '+':
+    if (consume_char(ctx, '=')) {
+      return new_token(ctx, TOKEN_ADDEQ);
+    } else if (consume_char(ctx, '+')) {
+      return new_token(ctx, TOKEN_INC);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_ADD, pos);
-  }
-  case '-': {
-    c2 = read_char(ctx);
-    if (c2 == '=') {
-      return new_token(TOKEN_SUBEQ, pos);
-    } else if (c2 == '-') {
-      return new_token(TOKEN_DEC, pos);
-    } else if (c2 == '>') {
-      return new_token(TOKEN_ARROW, pos);
+    return new_token(ctx, TOKEN_ADD);
+  case '-':
+    if (consume_char(ctx, '=')) {
+      return new_token(ctx, TOKEN_SUBEQ);
+    } else if (consume_char(ctx, '-')) {
+      return new_token(ctx, TOKEN_DEC);
+    } else if (consume_char(ctx, '>')) {
+      return new_token(ctx, TOKEN_ARROW);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_SUB, pos);
-  }
-  case '*': {
-    c2 = read_char(ctx);
-    if (c2 == '=') {
-      return new_token(TOKEN_MULEQ, pos);
+    return new_token(ctx, TOKEN_SUB);
+  case '*':
+    if (consume_char(ctx, '=')) {
+      return new_token(ctx, TOKEN_MULEQ);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_MUL, pos);
-  }
-  case '/': {
-    c2 = read_char(ctx);
-    if (c2 == '/') {
+    return new_token(ctx, TOKEN_MUL);
+  case '/':
+    if (consume_char(ctx, '/')) {
       read_line_comment(ctx);
       return read_next_token(ctx);
-    } else if (c2 == '=') {
-      return new_token(TOKEN_DIVEQ, pos);
+    } else if (consume_char(ctx, '=')) {
+      return new_token(ctx, TOKEN_DIVEQ);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_DIV, pos);
-  }
-  case '%': {
-    c2 = read_char(ctx);
-    if (c2 == '=') {
-      return new_token(TOKEN_REMEQ, pos);
+    return new_token(ctx, TOKEN_DIV);
+  case '%':
+    if (consume_char(ctx, '=')) {
+      return new_token(ctx, TOKEN_REMEQ);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_REM, pos);
-  }
-  case '&': {
-    c2 = read_char(ctx);
-    if (c2 == '=') {
-      return new_token(TOKEN_ANDEQ, pos);
-    } else if (c2 == '&') {
-      return new_token(TOKEN_LOGAND, pos);
+    return new_token(ctx, TOKEN_REM);
+  case '&':
+    if (consume_char(ctx, '=')) {
+      return new_token(ctx, TOKEN_ANDEQ);
+    } else if (consume_char(ctx, '&')) {
+      return new_token(ctx, TOKEN_LOGAND);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_AND, pos);
-  }
-  case '|': {
-    c2 = read_char(ctx);
-    if (c2 == '=') {
-      return new_token(TOKEN_OREQ, pos);
-    } else if (c2 == '|') {
-      return new_token(TOKEN_LOGOR, pos);
+    return new_token(ctx, TOKEN_AND);
+  case '|':
+    if (consume_char(ctx, '=')) {
+      return new_token(ctx, TOKEN_OREQ);
+    } else if (consume_char(ctx, '|')) {
+      return new_token(ctx, TOKEN_LOGOR);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_OR, pos);
-  }
-  case '^': {
-    c2 = read_char(ctx);
-    if (c2 == '=') {
-      return new_token(TOKEN_XOREQ, pos);
+    return new_token(ctx, TOKEN_OR);
+  case '^':
+    if (consume_char(ctx, '=')) {
+      return new_token(ctx, TOKEN_XOREQ);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_XOR, pos);
-  }
-  case '<': {
-    c2 = read_char(ctx);
-    if (c2 == '=') {
-      return new_token(TOKEN_LE, pos);
-    } else if (c2 == '<') {
-      c3 = read_char(ctx);
-      if (c3 == '=') {
-        return new_token(TOKEN_SHLEQ, pos);
+    return new_token(ctx, TOKEN_XOR);
+  case '<':
+    if (consume_char(ctx, '=')) {
+      return new_token(ctx, TOKEN_LE);
+    } else if (consume_char(ctx, '<')) {
+      if (consume_char(ctx, '=')) {
+        return new_token(ctx, TOKEN_SHLEQ);
       }
-      unread_char(ctx, c3);
-      return new_token(TOKEN_SHL, pos);
+      return new_token(ctx, TOKEN_SHL);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_LT, pos);
-  }
-  case '>': {
-    c2 = read_char(ctx);
-    if (c2 == '=') {
-      return new_token(TOKEN_GE, pos);
-    } else if (c2 == '>') {
-      c3 = read_char(ctx);
-      if (c3 == '=') {
-        return new_token(TOKEN_SHREQ, pos);
+    return new_token(ctx, TOKEN_LT);
+  case '>':
+    if (consume_char(ctx, '=')) {
+      return new_token(ctx, TOKEN_GE);
+    } else if (consume_char(ctx, '>')) {
+      if (consume_char(ctx, '=')) {
+        return new_token(ctx, TOKEN_SHREQ);
       }
-      unread_char(ctx, c3);
-      return new_token(TOKEN_SHR, pos);
+      return new_token(ctx, TOKEN_SHR);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_GT, pos);
-  }
-  case '=': {
-    c2 = read_char(ctx);
-    if (c2 == '=') {
-      return new_token(TOKEN_EQ, pos);
+    return new_token(ctx, TOKEN_GT);
+  case '=':
+    if (consume_char(ctx, '=')) {
+      return new_token(ctx, TOKEN_EQ);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_ASSIGN, pos);
-  }
-  case '!': {
-    c2 = read_char(ctx);
-    if (c2 == '=') {
-      return new_token(TOKEN_NE, pos);
+    return new_token(ctx, TOKEN_ASSIGN);
+  case '!':
+    if (consume_char(ctx, '=')) {
+      return new_token(ctx, TOKEN_NE);
     }
-    unread_char(ctx, c2);
-    return new_token(TOKEN_NEG, pos);
-  }
+    return new_token(ctx, TOKEN_NEG);
   }
 
-  error(pos, "unexpected char '%c'\n", c);
+  lex_error(ctx, ctx->tokens->positions[ctx->slot], "unexpected char '%c'\n",
+            c);
+  return new_token(ctx, TOKEN_EOF);
+}
+
+void read_token(tokenizer_ctx_t *ctx, token_array_t *tokens, int slot) {
+  ctx->tokens = tokens;
+  ctx->slot = slot;
+  read_next_token(ctx);
 }
 
-token_t *tokenize(FILE *fp) {
-  tokenizer_ctx_t *ctx = new_tokenizer_ctx(fp);
-  token_t *head = read_next_token(ctx);
-  token_t *cur = head;
+void skip_line(tokenizer_ctx_t *ctx) {
+  read_line_comment(ctx);
+  read_char(ctx);
+}
 
-  while (cur->type != TOKEN_EOF) {
-    cur->next = read_next_token(ctx);
-    cur = cur->next;
+int skip_to_directive(tokenizer_ctx_t *ctx) {
+  while (1) {
+    skip_whitespaces(ctx);
+    int c = peek_char(ctx);
+    if (c == EOF) {
+      return 0;
+    }
+    if (c == '#') {
+      return 1;
+    }
+    skip_line(ctx);
+  }
+}
+
+char *read_header_name(tokenizer_ctx_t *ctx, int *is_system) {
+  skip_whitespaces(ctx);
+  pos_t pos = new_pos(ctx->line_base + ctx->line, ctx->column);
+
+  int terminator = '"';
+  *is_system = 0;
+  if (consume_char(ctx, '<')) {
+    terminator = '>';
+    *is_system = 1;
+  } else if (!consume_char(ctx, '"')) {
+    error(pos, "expected \"name\" or <name>\n");
+  }
+
+  int cap = 32;
+  int len = 0;
+  char *name = malloc(cap);
+  while (peek_char(ctx) != terminator) {
+    if (peek_char(ctx) == '\n' || peek_char(ctx) == EOF) {
+      error(pos, "missing terminating '%c'\n", terminator);
+    }
+    if (len + 1 == cap) {
+      cap *= 2;
+      name = realloc(name, cap);
+    }
+    name[len] = read_char(ctx);
+    len++;
   }
+  read_char(ctx);
 
-  return head;
+  name[len] = 0;
+  return name;
 }
@@ -1,16 +1,77 @@
 #pragma once
 #include <stdio.h>
 
+// A source position, passed by value. Line 0 means no position.
 typedef struct {
   int line;
   int column;
 } pos_t;
 
-char *pos_to_string(pos_t *pos);
+pos_t new_pos(int line, int column);
+
+// Returns the line within the file the position belongs to.
+int pos_line(pos_t pos);
+
+int pos_column(pos_t pos);
+
+// Returns the number of the file the position belongs to, counting from 1.
+int pos_file(pos_t pos);
+
+// Registers a file of the translation unit and returns its number.
+int add_source_file(char *path);
+
+int source_file_count();
+
+char *source_file_name(int file);
+
+// Maps the lines from line on to the given file, starting at file_line.
+void map_source_lines(int line, int file, int file_line);
+
+char *pos_to_string(pos_t pos);
+
+typedef struct _token_array_t token_array_t;
+typedef struct _lexed_t lexed_t;
 
 typedef struct {
-  FILE *fp;
-  pos_t *cur_pos;
+  char *buf;
+  int size;
+  int index;
+  int line;
+  int column;
+
+  // added to every line, so that all files of a translation unit share one
+  // stream of lines
+  int line_base;
+
+  // use the byte-at-a-time loops instead of the vectorized scanners
+  int is_scalar;
+
+  // while set, newlines are returned as TOKEN_NEWLINE
+  int is_directive;
+
+  // identifiers are NUL-terminated in place, so the byte that followed the
+  // last one is kept here until the tokenizer moves past it
+  int pending_index;
+  char pending_char;
+
+  // the slot being filled
+  token_array_t *tokens;
+  int slot;
+
+  // Set while lexing ahead of the parser, see parallel_lex.h. Identifiers
+  // and strings are not interned then: their value is the offset of the
+  // spelling in buf and hashes holds its hash. The first error is recorded
+  // instead of reported.
+  int *hashes;
+  pos_t error_pos;
+  char *error_message;
+
+  // set by the lexing bench, so that an error is recorded and ends the
+  // tokens instead of ending ccc
+  int records_errors;
+
+  // tokens lexed ahead of time, served instead of lexing their text again
+  lexed_t *lexed;
 } tokenizer_ctx_t;
 
 typedef enum {
@@ -83,20 +144,68 @@ typedef enum {
   TOKEN_ARROW,
   TOKEN_CHAR_LIT,
   TOKEN_EXTERN,
+  TOKEN_HASH,
+  TOKEN_NEWLINE,
 } tokentype_t;
 
-typedef struct _token_t token_t;
-struct _token_t {
-  tokentype_t type;
-  pos_t *pos;
-  union {
-    int number;
-    char *ident;
-    char *string;
-    char char_;
-  } value;
-
-  token_t *next;
+// Tokens are stored as a struct of arrays. values holds the number of a
+// TOKEN_NUMBER, the char of a TOKEN_CHAR_LIT and the interned symbol of a
+// TOKEN_IDENT or TOKEN_STRING.
+struct _token_array_t {
+  tokentype_t *kinds;
+  pos_t *positions;
+  int *values;
+  int cap;
+};
+
+// Stretches of a file lexed ahead of time. Stretch i covers the bytes from
+// starts[i] up to ends[i], where the line is end_lines[i], and its tokens are
+// tokens[token_starts[i]] up to tokens[token_ends[i]]. Their positions leave
+// out the line base, which is only known once the file is entered, and
+// identifiers and strings are interned as they are served, through hashes,
+// so that symbols are numbered as if lexed in order. Lexing stopped with an
+// error at error_token, or error_token is -1.
+struct _lexed_t {
+  token_array_t *tokens;
+  int *hashes;
+  int *starts;
+  int *ends;
+  int *end_lines;
+  int *token_starts;
+  int *token_ends;
+  int len;
+
+  // the next stretch not passed yet, and the next token to serve from it or
+  // -1 before it was reached
+  int next;
+  int cur;
+
+  int error_token;
+  pos_t error_pos;
+  char *error_message;
 };
 
-token_t *tokenize(FILE *fp);
+token_array_t *new_token_array(int cap);
+
+void grow_token_array(token_array_t *tokens, int cap);
+
+int token_array_bytes(int len);
+
+tokenizer_ctx_t *new_tokenizer_ctx(char *buf, int size);
+
+// Reads the next token into the given slot. Tokens are produced on demand,
+// so callers own the storage and may reuse slots.
+void read_token(tokenizer_ctx_t *ctx, token_array_t *tokens, int slot);
+
+// Skips the rest of the current line, including the newline.
+void skip_line(tokenizer_ctx_t *ctx);
+
+// Skips lines until one that starts with '#'. Returns 0 at the end of input.
+int skip_to_directive(tokenizer_ctx_t *ctx);
+
+// Reads the "name" or <name> of an #include. The returned copy is owned by
+// the caller, and *is_system is set for the <name> form.
+char *read_header_name(tokenizer_ctx_t *ctx, int *is_system);
+
+// Returns the value of the hex digit c.
+int hex_digit_value(int c);
@@ -1,31 +1,77 @@
 #include "type.h"
+#include "arena.h"
 #include "error.h"
+#include "intern.h"
 #include <stdlib.h>
-#include <string.h>
 
-type_t *new_type(typekind_t kind) {
-  type_t *type = calloc(1, sizeof(type_t));
+type_t *void_type;
+type_t *char_type;
+type_t *int_type;
+
+// Shared types are kept for the whole program, even when they are first made
+// while codegen allocates from the arena of a function.
+type_t *new_shared_type(typekind_t kind) {
+  type_t *type = arena_alloc(program_arena(), sizeof(type_t));
   type->kind = kind;
   return type;
 }
 
+type_t *new_type(typekind_t kind) {
+  switch (kind) {
+  case TYPE_VOID:
+    if (!void_type) {
+      void_type = new_shared_type(kind);
+    }
+    return void_type;
+  case TYPE_CHAR:
+    if (!char_type) {
+      char_type = new_shared_type(kind);
+    }
+    return char_type;
+  case TYPE_INT:
+    if (!int_type) {
+      int_type = new_shared_type(kind);
+    }
+    return int_type;
+  default: {
+    type_t *type = node_alloc(sizeof(type_t));
+    type->kind = kind;
+    return type;
+  }
+  }
+}
+
 type_t *ptr_to(type_t *base_type) {
-  type_t *type = new_type(TYPE_PTR);
-  type->value.ptr = base_type;
-  return type;
+  if (!base_type->pointer) {
+    type_t *type = new_shared_type(TYPE_PTR);
+    type->value.ptr = base_type;
+    base_type->pointer = type;
+  }
+  return base_type->pointer;
 }
 
 type_t *array_of(type_t *elm_type, int len) {
-  type_t *type = new_type(TYPE_ARRAY);
+  type_t *cur = elm_type->arrays;
+  while (cur) {
+    if (cur->value.array.len == len) {
+      return cur;
+    }
+    cur = cur->next_array;
+  }
+
+  type_t *type = new_shared_type(TYPE_ARRAY);
   type->value.array.elm = elm_type;
   type->value.array.len = len;
+  type->next_array = elm_type->arrays;
+  elm_type->arrays = type;
   return type;
 }
 
 struct_member_t *new_struct_member(type_t *type, char *name) {
-  struct_member_t *member = calloc(1, sizeof(struct_member_t));
+  struct_member_t *member = node_alloc(sizeof(struct_member_t));
   member->type = type;
   member->name = name;
+  member->symbol = intern_symbol(name);
   return member;
 }
 
@@ -90,7 +136,7 @@ type_t *union_of(char *tag, struct_member_t *members) {
 }
 
 enum_t *new_enum(char *name, int value) {
-  enum_t *enum_ = calloc(1, sizeof(enum_t));
+  enum_t *enum_ = node_alloc(sizeof(enum_t));
   enum_->name = name;
   enum_->value = value;
   return enum_;
@@ -156,20 +202,57 @@ type_t *type_deref(type_t *type) {
   }
 }
 
-struct_member_t *find_member(type_t *type, char *name) {
-  if (type->kind != TYPE_STRUCT && type->kind != TYPE_UNION) {
-    panic("type must be struct or union: type=%d\n", type->kind);
+// the first member of a name is the one found
+void index_members(type_t *type) {
+  int len = 0;
+  struct_member_t *cur = type->value.struct_union.members;
+  while (cur) {
+    len++;
+    cur = cur->next;
   }
 
-  struct_member_t *cur = type->value.struct_union.members;
+  int cap = 8;
+  while (cap < len * 2) {
+    cap *= 2;
+  }
+  struct_member_t **index =
+      arena_alloc(program_arena(), cap * sizeof(struct_member_t *));
+
+  cur = type->value.struct_union.members;
   while (cur) {
-    if (!strcmp(cur->name, name)) {
-      return cur;
+    int slot = cur->symbol & (cap - 1);
+    while (index[slot] && index[slot]->symbol != cur->symbol) {
+      slot = (slot + 1) & (cap - 1);
+    }
+    if (!index[slot]) {
+      index[slot] = cur;
     }
-
     cur = cur->next;
   }
 
+  type->value.struct_union.index = index;
+  type->value.struct_union.index_cap = cap;
+}
+
+struct_member_t *find_member(type_t *type, int symbol) {
+  if (type->kind != TYPE_STRUCT && type->kind != TYPE_UNION) {
+    panic("type must be struct or union: type=%d\n", type->kind);
+  }
+
+  if (!type->value.struct_union.index) {
+    index_members(type);
+  }
+
+  struct_member_t **index = type->value.struct_union.index;
+  int mask = type->value.struct_union.index_cap - 1;
+  int slot = symbol & mask;
+  while (index[slot]) {
+    if (index[slot]->symbol == symbol) {
+      return index[slot];
+    }
+    slot = (slot + 1) & mask;
+  }
+
   return NULL;
 }
 
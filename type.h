@@ -17,6 +17,7 @@ typedef struct _struct_member_t struct_member_t;
 struct _struct_member_t {
   type_t *type;
   char *name;
+  int symbol;
   int offset;
 
   struct_member_t *next;
@@ -44,15 +45,30 @@ struct _type_t {
 
       int size;
       int align;
+
+      // an open addressing table of the members by symbol, built on the
+      // first lookup
+      struct_member_t **index;
+      int index_cap;
     } struct_union;
     struct {
       char *tag;
       enum_t *enums;
     } enum_;
   } value;
-  int is_extern;
+
+  // The pointer type to this type, and the array types of it linked through
+  // next_array, so that each derived type is made only once.
+  type_t *pointer;
+  type_t *arrays;
+  type_t *next_array;
+
+  // the complete type an incomplete struct, union or enum resolved to
+  type_t *completion;
 };
 
+// Returns the type of the kind. void, char and int are single shared objects
+// and must not be changed.
 type_t *new_type(typekind_t kind);
 
 type_t *ptr_to(type_t *base_type);
@@ -75,7 +91,7 @@ int type_align(type_t *type);
 
 type_t *type_deref(type_t *type);
 
-struct_member_t *find_member(type_t *type, char *name);
+struct_member_t *find_member(type_t *type, int symbol);
 
 int is_integer(type_t *type);
 
@@ -0,0 +1,159 @@
+#include "writer.h"
+#include <stdlib.h>
+#include <string.h>
+
+writer_t *new_writer(FILE *fp) {
+  writer_t *writer = calloc(1, sizeof(writer_t));
+  writer->fp = fp;
+  writer->cap = 1048576;
+  writer->buf = malloc(writer->cap);
+  return writer;
+}
+
+void write_out(writer_t *writer, char *bytes, int len) {
+  if (writer->assembler) {
+    assemble(writer->assembler, bytes, len);
+  } else {
+    fwrite(bytes, 1, len, writer->fp);
+  }
+  writer->flushed += len;
+}
+
+void flush_writer(writer_t *writer) {
+  if (writer->len > 0) {
+    write_out(writer, writer->buf, writer->len);
+  }
+  writer->len = 0;
+}
+
+void put_bytes(writer_t *writer, char *bytes, int len) {
+  if (writer->len + len > writer->cap) {
+    flush_writer(writer);
+    // the assembler changes the text it is given, so it only gets the buffer
+    while (writer->assembler && len > writer->cap) {
+      memcpy(writer->buf, bytes, writer->cap);
+      writer->len = writer->cap;
+      flush_writer(writer);
+      bytes = bytes + writer->cap;
+      len -= writer->cap;
+    }
+    if (len > writer->cap) {
+      write_out(writer, bytes, len);
+      return;
+    }
+  }
+  memcpy(writer->buf + writer->len, bytes, len);
+  writer->len += len;
+}
+
+void put_str(writer_t *writer, char *str) {
+  put_bytes(writer, str, strlen(str));
+}
+
+void put_char(writer_t *writer, char c) {
+  if (writer->len == writer->cap) {
+    flush_writer(writer);
+  }
+  writer->buf[writer->len] = c;
+  writer->len++;
+}
+
+void put_int(writer_t *writer, int n) {
+  // the digits are taken off a negative value, which holds the most negative
+  // int as well
+  int is_negative = n < 0;
+  if (!is_negative) {
+    n = -n;
+  }
+
+  char digits[12];
+  int len = 0;
+  while (1) {
+    digits[len] = '0' - n % 10;
+    len++;
+    n = n / 10;
+    if (n == 0) {
+      break;
+    }
+  }
+
+  if (is_negative) {
+    put_char(writer, '-');
+  }
+  while (len > 0) {
+    len--;
+    put_char(writer, digits[len]);
+  }
+}
+
+int writer_size(writer_t *writer) { return writer->flushed + writer->len; }
+
+void put_le(writer_t *writer, int value, int size) {
+  int i = 0;
+  while (i < size) {
+    if (i < 4) {
+      put_char(writer, (value >> (i * 8)) & 255);
+    } else if (value < 0) {
+      put_char(writer, 255);
+    } else {
+      put_char(writer, 0);
+    }
+    i++;
+  }
+}
+
+bytes_t *new_bytes() {
+  bytes_t *bytes = calloc(1, sizeof(bytes_t));
+  bytes->cap = 4096;
+  bytes->data = malloc(bytes->cap);
+  return bytes;
+}
+
+void reserve_bytes(bytes_t *bytes, int len) {
+  if (bytes->len + len <= bytes->cap) {
+    return;
+  }
+  while (bytes->len + len > bytes->cap) {
+    bytes->cap *= 2;
+  }
+  bytes->data = realloc(bytes->data, bytes->cap);
+}
+
+void add_byte(bytes_t *bytes, int c) {
+  reserve_bytes(bytes, 1);
+  bytes->data[bytes->len] = c;
+  bytes->len++;
+}
+
+void add_bytes(bytes_t *bytes, char *data, int len) {
+  reserve_bytes(bytes, len);
+  memcpy(bytes->data + bytes->len, data, len);
+  bytes->len += len;
+}
+
+void add_zeros(bytes_t *bytes, int len) {
+  reserve_bytes(bytes, len);
+  memset(bytes->data + bytes->len, 0, len);
+  bytes->len += len;
+}
+
+void add_le(bytes_t *bytes, int value, int size) {
+  int i = 0;
+  while (i < size) {
+    if (i < 4) {
+      add_byte(bytes, (value >> (i * 8)) & 255);
+    } else if (value < 0) {
+      add_byte(bytes, 255);
+    } else {
+      add_byte(bytes, 0);
+    }
+    i++;
+  }
+}
+
+int add_cstring(bytes_t *bytes, char *string) {
+  int offset = bytes->len;
+  int len = strlen(string);
+  add_bytes(bytes, string, len + 1);
+  return offset;
+}
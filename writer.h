@@ -0,0 +1,62 @@
+#pragma once
+#include "assembler.h"
+#include <stdio.h>
+
+// An append buffer in front of a file. Text is gathered in a large buffer and
+// written out a buffer at a time, so that a piece of output costs a copy
+// rather than a call into stdio.
+typedef struct {
+  FILE *fp;
+  // when set, the text is handed to the assembler instead of fp
+  assembler_t *assembler;
+  char *buf;
+  int len;
+  int cap;
+
+  // the bytes written out so far
+  int flushed;
+} writer_t;
+
+writer_t *new_writer(FILE *fp);
+
+void put_str(writer_t *writer, char *str);
+
+void put_char(writer_t *writer, char c);
+
+void put_bytes(writer_t *writer, char *bytes, int len);
+
+// Writes the number in decimal.
+void put_int(writer_t *writer, int n);
+
+// Writes out what is buffered.
+void flush_writer(writer_t *writer);
+
+// Returns the number of bytes written so far, buffered or not.
+int writer_size(writer_t *writer);
+
+// Writes the value in size bytes, little endian, sign extended past 4 bytes.
+void put_le(writer_t *writer, int value, int size);
+
+// A growable run of bytes kept in memory, such as a section being built.
+typedef struct {
+  char *data;
+  int len;
+  int cap;
+} bytes_t;
+
+bytes_t *new_bytes();
+
+// Makes room for len more bytes.
+void reserve_bytes(bytes_t *bytes, int len);
+
+void add_byte(bytes_t *bytes, int c);
+
+void add_bytes(bytes_t *bytes, char *data, int len);
+
+void add_zeros(bytes_t *bytes, int len);
+
+// Adds the value in size bytes, little endian, sign extended past 4 bytes.
+void add_le(bytes_t *bytes, int value, int size);
+
+// Adds the string with its NUL and returns where it starts.
+int add_cstring(bytes_t *bytes, char *string);